@@ -0,0 +1,248 @@
+#include "rk_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef RK_CODEC_WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef RK_CODEC_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace rk_codec {
+
+namespace {
+
+const char kMagic[4] = {'R', 'K', 'Z', '1'};
+
+void
+WriteHeader(const Codec codec, const uint64_t raw_size, uint8_t* header)
+{
+  memcpy(header, kMagic, sizeof(kMagic));
+  header[4] = (uint8_t)codec;
+  header[5] = header[6] = header[7] = 0;
+  for (int i = 0; i < 8; ++i) {
+    header[8 + i] = (uint8_t)(raw_size >> (8 * i));
+  }
+}
+
+bool
+ReadHeader(
+    const void* frame, const size_t frame_size, Codec* codec,
+    uint64_t* raw_size, std::string* error)
+{
+  const uint8_t* header = (const uint8_t*)frame;
+  if ((frame_size < kFrameHeaderSize) ||
+      (memcmp(header, kMagic, sizeof(kMagic)) != 0)) {
+    *error = "not an rk_codec frame";
+    return false;
+  }
+  *codec = (Codec)header[4];
+  if (!CodecAvailable(*codec)) {
+    *error = std::string("codec ") + std::to_string(header[4]) +
+             " of the frame is not available";
+    return false;
+  }
+  *raw_size = 0;
+  for (int i = 0; i < 8; ++i) {
+    *raw_size |= (uint64_t)header[8 + i] << (8 * i);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool
+CodecFromName(const std::string& name, Codec* codec)
+{
+  if (name == "none") {
+    *codec = Codec::NONE;
+  } else if (name == "lz4") {
+    *codec = Codec::LZ4;
+  } else if (name == "zstd") {
+    *codec = Codec::ZSTD;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char*
+CodecName(const Codec codec)
+{
+  switch (codec) {
+    case Codec::NONE:
+      return "none";
+    case Codec::LZ4:
+      return "lz4";
+    case Codec::ZSTD:
+      return "zstd";
+  }
+  return "unknown";
+}
+
+bool
+CodecAvailable(const Codec codec)
+{
+  switch (codec) {
+    case Codec::NONE:
+      return true;
+#ifdef RK_CODEC_WITH_LZ4
+    case Codec::LZ4:
+      return true;
+#endif
+#ifdef RK_CODEC_WITH_ZSTD
+    case Codec::ZSTD:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+bool
+Encode(
+    const Codec codec, const int level, const void* src, const size_t size,
+    std::vector<uint8_t>* frame, std::string* error)
+{
+  (void)level;  // Unused without liblz4 and libzstd.
+  if (!CodecAvailable(codec)) {
+    *error = std::string("codec ") + CodecName(codec) + " is not available";
+    return false;
+  }
+  size_t compressed = size;
+  switch (codec) {
+    case Codec::NONE:
+      frame->resize(kFrameHeaderSize + size);
+      memcpy(frame->data() + kFrameHeaderSize, src, size);
+      break;
+#ifdef RK_CODEC_WITH_LZ4
+    case Codec::LZ4: {
+      if (size > (size_t)LZ4_MAX_INPUT_SIZE) {
+        *error = "tensor too large for LZ4";
+        return false;
+      }
+      const int bound = LZ4_compressBound((int)size);
+      frame->resize(kFrameHeaderSize + bound);
+      char* dst = (char*)frame->data() + kFrameHeaderSize;
+      const int ret =
+          (level > 0)
+              ? LZ4_compress_HC((const char*)src, dst, (int)size, bound, level)
+              : LZ4_compress_default((const char*)src, dst, (int)size, bound);
+      if (ret <= 0) {
+        *error = "LZ4 compression failed";
+        return false;
+      }
+      compressed = ret;
+      break;
+    }
+#endif
+#ifdef RK_CODEC_WITH_ZSTD
+    case Codec::ZSTD: {
+      const size_t bound = ZSTD_compressBound(size);
+      frame->resize(kFrameHeaderSize + bound);
+      const size_t ret = ZSTD_compress(
+          frame->data() + kFrameHeaderSize, bound, src, size, level);
+      if (ZSTD_isError(ret)) {
+        *error = std::string("zstd compression failed: ") +
+                 ZSTD_getErrorName(ret);
+        return false;
+      }
+      compressed = ret;
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  frame->resize(kFrameHeaderSize + compressed);
+  WriteHeader(codec, size, frame->data());
+  return true;
+}
+
+bool
+FrameRawSize(
+    const void* frame, const size_t frame_size, uint64_t* raw_size,
+    std::string* error)
+{
+  Codec codec;
+  return ReadHeader(frame, frame_size, &codec, raw_size, error);
+}
+
+bool
+Decode(
+    const void* frame, const size_t frame_size, void* dst,
+    const size_t dst_size, std::string* error)
+{
+  Codec codec;
+  uint64_t raw_size;
+  if (!ReadHeader(frame, frame_size, &codec, &raw_size, error)) {
+    return false;
+  }
+  if (raw_size != dst_size) {
+    *error = "the frame holds " + std::to_string(raw_size) +
+             " bytes, the destination " + std::to_string(dst_size);
+    return false;
+  }
+  const uint8_t* payload = (const uint8_t*)frame + kFrameHeaderSize;
+  const size_t payload_size = frame_size - kFrameHeaderSize;
+  size_t decoded = 0;
+  switch (codec) {
+    case Codec::NONE:
+      decoded = std::min(payload_size, dst_size);
+      memcpy(dst, payload, decoded);
+      break;
+#ifdef RK_CODEC_WITH_LZ4
+    case Codec::LZ4: {
+      if (dst_size > (size_t)LZ4_MAX_INPUT_SIZE) {
+        *error = "tensor too large for LZ4";
+        return false;
+      }
+      const int ret = LZ4_decompress_safe(
+          (const char*)payload, (char*)dst, (int)payload_size, (int)dst_size);
+      if (ret < 0) {
+        *error = "corrupted LZ4 frame";
+        return false;
+      }
+      decoded = ret;
+      break;
+    }
+#endif
+#ifdef RK_CODEC_WITH_ZSTD
+    case Codec::ZSTD: {
+      const size_t ret = ZSTD_decompress(dst, dst_size, payload, payload_size);
+      if (ZSTD_isError(ret)) {
+        *error = std::string("corrupted zstd frame: ") +
+                 ZSTD_getErrorName(ret);
+        return false;
+      }
+      decoded = ret;
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  if (decoded != dst_size) {
+    *error = "truncated frame";
+    return false;
+  }
+  return true;
+}
+
+bool
+Decode(
+    const void* frame, const size_t frame_size, std::vector<uint8_t>* raw,
+    std::string* error)
+{
+  uint64_t raw_size;
+  if (!FrameRawSize(frame, frame_size, &raw_size, error)) {
+    return false;
+  }
+  raw->resize(raw_size);
+  return Decode(frame, frame_size, raw->data(), raw->size(), error);
+}
+
+}  // namespace rk_codec
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rk_codec {
+
+//
+// Encoding of the output tensors of a model with "response_compression"
+// set. Each output is sent as a BYTES tensor of one element holding a
+// frame: the 4-byte magic "RKZ1", the codec, 3 reserved bytes, the
+// size of the raw tensor as a little-endian uint64 and the compressed
+// tensor. The shape and datatype of the raw tensor are in the response
+// parameters "<output>_shape" and "<output>_datatype".
+//
+// Clients link this library (rk_codec) to decode the frames. The
+// codecs are compiled in when liblz4 / libzstd are found at build time.
+//
+enum class Codec : uint8_t { NONE = 0, LZ4 = 1, ZSTD = 2 };
+
+const size_t kFrameHeaderSize = 16;
+
+// Parse "none", "lz4" or "zstd".
+bool CodecFromName(const std::string& name, Codec* codec);
+const char* CodecName(const Codec codec);
+// Whether 'codec' was compiled in.
+bool CodecAvailable(const Codec codec);
+
+// Compress the 'size' bytes of 'src' into a frame. 'level' is the zstd
+// level, or the LZ4 HC level (0 for the fast LZ4 compressor).
+bool Encode(
+    const Codec codec, const int level, const void* src, const size_t size,
+    std::vector<uint8_t>* frame, std::string* error);
+
+// Size of the raw tensor of 'frame'.
+bool FrameRawSize(
+    const void* frame, const size_t frame_size, uint64_t* raw_size,
+    std::string* error);
+
+// Decompress 'frame' into the 'dst_size' bytes of 'dst', which must be
+// FrameRawSize bytes.
+bool Decode(
+    const void* frame, const size_t frame_size, void* dst,
+    const size_t dst_size, std::string* error);
+bool Decode(
+    const void* frame, const size_t frame_size, std::vector<uint8_t>* raw,
+    std::string* error);
+
+}  // namespace rk_codec
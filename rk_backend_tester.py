@@ -1,8 +1,100 @@
 import argparse
+import os
+import socket
+import struct
+import sys
 import numpy as np
 
 import tritonclient.http as httpclient
-from tritonclient.utils import InferenceServerException
+import tritonclient.utils.shared_memory as shm
+from tritonclient.utils import InferenceServerException, triton_to_np_dtype
+
+
+def infer_with_shm(triton_client, model_name, input0_data):
+    # Input and outputs go through system shared-memory regions, only
+    # the request and response headers travel over HTTP. The backend
+    # reads the input and writes the outputs in place.
+    metadata = triton_client.get_model_metadata(model_name)
+    regions = []
+    try:
+        triton_client.unregister_system_shared_memory()
+        input_byte_size = input0_data.size * input0_data.itemsize
+        handle = shm.create_shared_memory_region(
+            'rk_input', '/rk_input', input_byte_size)
+        regions.append(('rk_input', handle))
+        shm.set_shared_memory_region(handle, [input0_data])
+        triton_client.register_system_shared_memory(
+            'rk_input', '/rk_input', input_byte_size)
+
+        inputs = [httpclient.InferInput('images', list(input0_data.shape),
+                                        "INT8")]
+        inputs[0].set_shared_memory('rk_input', input_byte_size)
+
+        outputs = []
+        output_handles = {}
+        for output in metadata['outputs']:
+            name = output['name']
+            shape = [max(1, int(d)) for d in output['shape']]
+            byte_size = int(np.prod(shape)) * np.dtype(
+                triton_to_np_dtype(output['datatype'])).itemsize
+            region = 'rk_output_' + name
+            handle = shm.create_shared_memory_region(
+                region, '/' + region, byte_size)
+            regions.append((region, handle))
+            triton_client.register_system_shared_memory(
+                region, '/' + region, byte_size)
+            requested = httpclient.InferRequestedOutput(name, binary_data=True)
+            requested.set_shared_memory(region, byte_size)
+            outputs.append(requested)
+            output_handles[name] = handle
+
+        result = triton_client.infer(model_name, inputs, outputs=outputs)
+        print('Response: {}'.format(result.get_response()))
+        for name, handle in output_handles.items():
+            output = result.get_output(name)
+            data = shm.get_contents_as_numpy(
+                handle, triton_to_np_dtype(output['datatype']),
+                output['shape'])
+            print('{} = {} from shared memory'.format(name, data.shape))
+    finally:
+        for region, handle in regions:
+            triton_client.unregister_system_shared_memory(region)
+            shm.destroy_shared_memory_region(handle)
+
+def infer_with_dmabuf(triton_client, model_name, input0_data,
+                      descriptor_input, socket_path):
+    # A memfd stands in for the buffer of the hardware video decoder.
+    # Its fd is handed to the backend over the "dmabuf-socket" once,
+    # then only the descriptor of the frame is sent and the NPU reads
+    # the frame from the buffer.
+    data = input0_data.tobytes()
+    fd = os.memfd_create('rk_frame')
+    handoff = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+    try:
+        os.ftruncate(fd, len(data))
+        os.pwrite(fd, data, 0)
+        handoff.connect(socket_path)
+        handoff.sendmsg([struct.pack('q', 0)],
+                        [(socket.SOL_SOCKET, socket.SCM_RIGHTS,
+                          struct.pack('i', fd))])
+        handle = struct.unpack('q', handoff.recv(8))[0]
+        if handle < 0:
+            raise RuntimeError('the backend refused the frame buffer')
+        # handle, offset, size, stride (0: packed rows)
+        descriptor = np.array([[handle, 0, len(data), 0]], dtype=np.int64)
+        inputs = [httpclient.InferInput(descriptor_input,
+                                        list(descriptor.shape), "INT64")]
+        inputs[0].set_data_from_numpy(descriptor)
+        result = triton_client.infer(model_name, inputs)
+        print('Response: {}'.format(result.get_response()))
+        for output in result.get_response()['outputs']:
+            print('{} = {}'.format(output['name'],
+                                   result.as_numpy(output['name']).shape))
+    finally:
+        # Closing the connection releases the handle.
+        handoff.close()
+        os.close(fd)
+
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
@@ -12,7 +104,36 @@ if __name__ == '__main__':
                         required=False,
                         default='localhost:8000',
                         help='Inference server URL. Default is localhost:8000.')
+    parser.add_argument('--shm',
+                        action='store_true',
+                        required=False,
+                        default=False,
+                        help='Pass the input and outputs through system '
+                        'shared memory. The server must run on this host.')
+    parser.add_argument('--dmabuf',
+                        type=str,
+                        required=False,
+                        default=None,
+                        help='Send the frame as a memfd descriptor in this '
+                        'input, the "dmabuf_input" model parameter. The '
+                        'server must run on this host as the same user.')
+    parser.add_argument('--dmabuf-socket',
+                        type=str,
+                        required=False,
+                        default='/tmp/rockchip-dmabuf.sock',
+                        help='The "dmabuf-socket" backend config the frame '
+                        'buffer is handed over through.')
+    parser.add_argument('--outputs',
+                        type=str,
+                        required=False,
+                        default=None,
+                        help='Comma separated outputs to request, e.g. 377 '
+                        'for the 12x20 head only. Default all outputs.')
     FLAGS = parser.parse_args()
+    requested_outputs = None
+    if FLAGS.outputs:
+        requested_outputs = [httpclient.InferRequestedOutput(name)
+                             for name in FLAGS.outputs.split(',')]
 
     # For the HTTP client, need to specify large enough concurrency to
     # issue all the inference requests to the server in parallel. For
@@ -25,6 +146,16 @@ if __name__ == '__main__':
         print("channel creation failed: " + str(e))
         sys.exit(1)
 
+    if FLAGS.shm:
+        input0_data = np.random.randint(0,high=128,size=(1,3,384,640),dtype=np.int8)
+        infer_with_shm(triton_client, 'rockchip', input0_data)
+        sys.exit(0)
+    if FLAGS.dmabuf:
+        input0_data = np.random.randint(0,high=128,size=(1,3,384,640),dtype=np.int8)
+        infer_with_dmabuf(triton_client, 'rockchip', input0_data, FLAGS.dmabuf,
+                          FLAGS.dmabuf_socket)
+        sys.exit(0)
+
     # First send a single request to the nonbatching model.
     # print('=========')
     # input0_data = np.array([ 1, 2, 3, 4 ], dtype=np.int32)
@@ -52,7 +183,8 @@ if __name__ == '__main__':
         # print('Sending request to rockchip model: IN0 = {}'.format(input0_data))
         inputs = [ httpclient.InferInput('images', [1,3, 384, 640], "INT8") ]
         inputs[0].set_data_from_numpy(input0_data)
-        async_requests.append(triton_client.async_infer('rockchip', inputs))
+        async_requests.append(triton_client.async_infer(
+            'rockchip', inputs, outputs=requested_outputs))
 
     # # input0_data = np.array([[ 20, 21, 22, 23 ]], dtype=np.int32)
     # input0_data = np.random.randint(0,high=128,size=(1,3,384,640),dtype=np.int8)
@@ -60,13 +192,14 @@ if __name__ == '__main__':
     # inputs = [ httpclient.InferInput('INPUT_0', [1,3, 384, 640], "INT8") ]
     # inputs[0].set_data_from_numpy(input0_data)
     
-    async_requests.append(triton_client.async_infer('rockchip', inputs))
+    async_requests.append(triton_client.async_infer(
+        'rockchip', inputs, outputs=requested_outputs))
 
     for async_request in async_requests:
         # Get the result from the initiated asynchronous inference
         # request. This call will block till the server responds.
         result = async_request.get_result()
         print('Response: {}'.format(result.get_response()))
-        print('output = {}'.format(result.as_numpy('output').shape))
-        print('371 = {}'.format(result.as_numpy('376').shape))
-        print('390 = {}'.format(result.as_numpy('377').shape))
+        for output in result.get_response()['outputs']:
+            print('{} = {}'.format(output['name'],
+                                   result.as_numpy(output['name']).shape))
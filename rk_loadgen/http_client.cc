@@ -0,0 +1,307 @@
+#include "http_client.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+namespace rk_loadgen {
+
+namespace {
+
+std::string
+Lower(std::string str)
+{
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+}  // namespace
+
+HttpConnection::HttpConnection(const std::string& host, const int port)
+    : host_(host), port_(port), fd_(-1), buffer_pos_(0)
+{
+}
+
+HttpConnection::~HttpConnection()
+{
+  Close();
+}
+
+void
+HttpConnection::Close()
+{
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  buffer_.clear();
+  buffer_pos_ = 0;
+}
+
+bool
+HttpConnection::Connect(std::string* error)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* result = nullptr;
+  const int ret = getaddrinfo(
+      host_.c_str(), std::to_string(port_).c_str(), &hints, &result);
+  if (ret != 0) {
+    *error =
+        std::string("cannot resolve ") + host_ + ": " + gai_strerror(ret);
+    return false;
+  }
+  for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+    fd_ = socket(
+        ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd_ < 0) {
+      continue;
+    }
+    if (connect(fd_, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd_);
+    fd_ = -1;
+  }
+  freeaddrinfo(result);
+  if (fd_ < 0) {
+    *error = "cannot connect to " + host_ + ":" + std::to_string(port_) +
+             ": " + std::strerror(errno);
+    return false;
+  }
+  // Requests are written in one go, do not let Nagle delay the tail.
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return true;
+}
+
+bool
+HttpConnection::SendAll(
+    const std::string& head,
+    const std::vector<std::pair<const char*, size_t>>& body,
+    std::string* error)
+{
+  std::vector<struct iovec> iov;
+  iov.push_back({const_cast<char*>(head.data()), head.size()});
+  for (const auto& piece : body) {
+    if (piece.second > 0) {
+      iov.push_back({const_cast<char*>(piece.first), piece.second});
+    }
+  }
+  size_t idx = 0;
+  while (idx < iov.size()) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov[idx];
+    msg.msg_iovlen = std::min<size_t>(iov.size() - idx, IOV_MAX);
+    ssize_t sent = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *error = std::string("send: ") + std::strerror(errno);
+      return false;
+    }
+    while ((idx < iov.size()) && ((size_t)sent >= iov[idx].iov_len)) {
+      sent -= iov[idx].iov_len;
+      idx++;
+    }
+    if (idx < iov.size()) {
+      iov[idx].iov_base = (char*)iov[idx].iov_base + sent;
+      iov[idx].iov_len -= sent;
+    }
+  }
+  return true;
+}
+
+bool
+HttpConnection::Fill(const size_t size, std::string* error)
+{
+  if (buffer_pos_ > 0) {
+    buffer_.erase(0, buffer_pos_);
+    buffer_pos_ = 0;
+  }
+  char chunk[64 * 1024];
+  while (buffer_.size() < size) {
+    ssize_t len = recv(fd_, chunk, sizeof(chunk), 0);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *error = std::string("recv: ") + std::strerror(errno);
+      return false;
+    }
+    if (len == 0) {
+      *error = "connection closed by server";
+      return false;
+    }
+    buffer_.append(chunk, len);
+  }
+  return true;
+}
+
+bool
+HttpConnection::ReadLine(std::string* line, std::string* error)
+{
+  while (true) {
+    const size_t end = buffer_.find("\r\n", buffer_pos_);
+    if (end != std::string::npos) {
+      line->assign(buffer_, buffer_pos_, end - buffer_pos_);
+      buffer_pos_ = end + 2;
+      return true;
+    }
+    if (!Fill(buffer_.size() - buffer_pos_ + 1, error)) {
+      return false;
+    }
+  }
+}
+
+bool
+HttpConnection::ReadResponse(
+    HttpResponse* response, bool* keep_alive, std::string* error)
+{
+  std::string line;
+  if (!ReadLine(&line, error)) {
+    return false;
+  }
+  // "HTTP/1.1 200 OK"
+  const size_t space = line.find(' ');
+  if ((line.compare(0, 5, "HTTP/") != 0) || (space == std::string::npos)) {
+    *error = "malformed status line: " + line;
+    return false;
+  }
+  response->status_ = std::atoi(line.c_str() + space + 1);
+  *keep_alive = (line.compare(0, 8, "HTTP/1.0") != 0);
+
+  int64_t content_length = -1;
+  bool chunked = false;
+  while (true) {
+    if (!ReadLine(&line, error)) {
+      return false;
+    }
+    if (line.empty()) {
+      break;
+    }
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    const std::string name = Lower(line.substr(0, colon));
+    size_t value_pos = colon + 1;
+    while ((value_pos < line.size()) && (line[value_pos] == ' ')) {
+      value_pos++;
+    }
+    const std::string value = line.substr(value_pos);
+    if (name == "content-length") {
+      content_length = std::atoll(value.c_str());
+    } else if (name == "inference-header-content-length") {
+      response->inference_header_length_ = std::atoll(value.c_str());
+    } else if (name == "transfer-encoding") {
+      chunked = (Lower(value).find("chunked") != std::string::npos);
+    } else if (name == "connection") {
+      const std::string lower = Lower(value);
+      if (lower == "close") {
+        *keep_alive = false;
+      } else if (lower == "keep-alive") {
+        *keep_alive = true;
+      }
+    }
+  }
+
+  response->body_.clear();
+  if (chunked) {
+    while (true) {
+      if (!ReadLine(&line, error)) {
+        return false;
+      }
+      const size_t chunk_size = std::strtoull(line.c_str(), nullptr, 16);
+      if (chunk_size == 0) {
+        // Trailers, then the final empty line.
+        do {
+          if (!ReadLine(&line, error)) {
+            return false;
+          }
+        } while (!line.empty());
+        break;
+      }
+      if (!Fill(chunk_size + 2, error)) {
+        return false;
+      }
+      response->body_.append(buffer_, buffer_pos_, chunk_size);
+      buffer_pos_ += chunk_size + 2;
+    }
+  } else if (content_length >= 0) {
+    if (!Fill(content_length, error)) {
+      return false;
+    }
+    response->body_.assign(buffer_, buffer_pos_, content_length);
+    buffer_pos_ += content_length;
+  } else {
+    // Body delimited by the end of the connection.
+    *keep_alive = false;
+    std::string ignored;
+    while (Fill(buffer_.size() - buffer_pos_ + 1, &ignored)) {
+    }
+    response->body_.assign(buffer_, buffer_pos_, std::string::npos);
+    buffer_pos_ = buffer_.size();
+  }
+  return true;
+}
+
+bool
+HttpConnection::Request(
+    const std::string& method, const std::string& path,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    const std::vector<std::pair<const char*, size_t>>& body,
+    HttpResponse* response, std::string* error)
+{
+  size_t body_size = 0;
+  for (const auto& piece : body) {
+    body_size += piece.second;
+  }
+  std::string head = method + " " + path + " HTTP/1.1\r\nHost: " + host_ +
+                     ":" + std::to_string(port_) +
+                     "\r\nConnection: keep-alive\r\n";
+  for (const auto& header : headers) {
+    head += header.first + ": " + header.second + "\r\n";
+  }
+  if ((body_size > 0) || (method == "POST")) {
+    head += "Content-Length: " + std::to_string(body_size) + "\r\n";
+  }
+  head += "\r\n";
+
+  // A kept-alive connection may have been closed by the server since
+  // the last request, retry once on a fresh connection in that case.
+  const bool reused = (fd_ >= 0);
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if ((fd_ < 0) && !Connect(error)) {
+      return false;
+    }
+    bool keep_alive = true;
+    if (SendAll(head, body, error) &&
+        ReadResponse(response, &keep_alive, error)) {
+      if (!keep_alive) {
+        Close();
+      }
+      return true;
+    }
+    Close();
+    if (!reused) {
+      break;
+    }
+  }
+  return false;
+}
+
+}  // namespace rk_loadgen
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rk_loadgen {
+
+struct HttpResponse {
+  HttpResponse() : status_(0), inference_header_length_(-1) {}
+
+  int status_;
+  // Value of the Inference-Header-Content-Length header, -1 if absent.
+  int64_t inference_header_length_;
+  std::string body_;
+};
+
+//
+// HttpConnection
+//
+// One persistent HTTP/1.1 connection. Requests are sent with
+// keep-alive and the connection is re-established transparently when
+// the server closed it, so a worker pays the TCP handshake once and
+// not per request.
+//
+class HttpConnection {
+ public:
+  HttpConnection(const std::string& host, const int port);
+  ~HttpConnection();
+
+  // Send a request and wait for the complete response. 'body' may be
+  // split in several pieces (e.g. the JSON inference header and the
+  // binary tensors) that are sent with a single sendmsg. Returns false
+  // and sets 'error' on transport errors; HTTP errors are reported in
+  // 'response->status_'.
+  bool Request(
+      const std::string& method, const std::string& path,
+      const std::vector<std::pair<std::string, std::string>>& headers,
+      const std::vector<std::pair<const char*, size_t>>& body,
+      HttpResponse* response, std::string* error);
+
+ private:
+  HttpConnection(const HttpConnection&) = delete;
+  HttpConnection& operator=(const HttpConnection&) = delete;
+
+  bool Connect(std::string* error);
+  void Close();
+  bool SendAll(
+      const std::string& head,
+      const std::vector<std::pair<const char*, size_t>>& body,
+      std::string* error);
+  // Read until 'buffer_' holds at least 'size' bytes.
+  bool Fill(const size_t size, std::string* error);
+  bool ReadLine(std::string* line, std::string* error);
+  bool ReadResponse(
+      HttpResponse* response, bool* keep_alive, std::string* error);
+
+  const std::string host_;
+  const int port_;
+  int fd_;
+  // Bytes received but not consumed yet.
+  std::string buffer_;
+  size_t buffer_pos_;
+};
+
+}  // namespace rk_loadgen
@@ -0,0 +1,260 @@
+#include "json.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace rk_loadgen {
+
+class JsonParser {
+ public:
+  explicit JsonParser(const std::string& text) : text_(text), pos_(0) {}
+
+  bool ParseDocument(JsonValue* value, std::string* error)
+  {
+    if (!ParseValue(value, 0)) {
+      *error = error_ + " at offset " + std::to_string(pos_);
+      return false;
+    }
+    SkipSpace();
+    if (pos_ != text_.size()) {
+      *error = "trailing data at offset " + std::to_string(pos_);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  // Metadata documents are shallow, bound the recursion anyway.
+  static const int kMaxDepth = 64;
+
+  void SkipSpace()
+  {
+    while ((pos_ < text_.size()) &&
+           ((text_[pos_] == ' ') || (text_[pos_] == '\t') ||
+            (text_[pos_] == '\n') || (text_[pos_] == '\r'))) {
+      pos_++;
+    }
+  }
+
+  bool Fail(const char* msg)
+  {
+    error_ = msg;
+    return false;
+  }
+
+  bool Expect(const char* literal)
+  {
+    for (const char* c = literal; *c != '\0'; ++c, ++pos_) {
+      if ((pos_ >= text_.size()) || (text_[pos_] != *c)) {
+        return Fail("invalid literal");
+      }
+    }
+    return true;
+  }
+
+  bool ParseString(std::string* str)
+  {
+    if ((pos_ >= text_.size()) || (text_[pos_] != '"')) {
+      return Fail("expected string");
+    }
+    pos_++;
+    str->clear();
+    while (pos_ < text_.size()) {
+      char c = text_[pos_++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        *str += c;
+        continue;
+      }
+      if (pos_ >= text_.size()) {
+        break;
+      }
+      c = text_[pos_++];
+      switch (c) {
+        case 'b':
+          *str += '\b';
+          break;
+        case 'f':
+          *str += '\f';
+          break;
+        case 'n':
+          *str += '\n';
+          break;
+        case 'r':
+          *str += '\r';
+          break;
+        case 't':
+          *str += '\t';
+          break;
+        case 'u': {
+          if (pos_ + 4 > text_.size()) {
+            return Fail("truncated escape");
+          }
+          const unsigned long cp =
+              std::strtoul(text_.substr(pos_, 4).c_str(), nullptr, 16);
+          pos_ += 4;
+          // Names in metadata are ASCII, keep the BMP as UTF-8 anyway.
+          if (cp < 0x80) {
+            *str += (char)cp;
+          } else if (cp < 0x800) {
+            *str += (char)(0xc0 | (cp >> 6));
+            *str += (char)(0x80 | (cp & 0x3f));
+          } else {
+            *str += (char)(0xe0 | (cp >> 12));
+            *str += (char)(0x80 | ((cp >> 6) & 0x3f));
+            *str += (char)(0x80 | (cp & 0x3f));
+          }
+          break;
+        }
+        default:
+          *str += c;
+          break;
+      }
+    }
+    return Fail("unterminated string");
+  }
+
+  bool ParseValue(JsonValue* value, const int depth)
+  {
+    if (depth > kMaxDepth) {
+      return Fail("nesting too deep");
+    }
+    SkipSpace();
+    if (pos_ >= text_.size()) {
+      return Fail("unexpected end");
+    }
+    const char c = text_[pos_];
+    if (c == '{') {
+      value->type_ = JsonValue::Type::OBJECT;
+      pos_++;
+      SkipSpace();
+      if ((pos_ < text_.size()) && (text_[pos_] == '}')) {
+        pos_++;
+        return true;
+      }
+      while (true) {
+        SkipSpace();
+        std::pair<std::string, JsonValue> member;
+        if (!ParseString(&member.first)) {
+          return false;
+        }
+        SkipSpace();
+        if ((pos_ >= text_.size()) || (text_[pos_] != ':')) {
+          return Fail("expected ':'");
+        }
+        pos_++;
+        if (!ParseValue(&member.second, depth + 1)) {
+          return false;
+        }
+        value->members_.push_back(std::move(member));
+        SkipSpace();
+        if ((pos_ < text_.size()) && (text_[pos_] == ',')) {
+          pos_++;
+        } else if ((pos_ < text_.size()) && (text_[pos_] == '}')) {
+          pos_++;
+          return true;
+        } else {
+          return Fail("expected ',' or '}'");
+        }
+      }
+    }
+    if (c == '[') {
+      value->type_ = JsonValue::Type::ARRAY;
+      pos_++;
+      SkipSpace();
+      if ((pos_ < text_.size()) && (text_[pos_] == ']')) {
+        pos_++;
+        return true;
+      }
+      while (true) {
+        value->array_.emplace_back();
+        if (!ParseValue(&value->array_.back(), depth + 1)) {
+          return false;
+        }
+        SkipSpace();
+        if ((pos_ < text_.size()) && (text_[pos_] == ',')) {
+          pos_++;
+        } else if ((pos_ < text_.size()) && (text_[pos_] == ']')) {
+          pos_++;
+          return true;
+        } else {
+          return Fail("expected ',' or ']'");
+        }
+      }
+    }
+    if (c == '"') {
+      value->type_ = JsonValue::Type::STRING;
+      return ParseString(&value->string_);
+    }
+    if (c == 't') {
+      value->type_ = JsonValue::Type::BOOL;
+      value->bool_ = true;
+      return Expect("true");
+    }
+    if (c == 'f') {
+      value->type_ = JsonValue::Type::BOOL;
+      value->bool_ = false;
+      return Expect("false");
+    }
+    if (c == 'n') {
+      value->type_ = JsonValue::Type::NUL;
+      return Expect("null");
+    }
+    const char* begin = text_.c_str() + pos_;
+    char* end = nullptr;
+    value->number_ = std::strtod(begin, &end);
+    if (end == begin) {
+      return Fail("unexpected character");
+    }
+    value->type_ = JsonValue::Type::NUMBER;
+    pos_ += end - begin;
+    return true;
+  }
+
+  const std::string& text_;
+  size_t pos_;
+  std::string error_;
+};
+
+bool
+JsonValue::Parse(const std::string& text, JsonValue* value, std::string* error)
+{
+  *value = JsonValue();
+  JsonParser parser(text);
+  return parser.ParseDocument(value, error);
+}
+
+const JsonValue*
+JsonValue::Find(const std::string& key) const
+{
+  for (const auto& member : members_) {
+    if (member.first == key) {
+      return &member.second;
+    }
+  }
+  return nullptr;
+}
+
+std::string
+JsonQuote(const std::string& str)
+{
+  std::string quoted = "\"";
+  for (const char c : str) {
+    if ((c == '"') || (c == '\\')) {
+      quoted += '\\';
+      quoted += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      quoted += buf;
+    } else {
+      quoted += c;
+    }
+  }
+  quoted += '"';
+  return quoted;
+}
+
+}  // namespace rk_loadgen
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rk_loadgen {
+
+//
+// JsonValue
+//
+// Just enough JSON to read the KServe v2 model metadata returned by
+// Triton, rk_loadgen has no other dependency than the C++ library.
+//
+class JsonValue {
+ public:
+  enum class Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+  JsonValue() : type_(Type::NUL), bool_(false), number_(0) {}
+
+  // Parse 'text' into 'value'. Returns false and sets 'error' on
+  // malformed input.
+  static bool Parse(
+      const std::string& text, JsonValue* value, std::string* error);
+
+  Type GetType() const { return type_; }
+  bool AsBool() const { return bool_; }
+  double AsNumber() const { return number_; }
+  const std::string& AsString() const { return string_; }
+  const std::vector<JsonValue>& AsArray() const { return array_; }
+
+  // Member 'key' of an object, nullptr if absent or not an object.
+  const JsonValue* Find(const std::string& key) const;
+
+ private:
+  friend class JsonParser;
+
+  Type type_;
+  bool bool_;
+  double number_;
+  std::string string_;
+  std::vector<JsonValue> array_;
+  std::vector<std::pair<std::string, JsonValue>> members_;
+};
+
+// Quote and escape 'str' as a JSON string.
+std::string JsonQuote(const std::string& str);
+
+}  // namespace rk_loadgen
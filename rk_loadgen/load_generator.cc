@@ -0,0 +1,522 @@
+#include "load_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "http_client.h"
+#include "json.h"
+
+namespace rk_loadgen {
+
+namespace {
+
+// Size of one element of a KServe v2 datatype, 0 if not supported.
+size_t
+ElementSize(const std::string& datatype)
+{
+  if ((datatype == "BOOL") || (datatype == "INT8") || (datatype == "UINT8")) {
+    return 1;
+  }
+  if ((datatype == "INT16") || (datatype == "UINT16") ||
+      (datatype == "FP16") || (datatype == "BF16")) {
+    return 2;
+  }
+  if ((datatype == "INT32") || (datatype == "UINT32") ||
+      (datatype == "FP32")) {
+    return 4;
+  }
+  if ((datatype == "INT64") || (datatype == "UINT64") ||
+      (datatype == "FP64")) {
+    return 8;
+  }
+  return 0;
+}
+
+// Random tensor content. Floating point inputs get values in [0, 1) so
+// that the model does not see NaN or infinities.
+void
+FillRandom(
+    const std::string& datatype, const size_t byte_size, std::mt19937* rng,
+    std::string* data)
+{
+  const size_t offset = data->size();
+  data->resize(offset + byte_size);
+  char* dst = &(*data)[offset];
+  if (datatype == "FP32") {
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (size_t i = 0; i < byte_size / sizeof(float); ++i) {
+      const float value = dist(*rng);
+      memcpy(dst + i * sizeof(float), &value, sizeof(float));
+    }
+  } else if ((datatype == "FP16") || (datatype == "BF16")) {
+    // Exponent below the bias keeps both encodings in [0, 1).
+    const uint16_t exponent = (datatype == "FP16") ? 0x3800 : 0x3f00;
+    for (size_t i = 0; i < byte_size / sizeof(uint16_t); ++i) {
+      const uint16_t value = exponent | ((*rng)() & 0xff);
+      memcpy(dst + i * sizeof(uint16_t), &value, sizeof(uint16_t));
+    }
+  } else if (datatype == "FP64") {
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    for (size_t i = 0; i < byte_size / sizeof(double); ++i) {
+      const double value = dist(*rng);
+      memcpy(dst + i * sizeof(double), &value, sizeof(double));
+    }
+  } else if (datatype == "BOOL") {
+    for (size_t i = 0; i < byte_size; ++i) {
+      dst[i] = (char)((*rng)() & 1);
+    }
+  } else {
+    for (size_t i = 0; i < byte_size; ++i) {
+      dst[i] = (char)((*rng)() & 0xff);
+    }
+  }
+}
+
+double
+Percentile(const std::vector<double>& sorted, const double p)
+{
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)std::ceil(p * sorted.size());
+  idx = std::min(sorted.size(), std::max<size_t>(idx, 1)) - 1;
+  return sorted[idx];
+}
+
+}  // namespace
+
+LoadGenerator::LoadGenerator(const LoadOptions& options)
+    : options_(options), end_s_(0), next_(0)
+{
+  infer_path_ = "/v2/models/" + options_.model_;
+  if (!options_.version_.empty()) {
+    infer_path_ += "/versions/" + options_.version_;
+  }
+}
+
+bool
+LoadGenerator::Init(std::string* error)
+{
+  return FetchMetadata(error) && BuildRequest(error);
+}
+
+bool
+LoadGenerator::FetchMetadata(std::string* error)
+{
+  HttpConnection connection(options_.host_, options_.port_);
+  HttpResponse response;
+  if (!connection.Request("GET", infer_path_, {}, {}, &response, error)) {
+    return false;
+  }
+  if (response.status_ != 200) {
+    *error = "model metadata of '" + options_.model_ + "' returned HTTP " +
+             std::to_string(response.status_) + ": " + response.body_;
+    return false;
+  }
+  JsonValue metadata;
+  if (!JsonValue::Parse(response.body_, &metadata, error)) {
+    *error = "malformed model metadata: " + *error;
+    return false;
+  }
+
+  const JsonValue* inputs = metadata.Find("inputs");
+  if ((inputs == nullptr) || inputs->AsArray().empty()) {
+    *error = "model metadata has no inputs";
+    return false;
+  }
+  for (const auto& input : inputs->AsArray()) {
+    const JsonValue* name = input.Find("name");
+    const JsonValue* datatype = input.Find("datatype");
+    const JsonValue* shape = input.Find("shape");
+    if ((name == nullptr) || (datatype == nullptr) || (shape == nullptr)) {
+      *error = "model metadata input lacks name, datatype or shape";
+      return false;
+    }
+    TensorSpec spec;
+    spec.name_ = name->AsString();
+    spec.datatype_ = datatype->AsString();
+    for (const auto& dim : shape->AsArray()) {
+      int64_t value = (int64_t)dim.AsNumber();
+      if (value < 0) {
+        // Only the batch dimension is variable for RKNN models.
+        if (!spec.shape_.empty()) {
+          *error = "input '" + spec.name_ +
+                   "' has a variable dimension other than the batch one";
+          return false;
+        }
+        value = options_.batch_;
+      }
+      spec.shape_.push_back(value);
+    }
+    inputs_.push_back(spec);
+  }
+
+  const JsonValue* outputs = metadata.Find("outputs");
+  if (outputs != nullptr) {
+    for (const auto& output : outputs->AsArray()) {
+      const JsonValue* name = output.Find("name");
+      if (name != nullptr) {
+        outputs_.push_back(name->AsString());
+      }
+    }
+  }
+  return true;
+}
+
+bool
+LoadGenerator::BuildRequest(std::string* error)
+{
+  std::mt19937 rng(options_.seed_);
+  std::string header = "{\"inputs\":[";
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    const TensorSpec& spec = inputs_[i];
+    const size_t element_size = ElementSize(spec.datatype_);
+    if (element_size == 0) {
+      *error = "input '" + spec.name_ + "' has unsupported datatype " +
+               spec.datatype_;
+      return false;
+    }
+    size_t byte_size = element_size;
+    for (const int64_t dim : spec.shape_) {
+      byte_size *= dim;
+    }
+
+    const auto file = options_.input_files_.find(spec.name_);
+    if (file != options_.input_files_.end()) {
+      std::ifstream in(file->second, std::ios::binary);
+      std::stringstream content;
+      content << in.rdbuf();
+      if (!in) {
+        *error = "cannot read " + file->second;
+        return false;
+      }
+      std::string tensor = content.str();
+      // A single sample is repeated over the batch.
+      const size_t batch_elements =
+          spec.shape_.empty() ? 1 : (size_t)spec.shape_[0];
+      if ((tensor.size() * batch_elements == byte_size) &&
+          (batch_elements > 1)) {
+        std::string batch;
+        for (size_t b = 0; b < batch_elements; ++b) {
+          batch += tensor;
+        }
+        tensor.swap(batch);
+      }
+      if (tensor.size() != byte_size) {
+        *error = file->second + " holds " + std::to_string(tensor.size()) +
+                 " bytes, input '" + spec.name_ + "' expects " +
+                 std::to_string(byte_size);
+        return false;
+      }
+      data_ += tensor;
+    } else {
+      FillRandom(spec.datatype_, byte_size, &rng, &data_);
+    }
+
+    header += (i == 0) ? "" : ",";
+    header += "{\"name\":" + JsonQuote(spec.name_) + ",\"shape\":[";
+    for (size_t d = 0; d < spec.shape_.size(); ++d) {
+      header += ((d == 0) ? "" : ",") + std::to_string(spec.shape_[d]);
+    }
+    header += "],\"datatype\":" + JsonQuote(spec.datatype_) +
+              ",\"parameters\":{\"binary_data_size\":" +
+              std::to_string(byte_size) + "}}";
+  }
+  for (const auto& file : options_.input_files_) {
+    bool found = false;
+    for (const auto& spec : inputs_) {
+      found |= (spec.name_ == file.first);
+    }
+    if (!found) {
+      *error = "model has no input named '" + file.first + "'";
+      return false;
+    }
+  }
+  // Outputs come back as binary too, the client does not parse them.
+  header += "],\"outputs\":[";
+  for (size_t i = 0; i < outputs_.size(); ++i) {
+    header += ((i == 0) ? "{\"name\":" : ",{\"name\":") +
+              JsonQuote(outputs_[i]) +
+              ",\"parameters\":{\"binary_data\":true}}";
+  }
+  header += "]}";
+  header_.swap(header);
+  return true;
+}
+
+void
+LoadGenerator::ClosedLoopWorker(
+    std::vector<Sample>* samples, std::string* error)
+{
+  HttpConnection connection(options_.host_, options_.port_);
+  const std::vector<std::pair<std::string, std::string>> headers{
+      {"Content-Type", "application/octet-stream"},
+      {"Inference-Header-Content-Length", std::to_string(header_.size())}};
+  const std::vector<std::pair<const char*, size_t>> body{
+      {header_.data(), header_.size()}, {data_.data(), data_.size()}};
+  const std::string path = infer_path_ + "/infer";
+  HttpResponse response;
+  while (true) {
+    const auto begin = std::chrono::steady_clock::now();
+    const double start_s =
+        std::chrono::duration<double>(begin - start_).count();
+    if (start_s >= end_s_) {
+      break;
+    }
+    std::string request_error;
+    bool ok = connection.Request(
+        "POST", path, headers, body, &response, &request_error);
+    if (ok && (response.status_ != 200)) {
+      request_error =
+          "HTTP " + std::to_string(response.status_) + ": " + response.body_;
+      ok = false;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const double latency_us =
+        std::chrono::duration<double, std::micro>(end - begin).count();
+    samples->push_back({start_s, latency_us, ok});
+    if (!ok) {
+      if (error->empty()) {
+        *error = request_error;
+      }
+      // Do not spin on a server that is down.
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+void
+LoadGenerator::OpenLoopWorker(
+    const std::vector<double>* schedule, std::vector<Sample>* samples,
+    uint64_t* delayed, std::string* error)
+{
+  HttpConnection connection(options_.host_, options_.port_);
+  const std::vector<std::pair<std::string, std::string>> headers{
+      {"Content-Type", "application/octet-stream"},
+      {"Inference-Header-Content-Length", std::to_string(header_.size())}};
+  const std::vector<std::pair<const char*, size_t>> body{
+      {header_.data(), header_.size()}, {data_.data(), data_.size()}};
+  const std::string path = infer_path_ + "/infer";
+  HttpResponse response;
+  while (true) {
+    const size_t slot = next_.fetch_add(1);
+    if (slot >= schedule->size()) {
+      break;
+    }
+    const double start_s = (*schedule)[slot];
+    const auto intended =
+        start_ +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(start_s));
+    std::this_thread::sleep_until(intended);
+    if (std::chrono::steady_clock::now() - intended >
+        std::chrono::milliseconds(1)) {
+      (*delayed)++;
+    }
+    std::string request_error;
+    bool ok = connection.Request(
+        "POST", path, headers, body, &response, &request_error);
+    if (ok && (response.status_ != 200)) {
+      request_error =
+          "HTTP " + std::to_string(response.status_) + ": " + response.body_;
+      ok = false;
+    }
+    // Latency from the scheduled start, waiting for a free connection
+    // is part of what the user would have seen.
+    const auto end = std::chrono::steady_clock::now();
+    samples->push_back(
+        {start_s,
+         std::chrono::duration<double, std::micro>(end - intended).count(),
+         ok});
+    if (!ok && error->empty()) {
+      *error = request_error;
+    }
+  }
+}
+
+void
+LoadGenerator::Run(LoadResult* result)
+{
+  *result = LoadResult();
+  const bool open_loop = (options_.rate_ > 0);
+  const int workers = open_loop ? std::max(1, options_.connections_)
+                                : std::max(1, options_.concurrency_);
+  end_s_ = options_.warmup_s_ + options_.duration_s_;
+
+  // The open loop schedule is drawn up front so that the sending
+  // threads only sleep and send.
+  std::vector<double> schedule;
+  if (open_loop) {
+    std::mt19937 rng(options_.seed_);
+    std::exponential_distribution<double> interval(options_.rate_);
+    double t = 0;
+    while (t < end_s_) {
+      schedule.push_back(t);
+      t = options_.poisson_ ? (t + interval(rng))
+                            : (schedule.size() / options_.rate_);
+    }
+  }
+
+  std::vector<std::vector<Sample>> samples(workers);
+  std::vector<std::string> errors(workers);
+  std::vector<uint64_t> delayed(workers, 0);
+  std::vector<std::thread> threads;
+  next_ = 0;
+  start_ = std::chrono::steady_clock::now();
+  for (int i = 0; i < workers; ++i) {
+    if (open_loop) {
+      threads.emplace_back(
+          &LoadGenerator::OpenLoopWorker, this, &schedule, &samples[i],
+          &delayed[i], &errors[i]);
+    } else {
+      threads.emplace_back(
+          &LoadGenerator::ClosedLoopWorker, this, &samples[i], &errors[i]);
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<double> latencies;
+  for (int i = 0; i < workers; ++i) {
+    for (const auto& sample : samples[i]) {
+      if (sample.start_s_ < options_.warmup_s_) {
+        continue;
+      }
+      if (sample.ok_) {
+        latencies.push_back(sample.latency_us_);
+      } else {
+        result->errors_++;
+      }
+    }
+    result->delayed_ += delayed[i];
+    if (result->first_error_.empty()) {
+      result->first_error_ = errors[i];
+    }
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  result->requests_ = latencies.size();
+  result->duration_s_ = options_.duration_s_;
+  if (result->duration_s_ > 0) {
+    result->request_rate_ = result->requests_ / result->duration_s_;
+    result->infer_rate_ = result->request_rate_ * options_.batch_;
+  }
+  if (latencies.empty()) {
+    return;
+  }
+  double sum = 0;
+  for (const double latency : latencies) {
+    sum += latency;
+  }
+  result->mean_us_ = sum / latencies.size();
+  result->p50_us_ = Percentile(latencies, 0.50);
+  result->p90_us_ = Percentile(latencies, 0.90);
+  result->p95_us_ = Percentile(latencies, 0.95);
+  result->p99_us_ = Percentile(latencies, 0.99);
+  result->min_us_ = latencies.front();
+  result->max_us_ = latencies.back();
+
+  // Power of two buckets from the one holding the fastest request up to
+  // the one holding the slowest.
+  double bound = 1;
+  while (bound < result->min_us_) {
+    bound *= 2;
+  }
+  size_t idx = 0;
+  while (idx < latencies.size()) {
+    uint64_t count = 0;
+    while ((idx < latencies.size()) && (latencies[idx] <= bound)) {
+      count++;
+      idx++;
+    }
+    result->histogram_.emplace_back(bound, count);
+    bound *= 2;
+  }
+}
+
+std::string
+FormatResult(
+    const LoadOptions& options, const LoadGenerator& generator,
+    const LoadResult& result)
+{
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1);
+  const std::string mode = (options.rate_ > 0)
+                               ? (options.poisson_ ? "poisson" : "constant")
+                               : "concurrency";
+  if (options.format_ == OutputFormat::JSON) {
+    ss << "{\"model\":" << JsonQuote(options.model_)
+       << ",\"mode\":" << JsonQuote(mode)
+       << ",\"concurrency\":" << options.concurrency_
+       << ",\"target_rate\":" << options.rate_
+       << ",\"batch\":" << options.batch_
+       << ",\"duration_s\":" << result.duration_s_
+       << ",\"requests\":" << result.requests_
+       << ",\"errors\":" << result.errors_
+       << ",\"first_error\":" << JsonQuote(result.first_error_)
+       << ",\"delayed\":" << result.delayed_
+       << ",\"request_rate\":" << result.request_rate_
+       << ",\"infer_rate\":" << result.infer_rate_
+       << ",\"latency_us\":{\"mean\":" << result.mean_us_
+       << ",\"p50\":" << result.p50_us_ << ",\"p90\":" << result.p90_us_
+       << ",\"p95\":" << result.p95_us_ << ",\"p99\":" << result.p99_us_
+       << ",\"min\":" << result.min_us_ << ",\"max\":" << result.max_us_
+       << "},\"histogram\":[";
+    for (size_t i = 0; i < result.histogram_.size(); ++i) {
+      ss << ((i == 0) ? "" : ",") << "{\"le_us\":"
+         << result.histogram_[i].first
+         << ",\"count\":" << result.histogram_[i].second << "}";
+    }
+    ss << "]}\n";
+    return ss.str();
+  }
+
+  ss << "model " << options.model_;
+  for (const auto& input : generator.Inputs()) {
+    ss << "  " << input.name_ << " " << input.datatype_ << " [";
+    for (size_t d = 0; d < input.shape_.size(); ++d) {
+      ss << ((d == 0) ? "" : ",") << input.shape_[d];
+    }
+    ss << "]";
+  }
+  ss << "\n";
+  if (options.rate_ > 0) {
+    ss << "mode " << mode << " rate " << options.rate_ << " req/s over "
+       << options.connections_ << " connections\n";
+  } else {
+    ss << "mode concurrency " << std::max(1, options.concurrency_) << "\n";
+  }
+  ss << "requests " << result.requests_ << "  errors " << result.errors_;
+  if (options.rate_ > 0) {
+    ss << "  delayed " << result.delayed_;
+  }
+  ss << "\nthroughput " << result.request_rate_ << " req/s  "
+     << result.infer_rate_ << " infer/s\n"
+     << "latency us  mean " << result.mean_us_ << "  p50 " << result.p50_us_
+     << "  p90 " << result.p90_us_ << "  p95 " << result.p95_us_ << "  p99 "
+     << result.p99_us_ << "  max " << result.max_us_ << "\n";
+  if (!result.first_error_.empty()) {
+    ss << "first error: " << result.first_error_ << "\n";
+  }
+
+  uint64_t peak = 0;
+  for (const auto& bucket : result.histogram_) {
+    peak = std::max(peak, bucket.second);
+  }
+  for (const auto& bucket : result.histogram_) {
+    const int bar = (peak == 0) ? 0 : (int)(50 * bucket.second / peak);
+    ss << std::setprecision(0) << "  <= " << std::setw(9) << bucket.first
+       << " us " << std::setw(9) << bucket.second << " "
+       << std::string(bar, '#') << "\n";
+  }
+  return ss.str();
+}
+
+}  // namespace rk_loadgen
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace rk_loadgen {
+
+enum class OutputFormat { TABLE, JSON };
+
+struct LoadOptions {
+  LoadOptions()
+      : host_("localhost"), port_(8000), model_("rockchip"), concurrency_(0),
+        rate_(0), poisson_(false), connections_(16), duration_s_(10),
+        warmup_s_(2), batch_(1), seed_(1), format_(OutputFormat::TABLE)
+  {
+  }
+
+  std::string host_;
+  int port_;
+  std::string model_;
+  // Empty for the version picked by the server.
+  std::string version_;
+  // Closed loop: 'concurrency_' requests in flight, each worker sends
+  // the next request as soon as the previous one returned.
+  int concurrency_;
+  // Open loop: requests per second sent on a fixed schedule whatever
+  // the server latency. Used instead of 'concurrency_' when > 0.
+  double rate_;
+  // Exponential inter-arrival times instead of a constant interval.
+  bool poisson_;
+  // Keep-alive connections (and sending threads) of the open loop
+  // mode. Must cover rate * latency or requests start late.
+  int connections_;
+  double duration_s_;
+  // Requests started during the warmup are not reported.
+  double warmup_s_;
+  // Replaces the -1 batch dimension of the model inputs.
+  int batch_;
+  // Raw tensor per input name, random data for the others.
+  std::map<std::string, std::string> input_files_;
+  uint32_t seed_;
+  OutputFormat format_;
+};
+
+struct TensorSpec {
+  std::string name_;
+  std::string datatype_;
+  std::vector<int64_t> shape_;
+};
+
+struct LoadResult {
+  LoadResult()
+      : requests_(0), errors_(0), delayed_(0), duration_s_(0),
+        request_rate_(0), infer_rate_(0), mean_us_(0), p50_us_(0),
+        p90_us_(0), p95_us_(0), p99_us_(0), min_us_(0), max_us_(0)
+  {
+  }
+
+  // Successful requests started in the measurement window.
+  uint64_t requests_;
+  uint64_t errors_;
+  std::string first_error_;
+  // Open loop only: requests sent more than 1 ms after their scheduled
+  // time because every connection was busy.
+  uint64_t delayed_;
+  double duration_s_;
+  double request_rate_;
+  // Batch elements per second.
+  double infer_rate_;
+  // Latency of successful requests. In open loop mode it is measured
+  // from the scheduled start so that a slow server is not hidden by the
+  // client waiting for it (coordinated omission).
+  double mean_us_;
+  double p50_us_;
+  double p90_us_;
+  double p95_us_;
+  double p99_us_;
+  double min_us_;
+  double max_us_;
+  // Power of two latency buckets: upper bound in us and count.
+  std::vector<std::pair<double, uint64_t>> histogram_;
+};
+
+//
+// LoadGenerator
+//
+// Sends KServe v2 inference requests to Triton over HTTP. The request
+// body, built once from the model metadata, carries the input tensors
+// with the binary data extension so no JSON encoding of the tensor
+// data happens on the measured path.
+//
+class LoadGenerator {
+ public:
+  explicit LoadGenerator(const LoadOptions& options);
+
+  // Fetch the model metadata and build the request. Returns false and
+  // sets 'error' on failure.
+  bool Init(std::string* error);
+
+  const std::vector<TensorSpec>& Inputs() const { return inputs_; }
+  const std::vector<std::string>& Outputs() const { return outputs_; }
+
+  // Run the load for the configured warmup and duration.
+  void Run(LoadResult* result);
+
+ private:
+  // One request as seen by the client.
+  struct Sample {
+    // Start relative to the beginning of the run.
+    double start_s_;
+    double latency_us_;
+    bool ok_;
+  };
+
+  bool FetchMetadata(std::string* error);
+  bool BuildRequest(std::string* error);
+  void ClosedLoopWorker(std::vector<Sample>* samples, std::string* error);
+  void OpenLoopWorker(
+      const std::vector<double>* schedule, std::vector<Sample>* samples,
+      uint64_t* delayed, std::string* error);
+
+  const LoadOptions options_;
+  std::string infer_path_;
+  std::vector<TensorSpec> inputs_;
+  std::vector<std::string> outputs_;
+  std::string header_;
+  std::string data_;
+
+  std::chrono::steady_clock::time_point start_;
+  // Nothing is started after 'end_s_' seconds.
+  double end_s_;
+  // Next schedule slot of the open loop.
+  std::atomic<size_t> next_;
+};
+
+std::string FormatResult(
+    const LoadOptions& options, const LoadGenerator& generator,
+    const LoadResult& result);
+
+}  // namespace rk_loadgen
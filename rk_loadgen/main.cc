@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "load_generator.h"
+
+namespace {
+
+void
+Usage(const char* prog)
+{
+  std::cerr
+      << "usage: " << prog << " [options]\n"
+      << "  -u <host:port>         Triton HTTP endpoint\n"
+      << "                         (default localhost:8000)\n"
+      << "  -m <model>             model name (default rockchip)\n"
+      << "  -x <version>           model version (default server policy)\n"
+      << "  --concurrency <n>      closed loop with <n> requests in flight\n"
+      << "                         (default 1)\n"
+      << "  --rate <req/s>         open loop at a fixed request rate\n"
+      << "  --poisson              open loop with Poisson arrivals\n"
+      << "  -c <connections>       open loop connections (default 16)\n"
+      << "  -d <seconds>           measurement duration (default 10)\n"
+      << "  -w <seconds>           warmup, not reported (default 2)\n"
+      << "  -b <batch>             batch size of the requests (default 1)\n"
+      << "  --input-data <n=file>  raw tensor for input <n>, repeat per\n"
+      << "                         input (default random data)\n"
+      << "  -s <seed>              random data seed (default 1)\n"
+      << "  -f table|json          output format (default table)\n";
+}
+
+// Split "[http://]host[:port]" into 'options'.
+bool
+ParseUrl(const std::string& url, rk_loadgen::LoadOptions* options)
+{
+  std::string rest = url;
+  const size_t scheme = rest.find("://");
+  if (scheme != std::string::npos) {
+    if (rest.compare(0, scheme, "http") != 0) {
+      std::cerr << "only the HTTP endpoint is supported, got " << url
+                << std::endl;
+      return false;
+    }
+    rest = rest.substr(scheme + 3);
+  }
+  const size_t colon = rest.rfind(':');
+  if (colon != std::string::npos) {
+    options->port_ = std::atoi(rest.c_str() + colon + 1);
+    rest = rest.substr(0, colon);
+  }
+  options->host_ = rest;
+  return !options->host_.empty() && (options->port_ > 0);
+}
+
+}  // namespace
+
+int
+main(int argc, char* argv[])
+{
+  rk_loadgen::LoadOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if ((arg == "-h") || (arg == "--help")) {
+      Usage(argv[0]);
+      return 0;
+    }
+    if (arg == "--poisson") {
+      options.poisson_ = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "missing value for " << arg << std::endl;
+      Usage(argv[0]);
+      return 1;
+    }
+    const std::string value(argv[++i]);
+    if (arg == "-u") {
+      if (!ParseUrl(value, &options)) {
+        return 1;
+      }
+    } else if (arg == "-m") {
+      options.model_ = value;
+    } else if (arg == "-x") {
+      options.version_ = value;
+    } else if (arg == "--concurrency") {
+      options.concurrency_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--rate") {
+      options.rate_ = std::max(0.0, std::atof(value.c_str()));
+    } else if (arg == "-c") {
+      options.connections_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "-d") {
+      options.duration_s_ = std::max(0.1, std::atof(value.c_str()));
+    } else if (arg == "-w") {
+      options.warmup_s_ = std::max(0.0, std::atof(value.c_str()));
+    } else if (arg == "-b") {
+      options.batch_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--input-data") {
+      const size_t eq = value.find('=');
+      if ((eq == std::string::npos) || (eq == 0)) {
+        std::cerr << "--input-data expects <input>=<file>" << std::endl;
+        return 1;
+      }
+      options.input_files_[value.substr(0, eq)] = value.substr(eq + 1);
+    } else if (arg == "-s") {
+      options.seed_ = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (arg == "-f") {
+      if (value == "table") {
+        options.format_ = rk_loadgen::OutputFormat::TABLE;
+      } else if (value == "json") {
+        options.format_ = rk_loadgen::OutputFormat::JSON;
+      } else {
+        std::cerr << "unknown format " << value << std::endl;
+        return 1;
+      }
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  if ((options.rate_ > 0) && (options.concurrency_ > 0)) {
+    std::cerr << "--rate and --concurrency are exclusive" << std::endl;
+    return 1;
+  }
+  if (options.poisson_ && (options.rate_ <= 0)) {
+    std::cerr << "--poisson needs --rate" << std::endl;
+    return 1;
+  }
+
+  rk_loadgen::LoadGenerator generator(options);
+  std::string error;
+  if (!generator.Init(&error)) {
+    std::cerr << "rk_loadgen: " << error << std::endl;
+    return 1;
+  }
+  rk_loadgen::LoadResult result;
+  generator.Run(&result);
+  std::cout << rk_loadgen::FormatResult(options, generator, result)
+            << std::flush;
+  return (result.requests_ > 0) ? 0 : 1;
+}
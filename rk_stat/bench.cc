@@ -0,0 +1,807 @@
+#include "bench.h"
+
+#include <rknn_api.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "rock-chip_convert.h"
+#include "rock-chip_dequant.h"
+#include "rock-chip_layout.h"
+
+namespace rk_stat {
+
+using triton::backend::rockchip::ConvertShape;
+using triton::backend::rockchip::DequantJob;
+using triton::backend::rockchip::InputConversion;
+using triton::backend::rockchip::InputLayout;
+using triton::backend::rockchip::Nc1hwc2Layout;
+using triton::backend::rockchip::OutputActivation;
+
+namespace {
+
+// How the outputs are read back after a run, see
+// BenchOptions::output_paths_.
+enum class OutputPath { GET, NATIVE, FLOAT, DEQUANT };
+
+bool
+OutputPathFromName(const std::string& name, OutputPath* path)
+{
+  if (name == "get") {
+    *path = OutputPath::GET;
+  } else if (name == "native") {
+    *path = OutputPath::NATIVE;
+  } else if (name == "float") {
+    *path = OutputPath::FLOAT;
+  } else if (name == "dequant") {
+    *path = OutputPath::DEQUANT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+struct CoreMaskName {
+  const char* name_;
+  rknn_core_mask mask_;
+};
+
+const CoreMaskName kCoreMasks[] = {
+    {"auto", RKNN_NPU_CORE_AUTO}, {"0", RKNN_NPU_CORE_0},
+    {"1", RKNN_NPU_CORE_1},       {"2", RKNN_NPU_CORE_2},
+    {"0_1", RKNN_NPU_CORE_0_1},   {"0_1_2", RKNN_NPU_CORE_0_1_2},
+};
+
+bool
+CoreMaskFromName(const std::string& name, rknn_core_mask* mask)
+{
+  for (const auto& entry : kCoreMasks) {
+    if (name == entry.name_) {
+      *mask = entry.mask_;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t
+NowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t
+ResidentBytes()
+{
+  std::ifstream statm("/proc/self/statm");
+  uint64_t size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+double
+Percentile(const std::vector<double>& sorted, const double p)
+{
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)std::ceil(p * sorted.size());
+  idx = (idx == 0) ? 0 : idx - 1;
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+bool
+LoadInputs(
+    const BenchOptions& options, const std::vector<rknn_tensor_attr>& attrs,
+    std::vector<std::vector<uint8_t>>* buffers)
+{
+  std::mt19937 rng(0x5eed);
+  buffers->resize(attrs.size());
+  for (size_t i = 0; i < attrs.size(); ++i) {
+    std::vector<uint8_t>& buffer = (*buffers)[i];
+    buffer.resize(attrs[i].size);
+    if (i < options.input_files_.size()) {
+      std::ifstream file(options.input_files_[i], std::ios::binary);
+      if (!file) {
+        std::cerr << "cannot open input " << options.input_files_[i]
+                  << std::endl;
+        return false;
+      }
+      file.read((char*)buffer.data(), buffer.size());
+      if ((size_t)file.gcount() != buffer.size()) {
+        std::cerr << "input " << options.input_files_[i] << " has "
+                  << file.gcount() << " bytes, model input " << i
+                  << " needs " << buffer.size() << std::endl;
+        return false;
+      }
+    } else {
+      for (auto& byte : buffer) {
+        byte = rng() & 0xff;
+      }
+    }
+  }
+  return true;
+}
+
+// Timings collected by one context.
+struct ContextRun {
+  ContextRun() : ok_(false), batch_(1), run_total_us_(0)
+  {
+    memset(&mem_size_, 0, sizeof(mem_size_));
+  }
+  bool ok_;
+  uint32_t batch_;
+  std::vector<double> latencies_;
+  double run_total_us_;
+  rknn_mem_size mem_size_;
+};
+
+void
+RunContext(
+    const BenchOptions& options, const std::string& model_path,
+    const std::string& core_mask_name, const rknn_core_mask core_mask,
+    const bool pass_through, const OutputPath output_path,
+    const OutputActivation activation, ContextRun* run)
+{
+  const bool native_outputs = (output_path == OutputPath::NATIVE);
+  rknn_context ctx;
+  int ret = rknn_init(&ctx, (void*)model_path.c_str(), 0, 0, NULL);
+  if (ret < 0) {
+    std::cerr << "rknn_init " << model_path << " failed, ret=" << ret
+              << std::endl;
+    return;
+  }
+
+  std::vector<rknn_tensor_mem*> output_mems;
+  do {
+    if ((core_mask != RKNN_NPU_CORE_AUTO) &&
+        ((ret = rknn_set_core_mask(ctx, core_mask)) < 0)) {
+      std::cerr << "rknn_set_core_mask " << core_mask_name
+                << " failed, ret=" << ret << std::endl;
+      break;
+    }
+
+    rknn_input_output_num io_num;
+    if (rknn_query(ctx, RKNN_QUERY_IN_OUT_NUM, &io_num, sizeof(io_num)) < 0) {
+      std::cerr << "rknn_query RKNN_QUERY_IN_OUT_NUM failed" << std::endl;
+      break;
+    }
+    std::vector<rknn_tensor_attr> input_attrs(io_num.n_input);
+    bool attrs_ok = true;
+    for (uint32_t i = 0; i < io_num.n_input; ++i) {
+      memset(&input_attrs[i], 0, sizeof(rknn_tensor_attr));
+      input_attrs[i].index = i;
+      attrs_ok &= (rknn_query(
+                       ctx, RKNN_QUERY_INPUT_ATTR, &input_attrs[i],
+                       sizeof(rknn_tensor_attr)) >= 0);
+      // The native attr is what the NPU consumes without conversion,
+      // runtimes that do not report it consume the regular one.
+      rknn_tensor_attr native = input_attrs[i];
+      if (pass_through &&
+          (rknn_query(
+               ctx, RKNN_QUERY_NATIVE_INPUT_ATTR, &native,
+               sizeof(rknn_tensor_attr)) >= 0)) {
+        input_attrs[i] = native;
+      }
+    }
+    if (!attrs_ok || input_attrs.empty()) {
+      std::cerr << "rknn_query RKNN_QUERY_INPUT_ATTR failed" << std::endl;
+      break;
+    }
+
+    std::vector<std::vector<uint8_t>> buffers;
+    if (!LoadInputs(options, input_attrs, &buffers)) {
+      break;
+    }
+    std::vector<rknn_input> inputs(io_num.n_input);
+    for (uint32_t i = 0; i < io_num.n_input; ++i) {
+      memset(&inputs[i], 0, sizeof(rknn_input));
+      inputs[i].index = i;
+      inputs[i].type = input_attrs[i].type;
+      inputs[i].fmt = input_attrs[i].fmt;
+      inputs[i].size = buffers[i].size();
+      inputs[i].buf = buffers[i].data();
+      inputs[i].pass_through = pass_through ? 1 : 0;
+    }
+    std::vector<rknn_output> outputs(io_num.n_output);
+
+    // Native outputs are bound once and converted after every run.
+    std::vector<Nc1hwc2Layout> layouts(io_num.n_output);
+    std::vector<std::vector<uint8_t>> converted(io_num.n_output);
+    std::vector<bool> nhwc(io_num.n_output, false);
+    bool outputs_ok = true;
+    for (uint32_t i = 0; native_outputs && (i < io_num.n_output); ++i) {
+      rknn_tensor_attr attr, native;
+      memset(&attr, 0, sizeof(attr));
+      attr.index = i;
+      outputs_ok &=
+          (rknn_query(ctx, RKNN_QUERY_OUTPUT_ATTR, &attr, sizeof(attr)) >= 0);
+      native = attr;
+      outputs_ok &= (rknn_query(
+                         ctx, RKNN_QUERY_NATIVE_OUTPUT_ATTR, &native,
+                         sizeof(native)) >= 0);
+      if (!triton::backend::rockchip::Nc1hwc2LayoutFromAttrs(
+              native, attr, &layouts[i])) {
+        native = attr;
+      }
+      converted[i].resize(attr.size);
+      nhwc[i] = (attr.fmt == RKNN_TENSOR_NHWC);
+      rknn_tensor_mem* mem = rknn_create_mem(
+          ctx, std::max(native.size, native.size_with_stride));
+      output_mems.push_back(mem);
+      outputs_ok &=
+          (mem != nullptr) && (rknn_set_io_mem(ctx, mem, &native) >= 0);
+    }
+
+    // The quantized outputs are dequantized into FP32 after every run,
+    // the others are used as rknn_outputs_get returns them.
+    std::vector<DequantJob> jobs;
+    std::vector<uint32_t> job_outputs;
+    std::vector<std::vector<float>> dequantized(io_num.n_output);
+    for (uint32_t i = 0;
+         (output_path == OutputPath::DEQUANT) && (i < io_num.n_output); ++i) {
+      rknn_tensor_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.index = i;
+      outputs_ok &=
+          (rknn_query(ctx, RKNN_QUERY_OUTPUT_ATTR, &attr, sizeof(attr)) >= 0);
+      if ((attr.type != RKNN_TENSOR_INT8) && (attr.type != RKNN_TENSOR_UINT8)) {
+        continue;
+      }
+      dequantized[i].resize(attr.n_elems);
+      DequantJob job;
+      job.src_signed_ = (attr.type == RKNN_TENSOR_INT8);
+      job.count_ = attr.n_elems;
+      job.zp_ = attr.zp;
+      job.scale_ = attr.scale;
+      job.activation_ = activation;
+      job.dst_ = dequantized[i].data();
+      // The source is set from rknn_outputs_get after every run.
+      jobs.push_back(job);
+      job_outputs.push_back(i);
+    }
+    // The workers of the backend instance, one per output beyond the
+    // first.
+    triton::backend::rockchip::WorkerPool workers(
+        jobs.empty() ? 0 : jobs.size() - 1);
+    if (!outputs_ok) {
+      std::cerr << "preparing the outputs of " << model_path << " failed"
+                << std::endl;
+    }
+
+    run->latencies_.reserve(options.iterations_);
+    bool run_ok = outputs_ok;
+    for (int it = -options.warmup_; run_ok && (it < options.iterations_);
+         ++it) {
+      for (uint32_t i = 0; i < io_num.n_output; ++i) {
+        memset(&outputs[i], 0, sizeof(rknn_output));
+        outputs[i].index = i;
+        outputs[i].want_float = (output_path == OutputPath::FLOAT) ? 1 : 0;
+      }
+      const uint64_t start_us = NowUs();
+      run_ok &= (rknn_inputs_set(ctx, io_num.n_input, inputs.data()) >= 0);
+      const uint64_t run_start_us = NowUs();
+      run_ok &= (rknn_run(ctx, NULL) >= 0);
+      const uint64_t run_end_us = NowUs();
+      if (native_outputs) {
+        for (uint32_t i = 0; i < io_num.n_output; ++i) {
+          if (layouts[i].c2_ == 0) {
+            memcpy(
+                converted[i].data(), output_mems[i]->virt_addr,
+                std::min<size_t>(converted[i].size(), output_mems[i]->size));
+          } else if (nhwc[i]) {
+            triton::backend::rockchip::Nc1hwc2ToNhwc(
+                layouts[i], output_mems[i]->virt_addr, converted[i].data());
+          } else {
+            triton::backend::rockchip::Nc1hwc2ToNchw(
+                layouts[i], output_mems[i]->virt_addr, converted[i].data());
+          }
+        }
+      } else {
+        run_ok &= (rknn_outputs_get(
+                       ctx, io_num.n_output, outputs.data(), NULL) >= 0);
+        for (size_t j = 0; run_ok && (j < jobs.size()); ++j) {
+          jobs[j].src_ = outputs[job_outputs[j]].buf;
+        }
+        if (run_ok) {
+          triton::backend::rockchip::DequantizeAll(jobs, &workers);
+        }
+      }
+      const uint64_t end_us = NowUs();
+      if (!native_outputs) {
+        rknn_outputs_release(ctx, io_num.n_output, outputs.data());
+      }
+      if (!run_ok) {
+        std::cerr << "inference failed on " << model_path << std::endl;
+        break;
+      }
+      if (it >= 0) {
+        run->latencies_.push_back(end_us - start_us);
+        run->run_total_us_ += run_end_us - run_start_us;
+      }
+    }
+    if (!run_ok) {
+      break;
+    }
+
+    rknn_query(
+        ctx, RKNN_QUERY_MEM_SIZE, &run->mem_size_, sizeof(run->mem_size_));
+    run->batch_ = (input_attrs[0].n_dims > 0) ? input_attrs[0].dims[0] : 1;
+    run->ok_ = !run->latencies_.empty();
+  } while (false);
+
+  for (auto mem : output_mems) {
+    rknn_destroy_mem(ctx, mem);
+  }
+
+  rknn_destroy(ctx);
+}
+
+bool
+BenchOne(
+    const BenchOptions& options, const std::string& model_path,
+    const std::string& core_mask_name, const std::string& input_path,
+    const std::string& output_path, BenchResult* result)
+{
+  rknn_core_mask core_mask;
+  if (!CoreMaskFromName(core_mask_name, &core_mask)) {
+    std::cerr << "unknown core mask " << core_mask_name << std::endl;
+    return false;
+  }
+  if ((input_path != "convert") && (input_path != "pass_through")) {
+    std::cerr << "unknown input path " << input_path << std::endl;
+    return false;
+  }
+  OutputPath path;
+  if (!OutputPathFromName(output_path, &path)) {
+    std::cerr << "unknown output path " << output_path << std::endl;
+    return false;
+  }
+  OutputActivation activation;
+  if (!triton::backend::rockchip::ParseOutputActivation(
+          options.output_activation_, &activation)) {
+    std::cerr << "unknown activation " << options.output_activation_
+              << std::endl;
+    return false;
+  }
+
+  // One context per would-be Triton instance, all running concurrently.
+  std::vector<ContextRun> runs(options.contexts_);
+  std::vector<std::thread> threads;
+  const uint64_t bench_start_us = NowUs();
+  for (auto& run : runs) {
+    threads.emplace_back(
+        RunContext, std::cref(options), std::cref(model_path),
+        std::cref(core_mask_name), core_mask, input_path == "pass_through",
+        path, activation, &run);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const uint64_t bench_end_us = NowUs();
+
+  std::vector<double> latencies;
+  double run_total_us = 0;
+  for (const auto& run : runs) {
+    if (!run.ok_) {
+      return false;
+    }
+    latencies.insert(
+        latencies.end(), run.latencies_.begin(), run.latencies_.end());
+    run_total_us += run.run_total_us_;
+  }
+
+  double total_us = 0;
+  for (const double latency : latencies) {
+    total_us += latency;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  result->model_ = model_path;
+  result->core_mask_ = core_mask_name;
+  result->input_path_ = input_path;
+  result->output_path_ = output_path;
+  result->contexts_ = options.contexts_;
+  result->batch_ = runs[0].batch_;
+  result->iterations_ = latencies.size();
+  result->mean_us_ = total_us / latencies.size();
+  result->p50_us_ = Percentile(latencies, 0.50);
+  result->p99_us_ = Percentile(latencies, 0.99);
+  result->min_us_ = latencies.front();
+  result->max_us_ = latencies.back();
+  result->run_mean_us_ = run_total_us / latencies.size();
+  // Wall time includes the warmup iterations and rknn_init, scale the
+  // warmup out and accept the init as noise.
+  const double wall_us = (double)(bench_end_us - bench_start_us) *
+                         options.iterations_ /
+                         (options.iterations_ + options.warmup_);
+  result->throughput_fps_ =
+      (wall_us > 0) ? 1e6 * result->batch_ * latencies.size() / wall_us : 0;
+  for (const auto& run : runs) {
+    result->weight_bytes_ += run.mem_size_.total_weight_size;
+    result->internal_bytes_ += run.mem_size_.total_internal_size;
+  }
+  result->rss_bytes_ = ResidentBytes();
+  return true;
+}
+
+}  // namespace
+
+bool
+RunBench(const BenchOptions& options, std::vector<BenchResult>* results)
+{
+  std::vector<std::string> core_masks = options.core_masks_;
+  if (core_masks.empty()) {
+#if defined(__aarch64__)
+    // rk3588, sweep the single cores and the multi-core combinations.
+    for (const auto& entry : kCoreMasks) {
+      core_masks.push_back(entry.name_);
+    }
+#else
+    core_masks.push_back("auto");
+#endif
+  }
+
+  std::vector<std::string> input_paths = options.input_paths_;
+  if (input_paths.empty()) {
+    input_paths.push_back("convert");
+  }
+  std::vector<std::string> output_paths = options.output_paths_;
+  if (output_paths.empty()) {
+    output_paths.push_back("get");
+  }
+
+  for (const auto& model : options.models_) {
+    for (const auto& core_mask : core_masks) {
+      for (const auto& input_path : input_paths) {
+        for (const auto& output_path : output_paths) {
+          BenchResult result;
+          if (BenchOne(
+                  options, model, core_mask, input_path, output_path,
+                  &result)) {
+            results->push_back(result);
+          }
+        }
+      }
+    }
+  }
+  return !results->empty();
+}
+
+std::string
+FormatBench(const std::vector<BenchResult>& results, const OutputFormat format)
+{
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1);
+  switch (format) {
+    case OutputFormat::TABLE:
+      oss << std::left << std::setw(24) << "model" << std::right
+          << std::setw(7) << "mask" << std::setw(13) << "input"
+          << std::setw(8) << "output" << std::setw(5) << "ctx" << std::setw(6)
+          << "batch"
+          << std::setw(10) << "mean(us)" << std::setw(10) << "p50(us)"
+          << std::setw(10) << "p99(us)" << std::setw(10) << "run(us)"
+          << std::setw(10) << "fps" << std::setw(10) << "mem(MiB)"
+          << std::setw(10) << "rss(MiB)" << "\n";
+      for (const auto& r : results) {
+        std::string model = r.model_;
+        if (model.size() > 23) {
+          model = "..." + model.substr(model.size() - 20);
+        }
+        oss << std::left << std::setw(24) << model << std::right
+            << std::setw(7) << r.core_mask_ << std::setw(13)
+            << r.input_path_ << std::setw(8) << r.output_path_
+            << std::setw(5) << r.contexts_
+            << std::setw(6) << r.batch_
+            << std::setw(10) << r.mean_us_ << std::setw(10) << r.p50_us_
+            << std::setw(10) << r.p99_us_ << std::setw(10) << r.run_mean_us_
+            << std::setw(10) << r.throughput_fps_ << std::setw(10)
+            << (r.weight_bytes_ + r.internal_bytes_) / (1024.0 * 1024.0)
+            << std::setw(10) << r.rss_bytes_ / (1024.0 * 1024.0) << "\n";
+      }
+      break;
+    case OutputFormat::CSV:
+      oss << "model,core_mask,input_path,output_path,contexts,batch,"
+             "iterations,mean_us,p50_us,p99_us,min_us,max_us,run_mean_us,throughput_fps,"
+             "weight_bytes,internal_bytes,rss_bytes\n";
+      for (const auto& r : results) {
+        oss << r.model_ << "," << r.core_mask_ << "," << r.input_path_
+            << "," << r.output_path_ << "," << r.contexts_ << ","
+            << r.batch_ << ","
+            << r.iterations_ << "," << r.mean_us_ << "," << r.p50_us_ << ","
+            << r.p99_us_ << "," << r.min_us_ << "," << r.max_us_ << ","
+            << r.run_mean_us_ << "," << r.throughput_fps_ << ","
+            << r.weight_bytes_ << "," << r.internal_bytes_ << ","
+            << r.rss_bytes_ << "\n";
+      }
+      break;
+    case OutputFormat::JSON:
+      for (const auto& r : results) {
+        oss << "{\"model\":\"" << r.model_ << "\",\"core_mask\":\""
+            << r.core_mask_ << "\",\"input_path\":\"" << r.input_path_
+            << "\",\"output_path\":\"" << r.output_path_
+            << "\",\"contexts\":" << r.contexts_
+            << ",\"batch\":" << r.batch_
+            << ",\"iterations\":" << r.iterations_
+            << ",\"mean_us\":" << r.mean_us_ << ",\"p50_us\":" << r.p50_us_
+            << ",\"p99_us\":" << r.p99_us_ << ",\"min_us\":" << r.min_us_
+            << ",\"max_us\":" << r.max_us_
+            << ",\"run_mean_us\":" << r.run_mean_us_
+            << ",\"throughput_fps\":" << r.throughput_fps_
+            << ",\"weight_bytes\":" << r.weight_bytes_
+            << ",\"internal_bytes\":" << r.internal_bytes_
+            << ",\"rss_bytes\":" << r.rss_bytes_ << "}\n";
+      }
+      break;
+  }
+  return oss.str();
+}
+
+int
+BenchMain(int argc, char* argv[])
+{
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if ((arg[0] != '-') || (arg.size() == 1)) {
+      options.models_.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "missing value for " << arg << std::endl;
+      return 1;
+    }
+    const std::string value(argv[++i]);
+    if (arg == "-n") {
+      options.iterations_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "-w") {
+      options.warmup_ = std::max(0, std::atoi(value.c_str()));
+    } else if (arg == "-j") {
+      options.contexts_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "-i") {
+      options.input_files_.push_back(value);
+    } else if (arg == "-c") {
+      std::stringstream ss(value);
+      std::string mask;
+      while (std::getline(ss, mask, ',')) {
+        options.core_masks_.push_back(mask);
+      }
+    } else if (arg == "-p") {
+      std::stringstream ss(value);
+      std::string path;
+      while (std::getline(ss, path, ',')) {
+        options.input_paths_.push_back(path);
+      }
+    } else if (arg == "-o") {
+      std::stringstream ss(value);
+      std::string path;
+      while (std::getline(ss, path, ',')) {
+        options.output_paths_.push_back(path);
+      }
+    } else if (arg == "-a") {
+      options.output_activation_ = value;
+    } else if (arg == "-f") {
+      if (value == "table") {
+        options.format_ = OutputFormat::TABLE;
+      } else if (value == "csv") {
+        options.format_ = OutputFormat::CSV;
+      } else if (value == "json") {
+        options.format_ = OutputFormat::JSON;
+      } else {
+        std::cerr << "unknown format " << value << std::endl;
+        return 1;
+      }
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  if (options.models_.empty()) {
+    std::cerr
+        << "usage: rk_stat bench [options] model.rknn [model_b4.rknn ...]\n"
+        << "  -n <iterations>    timed iterations (default 200)\n"
+        << "  -w <iterations>    warmup iterations (default 20)\n"
+        << "  -j <contexts>      concurrent contexts, i.e. instance count\n"
+        << "                     (default 1)\n"
+        << "  -i <file>          raw input tensor, repeat per model input\n"
+        << "                     (default random data)\n"
+        << "  -c <masks>         core masks, e.g. auto,0,0_1,0_1_2\n"
+        << "                     (default all)\n"
+        << "  -p <paths>         input paths, convert,pass_through\n"
+        << "                     (default convert)\n"
+        << "  -o <paths>         output paths, get,native,float,dequant\n"
+        << "                     (default get)\n"
+        << "  -a <activation>    activation fused in the dequant path,\n"
+        << "                     none,sigmoid,exp (default none)\n"
+        << "  -f table|csv|json  output format (default table)\n";
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  if (!RunBench(options, &results)) {
+    return 1;
+  }
+  std::cout << FormatBench(results, options.format_) << std::flush;
+  return 0;
+}
+
+void
+RunConvertBench(
+    const ConvertBenchOptions& options, std::vector<ConvertResult>* results)
+{
+  ConvertShape shape;
+  shape.n_ = options.batch_;
+  shape.c_ = options.channels_;
+  shape.h_ = options.height_;
+  shape.w_ = options.width_;
+  std::mt19937 rng(0);
+  for (const InputConversion& conversion :
+       triton::backend::rockchip::InputConversions()) {
+    const size_t src_bytes =
+        shape.Elements() *
+        triton::backend::rockchip::ElementSize(conversion.src_);
+    std::vector<uint8_t> src(src_bytes);
+    std::vector<uint8_t> dst(
+        shape.Elements() *
+        triton::backend::rockchip::RknnElementSize(conversion.dst_));
+    // Small values, random bits would also be NaN and denormals.
+    std::uniform_int_distribution<int> byte(0, 63);
+    for (auto& b : src) {
+      b = (uint8_t)byte(rng);
+    }
+
+    for (int i = 0; i < options.warmup_; ++i) {
+      conversion.convert_(src.data(), dst.data(), shape);
+    }
+    std::vector<double> latencies;
+    latencies.reserve(options.iterations_);
+    for (int i = 0; i < options.iterations_; ++i) {
+      const uint64_t start = NowUs();
+      conversion.convert_(src.data(), dst.data(), shape);
+      latencies.push_back(NowUs() - start);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    ConvertResult result;
+    result.src_ = triton::backend::rockchip::ElementTypeName(conversion.src_);
+    result.dst_ = get_type_string(conversion.dst_);
+    result.layout_ = (conversion.layout_ == InputLayout::NCHW_TO_NHWC)
+                         ? "nchw_to_nhwc"
+                         : "same";
+    result.iterations_ = options.iterations_;
+    double total = 0;
+    for (const double latency : latencies) {
+      total += latency;
+    }
+    result.mean_us_ = latencies.empty() ? 0 : total / latencies.size();
+    result.p50_us_ = Percentile(latencies, 0.50);
+    result.p99_us_ = Percentile(latencies, 0.99);
+    result.min_us_ = latencies.empty() ? 0 : latencies.front();
+    if (result.mean_us_ > 0) {
+      result.src_mbps_ =
+          src_bytes / (1024.0 * 1024.0) / (result.mean_us_ / 1e6);
+    }
+    results->push_back(result);
+  }
+}
+
+std::string
+FormatConvertBench(
+    const std::vector<ConvertResult>& results, const OutputFormat format)
+{
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1);
+  switch (format) {
+    case OutputFormat::TABLE:
+      oss << std::left << std::setw(8) << "src" << std::setw(8) << "dst"
+          << std::setw(14) << "layout" << std::right << std::setw(10)
+          << "mean(us)" << std::setw(10) << "p50(us)" << std::setw(10)
+          << "p99(us)" << std::setw(10) << "min(us)" << std::setw(10)
+          << "MiB/s" << "\n";
+      for (const auto& r : results) {
+        oss << std::left << std::setw(8) << r.src_ << std::setw(8) << r.dst_
+            << std::setw(14) << r.layout_ << std::right << std::setw(10)
+            << r.mean_us_ << std::setw(10) << r.p50_us_ << std::setw(10)
+            << r.p99_us_ << std::setw(10) << r.min_us_ << std::setw(10)
+            << r.src_mbps_ << "\n";
+      }
+      break;
+    case OutputFormat::CSV:
+      oss << "src,dst,layout,iterations,mean_us,p50_us,p99_us,min_us,"
+             "src_mbps\n";
+      for (const auto& r : results) {
+        oss << r.src_ << "," << r.dst_ << "," << r.layout_ << ","
+            << r.iterations_ << "," << r.mean_us_ << "," << r.p50_us_ << ","
+            << r.p99_us_ << "," << r.min_us_ << "," << r.src_mbps_ << "\n";
+      }
+      break;
+    case OutputFormat::JSON:
+      for (const auto& r : results) {
+        oss << "{\"src\":\"" << r.src_ << "\",\"dst\":\"" << r.dst_
+            << "\",\"layout\":\"" << r.layout_
+            << "\",\"iterations\":" << r.iterations_
+            << ",\"mean_us\":" << r.mean_us_ << ",\"p50_us\":" << r.p50_us_
+            << ",\"p99_us\":" << r.p99_us_ << ",\"min_us\":" << r.min_us_
+            << ",\"src_mbps\":" << r.src_mbps_ << "}\n";
+      }
+      break;
+  }
+  return oss.str();
+}
+
+int
+ConvertBenchMain(int argc, char* argv[])
+{
+  ConvertBenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if ((arg == "-h") || (arg == "--help")) {
+      std::cerr
+          << "usage: rk_stat convert [options]\n"
+          << "  -n <iterations>    timed iterations (default 200)\n"
+          << "  -w <iterations>    warmup iterations (default 20)\n"
+          << "  -b <frames>        frames per call (default 1)\n"
+          << "  -s <c>x<h>x<w>     frame shape (default 3x384x640)\n"
+          << "  -f table|csv|json  output format (default table)\n";
+      return 1;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "missing value for " << arg << std::endl;
+      return 1;
+    }
+    const std::string value(argv[++i]);
+    if (arg == "-n") {
+      options.iterations_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "-w") {
+      options.warmup_ = std::max(0, std::atoi(value.c_str()));
+    } else if (arg == "-b") {
+      options.batch_ = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "-s") {
+      unsigned c = 0, h = 0, w = 0;
+      if ((sscanf(value.c_str(), "%ux%ux%u", &c, &h, &w) != 3) ||
+          (c == 0) || (h == 0) || (w == 0)) {
+        std::cerr << "frame shape must be <c>x<h>x<w>, got " << value
+                  << std::endl;
+        return 1;
+      }
+      options.channels_ = c;
+      options.height_ = h;
+      options.width_ = w;
+    } else if (arg == "-f") {
+      if (value == "table") {
+        options.format_ = OutputFormat::TABLE;
+      } else if (value == "csv") {
+        options.format_ = OutputFormat::CSV;
+      } else if (value == "json") {
+        options.format_ = OutputFormat::JSON;
+      } else {
+        std::cerr << "unknown format " << value << std::endl;
+        return 1;
+      }
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<ConvertResult> results;
+  RunConvertBench(options, &results);
+  std::cout << FormatConvertBench(results, options.format_) << std::flush;
+  return 0;
+}
+
+
+}  // namespace rk_stat
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "npu_stat.h"
+
+namespace rk_stat {
+
+struct BenchOptions {
+  BenchOptions()
+      : output_activation_("none"), iterations_(200), warmup_(20),
+        contexts_(1), format_(OutputFormat::TABLE)
+  {
+  }
+
+  // One model per batch size to compare, the batch size is read from
+  // the first dimension of the model input.
+  std::vector<std::string> models_;
+  // Raw input tensors, one per model input in index order. Random data
+  // is used when empty.
+  std::vector<std::string> input_files_;
+  // Core masks to sweep: "auto", "0", "1", "2", "0_1", "0_1_2".
+  std::vector<std::string> core_masks_;
+  // Input paths to sweep: "convert" sets the inputs in the layout of
+  // RKNN_QUERY_INPUT_ATTR and lets the driver convert them,
+  // "pass_through" sets them in the native layout with pass_through=1.
+  std::vector<std::string> input_paths_;
+  // Output paths to sweep: "get" converts every output to its regular
+  // layout in rknn_outputs_get, "native" binds the outputs in NC1HWC2
+  // and converts them on the CPU like the backend "native_output".
+  // "float" lets rknn_outputs_get dequantize with want_float=1,
+  // "dequant" fetches the quantized outputs and dequantizes them to
+  // FP32 on the CPU like the backend does for outputs declared float.
+  std::vector<std::string> output_paths_;
+  // Activation fused in the "dequant" path: none, sigmoid or exp.
+  std::string output_activation_;
+  // Iterations per context.
+  int iterations_;
+  int warmup_;
+  // Contexts running concurrently, the equivalent of the instance_group
+  // count of the Triton model.
+  int contexts_;
+  OutputFormat format_;
+};
+
+struct BenchResult {
+  BenchResult()
+      : contexts_(1), batch_(1), iterations_(0), mean_us_(0), p50_us_(0),
+        p99_us_(0), min_us_(0), max_us_(0), run_mean_us_(0),
+        throughput_fps_(0), weight_bytes_(0), internal_bytes_(0),
+        rss_bytes_(0)
+  {
+  }
+
+  std::string model_;
+  std::string core_mask_;
+  std::string input_path_;
+  std::string output_path_;
+  int contexts_;
+  uint32_t batch_;
+  int iterations_;
+  // End to end latency of inputs_set + run + outputs_get.
+  double mean_us_;
+  double p50_us_;
+  double p99_us_;
+  double min_us_;
+  double max_us_;
+  // Latency of rknn_run alone.
+  double run_mean_us_;
+  // Frames (batch elements) per second.
+  double throughput_fps_;
+  uint64_t weight_bytes_;
+  uint64_t internal_bytes_;
+  uint64_t rss_bytes_;
+};
+
+// Run every model of 'options' under every core mask with 'contexts_'
+// contexts running in parallel. Errors are reported on stderr, returns
+// false if no configuration could run.
+bool RunBench(const BenchOptions& options, std::vector<BenchResult>* results);
+
+std::string FormatBench(
+    const std::vector<BenchResult>& results, const OutputFormat format);
+
+// Entry point of "rk_stat bench", argv[0] is "bench".
+int BenchMain(int argc, char* argv[]);
+
+struct ConvertBenchOptions {
+  ConvertBenchOptions()
+      : batch_(1), channels_(3), height_(384), width_(640),
+        iterations_(200), warmup_(20), format_(OutputFormat::TABLE)
+  {
+  }
+
+  // Frames of 'channels_' x 'height_' x 'width_' converted per call.
+  uint32_t batch_;
+  uint32_t channels_;
+  uint32_t height_;
+  uint32_t width_;
+  int iterations_;
+  int warmup_;
+  OutputFormat format_;
+};
+
+struct ConvertResult {
+  ConvertResult()
+      : iterations_(0), mean_us_(0), p50_us_(0), p99_us_(0), min_us_(0),
+        src_mbps_(0)
+  {
+  }
+
+  // Client type, RKNN type and layout of the kernel.
+  std::string src_;
+  std::string dst_;
+  std::string layout_;
+  int iterations_;
+  double mean_us_;
+  double p50_us_;
+  double p99_us_;
+  double min_us_;
+  // Client data converted per second, in MiB.
+  double src_mbps_;
+};
+
+// Time every input conversion kernel of the backend on random frames.
+void RunConvertBench(
+    const ConvertBenchOptions& options, std::vector<ConvertResult>* results);
+
+std::string FormatConvertBench(
+    const std::vector<ConvertResult>& results, const OutputFormat format);
+
+// Entry point of "rk_stat convert", argv[0] is "convert".
+int ConvertBenchMain(int argc, char* argv[]);
+
+}  // namespace rk_stat
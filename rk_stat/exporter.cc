@@ -0,0 +1,378 @@
+#include "exporter.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace rk_stat {
+
+namespace {
+
+std::string
+LabelEscape(const std::string& str)
+{
+  std::string escaped;
+  for (const char c : str) {
+    if ((c == '\\') || (c == '"')) {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+void
+Describe(
+    std::ostringstream& oss, const char* name, const char* type,
+    const char* help)
+{
+  oss << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " " << type << "\n";
+}
+
+void
+Gauge(
+    std::ostringstream& oss, const char* name, const char* help,
+    const int64_t value)
+{
+  if (value < 0) {
+    return;
+  }
+  Describe(oss, name, "gauge", help);
+  oss << name << " " << value << "\n";
+}
+
+bool
+SendAll(const int fd, const std::string& data)
+{
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t len =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += len;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string
+FormatPrometheus(
+    const NpuSample& sample, const uint64_t sample_count,
+    const uint64_t error_count)
+{
+  std::ostringstream oss;
+  if (!sample.core_load_.empty()) {
+    Describe(
+        oss, "rknpu_core_utilization_percent", "gauge",
+        "Load of each NPU core in percent.");
+    for (size_t i = 0; i < sample.core_load_.size(); ++i) {
+      oss << "rknpu_core_utilization_percent{core=\"" << i << "\"} "
+          << sample.core_load_[i] << "\n";
+    }
+  }
+  Gauge(
+      oss, "rknpu_frequency_hz", "Current NPU frequency in Hz.",
+      sample.cur_freq_hz_);
+  Gauge(
+      oss, "rknpu_frequency_max_hz", "Maximum NPU frequency in Hz.",
+      sample.max_freq_hz_);
+  Gauge(
+      oss, "rknpu_frequency_min_hz", "Minimum NPU frequency in Hz.",
+      sample.min_freq_hz_);
+  if (sample.temperature_mc_ >= 0) {
+    Describe(
+        oss, "rknpu_temperature_celsius", "gauge",
+        "NPU temperature in degree Celsius.");
+    oss << "rknpu_temperature_celsius " << sample.temperature_mc_ / 1000
+        << "." << (sample.temperature_mc_ % 1000) / 100 << "\n";
+  }
+  Gauge(
+      oss, "rknpu_memory_total_bytes", "NPU memory managed by the driver.",
+      sample.mem_total_bytes_);
+  Gauge(
+      oss, "rknpu_memory_used_bytes", "NPU memory in use.",
+      sample.mem_used_bytes_);
+  if (!sample.driver_version_.empty() || !sample.governor_.empty()) {
+    Describe(
+        oss, "rknpu_info", "gauge",
+        "Driver version and devfreq governor of the NPU.");
+    // "RKNPU driver: v0.8.2" -> "v0.8.2"
+    std::string version = sample.driver_version_;
+    const size_t colon = version.rfind(": ");
+    if (colon != std::string::npos) {
+      version = version.substr(colon + 2);
+    }
+    oss << "rknpu_info{driver_version=\"" << LabelEscape(version)
+        << "\",governor=\""
+        << LabelEscape(sample.governor_) << "\"} 1\n";
+  }
+  if (sample.timestamp_ms_ > 0) {
+    Describe(
+        oss, "rknpu_exporter_last_sample_seconds", "gauge",
+        "Wall clock time of the last sample.");
+    oss << "rknpu_exporter_last_sample_seconds "
+        << sample.timestamp_ms_ / 1000 << "." << std::setfill('0')
+        << std::setw(3) << sample.timestamp_ms_ % 1000 << "\n";
+  }
+  Describe(
+      oss, "rknpu_exporter_samples_total", "counter",
+      "Samples taken by the exporter.");
+  oss << "rknpu_exporter_samples_total " << sample_count << "\n";
+  Describe(
+      oss, "rknpu_exporter_sample_errors_total", "counter",
+      "Samples that could not read any NPU node.");
+  oss << "rknpu_exporter_sample_errors_total " << error_count << "\n";
+  return oss.str();
+}
+
+Exporter::Exporter(const ExporterOptions& options)
+    : options_(options), sampler_(options.paths_), exiting_(false),
+      page_(new std::string())
+{
+}
+
+Exporter::~Exporter()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+  if (sample_thread_.joinable()) {
+    sample_thread_.join();
+  }
+}
+
+std::shared_ptr<const std::string>
+Exporter::Page()
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  return page_;
+}
+
+void
+Exporter::SampleLoop()
+{
+  uint64_t sample_count = 0;
+  uint64_t error_count = 0;
+  auto next = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!exiting_) {
+    lk.unlock();
+    NpuSample sample;
+    sample_count++;
+    if (!sampler_.Sample(&sample)) {
+      error_count++;
+      sample = NpuSample();
+    }
+    // Render once per sample, the scrapes share the result.
+    std::shared_ptr<const std::string> page(
+        new std::string(FormatPrometheus(sample, sample_count, error_count)));
+    if (!options_.textfile_path_.empty()) {
+      WriteTextfile(*page);
+    }
+    lk.lock();
+    page_ = page;
+
+    // Absolute deadline so the period does not drift with the sampling
+    // cost.
+    next += std::chrono::milliseconds(options_.interval_ms_);
+    while (!exiting_ &&
+           (cv_.wait_until(lk, next) != std::cv_status::timeout)) {
+    }
+  }
+}
+
+bool
+Exporter::WriteTextfile(const std::string& page)
+{
+  // The textfile collector may read at any time, write to a temporary
+  // file in the same directory and rename it over the target.
+  const std::string tmp_path = options_.textfile_path_ + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    if (!file) {
+      std::cerr << "cannot write " << tmp_path << std::endl;
+      return false;
+    }
+    file << page;
+    if (!file.flush()) {
+      std::cerr << "cannot write " << tmp_path << std::endl;
+      return false;
+    }
+  }
+  if (std::rename(tmp_path.c_str(), options_.textfile_path_.c_str()) != 0) {
+    std::cerr << "cannot rename " << tmp_path << " to "
+              << options_.textfile_path_ << ": " << std::strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void
+Exporter::HandleConnection(const int fd)
+{
+  // A slow or silent client must not stall the accept loop.
+  struct timeval timeout;
+  timeout.tv_sec = 1;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  std::string request;
+  char buf[1024];
+  while ((request.find("\r\n\r\n") == std::string::npos) &&
+         (request.size() < 8192)) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      break;
+    }
+    request.append(buf, len);
+  }
+
+  std::string method, target;
+  std::istringstream line(request.substr(0, request.find("\r\n")));
+  line >> method >> target;
+  const size_t query = target.find('?');
+  if (query != std::string::npos) {
+    target.resize(query);
+  }
+
+  std::string status = "200 OK";
+  std::string content_type = "text/plain; version=0.0.4; charset=utf-8";
+  std::shared_ptr<const std::string> page;
+  std::string body;
+  if ((method != "GET") && (method != "HEAD")) {
+    status = "405 Method Not Allowed";
+    body = "method not allowed\n";
+  } else if (target == "/metrics") {
+    page = Page();
+  } else if (target == "/") {
+    content_type = "text/html; charset=utf-8";
+    body =
+        "<html><head><title>rk_stat exporter</title></head><body>"
+        "<a href=\"/metrics\">Metrics</a></body></html>\n";
+  } else {
+    status = "404 Not Found";
+    body = "not found\n";
+  }
+  const std::string& content = page ? *page : body;
+
+  std::ostringstream header;
+  header << "HTTP/1.1 " << status << "\r\n"
+         << "Content-Type: " << content_type << "\r\n"
+         << "Content-Length: " << content.size() << "\r\n"
+         << "Connection: close\r\n\r\n";
+  if (SendAll(fd, header.str()) && (method != "HEAD")) {
+    SendAll(fd, content);
+  }
+}
+
+int
+Exporter::ServeHttp(const volatile std::sig_atomic_t& stop)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options_.port_);
+  if (inet_pton(AF_INET, options_.listen_address_.c_str(), &addr.sin_addr) !=
+      1) {
+    std::cerr << "invalid listen address " << options_.listen_address_
+              << std::endl;
+    return 1;
+  }
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    std::cerr << "socket: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if ((bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+      (listen(listen_fd, 16) < 0)) {
+    std::cerr << "cannot listen on " << options_.listen_address_ << ":"
+              << options_.port_ << ": " << std::strerror(errno) << std::endl;
+    close(listen_fd);
+    return 1;
+  }
+  std::cerr << "rk_stat exporter listening on http://"
+            << options_.listen_address_ << ":" << options_.port_
+            << "/metrics" << std::endl;
+
+  // Scrapes are a copy of the cached page, serving them one at a time
+  // from this thread is enough.
+  struct pollfd pfd;
+  pfd.fd = listen_fd;
+  pfd.events = POLLIN;
+  while (!stop) {
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, 200);
+    if (ret <= 0) {
+      continue;
+    }
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    HandleConnection(fd);
+    close(fd);
+  }
+  close(listen_fd);
+  return 0;
+}
+
+int
+Exporter::Run(const volatile std::sig_atomic_t& stop)
+{
+  if (!sampler_.Missing().empty()) {
+    std::cerr << "rk_stat cannot open:\n" << sampler_.Missing();
+  }
+  sample_thread_ = std::thread(&Exporter::SampleLoop, this);
+
+  int ret = 0;
+  if (options_.textfile_path_.empty()) {
+    ret = ServeHttp(stop);
+  } else {
+    while (!stop) {
+      usleep(200 * 1000);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+  sample_thread_.join();
+  return ret;
+}
+
+}  // namespace rk_stat
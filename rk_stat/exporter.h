@@ -0,0 +1,76 @@
+#pragma once
+
+#include <csignal>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "npu_stat.h"
+
+namespace rk_stat {
+
+struct ExporterOptions {
+  ExporterOptions()
+      : interval_ms_(1000), listen_address_("127.0.0.1"), port_(9102)
+  {
+  }
+
+  NpuPaths paths_;
+  // Sampling period of the background thread.
+  long interval_ms_;
+  // HTTP endpoint serving /metrics. Not used when 'textfile_path_' is set.
+  std::string listen_address_;
+  int port_;
+  // When set, the metrics are written to this file after every sample
+  // for the node_exporter textfile collector instead of being served.
+  std::string textfile_path_;
+};
+
+// Render a sample in the Prometheus text exposition format (0.0.4).
+// Metrics whose node is missing are left out.
+std::string FormatPrometheus(
+    const NpuSample& sample, const uint64_t sample_count,
+    const uint64_t error_count);
+
+//
+// Exporter
+//
+// Daemon mode of rk_stat. A background thread samples the NPU every
+// 'interval_ms_' and renders the metrics page once; a scrape only
+// copies a shared pointer to the last rendered page under a mutex, so
+// its cost does not depend on the sysfs nodes and any number of
+// Prometheus servers can scrape without adding load to the board.
+//
+class Exporter {
+ public:
+  explicit Exporter(const ExporterOptions& options);
+  ~Exporter();
+
+  // Serve (or write) metrics until 'stop' becomes non-zero. Returns the
+  // process exit code.
+  int Run(const volatile std::sig_atomic_t& stop);
+
+ private:
+  Exporter(const Exporter&) = delete;
+  Exporter& operator=(const Exporter&) = delete;
+
+  void SampleLoop();
+  bool WriteTextfile(const std::string& page);
+  int ServeHttp(const volatile std::sig_atomic_t& stop);
+  void HandleConnection(const int fd);
+  std::shared_ptr<const std::string> Page();
+
+  const ExporterOptions options_;
+  NpuSampler sampler_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool exiting_;
+  std::shared_ptr<const std::string> page_;
+  std::thread sample_thread_;
+};
+
+}  // namespace rk_stat
@@ -1,4 +1,6 @@
+#ifdef RK_STAT_WITH_RKNN
 #include <rknn_api.h>
+#endif
 #include <iostream>
 #ifdef _WIN32
 // suppress the min and max definitions in Windef.h.
@@ -18,6 +20,15 @@
 #include <string>
 #include <vector>
 #include <exception>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include "exporter.h"
+#include "npu_stat.h"
+#ifdef RK_STAT_WITH_RKNN
+#include "bench.h"
+#endif
 
 #define TRITON_ENABLE_LOGGING
 namespace triton { namespace common {
@@ -351,29 +362,83 @@ const char *getBuild() { //Get current architecture, detectx nearly every archit
         return "UNKNOWN";
         #endif
     }
-int main(int argc,char* argv[]){
-    rknn_context ctx;
-    rknn_sdk_version version;
-    rknn_mem_size mem_size;
-    std::string deviceArch(getBuild());
-    if(deviceArch.compare("ARM64")){ // rk3588
-      
+namespace {
 
-    }else{  //rv1126
+volatile std::sig_atomic_t gStop = 0;
 
-    }
+void
+HandleSignal(int)
+{
+  gStop = 1;
+}
+
+void
+Usage(const char* prog)
+{
+  std::cerr
+      << "usage: " << prog << " [options]            monitor the NPU\n"
+      << "       " << prog << " info [model.rknn]     print model memory size\n"
+      << "       " << prog << " bench model.rknn ...  latency per core mask and batch size\n"
+      << "       " << prog << " convert [options]    latency of the input conversion kernels\n"
+      << "       " << prog << " exporter [options]   serve Prometheus metrics\n"
+      << "options:\n"
+      << "  -l <ms>              refresh every <ms> milliseconds\n"
+      << "  -n <count>           stop after <count> samples\n"
+      << "  -f table|csv|json    output format (default table)\n"
+      << "  -r <dir>             prefix every sysfs/debugfs path with <dir>\n"
+      << "  --load <path>        NPU load node\n"
+      << "  --devfreq <dir>      NPU devfreq directory\n"
+      << "  --mm <path>          NPU memory node\n"
+      << "  --version <path>     NPU driver version node\n"
+      << "  --thermal <dir>      thermal class directory\n"
+      << "  --thermal-type <t>   thermal zone type of the NPU\n"
+      << "exporter options (and -l, -r, --load ...):\n"
+      << "  -a <address>         listen address (default 127.0.0.1)\n"
+      << "  -p <port>            listen port (default 9102)\n"
+      << "  -t <file>            write node_exporter textfile <file>\n"
+      << "                       instead of serving HTTP\n";
+}
+
+// Options selecting the sysfs/debugfs nodes, shared by the monitor and
+// the exporter. Returns false if 'arg' is not one of them.
+bool
+ParsePathOption(
+    const std::string& arg, const std::string& value, rk_stat::NpuPaths* paths)
+{
+  if (arg == "-r") {
+    paths->root_ = value;
+  } else if (arg == "--load") {
+    paths->load_ = value;
+  } else if (arg == "--devfreq") {
+    paths->devfreq_ = value;
+  } else if (arg == "--mm") {
+    paths->mm_ = value;
+  } else if (arg == "--version") {
+    paths->version_ = value;
+  } else if (arg == "--thermal") {
+    paths->thermal_ = value;
+  } else if (arg == "--thermal-type") {
+    paths->thermal_type_ = value;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int
+ModelInfo(const std::string& modelPath)
+{
+#ifdef RK_STAT_WITH_RKNN
+    rknn_context ctx;
+    rknn_mem_size mem_size;
     try
     {
-        std::string modelPath;
-        if(argc >1){
-            modelPath=std::move(argv[1]);
-        }else
-            modelPath=std::move("model.rknn");
         int ret =-1;
         ret= rknn_init(&ctx, (void*)modelPath.c_str(), 0, 0 , NULL); 
         if(ret<0)
            throw std::exception();
         ret = rknn_query(ctx, RKNN_QUERY_MEM_SIZE, &mem_size, sizeof(mem_size));
+        rknn_destroy(ctx);
         if(ret<0)
            throw std::exception();
         LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("rk_stat model :")+modelPath+
@@ -384,9 +449,188 @@ int main(int argc,char* argv[]){
     catch(const std::exception& e)
     {
         LOG_MESSAGE(TRITONSERVER_LOG_ERROR,(std::string("rknn_init or rknn_query error!")).c_str());
+        return 1;
     }
     return 0;
-    
-    
+#else
+    LOG_MESSAGE(TRITONSERVER_LOG_ERROR,(std::string("rk_stat built without rknn_api, cannot load ")+modelPath).c_str());
+    return 1;
+#endif
+}
+
+bool
+EndsWith(const std::string& str, const std::string& suffix)
+{
+  return (str.size() >= suffix.size()) &&
+         (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+int
+Monitor(int argc, char* argv[])
+{
+  rk_stat::NpuPaths paths;
+  rk_stat::OutputFormat format = rk_stat::OutputFormat::TABLE;
+  long interval_ms = 0;
+  long count = -1;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if ((arg == "-h") || (arg == "--help")) {
+      Usage(argv[0]);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "missing value for " << arg << std::endl;
+      Usage(argv[0]);
+      return 1;
+    }
+    const std::string value(argv[++i]);
+    if (arg == "-l") {
+      interval_ms = std::atol(value.c_str());
+    } else if (arg == "-n") {
+      count = std::atol(value.c_str());
+    } else if (arg == "-f") {
+      if (value == "table") {
+        format = rk_stat::OutputFormat::TABLE;
+      } else if (value == "csv") {
+        format = rk_stat::OutputFormat::CSV;
+      } else if (value == "json") {
+        format = rk_stat::OutputFormat::JSON;
+      } else {
+        std::cerr << "unknown format " << value << std::endl;
+        return 1;
+      }
+    } else if (!ParsePathOption(arg, value, &paths)) {
+      std::cerr << "unknown option " << arg << std::endl;
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  // Without a refresh interval take a single sample, like nvidia-smi.
+  if ((interval_ms <= 0) && (count < 0)) {
+    count = 1;
+  }
+
+  rk_stat::NpuSampler sampler(paths);
+  if (!sampler.Missing().empty()) {
+    LOG_MESSAGE(TRITONSERVER_LOG_WARN,(std::string("rk_stat cannot open:\n")+sampler.Missing()).c_str());
+  }
+
+  std::signal(SIGINT, HandleSignal);
+  std::signal(SIGTERM, HandleSignal);
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  bool header_written = false;
+  for (long n = 0; !gStop && ((count < 0) || (n < count)); ++n) {
+    rk_stat::NpuSample sample;
+    if (!sampler.Sample(&sample)) {
+      LOG_MESSAGE(TRITONSERVER_LOG_ERROR,std::string("rk_stat: no NPU node could be read").c_str());
+      return 1;
+    }
+    switch (format) {
+      case rk_stat::OutputFormat::TABLE:
+        if (interval_ms > 0) {
+          std::cout << "\033[H\033[2J";
+        }
+        std::cout << rk_stat::FormatTable(sample);
+        break;
+      case rk_stat::OutputFormat::CSV:
+        if (!header_written) {
+          std::cout << rk_stat::FormatCsvHeader(sample.core_load_.size());
+          header_written = true;
+        }
+        std::cout << rk_stat::FormatCsv(sample);
+        break;
+      case rk_stat::OutputFormat::JSON:
+        std::cout << rk_stat::FormatJson(sample);
+        break;
+    }
+    std::cout << std::flush;
+
+    if ((interval_ms <= 0) || ((count >= 0) && (n + 1 >= count))) {
+      continue;
+    }
+    // Sleep to an absolute deadline so the sampling period does not
+    // drift with the time spent formatting.
+    next.tv_sec += interval_ms / 1000;
+    next.tv_nsec += (interval_ms % 1000) * 1000000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    while (!gStop &&
+           (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) ==
+            EINTR)) {
+    }
+  }
+  return 0;
+}
+
+int
+Export(int argc, char* argv[])
+{
+  rk_stat::ExporterOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if ((arg == "-h") || (arg == "--help")) {
+      Usage("rk_stat");
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "missing value for " << arg << std::endl;
+      Usage("rk_stat");
+      return 1;
+    }
+    const std::string value(argv[++i]);
+    if (arg == "-l") {
+      options.interval_ms_ = std::max(10L, std::atol(value.c_str()));
+    } else if (arg == "-a") {
+      options.listen_address_ = value;
+    } else if (arg == "-p") {
+      options.port_ = std::atoi(value.c_str());
+    } else if (arg == "-t") {
+      options.textfile_path_ = value;
+    } else if (!ParsePathOption(arg, value, &options.paths_)) {
+      std::cerr << "unknown option " << arg << std::endl;
+      Usage("rk_stat");
+      return 1;
+    }
+  }
+
+  std::signal(SIGINT, HandleSignal);
+  std::signal(SIGTERM, HandleSignal);
+  rk_stat::Exporter exporter(options);
+  return exporter.Run(gStop);
+}
+
+}  // namespace
 
+int main(int argc,char* argv[]){
+    if((argc>1) && (std::string(argv[1])=="info")){
+        return ModelInfo((argc>2) ? std::string(argv[2]) : std::string("model.rknn"));
+    }
+    if((argc>1) && (std::string(argv[1])=="bench")){
+#ifdef RK_STAT_WITH_RKNN
+        return rk_stat::BenchMain(argc-1,argv+1);
+#else
+        LOG_MESSAGE(TRITONSERVER_LOG_ERROR,std::string("rk_stat built without rknn_api, bench is not available").c_str());
+        return 1;
+#endif
+    }
+    if((argc>1) && (std::string(argv[1])=="convert")){
+#ifdef RK_STAT_WITH_RKNN
+        return rk_stat::ConvertBenchMain(argc-1,argv+1);
+#else
+        LOG_MESSAGE(TRITONSERVER_LOG_ERROR,std::string("rk_stat built without rknn_api, convert is not available").c_str());
+        return 1;
+#endif
+    }
+    if((argc>1) && (std::string(argv[1])=="exporter")){
+        return Export(argc-1,argv+1);
+    }
+    // Backward compatible "rk_stat model.rknn".
+    if((argc==2) && EndsWith(argv[1],".rknn")){
+        return ModelInfo(argv[1]);
+    }
+    return Monitor(argc,argv);
 }
\ No newline at end of file
@@ -0,0 +1,442 @@
+#include "npu_stat.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+namespace rk_stat {
+
+namespace {
+
+std::string
+Trim(const std::string& str)
+{
+  size_t begin = 0;
+  size_t end = str.size();
+  while ((begin < end) && std::isspace((unsigned char)str[begin])) {
+    begin++;
+  }
+  while ((end > begin) && std::isspace((unsigned char)str[end - 1])) {
+    end--;
+  }
+  return str.substr(begin, end - begin);
+}
+
+bool
+ReadWholeFile(const std::string& path, std::string* content)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char buf[4096];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  close(fd);
+  if (len < 0) {
+    return false;
+  }
+  content->assign(buf, len);
+  return true;
+}
+
+int64_t
+ParseInt(const std::string& content)
+{
+  const std::string trimmed = Trim(content);
+  if (trimmed.empty()) {
+    return -1;
+  }
+  char* end = nullptr;
+  long long value = std::strtoll(trimmed.c_str(), &end, 10);
+  return (end == trimmed.c_str()) ? -1 : value;
+}
+
+// Parse "<number>[ ]<unit>" at 'pos', unit is B, KB, MB or GB (case
+// insensitive, 'iB' accepted). Returns -1 if there is no number.
+int64_t
+ParseSize(const std::string& str, size_t pos)
+{
+  while ((pos < str.size()) &&
+         (std::isspace((unsigned char)str[pos]) || (str[pos] == ':') ||
+          (str[pos] == '='))) {
+    pos++;
+  }
+  if ((pos >= str.size()) || !std::isdigit((unsigned char)str[pos])) {
+    return -1;
+  }
+  char* end = nullptr;
+  double value = std::strtod(str.c_str() + pos, &end);
+  pos = end - str.c_str();
+  while ((pos < str.size()) && (str[pos] == ' ')) {
+    pos++;
+  }
+  if (pos < str.size()) {
+    switch (std::toupper((unsigned char)str[pos])) {
+      case 'K':
+        value *= 1024;
+        break;
+      case 'M':
+        value *= 1024 * 1024;
+        break;
+      case 'G':
+        value *= 1024 * 1024 * 1024;
+        break;
+      default:
+        break;
+    }
+  }
+  return (int64_t)value;
+}
+
+std::string
+FormatTimestamp(const uint64_t timestamp_ms)
+{
+  time_t secs = timestamp_ms / 1000;
+  struct tm tm_time;
+  localtime_r(&secs, &tm_time);
+  char buf[32];
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_time);
+  return buf;
+}
+
+std::string
+JsonEscape(const std::string& str)
+{
+  std::string escaped;
+  for (const char c : str) {
+    if ((c == '"') || (c == '\\')) {
+      escaped += '\\';
+      escaped += c;
+    } else if ((unsigned char)c < 0x20) {
+      escaped += ' ';
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+NpuPaths::NpuPaths()
+    : load_("/sys/kernel/debug/rknpu/load"),
+      devfreq_("/sys/class/devfreq/fdab0000.npu"),
+      mm_("/sys/kernel/debug/rknpu/mm"),
+      version_("/sys/kernel/debug/rknpu/version"),
+      thermal_("/sys/class/thermal"), thermal_type_("npu_thermal")
+{
+}
+
+std::string
+NpuPaths::Resolve(const std::string& path) const
+{
+  if (root_.empty() || path.empty() || (path[0] != '/')) {
+    return path;
+  }
+  return root_ + path;
+}
+
+NpuSampler::NpuSampler(const NpuPaths& paths)
+{
+  Open(&load_, paths.Resolve(paths.load_));
+  const std::string devfreq = paths.Resolve(paths.devfreq_);
+  Open(&cur_freq_, devfreq + "/cur_freq");
+  Open(&max_freq_, devfreq + "/max_freq");
+  Open(&min_freq_, devfreq + "/min_freq");
+  Open(&governor_, devfreq + "/governor");
+  Open(&mm_, paths.Resolve(paths.mm_));
+  const std::string thermal_zone = FindThermalZone(paths);
+  if (!thermal_zone.empty()) {
+    Open(&temperature_, thermal_zone + "/temp");
+  } else {
+    missing_ += paths.Resolve(paths.thermal_) + "/*/type == " +
+                paths.thermal_type_ + "\n";
+  }
+
+  // The driver version does not change, read it once.
+  std::string version;
+  if (ReadWholeFile(paths.Resolve(paths.version_), &version)) {
+    driver_version_ = Trim(version);
+  }
+}
+
+NpuSampler::~NpuSampler()
+{
+  for (Node* node : {&load_, &cur_freq_, &max_freq_, &min_freq_, &governor_,
+                     &mm_, &temperature_}) {
+    if (node->fd_ >= 0) {
+      close(node->fd_);
+    }
+  }
+}
+
+void
+NpuSampler::Open(Node* node, const std::string& path)
+{
+  node->path_ = path;
+  node->fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (node->fd_ < 0) {
+    missing_ += path + "\n";
+  }
+}
+
+bool
+NpuSampler::Read(Node* node, std::string* content)
+{
+  if (node->fd_ < 0) {
+    return false;
+  }
+  char buf[4096];
+  ssize_t len = pread(node->fd_, buf, sizeof(buf), 0);
+  if (len < 0) {
+    return false;
+  }
+  content->assign(buf, len);
+  return true;
+}
+
+std::string
+NpuSampler::FindThermalZone(const NpuPaths& paths)
+{
+  const std::string thermal = paths.Resolve(paths.thermal_);
+  DIR* dir = opendir(thermal.c_str());
+  if (dir == nullptr) {
+    return std::string();
+  }
+  std::string found;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    const std::string name(entry->d_name);
+    if (name.compare(0, 12, "thermal_zone") != 0) {
+      continue;
+    }
+    std::string type;
+    if (ReadWholeFile(thermal + "/" + name + "/type", &type) &&
+        (Trim(type) == paths.thermal_type_)) {
+      found = thermal + "/" + name;
+      break;
+    }
+  }
+  closedir(dir);
+  return found;
+}
+
+bool
+NpuSampler::Sample(NpuSample* sample)
+{
+  *sample = NpuSample();
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  sample->timestamp_ms_ = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  sample->driver_version_ = driver_version_;
+
+  bool any = false;
+  std::string content;
+  if (Read(&load_, &content)) {
+    sample->core_load_ = ParseNpuLoad(content);
+    any = true;
+  }
+  if (Read(&cur_freq_, &content)) {
+    sample->cur_freq_hz_ = ParseInt(content);
+    any = true;
+  }
+  if (Read(&max_freq_, &content)) {
+    sample->max_freq_hz_ = ParseInt(content);
+    any = true;
+  }
+  if (Read(&min_freq_, &content)) {
+    sample->min_freq_hz_ = ParseInt(content);
+    any = true;
+  }
+  if (Read(&governor_, &content)) {
+    sample->governor_ = Trim(content);
+    any = true;
+  }
+  if (Read(&mm_, &content)) {
+    any |= ParseNpuMemory(
+        content, &sample->mem_total_bytes_, &sample->mem_used_bytes_);
+  }
+  if (Read(&temperature_, &content)) {
+    sample->temperature_mc_ = ParseInt(content);
+    any = true;
+  }
+  return any;
+}
+
+std::vector<int>
+ParseNpuLoad(const std::string& content)
+{
+  // rk3588: "NPU load:  Core0: 12%, Core1:  0%, Core2:  0%,"
+  // rv1126: "NPU load: 12%"
+  std::vector<int> loads;
+  size_t pos = content.find("Core");
+  if (pos == std::string::npos) {
+    pos = content.find(':');
+    if (pos != std::string::npos) {
+      int64_t load = ParseInt(content.substr(pos + 1));
+      if (load >= 0) {
+        loads.push_back(load);
+      }
+    }
+    return loads;
+  }
+  while (pos != std::string::npos) {
+    size_t colon = content.find(':', pos);
+    if (colon == std::string::npos) {
+      break;
+    }
+    loads.push_back(std::atoi(content.c_str() + colon + 1));
+    pos = content.find("Core", colon);
+  }
+  return loads;
+}
+
+bool
+ParseNpuMemory(
+    const std::string& content, int64_t* total_bytes, int64_t* used_bytes)
+{
+  // The layout of the memory node changed across driver releases, pick
+  // up "total", "used" and "free" figures wherever they appear.
+  std::string lower(content);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  int64_t total = -1, used = -1, free = -1;
+  size_t pos;
+  if ((pos = lower.find("total")) != std::string::npos) {
+    total = ParseSize(lower, pos + 5);
+  }
+  if ((pos = lower.find("used")) != std::string::npos) {
+    used = ParseSize(lower, pos + 4);
+  }
+  if ((pos = lower.find("free")) != std::string::npos) {
+    free = ParseSize(lower, pos + 4);
+  }
+  if ((used < 0) && (total >= 0) && (free >= 0)) {
+    used = total - free;
+  }
+  if ((total < 0) && (used >= 0) && (free >= 0)) {
+    total = used + free;
+  }
+  *total_bytes = total;
+  *used_bytes = used;
+  return (total >= 0) || (used >= 0);
+}
+
+std::string
+FormatTable(const NpuSample& sample)
+{
+  std::ostringstream oss;
+  const std::string line(
+      "+------------------------------------------------------------+\n");
+  oss << line << "| rk_stat  " << std::left << std::setw(22)
+      << FormatTimestamp(sample.timestamp_ms_) << std::right << std::setw(27)
+      << (sample.driver_version_.empty() ? "driver: N/A"
+                                         : sample.driver_version_)
+      << " |\n"
+      << line;
+
+  oss << "| Freq: ";
+  std::ostringstream freq;
+  if (sample.cur_freq_hz_ >= 0) {
+    freq << sample.cur_freq_hz_ / 1000000 << " / "
+         << ((sample.max_freq_hz_ >= 0) ? sample.max_freq_hz_ / 1000000 : 0)
+         << " MHz";
+  } else {
+    freq << "N/A";
+  }
+  oss << std::left << std::setw(22) << freq.str() << "Governor: " << std::setw(20)
+      << (sample.governor_.empty() ? "N/A" : sample.governor_) << " |\n";
+
+  std::ostringstream mem, temp;
+  if (sample.mem_used_bytes_ >= 0) {
+    mem << sample.mem_used_bytes_ / (1024 * 1024) << " / ";
+    if (sample.mem_total_bytes_ >= 0) {
+      mem << sample.mem_total_bytes_ / (1024 * 1024);
+    } else {
+      mem << "N/A";
+    }
+    mem << " MiB";
+  } else {
+    mem << "N/A";
+  }
+  if (sample.temperature_mc_ >= 0) {
+    temp << std::fixed << std::setprecision(1)
+         << sample.temperature_mc_ / 1000.0 << " C";
+  } else {
+    temp << "N/A";
+  }
+  oss << "| Mem:  " << std::setw(22) << mem.str() << "Temp:     " << std::setw(20)
+      << temp.str() << " |\n"
+      << line;
+
+  if (sample.core_load_.empty()) {
+    oss << "| " << std::setw(58) << "NPU load: N/A" << " |\n";
+  }
+  for (size_t core = 0; core < sample.core_load_.size(); ++core) {
+    const int load = std::max(0, std::min(100, sample.core_load_[core]));
+    const int bar = load * 40 / 100;
+    std::ostringstream label;
+    label << "Core" << core << " " << std::right << std::setw(3) << load
+          << "% ";
+    oss << "| " << std::left << std::setw(11) << label.str() << "["
+        << std::string(bar, '|') << std::string(40 - bar, ' ') << "]      |\n";
+  }
+  oss << line << std::right;
+  return oss.str();
+}
+
+std::string
+FormatCsvHeader(const size_t core_count)
+{
+  std::ostringstream oss;
+  oss << "timestamp_ms";
+  for (size_t core = 0; core < core_count; ++core) {
+    oss << ",core" << core << "_load";
+  }
+  oss << ",cur_freq_hz,max_freq_hz,min_freq_hz,governor,mem_used_bytes,"
+         "mem_total_bytes,temperature_mc\n";
+  return oss.str();
+}
+
+std::string
+FormatCsv(const NpuSample& sample)
+{
+  std::ostringstream oss;
+  oss << sample.timestamp_ms_;
+  for (const int load : sample.core_load_) {
+    oss << "," << load;
+  }
+  oss << "," << sample.cur_freq_hz_ << "," << sample.max_freq_hz_ << ","
+      << sample.min_freq_hz_ << "," << sample.governor_ << ","
+      << sample.mem_used_bytes_ << "," << sample.mem_total_bytes_ << ","
+      << sample.temperature_mc_ << "\n";
+  return oss.str();
+}
+
+std::string
+FormatJson(const NpuSample& sample)
+{
+  std::ostringstream oss;
+  oss << "{\"timestamp_ms\":" << sample.timestamp_ms_ << ",\"driver\":\""
+      << JsonEscape(sample.driver_version_) << "\",\"core_load\":[";
+  for (size_t core = 0; core < sample.core_load_.size(); ++core) {
+    oss << ((core == 0) ? "" : ",") << sample.core_load_[core];
+  }
+  oss << "],\"cur_freq_hz\":" << sample.cur_freq_hz_
+      << ",\"max_freq_hz\":" << sample.max_freq_hz_
+      << ",\"min_freq_hz\":" << sample.min_freq_hz_ << ",\"governor\":\""
+      << JsonEscape(sample.governor_)
+      << "\",\"mem_used_bytes\":" << sample.mem_used_bytes_
+      << ",\"mem_total_bytes\":" << sample.mem_total_bytes_
+      << ",\"temperature_mc\":" << sample.temperature_mc_ << "}\n";
+  return oss.str();
+}
+
+}  // namespace rk_stat
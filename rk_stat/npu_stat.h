@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rk_stat {
+
+// Location of the rknpu driver nodes. Every path is relative to 'root_'
+// so the whole tree can be redirected, e.g. to a fake sysfs tree when
+// testing on x86.
+struct NpuPaths {
+  NpuPaths();
+
+  // Join 'root_' and an absolute node path.
+  std::string Resolve(const std::string& path) const;
+
+  std::string root_;
+  // "NPU load:  Core0:  0%, Core1:  0%, Core2:  0%,"
+  std::string load_;
+  // devfreq directory holding cur_freq, max_freq, min_freq, governor.
+  std::string devfreq_;
+  // rknpu memory manager state, "total"/"used" figures.
+  std::string mm_;
+  // "RKNPU driver: v0.8.2"
+  std::string version_;
+  // thermal class directory, the zone whose type is 'thermal_type_' is
+  // used for the NPU temperature.
+  std::string thermal_;
+  std::string thermal_type_;
+};
+
+struct NpuSample {
+  NpuSample()
+      : timestamp_ms_(0), cur_freq_hz_(-1), max_freq_hz_(-1),
+        min_freq_hz_(-1), mem_total_bytes_(-1), mem_used_bytes_(-1),
+        temperature_mc_(-1)
+  {
+  }
+
+  // Wall clock time of the sample, ms since epoch.
+  uint64_t timestamp_ms_;
+  // Load of each core in percent, empty if the load node is missing.
+  std::vector<int> core_load_;
+  // -1 when the corresponding node is missing.
+  int64_t cur_freq_hz_;
+  int64_t max_freq_hz_;
+  int64_t min_freq_hz_;
+  std::string governor_;
+  int64_t mem_total_bytes_;
+  int64_t mem_used_bytes_;
+  // NPU temperature in milli degree Celsius.
+  int64_t temperature_mc_;
+  std::string driver_version_;
+};
+
+//
+// NpuSampler
+//
+// Reads the rknpu sysfs/debugfs nodes. The nodes are opened once and
+// every sample is a single pread() per node from offset 0, so a refresh
+// loop costs a handful of syscalls and no open/close churn.
+//
+class NpuSampler {
+ public:
+  explicit NpuSampler(const NpuPaths& paths);
+  ~NpuSampler();
+
+  // Take a sample. Returns false if none of the nodes could be read.
+  bool Sample(NpuSample* sample);
+
+  // Describe the nodes that could not be opened, one per line.
+  const std::string& Missing() const { return missing_; }
+
+ private:
+  NpuSampler(const NpuSampler&) = delete;
+  NpuSampler& operator=(const NpuSampler&) = delete;
+
+  struct Node {
+    Node() : fd_(-1) {}
+    std::string path_;
+    int fd_;
+  };
+
+  void Open(Node* node, const std::string& path);
+  bool Read(Node* node, std::string* content);
+  std::string FindThermalZone(const NpuPaths& paths);
+
+  Node load_;
+  Node cur_freq_;
+  Node max_freq_;
+  Node min_freq_;
+  Node governor_;
+  Node mm_;
+  Node temperature_;
+  std::string driver_version_;
+  std::string missing_;
+};
+
+// Parsers of the node contents, exposed for reuse by the other rk_stat
+// modes.
+std::vector<int> ParseNpuLoad(const std::string& content);
+bool ParseNpuMemory(
+    const std::string& content, int64_t* total_bytes, int64_t* used_bytes);
+
+// Output formats of the monitoring mode.
+enum class OutputFormat { TABLE, CSV, JSON };
+
+std::string FormatTable(const NpuSample& sample);
+std::string FormatCsvHeader(const size_t core_count);
+std::string FormatCsv(const NpuSample& sample);
+std::string FormatJson(const NpuSample& sample);
+
+}  // namespace rk_stat
@@ -0,0 +1,596 @@
+//
+// Stand-in for librknnrt.so.
+//
+// Implements the subset of rknn_api.h used by the rockchip backend so
+// Triton, the backend and rk_loadgen can be exercised end to end on a
+// host without an NPU. No inference happens: rknn_run sleeps for the
+// configured NPU time and the outputs are filled with a deterministic
+// pattern derived from the inputs.
+//
+// The model file content is ignored. Its tensors are read from a text
+// description "<model path>.stub" next to it (or from the file named
+// by RKNN_STUB_SPEC), one directive per line:
+//
+//   input  images INT8 NHWC 1 384 640 3
+//   output output INT8 NCHW 1 81 48 80
+//   run_us 8000
+//
+// Without a description the tensors of the example rockchip model of
+// server/model_repository are used. RKNN_STUB_RUN_US overrides run_us.
+//
+
+#include <rknn_api.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct StubModel {
+  StubModel() : run_us_(8000) {}
+  std::vector<rknn_tensor_attr> inputs_;
+  std::vector<rknn_tensor_attr> outputs_;
+  uint64_t run_us_;
+};
+
+struct StubContext {
+  StubModel model_;
+  std::vector<std::vector<uint8_t>> input_data_;
+  std::vector<std::vector<uint8_t>> output_data_;
+  // Buffers handed out by rknn_outputs_get without is_prealloc.
+  std::vector<void*> allocated_;
+  // Memory bound with rknn_set_io_mem, indexed like the tensors.
+  std::vector<rknn_tensor_mem*> input_mem_;
+  std::vector<rknn_tensor_mem*> output_mem_;
+  // Whether output_mem_ was bound in the native NC1HWC2 layout.
+  std::vector<bool> output_native_;
+  uint32_t core_mask_;
+  int64_t last_run_us_;
+};
+
+uint32_t
+TypeSize(const rknn_tensor_type type)
+{
+  switch (type) {
+    case RKNN_TENSOR_FLOAT32:
+    case RKNN_TENSOR_INT32:
+    case RKNN_TENSOR_UINT32:
+      return 4;
+    case RKNN_TENSOR_FLOAT16:
+    case RKNN_TENSOR_INT16:
+    case RKNN_TENSOR_UINT16:
+      return 2;
+    case RKNN_TENSOR_INT64:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+bool
+ParseType(const std::string& str, rknn_tensor_type* type)
+{
+  static const struct {
+    const char* name_;
+    rknn_tensor_type type_;
+  } kTypes[] = {
+      {"FP32", RKNN_TENSOR_FLOAT32}, {"FP16", RKNN_TENSOR_FLOAT16},
+      {"INT8", RKNN_TENSOR_INT8},    {"UINT8", RKNN_TENSOR_UINT8},
+      {"INT16", RKNN_TENSOR_INT16},  {"UINT16", RKNN_TENSOR_UINT16},
+      {"INT32", RKNN_TENSOR_INT32},  {"UINT32", RKNN_TENSOR_UINT32},
+      {"INT64", RKNN_TENSOR_INT64},  {"BOOL", RKNN_TENSOR_BOOL},
+  };
+  for (const auto& entry : kTypes) {
+    if (str == entry.name_) {
+      *type = entry.type_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+MakeAttr(
+    const uint32_t index, const std::string& name, const rknn_tensor_type type,
+    const rknn_tensor_format fmt, const std::vector<uint32_t>& dims,
+    rknn_tensor_attr* attr)
+{
+  memset(attr, 0, sizeof(rknn_tensor_attr));
+  attr->index = index;
+  snprintf(attr->name, RKNN_MAX_NAME_LEN, "%s", name.c_str());
+  attr->n_dims = std::min<size_t>(dims.size(), RKNN_MAX_DIMS);
+  attr->n_elems = 1;
+  for (uint32_t i = 0; i < attr->n_dims; ++i) {
+    attr->dims[i] = dims[i];
+    attr->n_elems *= dims[i];
+  }
+  attr->type = type;
+  attr->fmt = fmt;
+  attr->size = attr->n_elems * TypeSize(type);
+  attr->size_with_stride = attr->size;
+  attr->w_stride = (attr->n_dims > 2) ? dims[2] : 0;
+  if ((type == RKNN_TENSOR_INT8) || (type == RKNN_TENSOR_UINT8)) {
+    attr->qnt_type = RKNN_TENSOR_QNT_AFFINE_ASYMMETRIC;
+    attr->zp = (type == RKNN_TENSOR_INT8) ? -128 : 0;
+    attr->scale = 1.0f / 255;
+  }
+}
+
+// NC1HWC2 attr of the 4-D NCHW 'attr', as the NPU of rk3588 lays out
+// its outputs: 16 bytes of channels per pixel.
+void
+NativeAttr(const rknn_tensor_attr& attr, rknn_tensor_attr* native)
+{
+  *native = attr;
+  if ((attr.n_dims != 4) || (attr.fmt != RKNN_TENSOR_NCHW)) {
+    return;
+  }
+  const uint32_t c2 = std::max<uint32_t>(16 / TypeSize(attr.type), 1);
+  const uint32_t c1 = (attr.dims[1] + c2 - 1) / c2;
+  MakeAttr(
+      attr.index, attr.name, attr.type, RKNN_TENSOR_NC1HWC2,
+      {attr.dims[0], c1, attr.dims[2], attr.dims[3], c2}, native);
+  native->w_stride = attr.dims[3];
+  native->qnt_type = attr.qnt_type;
+  native->zp = attr.zp;
+  native->scale = attr.scale;
+}
+
+// Copy the NCHW 'src' of 'attr' into 'dst' in the layout of 'native'.
+void
+NchwToNative(
+    const rknn_tensor_attr& attr, const rknn_tensor_attr& native,
+    const uint8_t* src, uint8_t* dst, const size_t dst_size)
+{
+  const size_t es = TypeSize(attr.type);
+  const uint32_t c = attr.dims[1], h = attr.dims[2], w = attr.dims[3];
+  const uint32_t c1 = native.dims[1], c2 = native.dims[4];
+  memset(dst, 0, dst_size);
+  for (uint32_t n = 0; n < attr.dims[0]; ++n) {
+    for (uint32_t ci = 0; ci < c; ++ci) {
+      for (uint32_t p = 0; p < h * w; ++p) {
+        const size_t d =
+            (((size_t)n * c1 + ci / c2) * h * w + p) * c2 + ci % c2;
+        const size_t s = ((size_t)n * c + ci) * h * w + p;
+        if ((d + 1) * es <= dst_size) {
+          memcpy(dst + d * es, src + s * es, es);
+        }
+      }
+    }
+  }
+}
+
+void
+DefaultModel(StubModel* model)
+{
+  model->inputs_.resize(1);
+  MakeAttr(
+      0, "images", RKNN_TENSOR_INT8, RKNN_TENSOR_NHWC, {1, 384, 640, 3},
+      &model->inputs_[0]);
+  model->outputs_.resize(3);
+  MakeAttr(
+      0, "output", RKNN_TENSOR_INT8, RKNN_TENSOR_NCHW, {1, 81, 48, 80},
+      &model->outputs_[0]);
+  MakeAttr(
+      1, "376", RKNN_TENSOR_INT8, RKNN_TENSOR_NCHW, {1, 81, 24, 40},
+      &model->outputs_[1]);
+  MakeAttr(
+      2, "377", RKNN_TENSOR_INT8, RKNN_TENSOR_NCHW, {1, 81, 12, 20},
+      &model->outputs_[2]);
+}
+
+bool
+LoadModelSpec(const std::string& path, StubModel* model)
+{
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream iss(line);
+    std::string directive;
+    if (!(iss >> directive) || (directive[0] == '#')) {
+      continue;
+    }
+    if (directive == "run_us") {
+      iss >> model->run_us_;
+      continue;
+    }
+    std::string name, type_str, fmt_str;
+    iss >> name >> type_str >> fmt_str;
+    rknn_tensor_type type;
+    if (!ParseType(type_str, &type)) {
+      fprintf(stderr, "rknn_stub: unknown type %s in %s\n", type_str.c_str(),
+              path.c_str());
+      return false;
+    }
+    const rknn_tensor_format fmt =
+        (fmt_str == "NHWC") ? RKNN_TENSOR_NHWC
+                            : ((fmt_str == "NCHW") ? RKNN_TENSOR_NCHW
+                                                   : RKNN_TENSOR_UNDEFINED);
+    std::vector<uint32_t> dims;
+    uint32_t dim;
+    while (iss >> dim) {
+      dims.push_back(dim);
+    }
+    std::vector<rknn_tensor_attr>* attrs =
+        (directive == "input") ? &model->inputs_ : &model->outputs_;
+    attrs->emplace_back();
+    MakeAttr(attrs->size() - 1, name, type, fmt, dims, &attrs->back());
+  }
+  return !model->inputs_.empty() && !model->outputs_.empty();
+}
+
+StubContext*
+Ctx(const rknn_context context)
+{
+  return reinterpret_cast<StubContext*>(context);
+}
+
+const char kPerfDetail[] =
+    "-------------------------------------------------------------------\n"
+    "                         Operator Time Consuming Ranking Table\n"
+    "-------------------------------------------------------------------\n"
+    "ID   OpType   DataType Target InputShape   OutputShape  Time(us)  "
+    "FullName\n"
+    "1    InputOperator INT8 CPU  \\           (1,3,384,640) 10  "
+    "InputOperator:images\n"
+    "2    ConvRelu INT8  NPU  (1,3,384,640) (1,16,192,320) 1200  "
+    "Conv:stub_conv\n"
+    "3    OutputOperator INT8 CPU (1,81,48,80) \\ 20  "
+    "OutputOperator:output\n";
+
+}  // namespace
+
+extern "C" {
+
+int
+rknn_init(
+    rknn_context* context, void* model, uint32_t size, uint32_t flag,
+    rknn_init_extend* extend)
+{
+  std::unique_ptr<StubContext> ctx(new StubContext());
+  ctx->core_mask_ = RKNN_NPU_CORE_AUTO;
+  ctx->last_run_us_ = 0;
+
+  std::string spec_path;
+  const char* env_spec = getenv("RKNN_STUB_SPEC");
+  if (env_spec != nullptr) {
+    spec_path = env_spec;
+  } else if ((size == 0) && (model != nullptr)) {
+    // A zero size means 'model' is the path of the model file.
+    spec_path = std::string((const char*)model) + ".stub";
+  }
+  if (spec_path.empty() || !LoadModelSpec(spec_path, &ctx->model_)) {
+    ctx->model_ = StubModel();
+    DefaultModel(&ctx->model_);
+  }
+  const char* env_run_us = getenv("RKNN_STUB_RUN_US");
+  if (env_run_us != nullptr) {
+    ctx->model_.run_us_ = strtoull(env_run_us, nullptr, 10);
+  }
+
+  ctx->input_data_.resize(ctx->model_.inputs_.size());
+  for (size_t i = 0; i < ctx->model_.inputs_.size(); ++i) {
+    ctx->input_data_[i].assign(ctx->model_.inputs_[i].size, 0);
+  }
+  ctx->output_data_.resize(ctx->model_.outputs_.size());
+  for (size_t i = 0; i < ctx->model_.outputs_.size(); ++i) {
+    ctx->output_data_[i].assign(ctx->model_.outputs_[i].size, 0);
+  }
+  ctx->input_mem_.assign(ctx->model_.inputs_.size(), nullptr);
+  ctx->output_mem_.assign(ctx->model_.outputs_.size(), nullptr);
+  ctx->output_native_.assign(ctx->model_.outputs_.size(), false);
+  *context = reinterpret_cast<rknn_context>(ctx.release());
+  return RKNN_SUCC;
+}
+
+int
+rknn_dup_context(rknn_context* context_in, rknn_context* context_out)
+{
+  std::unique_ptr<StubContext> ctx(new StubContext(*Ctx(*context_in)));
+  ctx->allocated_.clear();
+  ctx->input_mem_.assign(ctx->model_.inputs_.size(), nullptr);
+  ctx->output_mem_.assign(ctx->model_.outputs_.size(), nullptr);
+  ctx->output_native_.assign(ctx->model_.outputs_.size(), false);
+  *context_out = reinterpret_cast<rknn_context>(ctx.release());
+  return RKNN_SUCC;
+}
+
+int
+rknn_destroy(rknn_context context)
+{
+  StubContext* ctx = Ctx(context);
+  for (void* buf : ctx->allocated_) {
+    free(buf);
+  }
+  delete ctx;
+  return RKNN_SUCC;
+}
+
+int
+rknn_query(rknn_context context, rknn_query_cmd cmd, void* info, uint32_t size)
+{
+  StubContext* ctx = Ctx(context);
+  switch (cmd) {
+    case RKNN_QUERY_IN_OUT_NUM: {
+      if (size < sizeof(rknn_input_output_num)) {
+        return RKNN_ERR_FAIL;
+      }
+      rknn_input_output_num* io_num = (rknn_input_output_num*)info;
+      io_num->n_input = ctx->model_.inputs_.size();
+      io_num->n_output = ctx->model_.outputs_.size();
+      return RKNN_SUCC;
+    }
+    case RKNN_QUERY_INPUT_ATTR:
+    case RKNN_QUERY_OUTPUT_ATTR:
+    case RKNN_QUERY_NATIVE_INPUT_ATTR:
+    case RKNN_QUERY_NATIVE_NHWC_INPUT_ATTR:
+    case RKNN_QUERY_NATIVE_OUTPUT_ATTR:
+    case RKNN_QUERY_NATIVE_NHWC_OUTPUT_ATTR: {
+      if (size < sizeof(rknn_tensor_attr)) {
+        return RKNN_ERR_FAIL;
+      }
+      rknn_tensor_attr* attr = (rknn_tensor_attr*)info;
+      const bool input = (cmd == RKNN_QUERY_INPUT_ATTR) ||
+                         (cmd == RKNN_QUERY_NATIVE_INPUT_ATTR) ||
+                         (cmd == RKNN_QUERY_NATIVE_NHWC_INPUT_ATTR);
+      const std::vector<rknn_tensor_attr>& attrs =
+          input ? ctx->model_.inputs_ : ctx->model_.outputs_;
+      if (attr->index >= attrs.size()) {
+        return RKNN_ERR_FAIL;
+      }
+      if (cmd == RKNN_QUERY_NATIVE_OUTPUT_ATTR) {
+        NativeAttr(attrs[attr->index], attr);
+      } else {
+        *attr = attrs[attr->index];
+      }
+      return RKNN_SUCC;
+    }
+    case RKNN_QUERY_PERF_RUN: {
+      rknn_perf_run* perf = (rknn_perf_run*)info;
+      perf->run_duration = ctx->last_run_us_;
+      return RKNN_SUCC;
+    }
+    case RKNN_QUERY_PERF_DETAIL: {
+      rknn_perf_detail* perf = (rknn_perf_detail*)info;
+      perf->perf_data = (char*)kPerfDetail;
+      perf->data_len = sizeof(kPerfDetail);
+      return RKNN_SUCC;
+    }
+    case RKNN_QUERY_SDK_VERSION: {
+      rknn_sdk_version* version = (rknn_sdk_version*)info;
+      snprintf(version->api_version, sizeof(version->api_version), "stub");
+      snprintf(version->drv_version, sizeof(version->drv_version), "stub");
+      return RKNN_SUCC;
+    }
+    case RKNN_QUERY_MEM_SIZE: {
+      rknn_mem_size* mem_size = (rknn_mem_size*)info;
+      memset(mem_size, 0, sizeof(rknn_mem_size));
+      for (const auto& attr : ctx->model_.inputs_) {
+        mem_size->total_internal_size += attr.size;
+      }
+      for (const auto& attr : ctx->model_.outputs_) {
+        mem_size->total_internal_size += attr.size;
+      }
+      return RKNN_SUCC;
+    }
+    default:
+      return RKNN_ERR_FAIL;
+  }
+}
+
+int
+rknn_inputs_set(rknn_context context, uint32_t n_inputs, rknn_input inputs[])
+{
+  StubContext* ctx = Ctx(context);
+  for (uint32_t i = 0; i < n_inputs; ++i) {
+    const rknn_input& input = inputs[i];
+    if (input.index >= ctx->input_data_.size()) {
+      return RKNN_ERR_FAIL;
+    }
+    std::vector<uint8_t>& data = ctx->input_data_[input.index];
+    memcpy(data.data(), input.buf, std::min<size_t>(input.size, data.size()));
+  }
+  return RKNN_SUCC;
+}
+
+int
+rknn_set_batch_core_num(rknn_context context, int core_num)
+{
+  return RKNN_SUCC;
+}
+
+int
+rknn_set_core_mask(rknn_context context, rknn_core_mask core_mask)
+{
+  Ctx(context)->core_mask_ = core_mask;
+  return RKNN_SUCC;
+}
+
+int
+rknn_run(rknn_context context, rknn_run_extend* extend)
+{
+  StubContext* ctx = Ctx(context);
+  for (size_t i = 0; i < ctx->input_mem_.size(); ++i) {
+    rknn_tensor_mem* mem = ctx->input_mem_[i];
+    if (mem != nullptr) {
+      memcpy(
+          ctx->input_data_[i].data(), mem->virt_addr,
+          std::min<size_t>(mem->size, ctx->input_data_[i].size()));
+    }
+  }
+
+  if (ctx->model_.run_us_ > 0) {
+    usleep(ctx->model_.run_us_);
+  }
+  ctx->last_run_us_ = ctx->model_.run_us_;
+
+  // Every output element is a function of the first input so clients
+  // can tell responses apart.
+  uint8_t seed = 0;
+  const std::vector<uint8_t>& first_input = ctx->input_data_[0];
+  for (size_t i = 0; i < first_input.size(); i += 4096) {
+    seed += first_input[i];
+  }
+  for (size_t o = 0; o < ctx->output_data_.size(); ++o) {
+    std::vector<uint8_t>& data = ctx->output_data_[o];
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = (uint8_t)(seed + i + o);
+    }
+    rknn_tensor_mem* mem = ctx->output_mem_[o];
+    if ((mem != nullptr) && ctx->output_native_[o]) {
+      rknn_tensor_attr native;
+      NativeAttr(ctx->model_.outputs_[o], &native);
+      NchwToNative(
+          ctx->model_.outputs_[o], native, data.data(),
+          (uint8_t*)mem->virt_addr, mem->size);
+    } else if (mem != nullptr) {
+      memcpy(
+          mem->virt_addr, data.data(),
+          std::min<size_t>(mem->size, data.size()));
+    }
+  }
+  return RKNN_SUCC;
+}
+
+int
+rknn_wait(rknn_context context, rknn_run_extend* extend)
+{
+  return RKNN_SUCC;
+}
+
+int
+rknn_outputs_get(
+    rknn_context context, uint32_t n_outputs, rknn_output outputs[],
+    rknn_output_extend* extend)
+{
+  StubContext* ctx = Ctx(context);
+  for (uint32_t i = 0; i < n_outputs; ++i) {
+    rknn_output& output = outputs[i];
+    if (output.index >= ctx->output_data_.size()) {
+      return RKNN_ERR_FAIL;
+    }
+    const rknn_tensor_attr& attr = ctx->model_.outputs_[output.index];
+    const std::vector<uint8_t>& data = ctx->output_data_[output.index];
+    const size_t size =
+        output.want_float ? attr.n_elems * sizeof(float) : data.size();
+    if (!output.is_prealloc) {
+      output.buf = malloc(size);
+      output.size = size;
+      ctx->allocated_.push_back(output.buf);
+    } else if (output.size < size) {
+      return RKNN_ERR_FAIL;
+    }
+    if (output.want_float) {
+      float* dst = (float*)output.buf;
+      for (uint32_t e = 0; e < attr.n_elems; ++e) {
+        const int32_t q = (attr.type == RKNN_TENSOR_INT8) ? (int8_t)data[e]
+                                                          : (uint8_t)data[e];
+        dst[e] = (q - attr.zp) * attr.scale;
+      }
+    } else {
+      memcpy(output.buf, data.data(), size);
+    }
+  }
+  return RKNN_SUCC;
+}
+
+int
+rknn_outputs_release(
+    rknn_context context, uint32_t n_ouputs, rknn_output outputs[])
+{
+  StubContext* ctx = Ctx(context);
+  for (uint32_t i = 0; i < n_ouputs; ++i) {
+    if (outputs[i].is_prealloc) {
+      continue;
+    }
+    auto it = std::find(
+        ctx->allocated_.begin(), ctx->allocated_.end(), outputs[i].buf);
+    if (it != ctx->allocated_.end()) {
+      free(*it);
+      ctx->allocated_.erase(it);
+    }
+    outputs[i].buf = nullptr;
+  }
+  return RKNN_SUCC;
+}
+
+rknn_tensor_mem*
+rknn_create_mem(rknn_context ctx, uint32_t size)
+{
+  rknn_tensor_mem* mem = new rknn_tensor_mem();
+  memset(mem, 0, sizeof(rknn_tensor_mem));
+  mem->virt_addr = calloc(1, size);
+  mem->fd = -1;
+  mem->size = size;
+  mem->flags = RKNN_TENSOR_MEMORY_FLAGS_ALLOC_INSIDE;
+  return mem;
+}
+
+rknn_tensor_mem*
+rknn_create_mem_from_fd(
+    rknn_context ctx, int32_t fd, void* virt_addr, uint32_t size,
+    int32_t offset)
+{
+  rknn_tensor_mem* mem = new rknn_tensor_mem();
+  memset(mem, 0, sizeof(rknn_tensor_mem));
+  mem->virt_addr = (char*)virt_addr + offset;
+  mem->fd = fd;
+  mem->offset = offset;
+  mem->size = size;
+  mem->flags = RKNN_TENSOR_MEMORY_FLAGS_FROM_FD;
+  return mem;
+}
+
+int
+rknn_destroy_mem(rknn_context context, rknn_tensor_mem* mem)
+{
+  if (mem == nullptr) {
+    return RKNN_SUCC;
+  }
+  StubContext* ctx = Ctx(context);
+  std::replace(ctx->input_mem_.begin(), ctx->input_mem_.end(), mem,
+               (rknn_tensor_mem*)nullptr);
+  std::replace(ctx->output_mem_.begin(), ctx->output_mem_.end(), mem,
+               (rknn_tensor_mem*)nullptr);
+  if (mem->flags == RKNN_TENSOR_MEMORY_FLAGS_ALLOC_INSIDE) {
+    free(mem->virt_addr);
+  }
+  delete mem;
+  return RKNN_SUCC;
+}
+
+int
+rknn_set_io_mem(
+    rknn_context context, rknn_tensor_mem* mem, rknn_tensor_attr* attr)
+{
+  StubContext* ctx = Ctx(context);
+  // Tensors are matched by name since inputs and outputs share indices.
+  for (size_t i = 0; i < ctx->model_.inputs_.size(); ++i) {
+    if (strcmp(ctx->model_.inputs_[i].name, attr->name) == 0) {
+      ctx->input_mem_[i] = mem;
+      return RKNN_SUCC;
+    }
+  }
+  for (size_t i = 0; i < ctx->model_.outputs_.size(); ++i) {
+    if (strcmp(ctx->model_.outputs_[i].name, attr->name) == 0) {
+      ctx->output_mem_[i] = mem;
+      ctx->output_native_[i] = (attr->fmt == RKNN_TENSOR_NC1HWC2);
+      return RKNN_SUCC;
+    }
+  }
+  return RKNN_ERR_FAIL;
+}
+
+}  // extern "C"
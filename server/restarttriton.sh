@@ -1,4 +1,23 @@
 #!/bin/bash
-pkill -9 tritonserver
-echo > tritonserver.log
-nohup start_triton.sh >> tritonserver.log &
+# Roll every model of model_repository to what is on disk without
+# stopping the server: Triton loads the new version next to the one
+# serving and switches to it once its instances are ready. Starts the
+# server when it is not running.
+TRITON_HTTP=${TRITON_HTTP:-localhost:8000}
+if ! curl -sf "http://${TRITON_HTTP}/v2/health/live" > /dev/null; then
+  echo > tritonserver.log
+  nohup start_triton.sh >> tritonserver.log &
+  exit 0
+fi
+status=0
+for dir in model_repository/*/; do
+  model=$(basename "${dir}")
+  if curl -sf -X POST \
+      "http://${TRITON_HTTP}/v2/repository/models/${model}/load" > /dev/null; then
+    echo "reloaded ${model}"
+  else
+    echo "failed to reload ${model}, the previous version keeps serving" >&2
+    status=1
+  fi
+done
+exit ${status}
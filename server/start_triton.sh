@@ -1 +1 @@
-tritonserver --strict-model-config=false   --model-repository=model_repository
+tritonserver --strict-model-config=false   --model-repository=model_repository --model-control-mode=explicit --load-model='*'
@@ -1,14 +1,185 @@
 #include "triton/backend/backend_common.h"
 #include "triton/backend/backend_input_collector.h"
+#include "triton/backend/backend_memory.h"
 #include "triton/backend/backend_model.h"
 #include "triton/backend/backend_model_instance.h"
 #include "triton/backend/backend_output_responder.h"
 #include "triton/core/tritonbackend.h"
 
 #include "rock-chip_backend.h"
+#include "rock-chip_cascade.h"
+#include "rock-chip_compressor.h"
+#include "rock-chip_context_manager.h"
+#include "rock-chip_dequant.h"
+#include "rock-chip_dmabuf.h"
+#include "rock-chip_layout.h"
+#include "rock-chip_metrics.h"
+#include "rock-chip_npu_arbiter.h"
+#include "rock-chip_profiler.h"
+#include "rock-chip_semaphore.h"
+#include "rock-chip_sequence.h"
+#include "rock-chip_sparse.h"
+#include "rock-chip_tiling.h"
+#include "rock-chip_worker_pool.h"
 
 namespace triton { namespace backend{namespace rockchip{
 
+//
+// BackendState
+//
+// State shared by every model and model instance that uses this
+// backend. An object of this class is created in
+// TRITONBACKEND_Initialize and associated with the
+// TRITONBACKEND_Backend. It owns the NPU arbiter so that all models
+// loaded in the process see the same view of the NPU cores, the
+// manager of the NPU memory budget of their contexts, and the backend
+// metric families.
+//
+class BackendState {
+ public:
+  static TRITONSERVER_Error* Create(
+      TRITONBACKEND_Backend* triton_backend, BackendState** state);
+  ~BackendState() = default;
+
+  NpuArbiter* Arbiter() { return arbiter_.get(); }
+  bool ArbiterEnabled() const { return arbiter_enabled_; }
+
+  // nullptr when the metrics are disabled.
+  BackendMetrics* Metrics() { return metrics_.get(); }
+
+  // nullptr unless "npu-memory-budget-mb" is set, every context then
+  // stays materialized.
+  ContextManager* Contexts() { return contexts_.get(); }
+
+  // nullptr unless "dmabuf-socket" is set, the models then cannot take
+  // dma-buf frames.
+  DmaBufHandoff* Handoff() { return handoff_.get(); }
+
+ private:
+  BackendState() : arbiter_enabled_(true) {}
+
+  // Parse the --backend-config=rockchip,<key>=<value> options.
+  TRITONSERVER_Error* ParseBackendConfig(TRITONBACKEND_Backend* triton_backend);
+
+  bool arbiter_enabled_;
+  std::unique_ptr<NpuArbiter> arbiter_;
+  std::unique_ptr<BackendMetrics> metrics_;
+  std::unique_ptr<ContextManager> contexts_;
+  std::unique_ptr<DmaBufHandoff> handoff_;
+};
+
+TRITONSERVER_Error*
+BackendState::Create(
+    TRITONBACKEND_Backend* triton_backend, BackendState** state)
+{
+  std::unique_ptr<BackendState> local_state(new BackendState());
+  RETURN_IF_ERROR(local_state->ParseBackendConfig(triton_backend));
+  *state = local_state.release();
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+BackendState::ParseBackendConfig(TRITONBACKEND_Backend* triton_backend)
+{
+  // rk3588 has 3 NPU cores, rv1126 has a single one.
+  int64_t core_count = std::string(getBuild()).compare("ARM64") ? 1 : 3;
+  bool metrics_enabled = true;
+  uint64_t metrics_interval_ms = 1000;
+  uint64_t memory_budget_mb = 0;
+  std::string dmabuf_socket;
+
+  TRITONSERVER_Message* backend_config_message;
+  RETURN_IF_ERROR(
+      TRITONBACKEND_BackendConfig(triton_backend, &backend_config_message));
+  const char* buffer;
+  size_t byte_size;
+  RETURN_IF_ERROR(TRITONSERVER_MessageSerializeToJson(
+      backend_config_message, &buffer, &byte_size));
+
+  common::TritonJson::Value backend_config;
+  if (byte_size != 0) {
+    RETURN_IF_ERROR(backend_config.Parse(buffer, byte_size));
+  }
+  common::TritonJson::Value cmdline;
+  if (backend_config.Find("cmdline", &cmdline)) {
+    common::TritonJson::Value value;
+    std::string value_str;
+    if (cmdline.Find("npu-core-count", &value)) {
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(ParseLongLongValue(value_str, &core_count));
+      RETURN_ERROR_IF_FALSE(
+          (core_count > 0) && (core_count <= 32), TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("npu-core-count must be in [1, 32], got ") + value_str);
+    }
+    if (cmdline.Find("npu-arbiter", &value)) {
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(ParseBoolValue(value_str, &arbiter_enabled_));
+    }
+    if (cmdline.Find("metrics", &value)) {
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(ParseBoolValue(value_str, &metrics_enabled));
+    }
+    if (cmdline.Find("metrics-interval-ms", &value)) {
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(
+          ParseUnsignedLongLongValue(value_str, &metrics_interval_ms));
+      RETURN_ERROR_IF_FALSE(
+          metrics_interval_ms > 0, TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("metrics-interval-ms must be positive"));
+    }
+    if (cmdline.Find("npu-memory-budget-mb", &value)) {
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(ParseUnsignedLongLongValue(value_str, &memory_budget_mb));
+    }
+    if (cmdline.Find("dmabuf-socket", &value)) {
+      RETURN_IF_ERROR(value.AsString(&dmabuf_socket));
+    }
+  }
+
+  if (!dmabuf_socket.empty()) {
+    RETURN_IF_ERROR(DmaBufHandoff::Create(dmabuf_socket, &handoff_));
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("rockchip backend takes dma-buf fds on ") +
+         dmabuf_socket)
+            .c_str());
+  }
+
+  if (memory_budget_mb > 0) {
+    contexts_.reset(new ContextManager(memory_budget_mb << 20));
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("rockchip backend keeps the rknn contexts within ") +
+         std::to_string(memory_budget_mb) + " MB of NPU memory")
+            .c_str());
+  }
+
+  arbiter_.reset(new NpuArbiter(core_count));
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("rockchip backend NPU arbiter ") +
+       (arbiter_enabled_ ? "enabled" : "disabled") + " with " +
+       std::to_string(core_count) + " core(s)")
+          .c_str());
+
+  if (metrics_enabled) {
+    // Triton refuses new metric families when it runs without metrics,
+    // that must not prevent the backend from loading.
+    TRITONSERVER_Error* err =
+        BackendMetrics::Create(core_count, metrics_interval_ms, &metrics_);
+    if (err != nullptr) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("rockchip backend metrics disabled: ") +
+           TRITONSERVER_ErrorMessage(err))
+              .c_str());
+      TRITONSERVER_ErrorDelete(err);
+      metrics_.reset();
+    }
+  }
+  return nullptr;  // success
+}
+
 //
 // ModelState
 //
@@ -22,7 +193,152 @@ class ModelState : public BackendModel {
  public:
   static TRITONSERVER_Error* Create(
       TRITONBACKEND_Model* triton_model, ModelState** state);
-  virtual ~ModelState() = default;
+  virtual ~ModelState();
+
+  // The backend-wide state shared with the other rockchip models.
+  BackendState* StateForBackend() const { return backend_state_; }
+
+  // NPU scheduling parameters, see NpuArbiter.
+  uint32_t NpuWeight() const { return npu_weight_; }
+  int32_t NpuPriority() const { return npu_priority_; }
+  uint32_t NpuCoreMask() const { return npu_core_mask_; }
+
+  // Per-layer profiler, nullptr unless "perf_profile_path" is set.
+  LayerProfiler* Profiler() const { return profiler_.get(); }
+
+  // Backend metrics of this model, nullptr when metrics are disabled.
+  ModelMetrics* Metrics() const { return metrics_.get(); }
+
+  // Input carrying a DmaBufDescriptor in place of the input tensor,
+  // empty unless "dmabuf_input" is set.
+  const std::string& DmaBufInputName() const { return dmabuf_input_name_; }
+  // Imported buffers kept per instance.
+  size_t DmaBufCacheSize() const { return dmabuf_cache_size_; }
+
+  // Whether instances may bind the input with pass_through when the
+  // declared input matches the native input of the model, false if
+  // "input_pass_through" is "off".
+  bool InputPassThroughAllowed() const { return input_pass_through_; }
+  // "format" of the input tensor in the model configuration,
+  // FORMAT_NONE when not given.
+  const std::string& InputFormat() const { return input_format_; }
+
+  // Whether instances bind the outputs in the native layout of the NPU
+  // and convert them on the CPU, "native_output" is "on".
+  bool NativeOutput() const { return native_output_; }
+
+  // Activation fused into the dequantization of the float output
+  // 'name', see DequantJob, from "output_activation".
+  OutputActivation OutputActivationOf(const std::string& name) const
+  {
+    auto it = output_activation_.find(name);
+    if (it != output_activation_.end()) {
+      return it->second;
+    }
+    return default_activation_;
+  }
+
+  // Whether a request asking for "<head>_index" gets the cells of the
+  // detection head whose objectness passes "sparse_output_threshold"
+  // instead of the dense head, see SparseHead.
+  bool SparseOutput() const { return sparse_output_; }
+  float SparseThreshold() const { return sparse_threshold_; }
+  // Channels per anchor and offset of the objectness in them, from
+  // "sparse_output_group".
+  uint32_t SparseGroup() const { return sparse_group_; }
+  uint32_t SparseObjectness() const { return sparse_objectness_; }
+  // Set 'head' if 'name' is the "<head>_index" output of a head of the
+  // model configuration and sparse outputs are on.
+  bool SparseIndexOutput(const std::string& name, std::string* head) const;
+
+  // Each head the backend decodes boxes from, for the cascade and for
+  // tiling, with the width and height of its anchors in input pixels,
+  // from "detection_heads", and the minimum score and NMS overlap of the
+  // boxes.
+  const std::vector<std::pair<std::string, std::vector<float>>>&
+  DetectionHeads() const
+  {
+    return detection_heads_;
+  }
+  float DetectionThreshold() const { return detection_threshold_; }
+  float DetectionIou() const { return detection_iou_; }
+
+  // Whether the boxes decoded from the detection heads are cropped out
+  // of the input image and classified by the second RKNN model
+  // "cascade_model" in the same execution, see
+  // ModelInstanceState::RespondCascadeOutputs.
+  bool Cascade() const { return !cascade_model_.empty(); }
+  // Path of "cascade_model", a relative one is in the version directory
+  // next to model.rknn.
+  std::string CascadeModelPath() const;
+  uint32_t CascadeMaxCrops() const { return cascade_max_crops_; }
+  // Whether 'name' is an output answered by the cascade.
+  bool CascadeOutput(const std::string& name) const;
+
+  // Whether the input is a frame larger than the model input, split
+  // into overlapping tiles that run through the model in batches, see
+  // ModelInstanceState::ExecuteTiled.
+  bool Tiling() const { return tiling_; }
+  // Frame pixels of a tile, 0 for the size of the model input, from
+  // "tile_size".
+  uint32_t TileHeight() const { return tile_height_; }
+  uint32_t TileWidth() const { return tile_width_; }
+  uint32_t TileOverlap() const { return tile_overlap_; }
+  TileMerge TileMergePolicy() const { return tile_merge_; }
+  // Contexts of an instance that run tiles at the same time, from
+  // "tile_parallel".
+  uint32_t TileParallel() const { return tile_parallel_; }
+  uint32_t TileMaxDetections() const { return tile_max_detections_; }
+
+  // Codec the outputs of the responses are compressed with on a worker
+  // thread of each instance, see ResponseCompressor, and its level,
+  // from "response_compression" and "response_compression_level".
+  rk_codec::Codec ResponseCodec() const { return response_codec_; }
+  int ResponseCompressionLevel() const { return response_level_; }
+
+  // Whether an instance hands the responses of a batch to its
+  // completion thread and takes the next batch right away, instead of
+  // answering it in TRITONBACKEND_ModelInstanceExecute, from
+  // "eager_batching".
+  bool EagerBatching() const { return eager_batching_; }
+
+  // The semaphores of the instances running on an NPU core, as the
+  // TensorRT backend keeps them per GPU.
+  struct SemaphoreContext {
+    std::vector<std::unique_ptr<Semaphore>> semaphore_list_;
+  };
+  // Add a semaphore of 'count' for an instance on 'core' to the
+  // context of the core.
+  Semaphore* RegisterSemaphore(const int core, const int count);
+  // Number of instances registered on 'core' so far.
+  size_t SemaphoreCount(const int core);
+
+  // Whether the model keeps implicit state between the requests of a
+  // sequence, the "state" of "sequence_batching", see SequenceStates.
+  bool ImplicitState() const { return !state_tensors_.empty(); }
+  // The input and output names of each state tensor.
+  const std::vector<std::pair<std::string, std::string>>& StateTensors() const
+  {
+    return state_tensors_;
+  }
+  const SequenceControls& SequenceControlInputs() const
+  {
+    return sequence_controls_;
+  }
+  // Number of sequences an instance keeps the state of at once.
+  size_t SequenceSlots() const { return sequence_slots_; }
+
+  // Whether the inputs of the requests of a batch are concatenated
+  // into the NPU inputs, padded up to their static shape, and the
+  // "batch_input" tensors are set alongside: an input is declared
+  // "allow_ragged_batch" or the model has "batch_input" or
+  // "batch_output", see InitializeBatchInputBindings.
+  bool RaggedBatching() const { return ragged_batching_; }
+  // Whether the input 'name' is declared "allow_ragged_batch".
+  bool RaggedInput(const std::string& name) const
+  {
+    return ragged_inputs_.count(name) != 0;
+  }
 
   // Name of the input and output tensor
   const std::string& InputTensorName() const { return input_name_; }
@@ -36,6 +352,19 @@ class ModelState : public BackendModel {
       return it->second;
     return TRITONSERVER_TYPE_UINT8;
    }
+  // Whether the model configuration declares an output TYPE_FP32 or
+  // TYPE_FP16, which the instances dequantize on the CPU when the NPU
+  // produces it quantized, see DequantJob.
+  bool HasFloatOutput() const
+  {
+    for (const auto& dt : output_dt_) {
+      if ((dt.second == TRITONSERVER_TYPE_FP32) ||
+          (dt.second == TRITONSERVER_TYPE_FP16)) {
+        return true;
+      }
+    }
+    return false;
+  }
   std::vector<int64_t>& getOutputshapes(std::string outputname){
     auto it = output_shape_.find(outputname);
     if(it!=output_shape_.end())
@@ -57,10 +386,147 @@ class ModelState : public BackendModel {
   // Validate that this model is supported by this backend.
   TRITONSERVER_Error* ValidateModelConfig();
 
+  // Fill in what the model configuration leaves out from the input
+  // and output attrs of the RKNN model: the name, data_type and dims
+  // of each tensor, the format of the input, max_batch_size from the
+  // batch the model was compiled for and, for a batched model, the
+  // dynamic batcher sized from the time of a warmup run.
+  TRITONSERVER_Error* AutoCompleteConfig();
+
+  // Path of the model.rknn of the version being loaded.
+  std::string ModelPath() const;
+
+  // Runs on zero inputs an instance makes before it takes requests,
+  // from "warmup_runs".
+  uint32_t WarmupRuns() const { return warmup_runs_; }
+
+  // Whether the model is decoupled, "model_transaction_policy", and
+  // streams a response per frame of the clip each request carries, see
+  // ModelInstanceState::ExecuteStreamed.
+  bool Decoupled() const { return decoupled_; }
+  // Whether a response holds the frames of a whole NPU batch instead of
+  // a single one, from "stream_response".
+  bool StreamPerBatch() const { return stream_per_batch_; }
+
+  // Create the context of an instance in 'ctx'. The first instance
+  // loads 'model_path' with 'flags', the next ones share its weights
+  // through rknn_dup_context so that a version holds one copy of them
+  // however many instances it has, and loads faster. Returns the
+  // result of rknn_init or rknn_dup_context.
+  int InitContext(
+      const std::string& model_path, const uint32_t flags, rknn_context* ctx);
+  // Map model.rknn once so that the contexts evicted by the
+  // ContextManager are materialized again from memory, not from the
+  // file system.
+  void MapModelFile();
+  // Stop duplicating 'ctx', its instance is going away.
+  void ReleaseContext(const rknn_context ctx);
+  // Without the arbiter, pin the new context 'ctx' to the cores of
+  // "npu_core_mask" for good; the arbiter otherwise moves the contexts
+  // for each run. 'ctx' is destroyed and zeroed if the runtime refuses
+  // the mask. Returns the result of rknn_set_core_mask.
+  int ApplyCoreMask(rknn_context* ctx);
+
+  // Parses the parameters in config
+  TRITONSERVER_Error* ParseParameters();
+
+  // Check that the "dmabuf_input" input is declared as TYPE_INT64
+  // [ 5 ].
+  TRITONSERVER_Error* ValidateDmaBufInput();
+
+  // Parses the control inputs and implicit state of
+  // "sequence_batching".
+  TRITONSERVER_Error* ParseSequenceBatching();
+
+  // Parses "allow_ragged_batch" and checks that ragged batching goes
+  // with the other parameters.
+  TRITONSERVER_Error* ParseRaggedBatching();
+
+  // Parses "model_transaction_policy" and "stream_response", and checks
+  // that a decoupled model takes clips.
+  TRITONSERVER_Error* ParseStreaming();
+
+  // Parses the "detection_*" parameters, for the cascade and tiling.
+  TRITONSERVER_Error* ParseDetectionHeads(common::TritonJson::Value& params);
+  // Parses the "cascade_*" parameters once "cascade_model" is given.
+  TRITONSERVER_Error* ParseCascade(common::TritonJson::Value& params);
+  // Parses the "tile_*" parameters once "tiling" is on.
+  TRITONSERVER_Error* ParseTiling(common::TritonJson::Value& params);
+
  private:
   ModelState(TRITONBACKEND_Model* triton_model);
 
+  // The tensors of 'attrs' as "input" or "output" entries of the
+  // model configuration, without the batch dimension when the model
+  // batches.
+  TRITONSERVER_Error* GetRefIO(
+      const bool is_input, const std::vector<rknn_tensor_attr>& attrs,
+      common::TritonJson::Value* ref_ios);
+  // Complete the "input" or "output" of the model configuration from
+  // 'ref_ios', matching the tensors by name, or take 'ref_ios' when
+  // the configuration declares none.
+  TRITONSERVER_Error* FixIO(
+      const bool is_input, common::TritonJson::Value& ref_ios);
+  // Set "preferred_batch_size" and "max_queue_delay_microseconds" of
+  // the dynamic batcher of a batched model when they are not given.
+  TRITONSERVER_Error* AutoCompleteDynamicBatching();
+  // Why the configuration keeps the batching it declares, e.g.
+  // "decoupled" or "native_output", or empty when auto-complete may batch the model. Read
+  // from the configuration, which is parsed after auto-complete.
+  std::string UnbatchedReason();
+  // Time a run of the model on zero inputs, in 'run_ns'.
+  TRITONSERVER_Error* TimeWarmupRun(uint64_t* run_ns);
+
+  BackendState* backend_state_;
+  uint32_t npu_weight_;
+  int32_t npu_priority_;
+  uint32_t npu_core_mask_;
+  std::unique_ptr<LayerProfiler> profiler_;
+  std::shared_ptr<ModelMetrics> metrics_;
+  std::string dmabuf_input_name_;
+  size_t dmabuf_cache_size_;
+  bool input_pass_through_;
+  bool native_output_;
+  OutputActivation default_activation_;
+  std::map<std::string, OutputActivation> output_activation_;
+  bool sparse_output_;
+  float sparse_threshold_;
+  uint32_t sparse_group_;
+  uint32_t sparse_objectness_;
+  std::vector<std::pair<std::string, std::vector<float>>> detection_heads_;
+  float detection_threshold_;
+  float detection_iou_;
+  std::string cascade_model_;
+  uint32_t cascade_max_crops_;
+  bool tiling_;
+  uint32_t tile_height_;
+  uint32_t tile_width_;
+  uint32_t tile_overlap_;
+  TileMerge tile_merge_;
+  uint32_t tile_parallel_;
+  uint32_t tile_max_detections_;
+  rk_codec::Codec response_codec_;
+  int response_level_;
+  bool eager_batching_;
+  std::mutex semaphore_mu_;
+  std::map<int, std::unique_ptr<SemaphoreContext>> semaphore_map_;
+  SequenceControls sequence_controls_;
+  std::vector<std::pair<std::string, std::string>> state_tensors_;
+  size_t sequence_slots_;
+  bool ragged_batching_;
+  std::set<std::string> ragged_inputs_;
+  uint32_t warmup_runs_;
+  bool decoupled_;
+  bool stream_per_batch_;
+  std::mutex context_mu_;
+  // Context the next instance duplicates, 0 before the first one.
+  rknn_context weights_ctx_;
+  // model.rknn mapped by MapModelFile, nullptr if not mapped.
+  void* model_data_;
+  size_t model_size_;
+
   std::string input_name_;
+  std::string input_format_;
   // std::string output_name_;
   std::vector<std::string> output_name_;
 
@@ -73,14 +539,54 @@ class ModelState : public BackendModel {
 };
 
 ModelState::ModelState(TRITONBACKEND_Model* triton_model)
-    : BackendModel(triton_model), shape_initialized_(false)
+    : BackendModel(triton_model), backend_state_(nullptr), npu_weight_(1),
+      npu_priority_(0), npu_core_mask_(0), dmabuf_cache_size_(16),
+      input_pass_through_(true), native_output_(false),
+      default_activation_(OutputActivation::NONE), sparse_output_(false),
+      sparse_threshold_(0), sparse_group_(0), sparse_objectness_(0),
+      detection_threshold_(0.25f), detection_iou_(0.45f),
+      cascade_max_crops_(32), tiling_(false), tile_height_(0), tile_width_(0),
+      tile_overlap_(64), tile_merge_(TileMerge::NMS), tile_parallel_(1),
+      tile_max_detections_(300),
+      response_codec_(rk_codec::Codec::NONE), response_level_(0),
+      eager_batching_(false), sequence_slots_(0), ragged_batching_(false),
+      warmup_runs_(1), decoupled_(false), stream_per_batch_(false),
+      weights_ctx_(0), model_data_(nullptr), model_size_(0),
+      input_format_("FORMAT_NONE"),
+      shape_initialized_(false)
 {
-  // Validate that the model's configuration matches what is supported
-  // by this backend.
-  THROW_IF_BACKEND_MODEL_ERROR(ValidateModelConfig());
   TRITONBACKEND_Backend* backend;
   THROW_IF_BACKEND_MODEL_ERROR(
       TRITONBACKEND_ModelBackend(triton_model, &backend));
+  void* vbackendstate;
+  THROW_IF_BACKEND_MODEL_ERROR(
+      TRITONBACKEND_BackendState(backend, &vbackendstate));
+  backend_state_ = reinterpret_cast<BackendState*>(vbackendstate);
+  // With auto-complete, the model fills in what the configuration
+  // leaves out before anything reads it.
+  bool auto_complete_config = false;
+  THROW_IF_BACKEND_MODEL_ERROR(TRITONBACKEND_ModelAutoCompleteConfig(
+      triton_model, &auto_complete_config));
+  if (auto_complete_config) {
+    THROW_IF_BACKEND_MODEL_ERROR(AutoCompleteConfig());
+    THROW_IF_BACKEND_MODEL_ERROR(SetModelConfig());
+  }
+  // Validate that the model's configuration matches what is supported
+  // by this backend.
+  THROW_IF_BACKEND_MODEL_ERROR(ValidateModelConfig());
+  THROW_IF_BACKEND_MODEL_ERROR(ParseParameters());
+  THROW_IF_BACKEND_MODEL_ERROR(ParseSequenceBatching());
+  THROW_IF_BACKEND_MODEL_ERROR(ParseRaggedBatching());
+  THROW_IF_BACKEND_MODEL_ERROR(ParseStreaming());
+  if (backend_state_->Contexts() != nullptr) {
+    MapModelFile();
+  }
+  backend_state_->Arbiter()->RegisterModel(Name(), npu_weight_, npu_priority_);
+  if (backend_state_->Metrics() != nullptr) {
+    LOG_IF_ERROR(
+        backend_state_->Metrics()->RegisterModel(Name(), Version(), &metrics_),
+        (std::string("failed to create metrics of model ") + Name()).c_str());
+  }
   // ModelState* x=reinterpret_cast<ModelState*>(backend);
   
   // LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("bbbbbbbbbbbbbbbbbbb")+std::string("x->batch_output_map_.size(); ")+std::to_string(x->batch_output_map_.size())).c_str());
@@ -122,290 +628,4747 @@ ModelState::Create(TRITONBACKEND_Model* triton_model, ModelState** state)
   return nullptr;  // success
 }
 
-TRITONSERVER_Error*
-ModelState::TensorShape(std::vector<int64_t>& shape)
+ModelState::~ModelState()
 {
-  // This backend supports models that batch along the first dimension
-  // and those that don't batch. For non-batch models the output shape
-  // will be the shape from the model configuration. For batch models
-  // the output shape will be the shape from the model configuration
-  // prepended with [ -1 ] to represent the batch dimension. The
-  // backend "responder" utility used below will set the appropriate
-  // batch dimension value for each response. The shape needs to be
-  // initialized lazily because the SupportsFirstDimBatching function
-  // cannot be used until the model is completely loaded.
-  if (!shape_initialized_) {
-    bool supports_first_dim_batching;
-    RETURN_IF_ERROR(SupportsFirstDimBatching(&supports_first_dim_batching));
-    if (supports_first_dim_batching) {
-      shape_.push_back(-1);
+  if (model_data_ != nullptr) {
+    munmap(model_data_, model_size_);
+  }
+  if (backend_state_ != nullptr) {
+    backend_state_->Arbiter()->UnregisterModel(Name());
+    if ((metrics_ != nullptr) && (backend_state_->Metrics() != nullptr)) {
+      backend_state_->Metrics()->UnregisterModel(Name(), Version());
     }
-
-    shape_.insert(shape_.end(), nb_shape_.begin(), nb_shape_.end());
-    shape_initialized_ = true;
   }
-
-  shape = shape_;
-
-  return nullptr;  // success
 }
 
 TRITONSERVER_Error*
-ModelState::ValidateModelConfig()
+ModelState::ParseParameters()
 {
-  // If verbose logging is enabled, dump the model's configuration as
-  // JSON into the console output.
-  if (TRITONSERVER_LogIsEnabled(TRITONSERVER_LOG_VERBOSE)) {
-    common::TritonJson::WriteBuffer buffer;
-    RETURN_IF_ERROR(ModelConfig().PrettyWrite(&buffer));
-    LOG_MESSAGE(
-        // TRITONSERVER_LOG_VERBOSE,
-        TRITONSERVER_LOG_INFO,
-        (std::string("model configuration:\n") + buffer.Contents()).c_str());
+  triton::common::TritonJson::Value params;
+  if (!ModelConfig().Find("parameters", &params)) {
+    return nullptr;  // success
   }
 
-  // ModelConfig is the model configuration as a TritonJson
-  // object. Use the TritonJson utilities to parse the JSON and
-  // determine if the configuration is supported by this backend.
-  common::TritonJson::Value inputs, outputs;
-  RETURN_IF_ERROR(ModelConfig().MemberAsArray("input", &inputs));
-  RETURN_IF_ERROR(ModelConfig().MemberAsArray("output", &outputs));
-
-  // The model must have exactly 1 input and 1 output.
-//   RETURN_ERROR_IF_FALSE(
-//       inputs.ArraySize() == 1, TRITONSERVER_ERROR_INVALID_ARG,
-//       std::string("model configuration must have 1 input"));
-//   RETURN_ERROR_IF_FALSE(
-//       outputs.ArraySize() == 1, TRITONSERVER_ERROR_INVALID_ARG,
-//       std::string("model configuration must have 1 output"));
+  std::string value_str;
+  int64_t value;
+  TRITONSERVER_Error* err = GetParameterValue(params, "npu_weight", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    RETURN_ERROR_IF_FALSE(
+        value > 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'npu_weight' must be positive, got ") + value_str);
+    npu_weight_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-  common::TritonJson::Value input, output;
-  RETURN_IF_ERROR(inputs.IndexAsObject(0, &input));
-  // RETURN_IF_ERROR(outputs.IndexAsObject(0, &output));
+  err = GetParameterValue(params, "npu_priority", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    npu_priority_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-  // Record the input and output name in the model state.
-  const char* input_name;
-  size_t input_name_len;
-  RETURN_IF_ERROR(input.MemberAsString("name", &input_name, &input_name_len));
-  input_name_ = std::string(input_name);
+  // Cores this model may run on, e.g. "0,2". Empty means any core. A
+  // core the board does not have would never be granted by the
+  // arbiter and every execution would wait for it.
+  err = GetParameterValue(params, "npu_core_mask", &value_str);
+  if (err == nullptr) {
+    const int core_count = backend_state_->Arbiter()->CoreCount();
+    std::stringstream ss(value_str);
+    std::string core;
+    while (std::getline(ss, core, ',')) {
+      RETURN_IF_ERROR(ParseLongLongValue(core, &value));
+      RETURN_ERROR_IF_FALSE(
+          (value >= 0) && (value < core_count),
+          TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("invalid core in 'npu_core_mask': ") + core +
+              ", the NPU has " + std::to_string(core_count) + " core(s)");
+      npu_core_mask_ |= (1u << value);
+    }
+    // Without the arbiter the mask is handed to rknn_set_core_mask,
+    // which only takes a single core, "0,1" or "0,1,2".
+    RETURN_ERROR_IF_FALSE(
+        backend_state_->ArbiterEnabled() || (npu_core_mask_ == 1) ||
+            (npu_core_mask_ == 2) || (npu_core_mask_ == 4) ||
+            (npu_core_mask_ == 3) || (npu_core_mask_ == 7),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'npu_core_mask' ") + value_str +
+            " needs the NPU arbiter, rknn_set_core_mask only takes a "
+            "single core, \"0,1\" or \"0,1,2\"");
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-  for(size_t i=0;i<outputs.ArraySize();i++){
-    const char* output_name;
-    size_t output_name_len;
-    RETURN_IF_ERROR(outputs.IndexAsObject(i, &output));
-    RETURN_IF_ERROR(
-        output.MemberAsString("name", &output_name, &output_name_len));
-        output_name_.push_back(std::string(output_name));
-    
-    const char* dt_name;
-    size_t dt_name_len;
-    RETURN_IF_ERROR(output.MemberAsString("data_type", &dt_name, &dt_name_len));
-    output_dt_.insert(std::make_pair(std::string(output_name),getTritonDT(std::string(dt_name))));
+  // Per-layer profiling, sampled every 'perf_profile_interval'
+  // inferences so that the query and file write cost stays bounded.
+  std::string profile_path;
+  err = GetParameterValue(params, "perf_profile_path", &profile_path);
+  if (err == nullptr) {
+    uint64_t interval = 100;
+    err = GetParameterValue(params, "perf_profile_interval", &value_str);
+    if (err == nullptr) {
+      RETURN_IF_ERROR(ParseUnsignedLongLongValue(value_str, &interval));
+    } else {
+      TRITONSERVER_ErrorDelete(err);
+    }
 
+    LayerProfiler::Format format =
+        ((profile_path.size() > 4) &&
+         (profile_path.compare(profile_path.size() - 4, 4, ".csv") == 0))
+            ? LayerProfiler::Format::CSV
+            : LayerProfiler::Format::JSON;
+    err = GetParameterValue(params, "perf_profile_format", &value_str);
+    if (err == nullptr) {
+      if (value_str == "csv") {
+        format = LayerProfiler::Format::CSV;
+      } else if (value_str == "json") {
+        format = LayerProfiler::Format::JSON;
+      } else {
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INVALID_ARG,
+            (std::string("'perf_profile_format' must be json or csv, got ") +
+             value_str)
+                .c_str());
+      }
+    } else {
+      TRITONSERVER_ErrorDelete(err);
+    }
 
-    common::TritonJson::Value model_config_dims;
-    RETURN_IF_ERROR(output.MemberAsArray("dims", &model_config_dims));
-    std::vector<int64_t> dim_vec;
-    
-    RETURN_IF_ERROR(DimsJsonToDimVec(model_config_dims, &dim_vec));
-    output_shape_.insert(std::make_pair(std::string(output_name),dim_vec));
+    RETURN_IF_ERROR(LayerProfiler::Create(
+        Name(), profile_path, format, interval, &profiler_));
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("model ") + Name() + " writes per-layer NPU profile to " +
+         profile_path + " every " + std::to_string(interval) + " inferences")
+            .c_str());
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-    
+  // Frames handed over as dma-buf fds, e.g. by the hardware video
+  // decoder, instead of being sent as tensor data.
+  err = GetParameterValue(params, "dmabuf_input", &dmabuf_input_name_);
+  if (err == nullptr) {
+    // The fds only come from local clients through the handoff socket,
+    // never from the request itself.
+    RETURN_ERROR_IF_TRUE(
+        backend_state_->Handoff() == nullptr, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'dmabuf_input' needs the backend config "
+                    "dmabuf-socket"));
+    RETURN_IF_ERROR(ValidateDmaBufInput());
+    err = GetParameterValue(params, "dmabuf_cache_size", &value_str);
+    if (err == nullptr) {
+      RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+      RETURN_ERROR_IF_FALSE(
+          value > 0, TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("'dmabuf_cache_size' must be positive, got ") +
+              value_str);
+      dmabuf_cache_size_ = value;
+    } else {
+      TRITONSERVER_ErrorDelete(err);
+    }
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("model ") + Name() + " accepts dma-buf frames in '" +
+         dmabuf_input_name_ + "', caching " +
+         std::to_string(dmabuf_cache_size_) + " imports per instance")
+            .c_str());
+  } else {
+    dmabuf_input_name_.clear();
+    TRITONSERVER_ErrorDelete(err);
   }
-    // {
-    //   std::stringstream ss;
-    // auto&xx=getOutputshapes("output");
-    // for (auto it = xx.begin(); it != xx.end(); it++)    {
-    //     if (it != xx.begin()) {
-    //         ss << " ";
-    //     }
-    //     ss << *it;
-    // }
-    // std::cout << ss.str() << std::endl;  
-    // std::cout << "line 224: --------------------------------------------"<<std::endl;    
-    // ss.str("");
-    // xx=getOutputshapes("376");
-    // for (auto it = xx.begin(); it != xx.end(); it++)    {
-    //     if (it != xx.begin()) {
-    //         ss << " ";
-    //     }
-    //     ss << *it;
-    // }
-    // std::cout << ss.str() << std::endl;  
-    // std::cout << "line 224: --------------------------------------------"<<std::endl;    
-    // ss.str("");
-    // xx=getOutputshapes("377");
-    // for (auto it = xx.begin(); it != xx.end(); it++)    {
-    //     if (it != xx.begin()) {
-    //         ss << " ";
-    //     }
-    //     ss << *it;
-    // }
-    // std::cout << ss.str() << std::endl;  
-    // std::cout << "line 224: --------------------------------------------"<<std::endl;    
-    // }
-  // Input and output must have same datatype
-  std::string input_dtype, output_dtype;
-  RETURN_IF_ERROR(input.MemberAsString("data_type", &input_dtype));
-  RETURN_IF_ERROR(output.MemberAsString("data_type", &output_dtype));
-//   RETURN_ERROR_IF_FALSE(
-//       input_dtype == output_dtype, TRITONSERVER_ERROR_INVALID_ARG,
-//       std::string("expected input and output datatype to match, got ") +
-//           input_dtype + " and " + output_dtype);
-  datatype_ = ModelConfigDataTypeToTritonServerDataType(input_dtype);
 
-  // Input and output must have same shape. Reshape is not supported
-  // on either input or output so flag an error is the model
-  // configuration uses it.
-//   triton::common::TritonJson::Value reshape;
-//   RETURN_ERROR_IF_TRUE(
-//       input.Find("reshape", &reshape), TRITONSERVER_ERROR_UNSUPPORTED,
-//       std::string("reshape not supported for input tensor"));
-//   RETURN_ERROR_IF_TRUE(
-//       output.Find("reshape", &reshape), TRITONSERVER_ERROR_UNSUPPORTED,
-//       std::string("reshape not supported for output tensor"));
+  // Skip the driver conversion of the input when the client already
+  // sends it in the native layout, "off" forces the conversion path,
+  // e.g. to compare both.
+  err = GetParameterValue(params, "input_pass_through", &value_str);
+  if (err == nullptr) {
+    RETURN_ERROR_IF_FALSE(
+        (value_str == "auto") || (value_str == "off"),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'input_pass_through' must be auto or off, got ") +
+            value_str);
+    input_pass_through_ = (value_str == "auto");
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-  std::vector<int64_t> input_shape, output_shape;
-  RETURN_IF_ERROR(backend::ParseShape(input, "dims", &input_shape));
-  RETURN_IF_ERROR(backend::ParseShape(output, "dims", &output_shape));
+  // Let the NPU write its outputs in NC1HWC2 and convert only the ones
+  // a request asks for, instead of rknn_outputs_get converting all of
+  // them on every run.
+  err = GetParameterValue(params, "native_output", &value_str);
+  if (err == nullptr) {
+    RETURN_ERROR_IF_FALSE(
+        (value_str == "on") || (value_str == "off"),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'native_output' must be on or off, got ") + value_str);
+    native_output_ = (value_str == "on");
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-//   RETURN_ERROR_IF_FALSE(
-//       input_shape == output_shape, TRITONSERVER_ERROR_INVALID_ARG,
-//       std::string("expected input and output shape to match, got ") +
-//           backend::ShapeToString(input_shape) + " and " +
-//           backend::ShapeToString(output_shape));
+  // Let Triton hand the next batch to an instance while the previous
+  // one is still being copied out and sent.
+  err = GetParameterValue(params, "eager_batching", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseBoolValue(value_str, &eager_batching_));
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-  nb_shape_ = input_shape;
+  // Activation applied while dequantizing the outputs declared as
+  // TYPE_FP32 or TYPE_FP16, either one for all of them ("sigmoid") or
+  // per output ("output:sigmoid,377:exp").
+  err = GetParameterValue(params, "output_activation", &value_str);
+  if (err == nullptr) {
+    std::stringstream ss(value_str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      const size_t colon = item.find(':');
+      const std::string name =
+          (colon == std::string::npos) ? "" : item.substr(0, colon);
+      const std::string act_str =
+          (colon == std::string::npos) ? item : item.substr(colon + 1);
+      OutputActivation act;
+      RETURN_ERROR_IF_FALSE(
+          ParseOutputActivation(act_str, &act),
+          TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("'output_activation' must be none, sigmoid or exp, "
+                      "got ") +
+              act_str);
+      if (name.empty()) {
+        default_activation_ = act;
+        continue;
+      }
+      auto dt = output_dt_.find(name);
+      RETURN_ERROR_IF_TRUE(
+          dt == output_dt_.end(), TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("'output_activation' names unknown output '") + name +
+              "'");
+      RETURN_ERROR_IF_FALSE(
+          (dt->second == TRITONSERVER_TYPE_FP32) ||
+              (dt->second == TRITONSERVER_TYPE_FP16),
+          TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("'output_activation' needs output '") + name +
+              "' declared as TYPE_FP32 or TYPE_FP16");
+      output_activation_[name] = act;
+    }
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-//   std::string input_string(input_shape.begin(),input_shape.end()),output_string(output_shape.begin(),output_shape.end());
-  std::ostringstream oss;
+  // Channels per anchor of the detection heads and the objectness in
+  // them, for the sparse outputs and the cascade.
+  err = GetParameterValue(params, "sparse_output_group", &value_str);
+  if (err == nullptr) {
+    const size_t colon = value_str.find(':');
+    int64_t group = 0, objectness = -1;
+    if (colon != std::string::npos) {
+      RETURN_IF_ERROR(ParseLongLongValue(value_str.substr(0, colon), &group));
+      RETURN_IF_ERROR(
+          ParseLongLongValue(value_str.substr(colon + 1), &objectness));
+    }
+    RETURN_ERROR_IF_FALSE(
+        (group > 0) && (objectness >= 0) && (objectness < group),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'sparse_output_group' must be <channels per anchor>:"
+                    "<objectness channel>, e.g. 27:4, got '") +
+            value_str + "'");
+    sparse_group_ = group;
+    sparse_objectness_ = objectness;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
 
-  if (!input_shape.empty() && !output_shape.empty())
+  // Return only the detection cells above an objectness threshold, in
+  // the domain of the dequantized (and activated) head.
+  err = GetParameterValue(params, "sparse_output_threshold", &value_str);
+  if (err == nullptr) {
+    double threshold;
+    RETURN_IF_ERROR(ParseDoubleValue(value_str, &threshold));
+    sparse_threshold_ = threshold;
+    sparse_output_ = true;
+    RETURN_ERROR_IF_TRUE(
+        sparse_group_ == 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'sparse_output_threshold' needs 'sparse_output_group' "
+                    "as <channels per anchor>:<objectness channel>, e.g. "
+                    "27:4"));
+    for (const auto& name : output_name_) {
+      std::string head;
+      if (SparseIndexOutput(name, &head)) {
+        RETURN_ERROR_IF_FALSE(
+            output_dt_[name] == TRITONSERVER_TYPE_INT32,
+            TRITONSERVER_ERROR_INVALID_ARG,
+            std::string("sparse output '") + name +
+                "' must be declared as TYPE_INT32 [ -1, 4 ]");
+      }
+    }
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+
+  // Classify the detections of this model with a second one inside the
+  // backend, instead of a round trip through the client per frame.
+  err = GetParameterValue(params, "cascade_model", &cascade_model_);
+  if (err != nullptr) {
+    cascade_model_.clear();
+    TRITONSERVER_ErrorDelete(err);
+  }
+  // Run frames larger than the model input as tiles and merge their
+  // detections, instead of downscaling them.
+  err = GetParameterValue(params, "tiling", &value_str);
+  if (err == nullptr) {
+    RETURN_ERROR_IF_FALSE(
+        (value_str == "on") || (value_str == "off"),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'tiling' must be on or off, got ") + value_str);
+    tiling_ = (value_str == "on");
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  if (Cascade() || tiling_) {
+    RETURN_ERROR_IF_TRUE(
+        Cascade() && tiling_, TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("'cascade_model' cannot be combined with 'tiling'"));
+    RETURN_IF_ERROR(ParseDetectionHeads(params));
+  }
+  if (Cascade()) {
+    RETURN_IF_ERROR(ParseCascade(params));
+  }
+  if (tiling_) {
+    RETURN_IF_ERROR(ParseTiling(params));
+  }
+
+  // Compress the output tensors of the responses, for clients on a
+  // slow link. The level defaults to the fast end of each codec.
+  err = GetParameterValue(params, "response_compression", &value_str);
+  if (err == nullptr) {
+    RETURN_ERROR_IF_FALSE(
+        rk_codec::CodecFromName(value_str, &response_codec_),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'response_compression' must be none, lz4 or zstd, "
+                    "got '") +
+            value_str + "'");
+    RETURN_ERROR_IF_FALSE(
+        rk_codec::CodecAvailable(response_codec_),
+        TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("'response_compression' ") + value_str +
+            " is not compiled into the backend");
+    response_level_ = (response_codec_ == rk_codec::Codec::ZSTD) ? 1 : 0;
+    err = GetParameterValue(params, "response_compression_level", &value_str);
+    if (err == nullptr) {
+      int64_t level;
+      RETURN_IF_ERROR(ParseLongLongValue(value_str, &level));
+      response_level_ = level;
+    } else {
+      TRITONSERVER_ErrorDelete(err);
+    }
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+
+  // Runs each instance makes before taking requests, so that the first
+  // requests served by a version swapped in under traffic do not pay
+  // for the lazy setup of the NPU. 0 turns the warmup off.
+  err = GetParameterValue(params, "warmup_runs", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    RETURN_ERROR_IF_FALSE(
+        value >= 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'warmup_runs' must not be negative, got ") + value_str);
+    warmup_runs_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+
+  std::stringstream mask_ss;
+  mask_ss << std::hex << npu_core_mask_;
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("model ") + Name() + " npu_weight=" +
+       std::to_string(npu_weight_) + ", npu_priority=" +
+       std::to_string(npu_priority_) + ", npu_core_mask=0x" + mask_ss.str())
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseDetectionHeads(common::TritonJson::Value& params)
+{
+  // The boxes are cropped or tiled out of the image input of the
+  // request, in the layout of the model configuration.
+  RETURN_ERROR_IF_FALSE(
+      (datatype_ == TRITONSERVER_TYPE_INT8) ||
+          (datatype_ == TRITONSERVER_TYPE_UINT8),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'cascade_model' and 'tiling' need the image input "
+                  "declared as TYPE_INT8 or TYPE_UINT8"));
+  RETURN_ERROR_IF_FALSE(
+      nb_shape_.size() == 3, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'cascade_model' and 'tiling' need a 3-D image input"));
+  RETURN_ERROR_IF_TRUE(
+      native_output_ || !dmabuf_input_name_.empty(),
+      TRITONSERVER_ERROR_UNSUPPORTED,
+      std::string("'cascade_model' and 'tiling' cannot be combined with "
+                  "'native_output' or 'dmabuf_input'"));
+  RETURN_ERROR_IF_FALSE(
+      sparse_objectness_ >= 4, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("decoding detections needs 'sparse_output_group' with "
+                  "the box in the first 4 channels of each anchor, e.g. "
+                  "27:4"));
+
+  // "output:10,13,16,30,33,23;376:30,61,62,45,59,119", the width and
+  // height of the anchors of each head in input pixels.
+  std::string value_str;
+  TRITONSERVER_Error* err =
+      GetParameterValue(params, "detection_heads", &value_str);
+  if (err != nullptr) {
+    TRITONSERVER_ErrorDelete(err);
+    value_str.clear();
+  }
+  std::stringstream ss(value_str);
+  std::string item;
+  while (std::getline(ss, item, ';')) {
+    const size_t colon = item.find(':');
+    RETURN_ERROR_IF_TRUE(
+        colon == std::string::npos, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'detection_heads' entries must be <head>:<anchor "
+                    "width>,<anchor height>,..., got '") +
+            item + "'");
+    const std::string name = item.substr(0, colon);
+    RETURN_ERROR_IF_TRUE(
+        output_dt_.find(name) == output_dt_.end(),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'detection_heads' names unknown output '") + name +
+            "'");
+    std::vector<float> anchors;
+    std::stringstream anchor_ss(item.substr(colon + 1));
+    std::string anchor;
+    while (std::getline(anchor_ss, anchor, ',')) {
+      double size;
+      RETURN_IF_ERROR(ParseDoubleValue(anchor, &size));
+      RETURN_ERROR_IF_FALSE(
+          size > 0, TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("'detection_heads' anchors must be positive, got ") +
+              anchor);
+      anchors.push_back(size);
+    }
+    RETURN_ERROR_IF_TRUE(
+        anchors.empty() || (anchors.size() % 2 != 0),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'detection_heads' needs a width and a height per "
+                    "anchor of head '") +
+            name + "'");
+    detection_heads_.emplace_back(name, anchors);
+  }
+  RETURN_ERROR_IF_TRUE(
+      detection_heads_.empty(), TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'cascade_model' and 'tiling' need 'detection_heads' as "
+                  "<head>:<anchor width>,<anchor height>,...;..., e.g. "
+                  "output:10,13,16,30,33,23"));
+
+  double ratio;
+  err = GetParameterValue(params, "detection_threshold", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseDoubleValue(value_str, &ratio));
+    RETURN_ERROR_IF_FALSE(
+        (ratio >= 0) && (ratio < 1), TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'detection_threshold' must be in [0, 1), got ") +
+            value_str);
+    detection_threshold_ = ratio;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  err = GetParameterValue(params, "detection_iou", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseDoubleValue(value_str, &ratio));
+    RETURN_ERROR_IF_FALSE(
+        (ratio > 0) && (ratio <= 1), TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'detection_iou' must be in (0, 1], got ") + value_str);
+    detection_iou_ = ratio;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseCascade(common::TritonJson::Value& params)
+{
+  std::string value_str;
+  TRITONSERVER_Error* err =
+      GetParameterValue(params, "cascade_max_crops", &value_str);
+  if (err == nullptr) {
+    int64_t value;
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    RETURN_ERROR_IF_FALSE(
+        value > 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'cascade_max_crops' must be positive, got ") +
+            value_str);
+    cascade_max_crops_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+
+  for (const char* name : {kCascadeDetectionsOutput, kCascadeClassesOutput}) {
+    auto dt = output_dt_.find(name);
+    RETURN_ERROR_IF_TRUE(
+        (dt != output_dt_.end()) && (dt->second != TRITONSERVER_TYPE_FP32),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("cascade output '") + name +
+            "' must be declared as TYPE_FP32");
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("model ") + Name() + " classifies up to " +
+       std::to_string(cascade_max_crops_) + " detections per request with " +
+       CascadeModelPath())
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseTiling(common::TritonJson::Value& params)
+{
+  // The completion thread answers the outputs of the NPU as they are,
+  // the tiles are answered by the execute thread.
+  RETURN_ERROR_IF_TRUE(
+      eager_batching_, TRITONSERVER_ERROR_UNSUPPORTED,
+      std::string("'tiling' cannot be combined with 'eager_batching'"));
+
+  // "<height>x<width>" in frame pixels, the tiles are resized to the
+  // model input when they differ from it.
+  std::string value_str;
+  int64_t value;
+  TRITONSERVER_Error* err = GetParameterValue(params, "tile_size", &value_str);
+  if (err == nullptr) {
+    const size_t x = value_str.find('x');
+    int64_t height = 0, width = 0;
+    if (x != std::string::npos) {
+      RETURN_IF_ERROR(ParseLongLongValue(value_str.substr(0, x), &height));
+      RETURN_IF_ERROR(ParseLongLongValue(value_str.substr(x + 1), &width));
+    }
+    RETURN_ERROR_IF_FALSE(
+        (height > 0) && (width > 0), TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'tile_size' must be <height>x<width>, e.g. 384x640, "
+                    "got '") +
+            value_str + "'");
+    tile_height_ = height;
+    tile_width_ = width;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  err = GetParameterValue(params, "tile_overlap", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    RETURN_ERROR_IF_FALSE(
+        value >= 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'tile_overlap' must not be negative, got ") +
+            value_str);
+    tile_overlap_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  err = GetParameterValue(params, "tile_merge", &value_str);
+  if (err == nullptr) {
+    RETURN_ERROR_IF_FALSE(
+        ParseTileMerge(value_str, &tile_merge_),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'tile_merge' must be nms, class_nms or none, got ") +
+            value_str);
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  err = GetParameterValue(params, "tile_parallel", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    RETURN_ERROR_IF_FALSE(
+        value > 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'tile_parallel' must be positive, got ") + value_str);
+    tile_parallel_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  err = GetParameterValue(params, "tile_max_detections", &value_str);
+  if (err == nullptr) {
+    RETURN_IF_ERROR(ParseLongLongValue(value_str, &value));
+    RETURN_ERROR_IF_FALSE(
+        value > 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'tile_max_detections' must be positive, got ") +
+            value_str);
+    tile_max_detections_ = value;
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+
+  auto dt = output_dt_.find(kTiledDetectionsOutput);
+  RETURN_ERROR_IF_TRUE(
+      (dt != output_dt_.end()) && (dt->second != TRITONSERVER_TYPE_FP32),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("tiled output '") + kTiledDetectionsOutput +
+          "' must be declared as TYPE_FP32");
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("model ") + Name() + " tiles its input with " +
+       std::to_string(tile_overlap_) + " pixels of overlap on " +
+       std::to_string(tile_parallel_) + " contexts per instance")
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseSequenceBatching()
+{
+  common::TritonJson::Value sequence_batching;
+  if (!ModelConfig().Find("sequence_batching", &sequence_batching)) {
+    return nullptr;  // success
+  }
+
+  common::TritonJson::Value control_inputs;
+  if (sequence_batching.Find("control_input", &control_inputs)) {
+    for (size_t i = 0; i < control_inputs.ArraySize(); ++i) {
+      common::TritonJson::Value control_input;
+      RETURN_IF_ERROR(control_inputs.IndexAsObject(i, &control_input));
+      std::string name;
+      RETURN_IF_ERROR(control_input.MemberAsString("name", &name));
+      common::TritonJson::Value controls;
+      RETURN_IF_ERROR(control_input.MemberAsArray("control", &controls));
+      for (size_t c = 0; c < controls.ArraySize(); ++c) {
+        common::TritonJson::Value control;
+        RETURN_IF_ERROR(controls.IndexAsObject(c, &control));
+        std::string kind;
+        RETURN_IF_ERROR(control.MemberAsString("kind", &kind));
+        if (kind == "CONTROL_SEQUENCE_CORRID") {
+          sequence_controls_.corrid_ = name;
+          continue;
+        }
+        SequenceControlInput* target = nullptr;
+        if (kind == "CONTROL_SEQUENCE_START") {
+          target = &sequence_controls_.start_;
+        } else if (kind == "CONTROL_SEQUENCE_END") {
+          target = &sequence_controls_.end_;
+        } else if (kind == "CONTROL_SEQUENCE_READY") {
+          target = &sequence_controls_.ready_;
+        } else {
+          return TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_UNSUPPORTED,
+              (std::string("sequence control ") + kind + " of '" + name +
+               "' is not supported")
+                  .c_str());
+        }
+        target->name_ = name;
+        // The true value is the second of the *_false_true pair.
+        common::TritonJson::Value false_true;
+        if (control.Find("int32_false_true", &false_true) &&
+            (false_true.ArraySize() == 2)) {
+          int64_t value;
+          RETURN_IF_ERROR(false_true.IndexAsInt(1, &value));
+          target->true_value_ = value;
+        } else if (
+            control.Find("fp32_false_true", &false_true) &&
+            (false_true.ArraySize() == 2)) {
+          RETURN_IF_ERROR(false_true.IndexAsDouble(1, &target->true_value_));
+        } else if (
+            control.Find("bool_false_true", &false_true) &&
+            (false_true.ArraySize() == 2)) {
+          bool value;
+          RETURN_IF_ERROR(false_true.IndexAsBool(1, &value));
+          target->true_value_ = value ? 1 : 0;
+        }
+      }
+    }
+  }
+
+  common::TritonJson::Value states;
+  if (sequence_batching.Find("state", &states)) {
+    for (size_t i = 0; i < states.ArraySize(); ++i) {
+      common::TritonJson::Value state;
+      RETURN_IF_ERROR(states.IndexAsObject(i, &state));
+      std::string input_name, output_name;
+      RETURN_IF_ERROR(state.MemberAsString("input_name", &input_name));
+      RETURN_IF_ERROR(state.MemberAsString("output_name", &output_name));
+      // The state starts from zero, it never leaves the NPU to be set
+      // from a file.
+      common::TritonJson::Value initial_states;
+      if (state.Find("initial_state", &initial_states)) {
+        for (size_t s = 0; s < initial_states.ArraySize(); ++s) {
+          common::TritonJson::Value initial_state;
+          RETURN_IF_ERROR(initial_states.IndexAsObject(s, &initial_state));
+          RETURN_ERROR_IF_TRUE(
+              initial_state.Find("data_file"), TRITONSERVER_ERROR_UNSUPPORTED,
+              std::string("initial_state of '") + input_name +
+                  "' must be zero_data");
+        }
+      }
+      state_tensors_.emplace_back(input_name, output_name);
+    }
+  }
+  // The state of a sequence is bound in place of its NPU input and
+  // output, a request per run, so the requests cannot be batched.
+  RETURN_ERROR_IF_TRUE(
+      !state_tensors_.empty() && (MaxBatchSize() > 1),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("model ") + Name() +
+          " keeps implicit state, which cannot be batched, set "
+          "max_batch_size to 1");
+
+  // Triton runs at most this many sequences on an instance at once.
+  sequence_slots_ = std::max(1, MaxBatchSize());
+  common::TritonJson::Value oldest;
+  if (sequence_batching.Find("oldest", &oldest)) {
+    int64_t candidates = 0;
+    if (oldest.Find("max_candidate_sequences")) {
+      RETURN_IF_ERROR(
+          oldest.MemberAsInt("max_candidate_sequences", &candidates));
+    }
+    sequence_slots_ = std::max<int64_t>(candidates, 1);
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseStreaming()
+{
+  common::TritonJson::Value policy;
+  if (ModelConfig().Find("model_transaction_policy", &policy)) {
+    common::TritonJson::Value decoupled;
+    if (policy.Find("decoupled", &decoupled)) {
+      RETURN_IF_ERROR(decoupled.AsBool(&decoupled_));
+    }
+  }
+  if (!decoupled_) {
+    return nullptr;  // success
+  }
+
+  // The frames of a clip are counted by the first dimension of the
+  // input, Triton would bound it by max_batch_size otherwise.
+  RETURN_ERROR_IF_TRUE(
+      MaxBatchSize() != 0, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("a decoupled model takes the frames of a clip in the "
+                  "first dimension of its input, set max_batch_size to 0"));
+  RETURN_ERROR_IF_FALSE(
+      (nb_shape_.size() >= 2) && (nb_shape_[0] == -1),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("a decoupled model must declare its input with a "
+                  "leading -1 frame dimension, e.g. dims: [ -1, 3, 384, "
+                  "640 ]"));
+  for (const auto& output : output_shape_) {
+    RETURN_ERROR_IF_FALSE(
+        !output.second.empty() && (output.second[0] == -1),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("output '") + output.first +
+            "' of a decoupled model must have a leading -1 frame "
+            "dimension");
+  }
+  // The frames go through the plain input and outputs of the NPU.
+  RETURN_ERROR_IF_TRUE(
+      eager_batching_ || native_output_ || sparse_output_ || Cascade() ||
+          tiling_ || !dmabuf_input_name_.empty() || ImplicitState() ||
+          ragged_batching_,
+      TRITONSERVER_ERROR_UNSUPPORTED,
+      std::string("a decoupled model cannot be combined with "
+                  "'eager_batching', 'native_output', sparse outputs, "
+                  "'cascade_model', 'tiling', 'dmabuf_input', sequence "
+                  "state or ragged batching"));
+
+  common::TritonJson::Value params;
+  if (ModelConfig().Find("parameters", &params)) {
+    std::string value_str;
+    TRITONSERVER_Error* err =
+        GetParameterValue(params, "stream_response", &value_str);
+    if (err == nullptr) {
+      RETURN_ERROR_IF_FALSE(
+          (value_str == "frame") || (value_str == "batch"),
+          TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("'stream_response' must be frame or batch, got ") +
+              value_str);
+      stream_per_batch_ = (value_str == "batch");
+    } else {
+      TRITONSERVER_ErrorDelete(err);
+    }
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("model ") + Name() + " streams a response per " +
+       (stream_per_batch_ ? "batch of frames" : "frame"))
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseRaggedBatching()
+{
+  common::TritonJson::Value inputs;
+  RETURN_IF_ERROR(ModelConfig().MemberAsArray("input", &inputs));
+  for (size_t i = 0; i < inputs.ArraySize(); ++i) {
+    common::TritonJson::Value input;
+    RETURN_IF_ERROR(inputs.IndexAsObject(i, &input));
+    bool ragged = false;
+    if (input.Find("allow_ragged_batch")) {
+      RETURN_IF_ERROR(input.MemberAsBool("allow_ragged_batch", &ragged));
+    }
+    if (ragged) {
+      std::string name;
+      RETURN_IF_ERROR(input.MemberAsString("name", &name));
+      ragged_inputs_.insert(name);
+    }
+  }
+  ragged_batching_ = !ragged_inputs_.empty() || !BatchInputs().empty() ||
+                     !BatchOutputs().empty();
+  if (!ragged_batching_) {
+    return nullptr;  // success
+  }
+
+  RETURN_ERROR_IF_FALSE(
+      MaxBatchSize() > 0, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("ragged batching of model ") + Name() +
+          " needs max_batch_size > 0");
+  // These bind a single request to the NPU.
+  RETURN_ERROR_IF_FALSE(
+      dmabuf_input_name_.empty(), TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("ragged batching cannot be combined with 'dmabuf_input'"));
+  RETURN_ERROR_IF_TRUE(
+      native_output_, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("ragged batching cannot be combined with 'native_output'"));
+  RETURN_ERROR_IF_TRUE(
+      ImplicitState(), TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("ragged batching cannot be combined with the \"state\" "
+                  "of \"sequence_batching\""));
+  for (const auto& batch_output : BatchOutputs()) {
+    RETURN_ERROR_IF_FALSE(
+        batch_output.BatchOutputKind() ==
+            BatchOutput::Kind::BATCH_SCATTER_WITH_INPUT_SHAPE,
+        TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("batch output kind other than "
+                    "BATCH_SCATTER_WITH_INPUT_SHAPE is not supported"));
+  }
+  return nullptr;  // success
+}
+
+Semaphore*
+ModelState::RegisterSemaphore(const int core, const int count)
+{
+  std::lock_guard<std::mutex> lk(semaphore_mu_);
+  auto it = semaphore_map_.find(core);
+  if (it == semaphore_map_.end()) {
+    it = semaphore_map_
+             .emplace(std::make_pair(core, new SemaphoreContext()))
+             .first;
+  }
+  it->second->semaphore_list_.emplace_back(new Semaphore(count));
+  return it->second->semaphore_list_.back().get();
+}
+
+size_t
+ModelState::SemaphoreCount(const int core)
+{
+  std::lock_guard<std::mutex> lk(semaphore_mu_);
+  auto it = semaphore_map_.find(core);
+  return (it == semaphore_map_.end()) ? 0
+                                      : it->second->semaphore_list_.size();
+}
+
+TRITONSERVER_Error*
+ModelState::ValidateDmaBufInput()
+{
+  common::TritonJson::Value inputs;
+  RETURN_IF_ERROR(ModelConfig().MemberAsArray("input", &inputs));
+  for (size_t i = 0; i < inputs.ArraySize(); ++i) {
+    common::TritonJson::Value input;
+    RETURN_IF_ERROR(inputs.IndexAsObject(i, &input));
+    std::string name;
+    RETURN_IF_ERROR(input.MemberAsString("name", &name));
+    if (name != dmabuf_input_name_) {
+      continue;
+    }
+    RETURN_ERROR_IF_TRUE(
+        i == 0, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'dmabuf_input' must follow the input tensor"));
+    std::string data_type;
+    RETURN_IF_ERROR(input.MemberAsString("data_type", &data_type));
+    std::vector<int64_t> dims;
+    RETURN_IF_ERROR(backend::ParseShape(input, "dims", &dims));
+    RETURN_ERROR_IF_FALSE(
+        (data_type == "TYPE_INT64") && (dims.size() == 1) &&
+            (dims[0] == (int64_t)kDmaBufDescriptorElements),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("'dmabuf_input' ") + name +
+            " must be TYPE_INT64 with dims [ " +
+            std::to_string(kDmaBufDescriptorElements) + " ]");
+    return nullptr;  // success
+  }
+  return TRITONSERVER_ErrorNew(
+      TRITONSERVER_ERROR_INVALID_ARG,
+      (std::string("'dmabuf_input' ") + dmabuf_input_name_ +
+       " is not an input of the model")
+          .c_str());
+}
+
+TRITONSERVER_Error*
+ModelState::TensorShape(std::vector<int64_t>& shape)
+{
+  // This backend supports models that batch along the first dimension
+  // and those that don't batch. For non-batch models the output shape
+  // will be the shape from the model configuration. For batch models
+  // the output shape will be the shape from the model configuration
+  // prepended with [ -1 ] to represent the batch dimension. The
+  // backend "responder" utility used below will set the appropriate
+  // batch dimension value for each response. The shape needs to be
+  // initialized lazily because the SupportsFirstDimBatching function
+  // cannot be used until the model is completely loaded.
+  if (!shape_initialized_) {
+    bool supports_first_dim_batching;
+    RETURN_IF_ERROR(SupportsFirstDimBatching(&supports_first_dim_batching));
+    if (supports_first_dim_batching) {
+      shape_.push_back(-1);
+    }
+
+    shape_.insert(shape_.end(), nb_shape_.begin(), nb_shape_.end());
+    shape_initialized_ = true;
+  }
+
+  shape = shape_;
+
+  return nullptr;  // success
+}
+
+bool
+ModelState::SparseIndexOutput(const std::string& name, std::string* head) const
+{
+  static const std::string suffix("_index");
+  if (!sparse_output_ || (name.size() <= suffix.size()) ||
+      (name.compare(name.size() - suffix.size(), suffix.size(), suffix) !=
+       0)) {
+    return false;
+  }
+  const std::string candidate = name.substr(0, name.size() - suffix.size());
+  if (output_dt_.find(candidate) == output_dt_.end()) {
+    return false;
+  }
+  *head = candidate;
+  return true;
+}
+
+namespace {
+
+// Runs timed by TimeWarmupRun after the one warming the NPU up.
+constexpr int kWarmupTimedRuns = 5;
+
+// The model configuration data_type of the RKNN tensor 'type'.
+const char*
+ModelConfigDataType(const rknn_tensor_type type)
+{
+  switch (type) {
+    case RKNN_TENSOR_FLOAT32:
+      return "TYPE_FP32";
+    case RKNN_TENSOR_FLOAT16:
+      return "TYPE_FP16";
+    case RKNN_TENSOR_INT8:
+      return "TYPE_INT8";
+    case RKNN_TENSOR_UINT8:
+      return "TYPE_UINT8";
+    case RKNN_TENSOR_INT16:
+      return "TYPE_INT16";
+    case RKNN_TENSOR_UINT16:
+      return "TYPE_UINT16";
+    case RKNN_TENSOR_INT32:
+      return "TYPE_INT32";
+    case RKNN_TENSOR_UINT32:
+      return "TYPE_UINT32";
+    case RKNN_TENSOR_INT64:
+      return "TYPE_INT64";
+    case RKNN_TENSOR_BOOL:
+      return "TYPE_BOOL";
+    default:
+      break;
+  }
+  return "TYPE_INVALID";
+}
+
+// The attr of the input 'attr' of 'ctx' as the NPU takes it, when
+// that is still a plain layout of the same elements, 'attr' otherwise.
+rknn_tensor_attr
+PlainNativeInputAttr(rknn_context ctx, const rknn_tensor_attr& attr)
+{
+  rknn_tensor_attr native;
+  memset(&native, 0, sizeof(native));
+  native.index = attr.index;
+  if ((rknn_query(
+           ctx, RKNN_QUERY_NATIVE_INPUT_ATTR, &native, sizeof(native)) >=
+       0) &&
+      ((native.fmt == RKNN_TENSOR_NHWC) || (native.fmt == RKNN_TENSOR_NCHW)) &&
+      (native.n_elems == attr.n_elems)) {
+    return native;
+  }
+  return attr;
+}
+
+// The input and output attrs of the model of 'ctx', as the runtime
+// reports them.
+TRITONSERVER_Error*
+QueryPlainModelAttrs(
+    rknn_context ctx, rknn_input_output_num* io_num,
+    std::vector<rknn_tensor_attr>* input_attrs,
+    std::vector<rknn_tensor_attr>* output_attrs)
+{
+  int ret = rknn_query(ctx, RKNN_QUERY_IN_OUT_NUM, io_num, sizeof(*io_num));
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_query RKNN_QUERY_IN_OUT_NUM, ret=") +
+          std::to_string(ret));
+  input_attrs->resize(io_num->n_input);
+  for (uint32_t i = 0; i < io_num->n_input; ++i) {
+    rknn_tensor_attr& attr = (*input_attrs)[i];
+    memset(&attr, 0, sizeof(attr));
+    attr.index = i;
+    ret = rknn_query(ctx, RKNN_QUERY_INPUT_ATTR, &attr, sizeof(attr));
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_query RKNN_QUERY_INPUT_ATTR ") +
+            std::to_string(i) + ", ret=" + std::to_string(ret));
+  }
+  output_attrs->resize(io_num->n_output);
+  for (uint32_t i = 0; i < io_num->n_output; ++i) {
+    rknn_tensor_attr& attr = (*output_attrs)[i];
+    memset(&attr, 0, sizeof(attr));
+    attr.index = i;
+    ret = rknn_query(ctx, RKNN_QUERY_OUTPUT_ATTR, &attr, sizeof(attr));
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_query RKNN_QUERY_OUTPUT_ATTR ") +
+            std::to_string(i) + ", ret=" + std::to_string(ret));
+  }
+  return nullptr;  // success
+}
+
+// The input and output attrs of the model of 'ctx'. An input the NPU
+// takes as is in a plain layout is described by its native attr, so
+// that instances bind the input of a completed configuration with
+// pass_through.
+TRITONSERVER_Error*
+QueryModelAttrs(
+    rknn_context ctx, std::vector<rknn_tensor_attr>* input_attrs,
+    std::vector<rknn_tensor_attr>* output_attrs)
+{
+  rknn_input_output_num io_num;
+  RETURN_IF_ERROR(
+      QueryPlainModelAttrs(ctx, &io_num, input_attrs, output_attrs));
+  for (rknn_tensor_attr& attr : *input_attrs) {
+    attr = PlainNativeInputAttr(ctx, attr);
+  }
+  return nullptr;  // success
+}
+
+// Set every input of 'ctx' to zeros, from 'buffers'.
+TRITONSERVER_Error*
+SetZeroInputs(
+    rknn_context ctx, std::vector<std::vector<uint8_t>>* buffers)
+{
+  std::vector<rknn_tensor_attr> input_attrs, output_attrs;
+  RETURN_IF_ERROR(QueryModelAttrs(ctx, &input_attrs, &output_attrs));
+  buffers->resize(input_attrs.size());
+  std::vector<rknn_input> inputs(input_attrs.size());
+  for (size_t i = 0; i < input_attrs.size(); ++i) {
+    const rknn_tensor_attr& attr = input_attrs[i];
+    const size_t byte_size =
+        attr.n_elems *
+        TRITONSERVER_DataTypeByteSize(ModelConfigDataTypeToTritonServerDataType(
+            ModelConfigDataType(attr.type)));
+    RETURN_ERROR_IF_TRUE(
+        byte_size == 0, TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("input ") + attr.name + " of type " +
+            get_type_string(attr.type) + " cannot be fed to a warmup run");
+    (*buffers)[i].assign(byte_size, 0);
+    memset(&inputs[i], 0, sizeof(rknn_input));
+    inputs[i].index = attr.index;
+    inputs[i].buf = (*buffers)[i].data();
+    inputs[i].size = byte_size;
+    inputs[i].pass_through = 0;
+    inputs[i].type = attr.type;
+    inputs[i].fmt = attr.fmt;
+  }
+  const int ret = rknn_inputs_set(ctx, inputs.size(), inputs.data());
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_inputs_set, ret=") + std::to_string(ret));
+  return nullptr;  // success
+}
+
+// Time the runs of 'ctx' on zero inputs, the fastest of
+// kWarmupTimedRuns after one that warms the NPU up, in 'run_ns'. With
+// an 'arbiter' each run waits for a core like those of the instances
+// of 'model_name' and is charged to it.
+TRITONSERVER_Error*
+TimeRuns(
+    rknn_context ctx, NpuArbiter* arbiter, const std::string& model_name,
+    uint64_t* run_ns)
+{
+  std::vector<std::vector<uint8_t>> buffers;
+  RETURN_IF_ERROR(SetZeroInputs(ctx, &buffers));
+  int ret = 0;
+  int bound_core = -1;
+  *run_ns = 0;
+  for (int r = 0; r <= kWarmupTimedRuns; ++r) {
+    int core = -1;
+    if (arbiter != nullptr) {
+      core = arbiter->Acquire(model_name, 0 /* core_mask */, bound_core);
+      if ((core != bound_core) && (arbiter->CoreCount() > 1)) {
+        ret = rknn_set_core_mask(ctx, (rknn_core_mask)(1 << core));
+        if (ret < 0) {
+          arbiter->Release(model_name, core, 0);
+          return TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_INTERNAL,
+              (std::string("fail to rknn_set_core_mask to core ") +
+               std::to_string(core) + ", ret=" + std::to_string(ret))
+                  .c_str());
+        }
+      }
+      bound_core = core;
+    }
+    uint64_t start_ns, end_ns;
+    SET_TIMESTAMP(start_ns);
+    ret = rknn_run(ctx, nullptr);
+    SET_TIMESTAMP(end_ns);
+    if (arbiter != nullptr) {
+      arbiter->Release(model_name, core, end_ns - start_ns);
+    }
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_run, ret=") + std::to_string(ret));
+    if ((r > 0) && ((*run_ns == 0) || (end_ns - start_ns < *run_ns))) {
+      *run_ns = end_ns - start_ns;
+    }
+  }
+  return nullptr;  // success
+}
+
+}  // namespace
+
+std::string
+ModelState::ModelPath() const
+{
+  return RepositoryPath() + "/" + std::to_string(Version()) + "/model.rknn";
+}
+
+std::string
+ModelState::CascadeModelPath() const
+{
+  if (!cascade_model_.empty() && (cascade_model_[0] == '/')) {
+    return cascade_model_;
+  }
+  return RepositoryPath() + "/" + std::to_string(Version()) + "/" +
+         cascade_model_;
+}
+
+bool
+ModelState::CascadeOutput(const std::string& name) const
+{
+  return Cascade() && ((name == kCascadeDetectionsOutput) ||
+                       (name == kCascadeClassesOutput));
+}
+
+int
+ModelState::InitContext(
+    const std::string& model_path, const uint32_t flags, rknn_context* ctx)
+{
+  bool duplicated = false;
   {
-    // Convert all but the last element to avoid a trailing ","
-    std::copy(input_shape.begin(), input_shape.end()-1,
-        std::ostream_iterator<int>(oss, ","));
+    // The lock keeps the duplicated context alive, it is not held
+    // across rknn_init as the ContextManager takes it to evict.
+    std::lock_guard<std::mutex> lk(context_mu_);
+    if (weights_ctx_ != 0) {
+      const int ret = rknn_dup_context(&weights_ctx_, ctx);
+      duplicated = (ret >= 0);
+      if (!duplicated) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("fail to rknn_dup_context for model ") + Name() +
+             ", ret=" + std::to_string(ret) + ", loading it again")
+                .c_str());
+      }
+    }
+  }
+  if (duplicated) {
+    return ApplyCoreMask(ctx);
+  }
+  int ret =
+      (model_data_ != nullptr)
+          ? rknn_init(ctx, model_data_, model_size_, flags, nullptr)
+          : rknn_init(ctx, (void*)model_path.c_str(), 0, flags, nullptr);
+  if (ret >= 0) {
+    ret = ApplyCoreMask(ctx);
+  }
+  if (ret >= 0) {
+    std::lock_guard<std::mutex> lk(context_mu_);
+    if (weights_ctx_ == 0) {
+      weights_ctx_ = *ctx;
+    }
+  }
+  return ret;
+}
+
+int
+ModelState::ApplyCoreMask(rknn_context* ctx)
+{
+  if ((npu_core_mask_ == 0) || backend_state_->ArbiterEnabled() ||
+      (backend_state_->Arbiter()->CoreCount() == 1)) {
+    return 0;
+  }
+  const int ret = rknn_set_core_mask(*ctx, (rknn_core_mask)npu_core_mask_);
+  if (ret < 0) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_ERROR,
+        (std::string("fail to rknn_set_core_mask of model ") + Name() +
+         " to mask " + std::to_string(npu_core_mask_) + ", ret=" +
+         std::to_string(ret))
+            .c_str());
+    rknn_destroy(*ctx);
+    *ctx = 0;
+  }
+  return ret;
+}
+
+void
+ModelState::MapModelFile()
+{
+  const std::string model_path = ModelPath();
+  const int fd = open(model_path.c_str(), O_RDONLY);
+  struct stat st;
+  if ((fd >= 0) && (fstat(fd, &st) == 0) && (st.st_size > 0)) {
+    // Private and writable as rknn_init takes a non-const buffer, the
+    // pages stay shared with the page cache unless written.
+    void* data = mmap(
+        nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      model_data_ = data;
+      model_size_ = st.st_size;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (model_data_ == nullptr) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("fail to map ") + model_path +
+         ", evicted contexts of model " + Name() + " are reloaded from it")
+            .c_str());
+  }
+}
+
+void
+ModelState::ReleaseContext(const rknn_context ctx)
+{
+  std::lock_guard<std::mutex> lk(context_mu_);
+  if (weights_ctx_ == ctx) {
+    weights_ctx_ = 0;
+  }
+}
+
+TRITONSERVER_Error*
+ModelState::AutoCompleteConfig()
+{
+  const std::string model_path = ModelPath();
+  rknn_context ctx = 0;
+  int ret = -1;
+#ifdef RKNN_FLAG_COLLECT_MODEL_INFO_ONLY
+  // Only the attrs are read, the weights stay off the NPU.
+  ret = rknn_init(
+      &ctx, (void*)model_path.c_str(), 0, RKNN_FLAG_COLLECT_MODEL_INFO_ONLY,
+      nullptr);
+#endif
+  if (ret < 0) {
+    ret = rknn_init(&ctx, (void*)model_path.c_str(), 0, 0, nullptr);
+  }
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("fail to rknn_init ") + model_path +
+          " to auto-complete the configuration of model " + Name() +
+          ", ret=" + std::to_string(ret));
+  std::vector<rknn_tensor_attr> input_attrs, output_attrs;
+  TRITONSERVER_Error* err = QueryModelAttrs(ctx, &input_attrs, &output_attrs);
+  rknn_destroy(ctx);
+  RETURN_IF_ERROR(err);
+  RETURN_ERROR_IF_TRUE(
+      input_attrs.empty(), TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("model ") + Name() + " has no input");
+
+  // A model compiled for a batch of N has N as the first dimension of
+  // its tensors, Triton batches its requests up to N. A larger
+  // max_batch_size is refused by InitModelAttrs.
+  const int64_t npu_batch =
+      (input_attrs[0].n_dims > 1) ? input_attrs[0].dims[0] : 1;
+  const std::string unbatched = UnbatchedReason();
+  if (!unbatched.empty()) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("model ") + Name() +
+         " keeps the max_batch_size and dynamic_batching it declares: " +
+         unbatched)
+            .c_str());
+  } else if ((MaxBatchSize() == 0) && (npu_batch > 1)) {
+    common::TritonJson::Value mbs_value;
+    if (ModelConfig().Find("max_batch_size", &mbs_value)) {
+      RETURN_IF_ERROR(mbs_value.SetInt(npu_batch));
+    } else {
+      RETURN_IF_ERROR(ModelConfig().AddInt("max_batch_size", npu_batch));
+    }
+    max_batch_size_ = npu_batch;
+  }
+
+  common::TritonJson::Value ref_inputs(
+      ModelConfig(), common::TritonJson::ValueType::ARRAY);
+  RETURN_IF_ERROR(GetRefIO(true /* is_input */, input_attrs, &ref_inputs));
+  RETURN_IF_ERROR(FixIO(true /* is_input */, ref_inputs));
+  common::TritonJson::Value ref_outputs(
+      ModelConfig(), common::TritonJson::ValueType::ARRAY);
+  RETURN_IF_ERROR(GetRefIO(false /* is_input */, output_attrs, &ref_outputs));
+  RETURN_IF_ERROR(FixIO(false /* is_input */, ref_outputs));
+
+  if (unbatched.empty() && (MaxBatchSize() > 1)) {
+    RETURN_IF_ERROR(AutoCompleteDynamicBatching());
+  }
+
+  if (TRITONSERVER_LogIsEnabled(TRITONSERVER_LOG_VERBOSE)) {
+    common::TritonJson::WriteBuffer buffer;
+    RETURN_IF_ERROR(ModelConfig().PrettyWrite(&buffer));
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_VERBOSE,
+        (std::string("post auto-complete:\n") + buffer.Contents()).c_str());
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::GetRefIO(
+    const bool is_input, const std::vector<rknn_tensor_attr>& attrs,
+    common::TritonJson::Value* ref_ios)
+{
+  for (const auto& attr : attrs) {
+    common::TritonJson::Value io(
+        ModelConfig(), common::TritonJson::ValueType::OBJECT);
+    RETURN_IF_ERROR(io.AddString("name", std::string(attr.name)));
+    RETURN_IF_ERROR(io.AddString("data_type", ModelConfigDataType(attr.type)));
+    common::TritonJson::Value dims(
+        ModelConfig(), common::TritonJson::ValueType::ARRAY);
+    const uint32_t first = ((MaxBatchSize() > 0) && (attr.n_dims > 1)) ? 1 : 0;
+    for (uint32_t d = first; d < attr.n_dims; ++d) {
+      RETURN_IF_ERROR(dims.AppendInt(attr.dims[d]));
+    }
+    // Triton only takes a format for an image input of 3 dims.
+    if (is_input && (dims.ArraySize() == 3)) {
+      if (attr.fmt == RKNN_TENSOR_NHWC) {
+        RETURN_IF_ERROR(io.AddString("format", "FORMAT_NHWC"));
+      } else if (attr.fmt == RKNN_TENSOR_NCHW) {
+        RETURN_IF_ERROR(io.AddString("format", "FORMAT_NCHW"));
+      }
+    }
+    RETURN_IF_ERROR(io.Add("dims", std::move(dims)));
+    RETURN_IF_ERROR(ref_ios->Append(std::move(io)));
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::FixIO(const bool is_input, common::TritonJson::Value& ref_ios)
+{
+  const char* key = is_input ? "input" : "output";
+  common::TritonJson::Value ios;
+  if (!ModelConfig().Find(key, &ios)) {
+    return ModelConfig().Add(key, std::move(ref_ios));
+  }
+  if (ios.ArraySize() == 0) {
+    return ios.Swap(ref_ios);
+  }
+
+  for (size_t i = 0; i < ios.ArraySize(); i++) {
+    common::TritonJson::Value io;
+    RETURN_IF_ERROR(ios.IndexAsObject(i, &io));
+    std::string name;
+    RETURN_IF_ERROR(io.MemberAsString("name", &name));
+    for (size_t j = 0; j < ref_ios.ArraySize(); j++) {
+      common::TritonJson::Value ref_io;
+      RETURN_IF_ERROR(ref_ios.IndexAsObject(j, &ref_io));
+      std::string ref_name;
+      RETURN_IF_ERROR(ref_io.MemberAsString("name", &ref_name));
+      if (name != ref_name) {
+        continue;
+      }
+
+      std::string ref_data_type;
+      RETURN_IF_ERROR(ref_io.MemberAsString("data_type", &ref_data_type));
+      common::TritonJson::Value data_type;
+      if (!io.Find("data_type", &data_type)) {
+        RETURN_IF_ERROR(io.AddString("data_type", ref_data_type));
+      } else {
+        std::string value;
+        RETURN_IF_ERROR(data_type.AsString(&value));
+        if (value.empty() || (value == "TYPE_INVALID")) {
+          RETURN_IF_ERROR(data_type.SetString(ref_data_type));
+        }
+      }
+
+      common::TritonJson::Value ref_dims;
+      RETURN_IF_ERROR(ref_io.MemberAsArray("dims", &ref_dims));
+      std::vector<int64_t> ref_dim_vec;
+      RETURN_IF_ERROR(DimsJsonToDimVec(ref_dims, &ref_dim_vec));
+      common::TritonJson::Value dims;
+      std::vector<int64_t> dim_vec;
+      if (io.Find("dims", &dims)) {
+        RETURN_IF_ERROR(DimsJsonToDimVec(dims, &dim_vec));
+      }
+      if (dim_vec.empty()) {
+        common::TritonJson::Value new_dims(
+            ModelConfig(), common::TritonJson::ValueType::ARRAY);
+        for (const int64_t dim : ref_dim_vec) {
+          RETURN_IF_ERROR(new_dims.AppendInt(dim));
+        }
+        if (io.Find("dims")) {
+          RETURN_IF_ERROR(io.Remove("dims"));
+        }
+        RETURN_IF_ERROR(io.Add("dims", std::move(new_dims)));
+        dim_vec = ref_dim_vec;
+      }
+
+      std::string ref_format;
+      if (!is_input || !ref_io.Find("format") ||
+          (ref_io.MemberAsString("format", &ref_format) != nullptr)) {
+        break;
+      }
+      common::TritonJson::Value format;
+      std::string value("FORMAT_NONE");
+      if (io.Find("format", &format)) {
+        RETURN_IF_ERROR(format.AsString(&value));
+      }
+      if ((value == "FORMAT_NONE") && (dim_vec == ref_dim_vec)) {
+        if (io.Find("format")) {
+          RETURN_IF_ERROR(format.SetString(ref_format));
+        } else {
+          RETURN_IF_ERROR(io.AddString("format", ref_format));
+        }
+      } else if ((value != "FORMAT_NONE") && (value != ref_format)) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("model ") + Name() + " declares input '" + name +
+             "' as " + value + " but the model takes " + ref_format +
+             ", the driver converts it on every run")
+                .c_str());
+      }
+      break;
+    }
+  }
+  return nullptr;  // success
+}
+
+std::string
+ModelState::UnbatchedReason()
+{
+  // The frames of a clip take the first dimension, see ParseStreaming.
+  common::TritonJson::Value policy, value;
+  bool decoupled = false;
+  if (ModelConfig().Find("model_transaction_policy", &policy) &&
+      policy.Find("decoupled", &value) &&
+      (value.AsBool(&decoupled) == nullptr) && decoupled) {
+    return "decoupled";
+  }
+  // Batched state is refused by ParseSequenceBatching.
+  common::TritonJson::Value sequence_batching;
+  if (ModelConfig().Find("sequence_batching", &sequence_batching) &&
+      sequence_batching.Find("state", &value) && (value.ArraySize() > 0)) {
+    return "sequence state";
+  }
+  // Both bind the NPU memory of a single request.
+  common::TritonJson::Value params;
+  if (!ModelConfig().Find("parameters", &params)) {
+    return "";
+  }
+  std::string value_str;
+  TRITONSERVER_Error* err =
+      GetParameterValue(params, "native_output", &value_str);
+  if (err == nullptr) {
+    if (value_str == "on") {
+      return "native_output";
+    }
+  } else {
+    TRITONSERVER_ErrorDelete(err);
+  }
+  err = GetParameterValue(params, "dmabuf_input", &value_str);
+  if (err == nullptr) {
+    return "dmabuf_input";
+  }
+  TRITONSERVER_ErrorDelete(err);
+  return "";
+}
+
+TRITONSERVER_Error*
+ModelState::AutoCompleteDynamicBatching()
+{
+  common::TritonJson::Value value;
+  // Sequences are batched by the sequence batcher.
+  if (ModelConfig().Find("sequence_batching", &value)) {
+    return nullptr;
+  }
+  common::TritonJson::Value dynamic_batching;
+  if (!ModelConfig().Find("dynamic_batching", &dynamic_batching)) {
+    common::TritonJson::Value empty(
+        ModelConfig(), common::TritonJson::ValueType::OBJECT);
+    RETURN_IF_ERROR(ModelConfig().Add("dynamic_batching", std::move(empty)));
+    ModelConfig().Find("dynamic_batching", &dynamic_batching);
+  }
+  const bool has_preferred =
+      dynamic_batching.Find("preferred_batch_size", &value) &&
+      (value.ArraySize() > 0);
+  uint64_t delay_us = 0;
+  if (dynamic_batching.Find("max_queue_delay_microseconds", &value)) {
+    RETURN_IF_ERROR(value.AsUInt(&delay_us));
+  }
+  if (has_preferred && (delay_us > 0)) {
+    return nullptr;
+  }
+
+  uint64_t run_ns = 0;
+  LOG_IF_ERROR(
+      TimeWarmupRun(&run_ns),
+      (std::string("failed to time a warmup run of model ") + Name())
+          .c_str());
+  if (!has_preferred) {
+    // The NPU runs its whole static batch however few requests fill
+    // it, so a full batch costs what a single request does.
+    common::TritonJson::Value sizes(
+        ModelConfig(), common::TritonJson::ValueType::ARRAY);
+    RETURN_IF_ERROR(sizes.AppendInt(MaxBatchSize()));
+    if (dynamic_batching.Find("preferred_batch_size")) {
+      RETURN_IF_ERROR(dynamic_batching.Remove("preferred_batch_size"));
+    }
+    RETURN_IF_ERROR(
+        dynamic_batching.Add("preferred_batch_size", std::move(sizes)));
+  }
+  if ((delay_us == 0) && (run_ns > 0)) {
+    // Holding a batch longer than a run to fill it adds more latency
+    // than running it partly filled.
+    delay_us = std::max<uint64_t>(run_ns / 1000, 1);
+    if (dynamic_batching.Find("max_queue_delay_microseconds")) {
+      RETURN_IF_ERROR(
+          dynamic_batching.Remove("max_queue_delay_microseconds"));
+    }
+    RETURN_IF_ERROR(
+        dynamic_batching.AddUInt("max_queue_delay_microseconds", delay_us));
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("model ") + Name() + " runs a batch of " +
+       std::to_string(MaxBatchSize()) + " in " +
+       std::to_string(run_ns / 1000) +
+       " us, dynamic batching prefers batches of " +
+       std::to_string(MaxBatchSize()) + " within " +
+       std::to_string(delay_us) + " us")
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::TimeWarmupRun(uint64_t* run_ns)
+{
+  // The runs share the NPU with the models already serving, through
+  // the NpuArbiter when it is enabled.
+  const std::string model_path = ModelPath();
+  rknn_context ctx = 0;
+  int ret = rknn_init(&ctx, (void*)model_path.c_str(), 0, 0, nullptr);
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_init ") + model_path +
+          ", ret=" + std::to_string(ret));
+  NpuArbiter* arbiter =
+      backend_state_->ArbiterEnabled() ? backend_state_->Arbiter() : nullptr;
+  TRITONSERVER_Error* err = TimeRuns(ctx, arbiter, Name(), run_ns);
+  rknn_destroy(ctx);
+  return err;
+}
+
+TRITONSERVER_Error*
+ModelState::ValidateModelConfig()
+{
+  // If verbose logging is enabled, dump the model's configuration as
+  // JSON into the console output.
+  if (TRITONSERVER_LogIsEnabled(TRITONSERVER_LOG_VERBOSE)) {
+    common::TritonJson::WriteBuffer buffer;
+    RETURN_IF_ERROR(ModelConfig().PrettyWrite(&buffer));
+    LOG_MESSAGE(
+        // TRITONSERVER_LOG_VERBOSE,
+        TRITONSERVER_LOG_INFO,
+        (std::string("model configuration:\n") + buffer.Contents()).c_str());
+  }
+
+  // ModelConfig is the model configuration as a TritonJson
+  // object. Use the TritonJson utilities to parse the JSON and
+  // determine if the configuration is supported by this backend.
+  common::TritonJson::Value inputs, outputs;
+  RETURN_IF_ERROR(ModelConfig().MemberAsArray("input", &inputs));
+  RETURN_IF_ERROR(ModelConfig().MemberAsArray("output", &outputs));
+
+  // The model must have exactly 1 input and 1 output.
+//   RETURN_ERROR_IF_FALSE(
+//       inputs.ArraySize() == 1, TRITONSERVER_ERROR_INVALID_ARG,
+//       std::string("model configuration must have 1 input"));
+//   RETURN_ERROR_IF_FALSE(
+//       outputs.ArraySize() == 1, TRITONSERVER_ERROR_INVALID_ARG,
+//       std::string("model configuration must have 1 output"));
+
+  common::TritonJson::Value input, output;
+  RETURN_IF_ERROR(inputs.IndexAsObject(0, &input));
+  // RETURN_IF_ERROR(outputs.IndexAsObject(0, &output));
+
+  // Record the input and output name in the model state.
+  const char* input_name;
+  size_t input_name_len;
+  RETURN_IF_ERROR(input.MemberAsString("name", &input_name, &input_name_len));
+  input_name_ = std::string(input_name);
+  triton::common::TritonJson::Value input_format;
+  if (input.Find("format", &input_format)) {
+    RETURN_IF_ERROR(input_format.AsString(&input_format_));
+  }
+
+  for(size_t i=0;i<outputs.ArraySize();i++){
+    const char* output_name;
+    size_t output_name_len;
+    RETURN_IF_ERROR(outputs.IndexAsObject(i, &output));
+    RETURN_IF_ERROR(
+        output.MemberAsString("name", &output_name, &output_name_len));
+        output_name_.push_back(std::string(output_name));
+    
+    const char* dt_name;
+    size_t dt_name_len;
+    RETURN_IF_ERROR(output.MemberAsString("data_type", &dt_name, &dt_name_len));
+    output_dt_.insert(std::make_pair(
+        std::string(output_name),
+        ModelConfigDataTypeToTritonServerDataType(std::string(dt_name))));
+
+
+    common::TritonJson::Value model_config_dims;
+    RETURN_IF_ERROR(output.MemberAsArray("dims", &model_config_dims));
+    std::vector<int64_t> dim_vec;
+    
+    RETURN_IF_ERROR(DimsJsonToDimVec(model_config_dims, &dim_vec));
+    output_shape_.insert(std::make_pair(std::string(output_name),dim_vec));
+
+    
+  }
+    // {
+    //   std::stringstream ss;
+    // auto&xx=getOutputshapes("output");
+    // for (auto it = xx.begin(); it != xx.end(); it++)    {
+    //     if (it != xx.begin()) {
+    //         ss << " ";
+    //     }
+    //     ss << *it;
+    // }
+    // std::cout << ss.str() << std::endl;  
+    // std::cout << "line 224: --------------------------------------------"<<std::endl;    
+    // ss.str("");
+    // xx=getOutputshapes("376");
+    // for (auto it = xx.begin(); it != xx.end(); it++)    {
+    //     if (it != xx.begin()) {
+    //         ss << " ";
+    //     }
+    //     ss << *it;
+    // }
+    // std::cout << ss.str() << std::endl;  
+    // std::cout << "line 224: --------------------------------------------"<<std::endl;    
+    // ss.str("");
+    // xx=getOutputshapes("377");
+    // for (auto it = xx.begin(); it != xx.end(); it++)    {
+    //     if (it != xx.begin()) {
+    //         ss << " ";
+    //     }
+    //     ss << *it;
+    // }
+    // std::cout << ss.str() << std::endl;  
+    // std::cout << "line 224: --------------------------------------------"<<std::endl;    
+    // }
+  // Input and output must have same datatype
+  std::string input_dtype, output_dtype;
+  RETURN_IF_ERROR(input.MemberAsString("data_type", &input_dtype));
+  RETURN_IF_ERROR(output.MemberAsString("data_type", &output_dtype));
+//   RETURN_ERROR_IF_FALSE(
+//       input_dtype == output_dtype, TRITONSERVER_ERROR_INVALID_ARG,
+//       std::string("expected input and output datatype to match, got ") +
+//           input_dtype + " and " + output_dtype);
+  datatype_ = ModelConfigDataTypeToTritonServerDataType(input_dtype);
+
+  // Input and output must have same shape. Reshape is not supported
+  // on either input or output so flag an error is the model
+  // configuration uses it.
+//   triton::common::TritonJson::Value reshape;
+//   RETURN_ERROR_IF_TRUE(
+//       input.Find("reshape", &reshape), TRITONSERVER_ERROR_UNSUPPORTED,
+//       std::string("reshape not supported for input tensor"));
+//   RETURN_ERROR_IF_TRUE(
+//       output.Find("reshape", &reshape), TRITONSERVER_ERROR_UNSUPPORTED,
+//       std::string("reshape not supported for output tensor"));
+
+  std::vector<int64_t> input_shape, output_shape;
+  RETURN_IF_ERROR(backend::ParseShape(input, "dims", &input_shape));
+  RETURN_IF_ERROR(backend::ParseShape(output, "dims", &output_shape));
+
+//   RETURN_ERROR_IF_FALSE(
+//       input_shape == output_shape, TRITONSERVER_ERROR_INVALID_ARG,
+//       std::string("expected input and output shape to match, got ") +
+//           backend::ShapeToString(input_shape) + " and " +
+//           backend::ShapeToString(output_shape));
+
+  nb_shape_ = input_shape;
+
+//   std::string input_string(input_shape.begin(),input_shape.end()),output_string(output_shape.begin(),output_shape.end());
+  std::ostringstream oss;
+
+  if (!input_shape.empty() && !output_shape.empty())
+  {
+    // Convert all but the last element to avoid a trailing ","
+    std::copy(input_shape.begin(), input_shape.end()-1,
+        std::ostream_iterator<int>(oss, ","));
+
+    // Now add the last element with no delimiter
+    oss << input_shape.back();
+    oss<< "][";
+    // Convert all but the last element to avoid a trailing ","
+    std::copy(output_shape.begin(), output_shape.end()-1,
+        std::ostream_iterator<int>(oss, ","));
+
+    // Now add the last element with no delimiter
+    oss << output_shape.back();
+  }
+  LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("validated model config for input and output shape is:[")+oss.str()+std::string("]")).c_str());
+  return nullptr;  // success
+}
+
+//
+// ModelInstanceState
+//
+// State associated with a model instance. An object of this class is
+// created and associated with each
+// TRITONBACKEND_ModelInstance. ModelInstanceState is derived from
+// BackendModelInstance class provided in the backend utilities that
+// provides many common functions.
+//
+class ModelInstanceState : public BackendModelInstance,
+                           public ContextManager::Client {
+ public:
+  static TRITONSERVER_Error* Create(
+      ModelState* model_state,
+      TRITONBACKEND_ModelInstance* triton_model_instance,
+      ModelInstanceState** state);
+  virtual ~ModelInstanceState();
+
+  // Get the state of the model that corresponds to this instance.
+  ModelState* StateForModel() const { return model_state_; }
+  rknn_context* getRknnContext(){return &ctx;}
+  
+  // The maximum possible size of the TensorRT tensor and the
+  // corresponding allocated GPU buffer across all optimization
+  // profile.
+  using BatchInputData = std::pair<BatchInput, std::unique_ptr<BackendMemory>>;
+  std::vector<std::pair<std::string, std::int64_t>> outputs_bytes;
+  struct IOBindingInfo {
+    IOBindingInfo()
+        : byte_size_(0), buffer_(nullptr), device_buffer_(nullptr),
+          memory_type_(TRITONSERVER_MEMORY_GPU), memory_type_id_(0),
+          buffer_is_ragged_(false), is_linear_format_(true),
+          vectorized_dim_(-1), components_per_element_(1),
+          is_state_output_(false), is_requested_output_tensor_(false)
+    {
+    }
+    uint64_t byte_size_;
+    void* buffer_;
+    void* device_buffer_;
+    TRITONSERVER_MemoryType memory_type_;
+    int64_t memory_type_id_;
+    bool buffer_is_ragged_;
+    bool is_linear_format_;
+    int vectorized_dim_;
+    int components_per_element_;
+    const BatchOutput* batch_output_;
+    // Instructions on constructing the batch input and the CPU buffer
+    // for storing mutable data
+    std::shared_ptr<BatchInputData> batch_input_;
+    // Store the pair of input name to look up and output shape
+    // for output scattering
+    std::pair<std::string, std::vector<int64_t>> io_shape_mapping_;
+
+    // Indicates whether the output is a state output.
+    bool is_state_output_;
+
+    // Indicates whether the output is a output tensor.
+    bool is_requested_output_tensor_;
+  };
+  TRITONSERVER_Error* InitIOBindingBuffers(); //assume input num always 1
+  // Run the context on an NPU core granted by the backend arbiter.
+  TRITONSERVER_Error* Run();
+  // Run 'context' on an NPU core granted by the backend arbiter, moving
+  // it when the arbiter grants another core than 'bound_core'. 'core'
+  // is set to the core granted, -1 without the arbiter.
+  TRITONSERVER_Error* RunOn(
+      rknn_context context, int* bound_core, int* core);
+  // Run the context "warmup_runs" times on zero inputs, before the
+  // instance takes requests.
+  TRITONSERVER_Error* Warmup();
+  // Lease the context from the ContextManager for an execution,
+  // materializing it again if it was evicted, and give it back after.
+  TRITONSERVER_Error* LeaseContext();
+  void ReturnContext();
+  // ContextManager::Client
+  void EvictContext() override;
+  // There are Context::num_expected_bindings_ number of IOBindingInfo
+  // elements for copy stream.
+  std::vector<IOBindingInfo> io_binding_infos_;
+  // Account the io_binding_infos_ buffers 'outputs' of an execution
+  // were bound to with is_prealloc in the buffer pool metrics.
+  void ReportBufferPoolUsage(
+      const rknn_output* outputs, const uint32_t output_count);
+
+  // A response buffer that rknn_outputs_get cannot write in place and
+  // that is filled from the runtime-allocated output instead.
+  struct OutputCopy {
+    uint32_t index_;
+    std::string name_;
+    void* buffer_;
+    size_t byte_size_;
+  };
+  // Create the response outputs of a single request and point
+  // 'outputs' at their buffers so that rknn_outputs_get writes the
+  // result in place, e.g. straight into the system shared-memory
+  // region registered by the client. Only the 'wanted' outputs are
+  // created, the 'sparse' heads are left to RespondSparseOutputs.
+  // Outputs that cannot be written in place are returned in 'copies'.
+  TRITONSERVER_Error* BindResponseOutputs(
+      TRITONBACKEND_Response* response, const rknn_tensor_attr* output_attrs,
+      const uint32_t output_count, const std::vector<bool>& wanted,
+      const std::set<std::string>& sparse, rknn_output* outputs,
+      std::vector<OutputCopy>* copies);
+
+  // Index in 'output_attrs' of the output 'name' of the model
+  // configuration, matched by tensor name or else by position.
+  // Returns 'output_count' if there is none.
+  uint32_t ModelOutputIndex(
+      const std::string& name, const rknn_tensor_attr* output_attrs,
+      const uint32_t output_count) const;
+  // Set 'wanted' for the outputs 'request' asks for.
+  TRITONSERVER_Error* MarkRequestedOutputs(
+      TRITONBACKEND_Request* request, const rknn_tensor_attr* output_attrs,
+      const uint32_t output_count, std::vector<bool>* wanted);
+  // rknn_outputs_get only the 'wanted' outputs. The entries of 'outputs'
+  // are updated, 'fetched' is what rknn_outputs_release takes back.
+  TRITONSERVER_Error* GetOutputs(
+      rknn_output* outputs, const uint32_t output_count,
+      const std::vector<bool>& wanted, std::vector<rknn_output>* fetched);
+  // Create the output 'name' of 'response', or of 'staged' when the
+  // response is compressed, and point 'buffer' at its 'byte_size'
+  // bytes.
+  TRITONSERVER_Error* NewOutput(
+      TRITONBACKEND_Response* response, StagedResponse* staged,
+      const std::string& name, const TRITONSERVER_DataType dt,
+      const std::vector<int64_t>& shape, const size_t byte_size,
+      void** buffer) const;
+  // Cut 'outputs' and their attrs down to frame 'frame' of the NPU
+  // batch, which the request of that frame is answered from. They are
+  // left whole for a model that does not batch its requests.
+  void FrameOutputs(
+      const rknn_output* outputs, const uint32_t frame,
+      std::vector<rknn_tensor_attr>* frame_attrs,
+      std::vector<rknn_output>* frame_outputs) const;
+  // Copy the outputs 'request' asks for from 'outputs' into 'response'.
+  TRITONSERVER_Error* ScatterOutputs(
+      TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+      StagedResponse* staged, const rknn_tensor_attr* output_attrs,
+      const rknn_output* outputs, const uint32_t output_count,
+      uint64_t* copy_bytes);
+  // Fill 'job' for the output 'name' if the model configuration
+  // declares it TYPE_FP32 or TYPE_FP16 while the NPU produces it 8-bit
+  // quantized as 'attr'; the caller sets the buffers and count. Returns
+  // false if the output is copied as is.
+  bool OutputDequantJob(
+      const std::string& name, const rknn_tensor_attr& attr,
+      DequantJob* job) const;
+  // Copy the 'src_size' bytes of the output 'name' into the 'dst_size'
+  // bytes of 'dst', or queue their dequantization in 'jobs' for
+  // DequantizeAll.
+  TRITONSERVER_Error* CopyOutput(
+      const std::string& name, const rknn_tensor_attr& attr, const void* src,
+      const size_t src_size, void* dst, const size_t dst_size,
+      std::vector<DequantJob>* jobs, uint64_t* copy_bytes) const;
+  // Set 'heads' to the detection heads 'request' asks the sparse
+  // outputs of, see ModelState::SparseOutput.
+  TRITONSERVER_Error* SparseHeads(
+      TRITONBACKEND_Request* request, std::set<std::string>* heads) const;
+  // Add to 'heads' the detection heads the cascade outputs 'request'
+  // asks for are decoded from and that it does not ask for itself.
+  // They are fetched but not answered.
+  TRITONSERVER_Error* CascadeOnlyHeads(
+      TRITONBACKEND_Request* request, std::set<std::string>* heads) const;
+  // Respond "<name>_index" with the (n, anchor, y, x) of the cells of
+  // the head 'name' whose objectness passes the threshold, and 'name'
+  // with their values if 'with_values'. 'data' is the quantized head
+  // in the layout of 'attr'. The values to dequantize are gathered
+  // into 'scratch' and queued in 'jobs'.
+  TRITONSERVER_Error* RespondSparseOutput(
+      TRITONBACKEND_Response* response, StagedResponse* staged,
+      const std::string& name,
+      const bool with_values, const rknn_tensor_attr& attr, const void* data,
+      std::vector<DequantJob>* jobs,
+      std::vector<std::unique_ptr<uint8_t[]>>* scratch,
+      uint64_t* copy_bytes) const;
+  // RespondSparseOutput for every sparse output 'request' asks for,
+  // from 'outputs'.
+  TRITONSERVER_Error* RespondSparseOutputs(
+      TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+      StagedResponse* staged, const rknn_tensor_attr* output_attrs,
+      const rknn_output* outputs, const uint32_t output_count,
+      uint64_t* copy_bytes) const;
+  // Respond the cascade outputs 'request' asks for: the boxes decoded
+  // from the detection heads of 'outputs' in "cascade_detections", and
+  // in "cascade_classes" the first output of the cascade model on the
+  // crop of each box, resized out of the input image of the request
+  // into the batched input of the model.
+  TRITONSERVER_Error* RespondCascadeOutputs(
+      TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+      StagedResponse* staged, const rknn_tensor_attr* output_attrs,
+      const rknn_output* outputs, const uint32_t output_count,
+      uint64_t* copy_bytes);
+  // Load "cascade_model" into a context of the instance and allocate
+  // the input the crops are resized into.
+  TRITONSERVER_Error* InitCascade();
+  // Point 'image' at the images of the input of 'request', 'image_count'
+  // of them, gathered into 'gathered' when they span several buffers.
+  TRITONSERVER_Error* RequestImages(
+      TRITONBACKEND_Request* request, CropSource* image,
+      uint32_t* image_count, std::unique_ptr<uint8_t[]>* gathered) const;
+
+  // Create the contexts the tiles run on, see ModelState::Tiling, and
+  // the inputs the tiles are resized into.
+  TRITONSERVER_Error* InitTiling();
+  // Answer 'requests' with the detections of their frames: every frame
+  // is cut into overlapping tiles that are resized into the batched
+  // input of the model, the batches are spread over the contexts of
+  // the instance, and the boxes of the tiles are moved to the frame and
+  // merged by NMS into "tiled_detections". The requests are released.
+  void ExecuteTiled(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      std::vector<TRITONBACKEND_Response*>* responses);
+
+  // Size the input a clip is padded into, see ModelState::Decoupled.
+  TRITONSERVER_Error* InitStreaming();
+  // Stream the clip of each of 'requests' through the NPU a batch of
+  // frames at a time, sending the responses of a batch from the
+  // response factory of its request as soon as the batch has run. The
+  // last response carries the final flag. The requests are released.
+  void ExecuteStreamed(
+      TRITONBACKEND_Request** requests, const uint32_t request_count);
+
+  // Set 'dmabuf' if the requests carry a DmaBufDescriptor instead of
+  // the input tensor. Such a request cannot share an execution with
+  // other requests, the NPU input is bound to a single buffer.
+  TRITONSERVER_Error* HasDmaBufInput(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      bool* dmabuf);
+  // Import the frame described by the request and bind it as the NPU
+  // input with rknn_set_io_mem.
+  TRITONSERVER_Error* BindDmaBufInput(
+      TRITONBACKEND_Request* request, const rknn_tensor_attr& input_attr);
+  // Whether the outputs are bound in the native layout, see
+  // InitNativeOutputs.
+  bool NativeOutputs() const { return !native_outputs_.empty(); }
+  // Create the outputs 'request' asks for from the native output
+  // buffers, converting them to the layout of the model configuration
+  // unless the request sets the "native_output_layout" parameter.
+  TRITONSERVER_Error* RespondNativeOutputs(
+      TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+      StagedResponse* staged, uint64_t* copy_bytes);
+  // Compresses and sends the responses, nullptr unless the model sets
+  // "response_compression".
+  ResponseCompressor* Compressor() const { return compressor_.get(); }
+
+  // What is left of an execution once the outputs are fetched.
+  struct ExecutionPayload {
+    ExecutionPayload()
+        : direct_outputs_(false), native_outputs_(false), ret_(0),
+          exec_start_ns_(0), compute_start_ns_(0), input_conversion_ns_(0)
+    {
+    }
+    std::vector<TRITONBACKEND_Request*> requests_;
+    std::vector<TRITONBACKEND_Response*> responses_;
+    std::vector<std::unique_ptr<StagedResponse>> staged_;
+    std::vector<rknn_output> outputs_;
+    // The outputs rknn_outputs_get allocated, see GetOutputs.
+    std::vector<rknn_output> fetched_outputs_;
+    std::vector<OutputCopy> output_copies_;
+    bool direct_outputs_;
+    bool native_outputs_;
+    int ret_;
+    uint64_t exec_start_ns_;
+    uint64_t compute_start_ns_;
+    uint64_t input_conversion_ns_;
+  };
+  // With eager batching, wait until the previous batch of the instance
+  // is done with the output buffers. Called right before the outputs
+  // are bound and the NPU runs.
+  void AcquireOutputs();
+  // Copy the outputs of 'payload' into its responses, send them and
+  // release the requests, right away or with eager batching on the
+  // completion thread while Triton hands the instance the next batch.
+  void Complete(std::unique_ptr<ExecutionPayload> payload);
+
+  // Implicit state of the sequences, nullptr unless the model has
+  // "state" in "sequence_batching".
+  SequenceStates* States() const { return sequence_states_.get(); }
+
+  // With ragged batching, gather the inputs of the batch and the
+  // "batch_input" tensors into the NPU input buffers, see
+  // InitializeBatchInputBindings.
+  TRITONSERVER_Error* CollectBatchInputs(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      BackendInputCollector* collector);
+  // rknn_inputs_set the buffers gathered by CollectBatchInputs.
+  TRITONSERVER_Error* SetBatchInputs();
+  // Whether the output 'index' of the NPU is a "batch_output", left to
+  // the runtime to allocate and scattered by RespondBatchOutputs.
+  bool IsBatchOutput(const uint32_t index) const
+  {
+    return (index < batch_outputs_.size()) &&
+           (batch_outputs_[index].second != nullptr);
+  }
+
+  // Number of inputs and outputs of the model and their attrs, as
+  // RKNN_QUERY_INPUT_ATTR and RKNN_QUERY_OUTPUT_ATTR report them when
+  // the context is created, see InitModelAttrs.
+  const rknn_input_output_num& IONum() const { return io_num_; }
+  const rknn_tensor_attr* InputAttrs() const { return input_attrs_.data(); }
+  const rknn_tensor_attr* OutputAttrs() const { return output_attrs_.data(); }
+  // Batch the model is compiled for, the first dimension of its first
+  // input, which a run always fills.
+  uint32_t NpuBatch() const { return npu_batch_; }
+
+  // Whether the input is bound with pass_through, see
+  // ChooseInputPath.
+  bool InputPassThrough() const { return input_pass_through_; }
+  // RKNN type the input is handed to the driver as, after the CPU
+  // conversion if there is one, see ChooseInputPath.
+  rknn_tensor_type InputType() const { return input_type_; }
+  // Convert the 'byte_size' bytes of client data 'input' points to, the
+  // 'frames' frames of a batch, with the kernel chosen by
+  // ChooseInputPath and point it to the result. A batch short of
+  // NpuBatch is padded with zeros, with or without a kernel.
+  TRITONSERVER_Error* ConvertInput(
+      rknn_input* input, const size_t byte_size, const uint32_t frames);
+  // Count in 'frames' the frames the requests of a batch hold, the first
+  // dimension of their input. The requests of a batch are run as the
+  // frames of the NPU batch in their order, one each.
+  TRITONSERVER_Error* BatchFrames(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      uint32_t* frames) const;
+  // Set the input tensors with rknn_inputs_set, or through a staging
+  // buffer once a dma-buf frame has been bound with rknn_set_io_mem.
+  TRITONSERVER_Error* SetInputs(
+      rknn_input* inputs, const uint32_t input_count,
+      const rknn_tensor_attr& input_attr);
+ private:
+  ModelInstanceState(
+      ModelState* model_state,
+      TRITONBACKEND_ModelInstance* triton_model_instance)
+      : BackendModelInstance(model_state, triton_model_instance),
+        npu_batch_(1), model_state_(model_state), ctx(0), init_flags_(0), context_bytes_(0),
+        npu_core_(-1), pool_used_bytes_(0),
+        pool_capacity_bytes_(0), input_pass_through_(false),
+        input_converter_(nullptr), input_type_(RKNN_TENSOR_UINT8),
+        input_fmt_(RKNN_TENSOR_NHWC), input_element_size_(1),
+        input_bytes_(0), partial_outputs_get_(true),
+        bound_input_mem_(nullptr), staging_input_mem_(nullptr),
+        cascade_ctx_(0), cascade_core_(-1), tile_pass_through_(false),
+        stream_batch_(1), stream_frame_bytes_(0), semaphore_(nullptr),
+        completion_exiting_(false)
+  {
+    memset(&io_num_, 0, sizeof(io_num_));
+    deviceArch=std::move(std::string(getBuild()));
+    LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("rk backends running on device arch :")+deviceArch).c_str());
+  }
+  TRITONSERVER_Error* InitializeConfigShapeOutputBindings(
+      common::TritonJson::Value& config_output);
+  // Query 'io_num_' and the attrs of the context, they do not change
+  // when it is evicted and created again.
+  TRITONSERVER_Error* InitModelAttrs();
+  rknn_input_output_num io_num_;
+  std::vector<rknn_tensor_attr> input_attrs_;
+  std::vector<rknn_tensor_attr> output_attrs_;
+  uint32_t npu_batch_;
+  // Start the threads DequantizeAll runs the large outputs on, one per
+  // quantized output beyond the first as long as there are cores.
+  void InitDequantWorkers();
+  std::unique_ptr<WorkerPool> dequant_workers_;
+  // Decide once per context whether the client data can be handed to
+  // the NPU as is (pass_through=1): the declared datatype and format
+  // must be those of the native input of the model, and a float input
+  // must not be quantized by the driver. A layout or type there is a
+  // CPU kernel for is converted into the native input first, the kernel
+  // is chosen here once. Otherwise the driver converts the input on
+  // every run.
+  TRITONSERVER_Error* ChooseInputPath();
+  // Bind every output with rknn_set_io_mem to memory of the context,
+  // in NC1HWC2 when the runtime reports that native layout for it.
+  TRITONSERVER_Error* InitNativeOutputs();
+  // Allocate the state of the sequences in NPU memory of the context,
+  // bound in the native layout of the state tensors when their input
+  // and output agree on it.
+  TRITONSERVER_Error* InitSequenceStates();
+  // Bind every NPU input to a buffer that CollectBatchInputs fills from
+  // the whole batch: the inputs of the model configuration are
+  // concatenated across the requests and the "batch_input" tensors
+  // describe where each request starts. The NPU inputs have a static
+  // shape, a batch is padded up to it with zeros and one that does not
+  // fit is refused.
+  TRITONSERVER_Error* InitializeBatchInputBindings(
+      common::TritonJson::Value& config);
+  // Map the "batch_output" tensors to the NPU outputs.
+  TRITONSERVER_Error* InitializeBatchOutputBindings();
+  // Respond the "batch_output" tensors of 'outputs' through
+  // 'responder', each request gets the part of the shape of its source
+  // input. They are converted into 'buffers' first, which must outlive
+  // the responder.
+  TRITONSERVER_Error* RespondBatchOutputs(
+      BackendOutputResponder* responder, const rknn_tensor_attr* output_attrs,
+      const rknn_output* outputs, const uint32_t output_count,
+      std::vector<std::unique_ptr<char[]>>* buffers, uint64_t* copy_bytes);
+  ModelState* model_state_;
+  rknn_context ctx;
+  // Flags the context is created with, and the NPU memory it holds as
+  // reported by RKNN_QUERY_MEM_SIZE.
+  uint32_t init_flags_;
+  uint64_t context_bytes_;
+  std::string deviceArch{};
+  unsigned char *model=NULL; // useless
+  // Core the context is currently bound to, -1 if not bound yet.
+  int npu_core_;
+  // Contribution of this instance to the model buffer pool metrics.
+  int64_t pool_used_bytes_;
+  int64_t pool_capacity_bytes_;
+  bool input_pass_through_;
+  // Kernel converting the client input on the CPU, nullptr when the
+  // data is handed to the driver as is, and the type and format of its
+  // result.
+  InputConvertFn input_converter_;
+  rknn_tensor_type input_type_;
+  rknn_tensor_format input_fmt_;
+  // Frame of the input, bytes of a client element and of the NPU input.
+  ConvertShape input_shape_;
+  size_t input_element_size_;
+  size_t input_bytes_;
+  std::vector<char> converted_input_;
+  // Whether rknn_outputs_get accepts a subset of the outputs, cleared
+  // the first time the runtime refuses one.
+  bool partial_outputs_get_;
+  // Imports of the dma-buf frames, nullptr unless the model has a
+  // "dmabuf_input".
+  std::unique_ptr<DmaBufImporter> dmabuf_importer_;
+  // Memory the input is bound to with rknn_set_io_mem, nullptr while
+  // rknn_inputs_set is used.
+  rknn_tensor_mem* bound_input_mem_;
+  rknn_tensor_mem* staging_input_mem_;
+  // An output bound with rknn_set_io_mem.
+  struct NativeOutput {
+    // Attr of the output as rknn_outputs_get returns it.
+    rknn_tensor_attr attr_;
+    // Attr the memory is bound with.
+    rknn_tensor_attr native_attr_;
+    rknn_tensor_mem* mem_;
+    // False if 'mem_' already holds the output in the layout of 'attr_'.
+    bool convert_;
+    Nc1hwc2Layout layout_;
+  };
+  std::vector<NativeOutput> native_outputs_;
+  // The native output of the output 'name' of the model configuration,
+  // nullptr if there is none.
+  const NativeOutput* FindNativeOutput(const std::string& name) const;
+  std::unique_ptr<ResponseCompressor> compressor_;
+  std::unique_ptr<SequenceStates> sequence_states_;
+
+  // Context of "cascade_model", 0 without a cascade, with the core it
+  // is bound to, the attrs of its input and first output, the crops of
+  // one batch in the element type of the image input, HWC, and the
+  // float output of one batch.
+  rknn_context cascade_ctx_;
+  int cascade_core_;
+  rknn_tensor_attr cascade_input_attr_;
+  rknn_tensor_attr cascade_output_attr_;
+  std::vector<uint8_t> cascade_input_;
+  std::vector<float> cascade_output_;
+
+  // A tile of an image of a request.
+  struct TileJob {
+    uint32_t request_;
+    uint32_t image_;
+    Tile tile_;
+  };
+  // A context tiles run on, 0 for the context of the instance, with
+  // the core it is bound to, the tiles of one batch resized HWC, and
+  // the boxes it found with the index of their request.
+  struct TileWorker {
+    TileWorker() : ctx_(0), core_(-1) {}
+    rknn_context ctx_;
+    int core_;
+    std::vector<uint8_t> input_;
+    std::vector<std::pair<uint32_t, Detection>> detections_;
+  };
+  // Run the batches of 'jobs' dealt to the worker 'w', the tiles are
+  // cut out of the images of 'sources', one per request.
+  TRITONSERVER_Error* RunTileBatches(
+      const size_t w, const std::vector<TileJob>& jobs,
+      const std::vector<CropSource>& sources);
+  std::vector<TileWorker> tile_workers_;
+  // The threads the workers beyond the first run on, kept for the life
+  // of the instance.
+  std::unique_ptr<WorkerPool> tile_threads_;
+  rknn_tensor_attr tile_input_attr_;
+  std::vector<rknn_tensor_attr> tile_output_attrs_;
+  // The detection heads with their index among the outputs.
+  std::vector<std::pair<uint32_t, DetectionHead>> tile_heads_;
+  bool tile_pass_through_;
+
+  // Stream the clip of 'request' through 'factory', 'final_sent' is set
+  // once the response with the final flag is out.
+  TRITONSERVER_Error* StreamRequest(
+      TRITONBACKEND_Request* request, TRITONBACKEND_ResponseFactory* factory,
+      bool* final_sent);
+  // Send a response with the 'wanted' outputs, each a name and its
+  // index on the NPU, of the 'count' frames from 'first' of the batch
+  // in 'outputs'.
+  TRITONSERVER_Error* StreamResponse(
+      TRITONBACKEND_ResponseFactory* factory,
+      const std::vector<std::pair<std::string, uint32_t>>& wanted,
+      const rknn_output* outputs, const uint32_t first, const uint32_t count,
+      const uint32_t flags, uint64_t* copy_bytes);
+  // Frames per NPU run and the bytes of one, the NPU attrs, and the
+  // input the last frames of a clip are padded into.
+  uint32_t stream_batch_;
+  size_t stream_frame_bytes_;
+  rknn_tensor_attr stream_input_attr_;
+  std::vector<rknn_tensor_attr> stream_output_attrs_;
+  std::vector<uint8_t> stream_input_;
+
+  // An NPU input set from the whole batch with ragged batching.
+  struct BatchBinding {
+    BatchBinding()
+        : datatype_(TRITONSERVER_TYPE_INVALID), byte_size_(0),
+          buffer_is_ragged_(false), batch_input_(nullptr)
+    {
+    }
+    std::string name_;
+    rknn_tensor_attr attr_;
+    // Datatype of the gathered data, the driver converts it.
+    TRITONSERVER_DataType datatype_;
+    // Size of the buffer, the static NPU input in 'datatype_'.
+    size_t byte_size_;
+    bool buffer_is_ragged_;
+    // The "batch_input" computed into the buffer, nullptr for an input
+    // of the model configuration.
+    const BatchInput* batch_input_;
+    std::unique_ptr<BackendMemory> memory_;
+  };
+  // Bind 'binding' to the NPU input of its name among 'attrs', else to
+  // the one at 'position'.
+  TRITONSERVER_Error* AllocateBatchBinding(
+      const std::vector<rknn_tensor_attr>& attrs, const size_t position,
+      std::vector<bool>* bound, BatchBinding* binding);
+  std::vector<BatchBinding> batch_bindings_;
+  // Per NPU output, the name and "batch_output" it is scattered by,
+  // nullptr if it is not one.
+  std::vector<std::pair<std::string, const BatchOutput*>> batch_outputs_;
+
+  // Eager batching, see ModelState::EagerBatching. The semaphore is
+  // held from right before the run of a batch until the completion
+  // thread has answered it, it is nullptr when eager batching is off.
+  void StartCompletionThread();
+  void CompletionLoop();
+  void CompleteExecution(ExecutionPayload* payload);
+  Semaphore* semaphore_;
+  // Outputs rknn_outputs_get allocated for the batch being answered,
+  // released by the execute thread once the semaphore is back.
+  std::vector<rknn_output> unreleased_outputs_;
+  std::mutex completion_mu_;
+  std::condition_variable completion_cv_;
+  bool completion_exiting_;
+  std::deque<std::unique_ptr<ExecutionPayload>> completion_queue_;
+  std::thread completion_thread_;
+};
+
+ModelInstanceState::~ModelInstanceState()
+{
+  // Out of the manager first so that it never evicts a context being
+  // destroyed.
+  ContextManager* contexts = model_state_->StateForBackend()->Contexts();
+  if (contexts != nullptr) {
+    contexts->Unregister(this);
+  }
+  // The responses still queued are sent before the context goes away.
+  if (completion_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lk(completion_mu_);
+      completion_exiting_ = true;
+    }
+    completion_cv_.notify_all();
+    completion_thread_.join();
+  }
+  if (!unreleased_outputs_.empty()) {
+    rknn_outputs_release(
+        ctx, unreleased_outputs_.size(), unreleased_outputs_.data());
+  }
+  compressor_.reset();
+  sequence_states_.reset();
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics != nullptr) {
+    metrics->AddBufferPool(-pool_used_bytes_, -pool_capacity_bytes_);
+  }
+  // Malloc'd by InitIOBindingBuffers, no execution is left to fill them.
+  for (const auto& io_binding_info : io_binding_infos_) {
+    free(io_binding_info.buffer_);
+  }
+  io_binding_infos_.clear();
+  dmabuf_importer_.reset();
+  if (staging_input_mem_ != nullptr) {
+    rknn_destroy_mem(ctx, staging_input_mem_);
+  }
+  for (auto& output : native_outputs_) {
+    rknn_destroy_mem(ctx, output.mem_);
+  }
+  if (cascade_ctx_ != 0) {
+    rknn_destroy(cascade_ctx_);
+  }
+  for (const TileWorker& worker : tile_workers_) {
+    if (worker.ctx_ != 0) {
+      model_state_->ReleaseContext(worker.ctx_);
+      rknn_destroy(worker.ctx_);
+    }
+  }
+  // Triton finalizes an instance once its executions have returned, so
+  // the context of a version swapped out goes with its last batch.
+  if (ctx != 0) {
+    model_state_->ReleaseContext(ctx);
+    rknn_destroy(ctx);
+  }
+}
+
+void
+ModelInstanceState::ReportBufferPoolUsage(
+    const rknn_output* outputs, const uint32_t output_count)
+{
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics == nullptr) {
+    return;
+  }
+  // Output i is bound to buffer i of the pool, the others went to the
+  // responses or the runtime.
+  int64_t used_bytes = 0;
+  for (size_t i = 0; (i < io_binding_infos_.size()) && (i < output_count);
+       ++i) {
+    if (outputs[i].is_prealloc &&
+        (outputs[i].buf == io_binding_infos_[i].buffer_)) {
+      used_bytes += io_binding_infos_[i].byte_size_;
+    }
+  }
+  metrics->AddBufferPool(used_bytes - pool_used_bytes_, 0);
+  pool_used_bytes_ = used_bytes;
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::BindResponseOutputs(
+    TRITONBACKEND_Response* response, const rknn_tensor_attr* output_attrs,
+    const uint32_t output_count, const std::vector<bool>& wanted,
+    const std::set<std::string>& sparse, rknn_output* outputs,
+    std::vector<OutputCopy>* copies)
+{
+  const std::vector<std::string>& names = model_state_->OutputTensorName();
+  for (uint32_t i = 0; i < output_count; ++i) {
+    outputs[i].index = i;
+    outputs[i].want_float = 0;
+    outputs[i].is_prealloc = 0;
+    if (!wanted[i]) {
+      continue;
+    }
+
+    // Config outputs are matched by name, by position for models whose
+    // tensor names were not exported.
+    size_t config_idx =
+        std::find(names.begin(), names.end(), output_attrs[i].name) -
+        names.begin();
+    if (config_idx == names.size()) {
+      config_idx = i;
+    }
+    if (config_idx >= names.size()) {
+      // Not in the model configuration, left to the runtime.
+      continue;
+    }
+
+    const std::string& name = names[config_idx];
+    if (sparse.count(name) != 0) {
+      // Fetched into runtime memory and scanned.
+      continue;
+    }
+    const TRITONSERVER_DataType dt = model_state_->OutputTensorDataType(name);
+    const std::vector<int64_t>& shape = model_state_->getOutputshapes(name);
+    const size_t byte_size = GetByteSize(dt, shape);
+    TRITONBACKEND_Output* response_output;
+    RETURN_IF_ERROR(TRITONBACKEND_ResponseOutput(
+        response, &response_output, name.c_str(), dt, shape.data(),
+        shape.size()));
+    void* buffer;
+    TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+    int64_t memory_type_id = 0;
+    RETURN_IF_ERROR(TRITONBACKEND_OutputBuffer(
+        response_output, &buffer, byte_size, &memory_type, &memory_type_id));
+
+    if (((memory_type == TRITONSERVER_MEMORY_CPU) ||
+         (memory_type == TRITONSERVER_MEMORY_CPU_PINNED)) &&
+        (byte_size == output_attrs[i].size)) {
+      outputs[i].is_prealloc = 1;
+      outputs[i].buf = buffer;
+      outputs[i].size = byte_size;
+    } else {
+      // A dequantized output never fits: rknn_outputs_get hands the
+      // quantized bytes, converted in CopyOutput.
+      copies->push_back({i, name, buffer, byte_size});
+    }
+  }
+
+  return nullptr;  // success
+}
+
+uint32_t
+ModelInstanceState::ModelOutputIndex(
+    const std::string& name, const rknn_tensor_attr* output_attrs,
+    const uint32_t output_count) const
+{
+  for (uint32_t i = 0; i < output_count; ++i) {
+    if (name == output_attrs[i].name) {
+      return i;
+    }
+  }
+  const std::vector<std::string>& names = model_state_->OutputTensorName();
+  const size_t config_idx =
+      std::find(names.begin(), names.end(), name) - names.begin();
+  return std::min((uint32_t)config_idx, output_count);
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::MarkRequestedOutputs(
+    TRITONBACKEND_Request* request, const rknn_tensor_attr* output_attrs,
+    const uint32_t output_count, std::vector<bool>* wanted)
+{
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    if (model_state_->CascadeOutput(name)) {
+      // Decoded from the detection heads.
+      for (const auto& head : model_state_->DetectionHeads()) {
+        const uint32_t i =
+            ModelOutputIndex(head.first, output_attrs, output_count);
+        RETURN_ERROR_IF_TRUE(
+            i == output_count, TRITONSERVER_ERROR_INVALID_ARG,
+            std::string("unknown output '") + head.first + "'");
+        (*wanted)[i] = true;
+      }
+      continue;
+    }
+    std::string head(name);
+    model_state_->SparseIndexOutput(name, &head);
+    const uint32_t i = ModelOutputIndex(head, output_attrs, output_count);
+    RETURN_ERROR_IF_TRUE(
+        i == output_count, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("unknown output '") + name + "'");
+    (*wanted)[i] = true;
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::GetOutputs(
+    rknn_output* outputs, const uint32_t output_count,
+    const std::vector<bool>& wanted, std::vector<rknn_output>* fetched)
+{
+  fetched->clear();
+  if (std::find(wanted.begin(), wanted.end(), true) == wanted.end()) {
+    return nullptr;  // success
+  }
+  int ret;
+  if (partial_outputs_get_) {
+    for (uint32_t i = 0; i < output_count; ++i) {
+      if (wanted[i]) {
+        fetched->push_back(outputs[i]);
+      }
+    }
+    ret = rknn_outputs_get(ctx, fetched->size(), fetched->data(), NULL);
+    if (ret >= 0) {
+      for (const auto& output : *fetched) {
+        outputs[output.index] = output;
+      }
+      return nullptr;  // success
+    }
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("instance ") + Name() +
+         ": rknn_outputs_get refuses a subset of the outputs, fetching "
+         "all of them from now on")
+            .c_str());
+    partial_outputs_get_ = false;
+  }
+  fetched->assign(outputs, outputs + output_count);
+  ret = rknn_outputs_get(ctx, output_count, fetched->data(), NULL);
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_outputs_get, ret=") + std::to_string(ret));
+  for (const auto& output : *fetched) {
+    outputs[output.index] = output;
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::NewOutput(
+    TRITONBACKEND_Response* response, StagedResponse* staged,
+    const std::string& name, const TRITONSERVER_DataType dt,
+    const std::vector<int64_t>& shape, const size_t byte_size,
+    void** buffer) const
+{
+  if (staged != nullptr) {
+    staged->outputs_.emplace_back();
+    StagedOutput& output = staged->outputs_.back();
+    output.name_ = name;
+    output.datatype_ = dt;
+    output.shape_ = shape;
+    output.data_.resize(byte_size);
+    *buffer = output.data_.data();
+    return nullptr;  // success
+  }
+  TRITONBACKEND_Output* response_output;
+  RETURN_IF_ERROR(TRITONBACKEND_ResponseOutput(
+      response, &response_output, name.c_str(), dt, shape.data(),
+      shape.size()));
+  *buffer = nullptr;
+  if (byte_size == 0) {
+    return nullptr;  // success
+  }
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  return TRITONBACKEND_OutputBuffer(
+      response_output, buffer, byte_size, &memory_type, &memory_type_id);
+}
+
+void
+ModelInstanceState::FrameOutputs(
+    const rknn_output* outputs, const uint32_t frame,
+    std::vector<rknn_tensor_attr>* frame_attrs,
+    std::vector<rknn_output>* frame_outputs) const
+{
+  frame_attrs->assign(output_attrs_.begin(), output_attrs_.end());
+  frame_outputs->assign(outputs, outputs + output_attrs_.size());
+  if ((model_state_->MaxBatchSize() == 0) || model_state_->RaggedBatching() ||
+      (npu_batch_ <= 1)) {
+    return;
+  }
+  for (size_t i = 0; i < frame_attrs->size(); ++i) {
+    rknn_tensor_attr& attr = (*frame_attrs)[i];
+    if ((attr.n_dims < 2) || (attr.dims[0] != npu_batch_)) {
+      continue;
+    }
+    attr.dims[0] = 1;
+    attr.n_elems /= npu_batch_;
+    attr.size /= npu_batch_;
+    attr.size_with_stride /= npu_batch_;
+    rknn_output& output = (*frame_outputs)[i];
+    if (output.buf != nullptr) {
+      output.buf = (char*)output.buf + (size_t)frame * attr.size;
+      output.size = attr.size;
+    }
+  }
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::ScatterOutputs(
+    TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+    StagedResponse* staged, const rknn_tensor_attr* output_attrs,
+    const rknn_output* outputs, const uint32_t output_count,
+    uint64_t* copy_bytes)
+{
+  std::set<std::string> sparse;
+  RETURN_IF_ERROR(SparseHeads(request, &sparse));
+  std::vector<DequantJob> jobs;
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    std::string head;
+    if ((sparse.count(name) != 0) ||
+        model_state_->SparseIndexOutput(name, &head) ||
+        model_state_->CascadeOutput(name) ||
+        (model_state_->FindBatchOutput(name) != nullptr)) {
+      // Left to RespondSparseOutputs, RespondCascadeOutputs and
+      // RespondBatchOutputs.
+      continue;
+    }
+    const uint32_t i = ModelOutputIndex(name, output_attrs, output_count);
+    RETURN_ERROR_IF_TRUE(
+        (i == output_count) || (outputs[i].buf == nullptr),
+        TRITONSERVER_ERROR_INTERNAL,
+        std::string("output '") + name + "' was not fetched");
+    const TRITONSERVER_DataType dt = model_state_->OutputTensorDataType(name);
+    const std::vector<int64_t>& shape = model_state_->getOutputshapes(name);
+    const size_t byte_size = GetByteSize(dt, shape);
+    void* buffer;
+    RETURN_IF_ERROR(
+        NewOutput(response, staged, name, dt, shape, byte_size, &buffer));
+    RETURN_IF_ERROR(CopyOutput(
+        name, output_attrs[i], outputs[i].buf,
+        std::min((size_t)outputs[i].size, (size_t)output_attrs[i].size),
+        buffer, byte_size, &jobs, copy_bytes));
+  }
+  DequantizeAll(jobs, dequant_workers_.get());
+  RETURN_IF_ERROR(RespondSparseOutputs(
+      request, response, staged, output_attrs, outputs, output_count,
+      copy_bytes));
+  return RespondCascadeOutputs(
+      request, response, staged, output_attrs, outputs, output_count,
+      copy_bytes);
+}
+
+namespace {
+
+// Zero point and scale of the quantized output 'attr'.
+void
+OutputQuantization(
+    const rknn_tensor_attr& attr, int32_t* zp, float* scale)
+{
+  *zp = 0;
+  *scale = 1.0f;
+  if (attr.qnt_type == RKNN_TENSOR_QNT_AFFINE_ASYMMETRIC) {
+    *zp = attr.zp;
+    *scale = attr.scale;
+  } else if (attr.qnt_type == RKNN_TENSOR_QNT_DFP) {
+    *scale = std::ldexp(1.0f, -attr.fl);
+  }
+}
+
+// The detection head laid out as 'attr', of 'group' channels per anchor
+// with the objectness at 'objectness'.
+SparseHead
+DetectionHeadLayout(
+    const rknn_tensor_attr& attr, const uint32_t group,
+    const uint32_t objectness)
+{
+  SparseHead head;
+  head.nhwc_ = (attr.fmt == RKNN_TENSOR_NHWC);
+  head.signed_ = (attr.type == RKNN_TENSOR_INT8);
+  head.batch_ = attr.dims[0];
+  head.channels_ = attr.dims[head.nhwc_ ? 3 : 1];
+  head.height_ = attr.dims[head.nhwc_ ? 1 : 2];
+  head.width_ = attr.dims[head.nhwc_ ? 2 : 3];
+  head.group_ = group;
+  head.objectness_ = objectness;
+  return head;
+}
+
+}  // namespace
+
+bool
+ModelInstanceState::OutputDequantJob(
+    const std::string& name, const rknn_tensor_attr& attr,
+    DequantJob* job) const
+{
+  const TRITONSERVER_DataType dt = model_state_->OutputTensorDataType(name);
+  if (((dt != TRITONSERVER_TYPE_FP32) && (dt != TRITONSERVER_TYPE_FP16)) ||
+      ((attr.type != RKNN_TENSOR_INT8) && (attr.type != RKNN_TENSOR_UINT8))) {
+    return false;
+  }
+  job->src_signed_ = (attr.type == RKNN_TENSOR_INT8);
+  job->fp16_ = (dt == TRITONSERVER_TYPE_FP16);
+  job->activation_ = model_state_->OutputActivationOf(name);
+  OutputQuantization(attr, &job->zp_, &job->scale_);
+  return true;
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::CopyOutput(
+    const std::string& name, const rknn_tensor_attr& attr, const void* src,
+    const size_t src_size, void* dst, const size_t dst_size,
+    std::vector<DequantJob>* jobs, uint64_t* copy_bytes) const
+{
+  DequantJob job;
+  if (!OutputDequantJob(name, attr, &job)) {
+    const size_t copy_size = std::min(dst_size, src_size);
+    memcpy(dst, src, copy_size);
+    *copy_bytes += copy_size;
+    return nullptr;  // success
+  }
+  job.count_ = dst_size / (job.fp16_ ? 2 : 4);
+  RETURN_ERROR_IF_TRUE(
+      job.count_ != src_size, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("output '") + name + "' holds " +
+          std::to_string(src_size) +
+          " quantized elements, the model configuration declares " +
+          std::to_string(job.count_));
+  job.src_ = src;
+  job.dst_ = dst;
+  jobs->push_back(job);
+  *copy_bytes += dst_size;
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::SparseHeads(
+    TRITONBACKEND_Request* request, std::set<std::string>* heads) const
+{
+  heads->clear();
+  if (!model_state_->SparseOutput()) {
+    return nullptr;  // success
+  }
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    std::string head;
+    if (model_state_->SparseIndexOutput(name, &head)) {
+      heads->insert(head);
+    }
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RespondSparseOutput(
+    TRITONBACKEND_Response* response, StagedResponse* staged,
+    const std::string& name,
+    const bool with_values, const rknn_tensor_attr& attr, const void* data,
+    std::vector<DequantJob>* jobs,
+    std::vector<std::unique_ptr<uint8_t[]>>* scratch,
+    uint64_t* copy_bytes) const
+{
+  const SparseHead head = DetectionHeadLayout(
+      attr, model_state_->SparseGroup(), model_state_->SparseObjectness());
+  RETURN_ERROR_IF_FALSE(
+      ((attr.type == RKNN_TENSOR_INT8) || (attr.type == RKNN_TENSOR_UINT8)) &&
+          (attr.n_dims == 4) && (head.channels_ % head.group_ == 0),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("output '") + name +
+          "' is not a 4-D 8-bit head of 'sparse_output_group' channel "
+          "groups");
+
+  // The threshold is compared in the domain of the response values:
+  // dequantized and activated for a float head.
+  int32_t zp;
+  float scale;
+  OutputQuantization(attr, &zp, &scale);
+  DequantJob probe;
+  const OutputActivation activation =
+      OutputDequantJob(name, attr, &probe) ? probe.activation_
+                                           : OutputActivation::NONE;
+  const int32_t first_passing = FirstPassingValue(
+      model_state_->SparseThreshold(), zp, scale, activation, head.signed_);
+  std::vector<int32_t> cells;
+  const size_t count = FindSparseCells(head, data, first_passing, &cells);
+
+  const std::string index_name = name + "_index";
+  const std::vector<int64_t> index_shape{(int64_t)count, 4};
+  const size_t index_bytes = cells.size() * sizeof(int32_t);
+  void* buffer;
+  RETURN_IF_ERROR(NewOutput(
+      response, staged, index_name, TRITONSERVER_TYPE_INT32, index_shape,
+      index_bytes, &buffer));
+  if (index_bytes > 0) {
+    memcpy(buffer, cells.data(), index_bytes);
+    *copy_bytes += index_bytes;
+  }
+  if (!with_values) {
+    return nullptr;  // success
+  }
+
+  const TRITONSERVER_DataType dt = model_state_->OutputTensorDataType(name);
+  const std::vector<int64_t> shape{(int64_t)count, (int64_t)head.group_};
+  const size_t quantized_bytes = count * head.group_;
+  const size_t byte_size = GetByteSize(dt, shape);
+  RETURN_IF_ERROR(
+      NewOutput(response, staged, name, dt, shape, byte_size, &buffer));
+  if (byte_size == 0) {
+    return nullptr;  // success
+  }
+  scratch->emplace_back(new uint8_t[quantized_bytes]);
+  GatherSparseCells(head, data, cells, scratch->back().get());
+  return CopyOutput(
+      name, attr, scratch->back().get(), quantized_bytes, buffer, byte_size,
+      jobs, copy_bytes);
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RespondSparseOutputs(
+    TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+    StagedResponse* staged, const rknn_tensor_attr* output_attrs,
+    const rknn_output* outputs, const uint32_t output_count,
+    uint64_t* copy_bytes) const
+{
+  std::set<std::string> requested;
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    requested.insert(name);
+  }
+  std::set<std::string> heads;
+  RETURN_IF_ERROR(SparseHeads(request, &heads));
+  std::vector<DequantJob> jobs;
+  std::vector<std::unique_ptr<uint8_t[]>> scratch;
+  for (const auto& head : heads) {
+    const uint32_t i = ModelOutputIndex(head, output_attrs, output_count);
+    RETURN_ERROR_IF_TRUE(
+        (i == output_count) || (outputs[i].buf == nullptr),
+        TRITONSERVER_ERROR_INTERNAL,
+        std::string("output '") + head + "' was not fetched");
+    RETURN_IF_ERROR(RespondSparseOutput(
+        response, staged, head, requested.count(head) != 0, output_attrs[i],
+        outputs[i].buf, &jobs, &scratch, copy_bytes));
+  }
+  DequantizeAll(jobs, dequant_workers_.get());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::CascadeOnlyHeads(
+    TRITONBACKEND_Request* request, std::set<std::string>* heads) const
+{
+  if (!model_state_->Cascade()) {
+    return nullptr;  // success
+  }
+  std::set<std::string> requested;
+  bool cascade = false;
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    requested.insert(name);
+    cascade |= model_state_->CascadeOutput(name);
+  }
+  for (const auto& head : model_state_->DetectionHeads()) {
+    if (cascade && (requested.count(head.first) == 0)) {
+      heads->insert(head.first);
+    }
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitCascade()
+{
+  const std::string path = model_state_->CascadeModelPath();
+  int ret = rknn_init(&cascade_ctx_, (void*)path.c_str(), 0, 0, nullptr);
+  if (ret >= 0) {
+    ret = model_state_->ApplyCoreMask(&cascade_ctx_);
+  }
+  if (ret < 0) {
+    cascade_ctx_ = 0;
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("fail to create the context of cascade model ") + path +
+         ", ret=" + std::to_string(ret))
+            .c_str());
+  }
+  std::vector<rknn_tensor_attr> input_attrs, output_attrs;
+  RETURN_IF_ERROR(QueryModelAttrs(cascade_ctx_, &input_attrs, &output_attrs));
+  RETURN_ERROR_IF_FALSE(
+      (input_attrs.size() == 1) && (input_attrs[0].n_dims == 4) &&
+          !output_attrs.empty(),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("cascade model ") + path +
+          " must take a single 4-D image input");
+  cascade_input_attr_ = input_attrs[0];
+  cascade_output_attr_ = output_attrs[0];
+
+  // The crops have the channels of the image input.
+  const rknn_tensor_attr& attr = cascade_input_attr_;
+  const bool nhwc = (attr.fmt == RKNN_TENSOR_NHWC);
+  const std::vector<int64_t>& shape = model_state_->TensorNonBatchShape();
+  const int64_t channels = (model_state_->InputFormat() == "FORMAT_NCHW")
+                               ? shape[0]
+                               : shape[2];
+  RETURN_ERROR_IF_FALSE(
+      attr.dims[nhwc ? 3 : 1] == channels, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("cascade model ") + path + " takes " +
+          std::to_string(attr.dims[nhwc ? 3 : 1]) +
+          " channels, the image input has " + std::to_string(channels));
+  cascade_input_.resize(attr.n_elems);
+  cascade_output_.resize(cascade_output_attr_.n_elems);
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + Name() + " runs cascade model " + path +
+       " on batches of " + std::to_string(attr.dims[0]) + " crops of " +
+       std::to_string(attr.dims[nhwc ? 2 : 3]) + "x" +
+       std::to_string(attr.dims[nhwc ? 1 : 2]))
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RequestImages(
+    TRITONBACKEND_Request* request, CropSource* image, uint32_t* image_count,
+    std::unique_ptr<uint8_t[]>* gathered) const
+{
+  // The images of the request, which stay valid until it is released.
+  TRITONBACKEND_Input* input;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestInput(
+      request, model_state_->InputTensorName().c_str(), &input));
+  TRITONSERVER_DataType datatype;
+  const int64_t* shape;
+  uint32_t dims_count;
+  uint64_t byte_size;
+  uint32_t buffer_count;
+  RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+      input, nullptr, &datatype, &shape, &dims_count, &byte_size,
+      &buffer_count));
+  RETURN_ERROR_IF_FALSE(
+      ((datatype == TRITONSERVER_TYPE_INT8) ||
+       (datatype == TRITONSERVER_TYPE_UINT8)) &&
+          ((dims_count == 3) || (dims_count == 4)),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("the image input must be an 8-bit 3-D image"));
+  const int64_t* dims = shape + (dims_count - 3);
+  image->planar_ = (model_state_->InputFormat() == "FORMAT_NCHW");
+  image->signed_ = (datatype == TRITONSERVER_TYPE_INT8);
+  image->channels_ = image->planar_ ? dims[0] : dims[2];
+  image->height_ = image->planar_ ? dims[1] : dims[0];
+  image->width_ = image->planar_ ? dims[2] : dims[1];
+  *image_count = (dims_count == 4) ? shape[0] : 1;
+  const size_t image_size =
+      (size_t)image->height_ * image->width_ * image->channels_;
+  image->data_ = nullptr;
+  size_t gathered_bytes = 0;
+  for (uint32_t b = 0; b < buffer_count; ++b) {
+    const void* buffer;
+    uint64_t buffer_byte_size;
+    TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+    int64_t memory_type_id = 0;
+    RETURN_IF_ERROR(TRITONBACKEND_InputBuffer(
+        input, b, &buffer, &buffer_byte_size, &memory_type,
+        &memory_type_id));
+    RETURN_ERROR_IF_TRUE(
+        memory_type == TRITONSERVER_MEMORY_GPU,
+        TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("images are cropped in CPU memory only"));
+    if (buffer_count == 1) {
+      image->data_ = buffer;
+      break;
+    }
+    if (*gathered == nullptr) {
+      gathered->reset(new uint8_t[byte_size]);
+      image->data_ = gathered->get();
+    }
+    const size_t copy_size =
+        std::min((size_t)buffer_byte_size, byte_size - gathered_bytes);
+    memcpy(gathered->get() + gathered_bytes, buffer, copy_size);
+    gathered_bytes += copy_size;
+  }
+  RETURN_ERROR_IF_TRUE(
+      (image->data_ == nullptr) || (byte_size < *image_count * image_size),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("the image input holds ") + std::to_string(byte_size) +
+          " bytes for " + std::to_string(*image_count) + " images");
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RespondCascadeOutputs(
+    TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+    StagedResponse* staged, const rknn_tensor_attr* output_attrs,
+    const rknn_output* outputs, const uint32_t output_count,
+    uint64_t* copy_bytes)
+{
+  if (!model_state_->Cascade()) {
+    return nullptr;  // success
+  }
+  bool want_detections = false, want_classes = false;
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    want_detections |= (std::string(name) == kCascadeDetectionsOutput);
+    want_classes |= (std::string(name) == kCascadeClassesOutput);
+  }
+  if (!want_detections && !want_classes) {
+    return nullptr;  // success
+  }
+
+  CropSource image;
+  uint32_t image_count;
+  std::unique_ptr<uint8_t[]> gathered;
+  RETURN_IF_ERROR(RequestImages(request, &image, &image_count, &gathered));
+  const size_t image_size =
+      (size_t)image.height_ * image.width_ * image.channels_;
+
+  // Boxes of the heads, in input pixels.
+  std::vector<Detection> detections;
+  for (const auto& cascade_head : model_state_->DetectionHeads()) {
+    const std::string& name = cascade_head.first;
+    const uint32_t i = ModelOutputIndex(name, output_attrs, output_count);
+    RETURN_ERROR_IF_TRUE(
+        (i == output_count) || (outputs[i].buf == nullptr),
+        TRITONSERVER_ERROR_INTERNAL,
+        std::string("output '") + name + "' was not fetched");
+    const rknn_tensor_attr& attr = output_attrs[i];
+    DetectionHead head;
+    head.head_ = DetectionHeadLayout(
+        attr, model_state_->SparseGroup(), model_state_->SparseObjectness());
+    head.anchors_ = cascade_head.second;
+    RETURN_ERROR_IF_FALSE(
+        ((attr.type == RKNN_TENSOR_INT8) || (attr.type == RKNN_TENSOR_UINT8)) &&
+            (attr.n_dims == 4) &&
+            (head.head_.channels_ % head.head_.group_ == 0) &&
+            (head.anchors_.size() == 2 * head.head_.Anchors()),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("output '") + name +
+            "' is not a 4-D 8-bit head of 'sparse_output_group' channel "
+            "groups, one per anchor of 'detection_heads'");
+    OutputQuantization(attr, &head.zp_, &head.scale_);
+    head.stride_x_ = (float)image.width_ / head.head_.width_;
+    head.stride_y_ = (float)image.height_ / head.head_.height_;
+    DecodeDetections(
+        head, outputs[i].buf, model_state_->DetectionThreshold(),
+        image.width_, image.height_, &detections);
+  }
+  // Only the images of this request are cropped.
+  detections.erase(
+      std::remove_if(
+          detections.begin(), detections.end(),
+          [image_count](const Detection& d) { return d.n_ >= image_count; }),
+      detections.end());
+  SuppressDetections(
+      model_state_->DetectionIou(), model_state_->CascadeMaxCrops(),
+      false /* per_class */, &detections);
+  const size_t count = detections.size();
+
+  void* buffer;
+  if (want_detections) {
+    const std::vector<int64_t> detections_shape{
+        (int64_t)count, (int64_t)kCascadeDetectionValues};
+    const size_t detections_bytes =
+        count * kCascadeDetectionValues * sizeof(float);
+    RETURN_IF_ERROR(NewOutput(
+        response, staged, kCascadeDetectionsOutput, TRITONSERVER_TYPE_FP32,
+        detections_shape, detections_bytes, &buffer));
+    float* row = static_cast<float*>(buffer);
+    for (const Detection& d : detections) {
+      row[0] = d.n_;
+      row[1] = d.x1_;
+      row[2] = d.y1_;
+      row[3] = d.x2_;
+      row[4] = d.y2_;
+      row[5] = d.score_;
+      row[6] = d.class_;
+      row += kCascadeDetectionValues;
+    }
+    *copy_bytes += detections_bytes;
+  }
+  if (!want_classes) {
+    return nullptr;  // success
+  }
+
+  // The crops are resized straight into the batched input of the
+  // cascade model, which runs once per batch of them.
+  const rknn_tensor_attr& input_attr = cascade_input_attr_;
+  const bool nhwc = (input_attr.fmt == RKNN_TENSOR_NHWC);
+  const uint32_t batch = input_attr.dims[0];
+  const uint32_t crop_height = input_attr.dims[nhwc ? 1 : 2];
+  const uint32_t crop_width = input_attr.dims[nhwc ? 2 : 3];
+  const size_t crop_size = (size_t)crop_height * crop_width * image.channels_;
+  RETURN_ERROR_IF_FALSE(
+      crop_size * batch == cascade_input_.size(),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("the image input has ") + std::to_string(image.channels_) +
+          " channels, the cascade model takes " +
+          std::to_string(input_attr.dims[nhwc ? 3 : 1]));
+  const size_t classes = cascade_output_attr_.n_elems / batch;
+  const std::vector<int64_t> classes_shape{(int64_t)count, (int64_t)classes};
+  const size_t classes_bytes = count * classes * sizeof(float);
+  RETURN_IF_ERROR(NewOutput(
+      response, staged, kCascadeClassesOutput, TRITONSERVER_TYPE_FP32,
+      classes_shape, classes_bytes, &buffer));
+  float* scores = static_cast<float*>(buffer);
+  for (size_t first = 0; first < count; first += batch) {
+    const size_t crops = std::min((size_t)batch, count - first);
+    for (size_t k = 0; k < crops; ++k) {
+      const Detection& detection = detections[first + k];
+      CropSource crop_source = image;
+      crop_source.data_ = static_cast<const uint8_t*>(image.data_) +
+                          detection.n_ * image_size;
+      CropResize(
+          crop_source, detection, crop_height, crop_width,
+          cascade_input_.data() + k * crop_size);
+    }
+
+    // The driver converts the HWC crops to the input of the model.
+    rknn_input crop_input;
+    memset(&crop_input, 0, sizeof(crop_input));
+    crop_input.index = 0;
+    crop_input.buf = cascade_input_.data();
+    crop_input.size = cascade_input_.size();
+    crop_input.pass_through = 0;
+    crop_input.type = image.signed_ ? RKNN_TENSOR_INT8 : RKNN_TENSOR_UINT8;
+    crop_input.fmt = RKNN_TENSOR_NHWC;
+    int ret = rknn_inputs_set(cascade_ctx_, 1, &crop_input);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_inputs_set the cascade crops, ret=") +
+            std::to_string(ret));
+    int core;
+    RETURN_IF_ERROR(RunOn(cascade_ctx_, &cascade_core_, &core));
+    rknn_output crop_output;
+    memset(&crop_output, 0, sizeof(crop_output));
+    crop_output.index = 0;
+    crop_output.want_float = 1;
+    crop_output.is_prealloc = 1;
+    crop_output.buf = cascade_output_.data();
+    crop_output.size = cascade_output_.size() * sizeof(float);
+    ret = rknn_outputs_get(cascade_ctx_, 1, &crop_output, nullptr);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_outputs_get the cascade output, ret=") +
+            std::to_string(ret));
+    memcpy(
+        scores + first * classes, cascade_output_.data(),
+        crops * classes * sizeof(float));
+    rknn_outputs_release(cascade_ctx_, 1, &crop_output);
+  }
+  *copy_bytes += classes_bytes;
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitTiling()
+{
+  // The tiles of a frame fill the batch of the model, the state of a
+  // sequence or a ragged batch has nothing to be split with them.
+  RETURN_ERROR_IF_TRUE(
+      model_state_->ImplicitState() || model_state_->RaggedBatching(),
+      TRITONSERVER_ERROR_UNSUPPORTED,
+      std::string("'tiling' cannot be combined with sequence state or "
+                  "ragged batching"));
+  tile_output_attrs_ = output_attrs_;
+  tile_input_attr_ = PlainNativeInputAttr(ctx, input_attrs_[0]);
+  RETURN_ERROR_IF_FALSE(
+      (io_num_.n_input == 1) && (tile_input_attr_.n_dims == 4),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'tiling' needs a model with a single 4-D image input"));
+  const rknn_tensor_attr& attr = tile_input_attr_;
+  const bool nhwc = (attr.fmt == RKNN_TENSOR_NHWC);
+  const std::vector<int64_t>& shape = model_state_->TensorNonBatchShape();
+  const int64_t channels = (model_state_->InputFormat() == "FORMAT_NCHW")
+                               ? shape[0]
+                               : shape[2];
+  RETURN_ERROR_IF_FALSE(
+      attr.dims[nhwc ? 3 : 1] == channels, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("model input takes ") +
+          std::to_string(attr.dims[nhwc ? 3 : 1]) +
+          " channels, the image input has " + std::to_string(channels));
+  const uint32_t batch = attr.dims[0];
+  const uint32_t height = attr.dims[nhwc ? 1 : 2];
+  const uint32_t width = attr.dims[nhwc ? 2 : 3];
+
+  // The tiles are resized HWC in the datatype of the image input,
+  // handed over as is when that is the native input.
+  rknn_tensor_attr native = attr;
+  if (rknn_query(
+          ctx, RKNN_QUERY_NATIVE_INPUT_ATTR, &native, sizeof(native)) < 0) {
+    native = attr;
+  }
+  const rknn_tensor_type tile_type =
+      (model_state_->TensorDataType() == TRITONSERVER_TYPE_INT8)
+          ? RKNN_TENSOR_INT8
+          : RKNN_TENSOR_UINT8;
+  tile_pass_through_ = model_state_->InputPassThroughAllowed() &&
+                       (native.fmt == RKNN_TENSOR_NHWC) &&
+                       (native.type == tile_type) &&
+                       (native.size == attr.n_elems);
+
+  for (const auto& detection_head : model_state_->DetectionHeads()) {
+    const std::string& name = detection_head.first;
+    const uint32_t i = ModelOutputIndex(
+        name, tile_output_attrs_.data(), tile_output_attrs_.size());
+    RETURN_ERROR_IF_TRUE(
+        i == tile_output_attrs_.size(), TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("model has no output '") + name + "'");
+    const rknn_tensor_attr& output_attr = tile_output_attrs_[i];
+    DetectionHead head;
+    head.head_ = DetectionHeadLayout(
+        output_attr, model_state_->SparseGroup(),
+        model_state_->SparseObjectness());
+    head.anchors_ = detection_head.second;
+    RETURN_ERROR_IF_FALSE(
+        ((output_attr.type == RKNN_TENSOR_INT8) ||
+         (output_attr.type == RKNN_TENSOR_UINT8)) &&
+            (output_attr.n_dims == 4) &&
+            (head.head_.channels_ % head.head_.group_ == 0) &&
+            (head.anchors_.size() == 2 * head.head_.Anchors()),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("output '") + name +
+            "' is not a 4-D 8-bit head of 'sparse_output_group' channel "
+            "groups, one per anchor of 'detection_heads'");
+    OutputQuantization(output_attr, &head.zp_, &head.scale_);
+    // The tiles are decoded in model input pixels.
+    head.stride_x_ = (float)width / head.head_.width_;
+    head.stride_y_ = (float)height / head.head_.height_;
+    tile_heads_.emplace_back(i, head);
+  }
+
+  // The first worker runs on the context of the instance, the others on
+  // duplicates of it that the arbiter spreads over the other cores.
+  tile_workers_.resize(model_state_->TileParallel());
+  for (size_t w = 0; w < tile_workers_.size(); ++w) {
+    TileWorker& worker = tile_workers_[w];
+    worker.input_.resize((size_t)batch * height * width * channels);
+    if (w == 0) {
+      continue;
+    }
+    const int ret = model_state_->InitContext(
+        model_state_->ModelPath(), init_flags_, &worker.ctx_);
+    if (ret < 0) {
+      worker.ctx_ = 0;
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("fail to create tile context ") + std::to_string(w) +
+           " of instance " + Name() + ", ret=" + std::to_string(ret))
+              .c_str());
+    }
+  }
+  tile_threads_.reset(new WorkerPool(tile_workers_.size() - 1));
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + Name() + " runs tiles of " +
+       std::to_string(width) + "x" + std::to_string(height) +
+       " in batches of " + std::to_string(batch) + " on " +
+       std::to_string(tile_workers_.size()) + " contexts" +
+       (tile_pass_through_ ? " with pass_through" : ""))
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RunTileBatches(
+    const size_t w, const std::vector<TileJob>& jobs,
+    const std::vector<CropSource>& sources)
+{
+  TileWorker& worker = tile_workers_[w];
+  const rknn_context context = (w == 0) ? ctx : worker.ctx_;
+  int* bound_core = (w == 0) ? &npu_core_ : &worker.core_;
+  const rknn_tensor_attr& attr = tile_input_attr_;
+  const bool nhwc = (attr.fmt == RKNN_TENSOR_NHWC);
+  const uint32_t batch = attr.dims[0];
+  const uint32_t height = attr.dims[nhwc ? 1 : 2];
+  const uint32_t width = attr.dims[nhwc ? 2 : 3];
+  const size_t tile_size = worker.input_.size() / batch;
+  const TileMerge merge = model_state_->TileMergePolicy();
+  const size_t batch_count = (jobs.size() + batch - 1) / batch;
+  std::vector<rknn_output> outputs(tile_output_attrs_.size());
+  std::vector<Detection> detections;
+
+  // The batches are dealt round-robin over the workers.
+  for (size_t b = w; b < batch_count; b += tile_workers_.size()) {
+    const size_t first = b * batch;
+    const size_t tiles = std::min((size_t)batch, jobs.size() - first);
+    for (size_t k = 0; k < tiles; ++k) {
+      const TileJob& job = jobs[first + k];
+      const CropSource& frames = sources[job.request_];
+      CropSource source = frames;
+      source.data_ = static_cast<const uint8_t*>(frames.data_) +
+                     (size_t)job.image_ * frames.height_ * frames.width_ *
+                         frames.channels_;
+      Detection box;
+      box.x1_ = job.tile_.x_;
+      box.y1_ = job.tile_.y_;
+      box.x2_ = job.tile_.x_ + job.tile_.width_;
+      box.y2_ = job.tile_.y_ + job.tile_.height_;
+      CropResize(
+          source, box, height, width, worker.input_.data() + k * tile_size);
+    }
+
+    rknn_input input;
+    memset(&input, 0, sizeof(input));
+    input.index = 0;
+    input.buf = worker.input_.data();
+    input.size = worker.input_.size();
+    input.pass_through = tile_pass_through_ ? 1 : 0;
+    input.type = sources[jobs[first].request_].signed_ ? RKNN_TENSOR_INT8
+                                                        : RKNN_TENSOR_UINT8;
+    input.fmt = RKNN_TENSOR_NHWC;
+    int ret = rknn_inputs_set(context, 1, &input);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_inputs_set the tiles, ret=") +
+            std::to_string(ret));
+    int core;
+    RETURN_IF_ERROR(RunOn(context, bound_core, &core));
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      memset(&outputs[i], 0, sizeof(rknn_output));
+      outputs[i].index = i;
+    }
+    ret = rknn_outputs_get(context, outputs.size(), outputs.data(), nullptr);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_outputs_get the tiles, ret=") +
+            std::to_string(ret));
+    detections.clear();
+    for (const auto& head : tile_heads_) {
+      DecodeDetections(
+          head.second, outputs[head.first].buf,
+          model_state_->DetectionThreshold(), width, height, &detections);
+    }
+    rknn_outputs_release(context, outputs.size(), outputs.data());
+
+    // The boxes of each tile are suppressed as the model would be on
+    // its own, then moved to the frame, the padding tiles are dropped.
+    SuppressDetections(
+        model_state_->DetectionIou(),
+        tiles * model_state_->TileMaxDetections(),
+        merge == TileMerge::CLASS_NMS, &detections);
+    for (Detection& detection : detections) {
+      if (detection.n_ >= tiles) {
+        continue;
+      }
+      const TileJob& job = jobs[first + detection.n_];
+      const float sx = (float)job.tile_.width_ / width;
+      const float sy = (float)job.tile_.height_ / height;
+      detection.x1_ = job.tile_.x_ + detection.x1_ * sx;
+      detection.y1_ = job.tile_.y_ + detection.y1_ * sy;
+      detection.x2_ = job.tile_.x_ + detection.x2_ * sx;
+      detection.y2_ = job.tile_.y_ + detection.y2_ * sy;
+      detection.n_ = job.image_;
+      worker.detections_.emplace_back(job.request_, detection);
+    }
+  }
+  return nullptr;  // success
+}
+
+void
+ModelInstanceState::ExecuteTiled(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    std::vector<TRITONBACKEND_Response*>* responses)
+{
+  uint64_t input_start_ns = 0;
+  SET_TIMESTAMP(input_start_ns);
+  const rknn_tensor_attr& attr = tile_input_attr_;
+  const bool nhwc = (attr.fmt == RKNN_TENSOR_NHWC);
+  const uint32_t tile_height = (model_state_->TileHeight() != 0)
+                                   ? model_state_->TileHeight()
+                                   : attr.dims[nhwc ? 1 : 2];
+  const uint32_t tile_width = (model_state_->TileWidth() != 0)
+                                  ? model_state_->TileWidth()
+                                  : attr.dims[nhwc ? 2 : 3];
+
+  // Every tile of every image of the batch, the requests only ask for
+  // the merged detections.
+  std::vector<CropSource> sources(request_count);
+  std::vector<std::unique_ptr<uint8_t[]>> gathered(request_count);
+  std::vector<TileJob> jobs;
+  std::vector<Tile> tiles;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    if ((*responses)[r] == nullptr) {
+      continue;
+    }
+    uint32_t requested_count;
+    TRITONSERVER_Error* err =
+        TRITONBACKEND_RequestOutputCount(requests[r], &requested_count);
+    for (uint32_t o = 0; (err == nullptr) && (o < requested_count); ++o) {
+      const char* name;
+      err = TRITONBACKEND_RequestOutputName(requests[r], o, &name);
+      if ((err == nullptr) &&
+          (std::string(name) != kTiledDetectionsOutput)) {
+        err = TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INVALID_ARG,
+            (std::string("a tiled model only answers '") +
+             kTiledDetectionsOutput + "', not '" + name + "'")
+                .c_str());
+      }
+    }
+    uint32_t image_count = 0;
+    if (err == nullptr) {
+      err = RequestImages(
+          requests[r], &sources[r], &image_count, &gathered[r]);
+    }
+    RESPOND_AND_SET_NULL_IF_ERROR(&(*responses)[r], err);
+    if ((*responses)[r] == nullptr) {
+      continue;
+    }
+    TileFrame(
+        sources[r].height_, sources[r].width_, tile_height, tile_width,
+        model_state_->TileOverlap(), &tiles);
+    for (uint32_t n = 0; n < image_count; ++n) {
+      for (const Tile& tile : tiles) {
+        TileJob job;
+        job.request_ = r;
+        job.image_ = n;
+        job.tile_ = tile;
+        jobs.push_back(job);
+      }
+    }
+  }
+  uint64_t input_end_ns = 0;
+  SET_TIMESTAMP(input_end_ns);
+
+  // The workers beyond the first run on the threads of the instance,
+  // each on the core the arbiter grants it.
+  std::vector<TRITONSERVER_Error*> errors(tile_workers_.size(), nullptr);
+  for (TileWorker& worker : tile_workers_) {
+    worker.detections_.clear();
+  }
+  if (!jobs.empty()) {
+    tile_threads_->Run(
+        tile_workers_.size(), [this, &jobs, &sources, &errors](size_t w) {
+          errors[w] = RunTileBatches(w, jobs, sources);
+        });
+  }
+  // A failed batch leaves holes in every request, the first error
+  // answers them all.
+  TRITONSERVER_Error* run_err = nullptr;
+  for (TRITONSERVER_Error* err : errors) {
+    if (run_err == nullptr) {
+      run_err = err;
+    } else if (err != nullptr) {
+      TRITONSERVER_ErrorDelete(err);
+    }
+  }
+  RESPOND_ALL_AND_SET_NULL_IF_ERROR((*responses), request_count, run_err);
+
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics != nullptr) {
+    metrics->AddInputConversion(input_end_ns - input_start_ns);
+    metrics->ObserveBatch(request_count);
+  }
+
+  // The boxes of the overlapping tiles are merged per request, the
+  // same object cut by two tiles is kept once. An IoU of 1 keeps them
+  // all with "tile_merge" none.
+  const TileMerge merge = model_state_->TileMergePolicy();
+  const float iou =
+      (merge == TileMerge::NONE) ? 1.0f : model_state_->DetectionIou();
+  ResponseCompressor* compressor = compressor_.get();
+  std::vector<std::unique_ptr<StagedResponse>> staged(request_count);
+  std::vector<Detection> detections;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    auto& response = (*responses)[r];
+    if (response == nullptr) {
+      continue;
+    }
+    if (compressor != nullptr) {
+      staged[r].reset(new StagedResponse(response));
+    }
+    detections.clear();
+    for (const TileWorker& worker : tile_workers_) {
+      for (const auto& detection : worker.detections_) {
+        if (detection.first == r) {
+          detections.push_back(detection.second);
+        }
+      }
+    }
+    SuppressDetections(
+        iou, model_state_->TileMaxDetections(),
+        merge == TileMerge::CLASS_NMS, &detections);
+
+    const size_t count = detections.size();
+    const std::vector<int64_t> shape{
+        (int64_t)count, (int64_t)kCascadeDetectionValues};
+    const size_t byte_size = count * kCascadeDetectionValues * sizeof(float);
+    void* buffer = nullptr;
+    RESPOND_AND_SET_NULL_IF_ERROR(
+        &response, NewOutput(
+                       response, staged[r].get(), kTiledDetectionsOutput,
+                       TRITONSERVER_TYPE_FP32, shape, byte_size, &buffer));
+    if (response == nullptr) {
+      continue;
+    }
+    float* row = static_cast<float*>(buffer);
+    for (const Detection& d : detections) {
+      row[0] = d.n_;
+      row[1] = d.x1_;
+      row[2] = d.y1_;
+      row[3] = d.x2_;
+      row[4] = d.y2_;
+      row[5] = d.score_;
+      row[6] = d.class_;
+      row += kCascadeDetectionValues;
+    }
+    if (metrics != nullptr) {
+      metrics->AddOutputCopy(byte_size);
+    }
+  }
+
+  for (uint32_t r = 0; r < request_count; ++r) {
+    auto& response = (*responses)[r];
+    if ((response != nullptr) && (staged[r] != nullptr)) {
+      compressor->Enqueue(std::move(staged[r]));
+    } else if (response != nullptr) {
+      LOG_IF_ERROR(
+          TRITONBACKEND_ResponseSend(
+              response, TRITONSERVER_RESPONSE_COMPLETE_FINAL, nullptr),
+          "failed to send response");
+    }
+  }
+  for (uint32_t r = 0; r < request_count; ++r) {
+    if ((*responses)[r] == nullptr) {
+      LOG_IF_ERROR(
+          TRITONBACKEND_ModelInstanceReportStatistics(
+              TritonModelInstance(), requests[r], false /* success */, 0, 0,
+              0, 0),
+          "failed reporting request statistics");
+    }
+    LOG_IF_ERROR(
+        TRITONBACKEND_RequestRelease(
+            requests[r], TRITONSERVER_REQUEST_RELEASE_ALL),
+        "failed releasing request");
+  }
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitStreaming()
+{
+  RETURN_ERROR_IF_TRUE(
+      io_num_.n_input != 1, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("a decoupled model must have a single input"));
+  stream_output_attrs_ = output_attrs_;
+  stream_input_attr_ = PlainNativeInputAttr(ctx, input_attrs_[0]);
+  const rknn_tensor_attr& attr = stream_input_attr_;
+  stream_batch_ = (attr.n_dims > 1) ? attr.dims[0] : 1;
+  const TRITONSERVER_DataType datatype = model_state_->TensorDataType();
+  stream_frame_bytes_ = (size_t)attr.n_elems / stream_batch_ *
+                        TRITONSERVER_DataTypeByteSize(datatype);
+
+  // A frame of the clip is a frame of the NPU input, unless the model
+  // configuration leaves its dimensions variable.
+  const std::vector<int64_t>& shape = model_state_->TensorNonBatchShape();
+  const std::vector<int64_t> frame_shape(shape.begin() + 1, shape.end());
+  const int64_t frame_bytes = GetByteSize(datatype, frame_shape);
+  RETURN_ERROR_IF_TRUE(
+      (frame_bytes > 0) && ((size_t)frame_bytes != stream_frame_bytes_),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("a frame of the input holds ") +
+          std::to_string(frame_bytes) + " bytes, the NPU takes " +
+          std::to_string(stream_frame_bytes_));
+  stream_input_.resize(stream_batch_ * stream_frame_bytes_);
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + Name() + " streams clips through the "
+       "NPU in batches of " + std::to_string(stream_batch_) + " frames")
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::StreamResponse(
+    TRITONBACKEND_ResponseFactory* factory,
+    const std::vector<std::pair<std::string, uint32_t>>& wanted,
+    const rknn_output* outputs, const uint32_t first, const uint32_t count,
+    const uint32_t flags, uint64_t* copy_bytes)
+{
+  TRITONBACKEND_Response* response;
+  RETURN_IF_ERROR(TRITONBACKEND_ResponseNewFromFactory(&response, factory));
+  std::unique_ptr<StagedResponse> staged;
+  if (compressor_ != nullptr) {
+    staged.reset(new StagedResponse(response));
+    staged->flags_ = flags;
+  }
+  std::vector<DequantJob> jobs;
+  TRITONSERVER_Error* err = nullptr;
+  for (const auto& output : wanted) {
+    const std::string& name = output.first;
+    const rknn_output& npu_output = outputs[output.second];
+    const TRITONSERVER_DataType dt = model_state_->OutputTensorDataType(name);
+    std::vector<int64_t> shape = model_state_->getOutputshapes(name);
+    shape[0] = count;
+    const size_t byte_size = GetByteSize(dt, shape);
+    const size_t frame_size = npu_output.size / stream_batch_;
+    void* buffer;
+    err = NewOutput(
+        response, staged.get(), name, dt, shape, byte_size, &buffer);
+    if (err == nullptr) {
+      err = CopyOutput(
+          name, stream_output_attrs_[output.second],
+          static_cast<const uint8_t*>(npu_output.buf) + first * frame_size,
+          count * frame_size, buffer, byte_size, &jobs, copy_bytes);
+    }
+    if (err != nullptr) {
+      LOG_IF_ERROR(
+          TRITONBACKEND_ResponseDelete(response),
+          "failed to delete response");
+      return err;
+    }
+  }
+  DequantizeAll(jobs, dequant_workers_.get());
+  if (staged != nullptr) {
+    compressor_->Enqueue(std::move(staged));
+    return nullptr;  // success
+  }
+  return TRITONBACKEND_ResponseSend(response, flags, nullptr);
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::StreamRequest(
+    TRITONBACKEND_Request* request, TRITONBACKEND_ResponseFactory* factory,
+    bool* final_sent)
+{
+  *final_sent = false;
+  TRITONBACKEND_Input* input;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestInput(
+      request, model_state_->InputTensorName().c_str(), &input));
+  TRITONSERVER_DataType datatype;
+  const int64_t* shape;
+  uint32_t dims_count;
+  uint64_t byte_size;
+  uint32_t buffer_count;
+  RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+      input, nullptr, &datatype, &shape, &dims_count, &byte_size,
+      &buffer_count));
+  RETURN_ERROR_IF_TRUE(
+      dims_count == 0, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("the clip has no frame dimension"));
+  const uint32_t frames = shape[0];
+  RETURN_ERROR_IF_TRUE(
+      byte_size != frames * stream_frame_bytes_,
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("the clip holds ") + std::to_string(byte_size) +
+          " bytes for " + std::to_string(frames) + " frames of " +
+          std::to_string(stream_frame_bytes_));
+
+  // A clip in a single buffer, e.g. a shared-memory region, is handed
+  // to the NPU a batch of frames at a time without being copied.
+  std::unique_ptr<uint8_t[]> gathered;
+  const uint8_t* clip = nullptr;
+  size_t gathered_bytes = 0;
+  for (uint32_t b = 0; b < buffer_count; ++b) {
+    const void* buffer;
+    uint64_t buffer_byte_size;
+    TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+    int64_t memory_type_id = 0;
+    RETURN_IF_ERROR(TRITONBACKEND_InputBuffer(
+        input, b, &buffer, &buffer_byte_size, &memory_type,
+        &memory_type_id));
+    RETURN_ERROR_IF_TRUE(
+        memory_type == TRITONSERVER_MEMORY_GPU,
+        TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("clips are streamed from CPU memory only"));
+    if (buffer_count == 1) {
+      clip = static_cast<const uint8_t*>(buffer);
+      break;
+    }
+    if (gathered == nullptr) {
+      gathered.reset(new uint8_t[byte_size]);
+      clip = gathered.get();
+    }
+    const size_t copy_size =
+        std::min((size_t)buffer_byte_size, byte_size - gathered_bytes);
+    memcpy(gathered.get() + gathered_bytes, buffer, copy_size);
+    gathered_bytes += copy_size;
+  }
+
+  // The outputs the request asks for, with their index on the NPU.
+  const uint32_t output_count = stream_output_attrs_.size();
+  std::vector<std::pair<std::string, uint32_t>> wanted;
+  uint32_t requested_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &requested_count));
+  for (uint32_t r = 0; r < requested_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    const uint32_t i = ModelOutputIndex(
+        name, stream_output_attrs_.data(), output_count);
+    RETURN_ERROR_IF_TRUE(
+        i == output_count, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("output '") + name + "' cannot be streamed");
+    wanted.emplace_back(name, i);
+  }
+
+  ModelMetrics* metrics = model_state_->Metrics();
+  const uint32_t per_response =
+      model_state_->StreamPerBatch() ? stream_batch_ : 1;
+  std::vector<rknn_output> outputs(output_count);
+  for (uint32_t first = 0; first < frames; first += stream_batch_) {
+    uint64_t input_start_ns = 0;
+    SET_TIMESTAMP(input_start_ns);
+    const uint32_t count = std::min(stream_batch_, frames - first);
+    rknn_input npu_input;
+    memset(&npu_input, 0, sizeof(npu_input));
+    npu_input.index = 0;
+    npu_input.size = stream_input_.size();
+    npu_input.pass_through = InputPassThrough() ? 1 : 0;
+    npu_input.type = input_type_;
+    npu_input.fmt = stream_input_attr_.fmt;
+    if (count == stream_batch_) {
+      npu_input.buf = (void*)(clip + first * stream_frame_bytes_);
+    } else {
+      // The last frames are padded up to the batch of the NPU.
+      memcpy(
+          stream_input_.data(), clip + first * stream_frame_bytes_,
+          count * stream_frame_bytes_);
+      memset(
+          stream_input_.data() + count * stream_frame_bytes_, 0,
+          stream_input_.size() - count * stream_frame_bytes_);
+      npu_input.buf = stream_input_.data();
+    }
+    RETURN_IF_ERROR(ConvertInput(&npu_input, npu_input.size, stream_batch_));
+    RETURN_IF_ERROR(SetInputs(&npu_input, 1, stream_input_attr_));
+    uint64_t input_end_ns = 0;
+    SET_TIMESTAMP(input_end_ns);
+    RETURN_IF_ERROR(Run());
+    for (uint32_t i = 0; i < output_count; ++i) {
+      memset(&outputs[i], 0, sizeof(rknn_output));
+      outputs[i].index = i;
+    }
+    const int ret =
+        rknn_outputs_get(ctx, outputs.size(), outputs.data(), nullptr);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_outputs_get, ret=") + std::to_string(ret));
+
+    // The responses of this batch go out before the next one runs.
+    uint64_t copy_bytes = 0;
+    TRITONSERVER_Error* err = nullptr;
+    for (uint32_t f = 0; (f < count) && (err == nullptr);
+         f += per_response) {
+      const uint32_t response_frames = std::min(per_response, count - f);
+      const bool last = (first + f + response_frames == frames);
+      err = StreamResponse(
+          factory, wanted, outputs.data(), f, response_frames,
+          last ? TRITONSERVER_RESPONSE_COMPLETE_FINAL : 0, &copy_bytes);
+      *final_sent = last && (err == nullptr);
+    }
+    rknn_outputs_release(ctx, outputs.size(), outputs.data());
+    if (metrics != nullptr) {
+      metrics->AddInputConversion(input_end_ns - input_start_ns);
+      metrics->ObserveBatch(count);
+      metrics->AddOutputCopy(copy_bytes);
+    }
+    RETURN_IF_ERROR(err);
+  }
+  return nullptr;  // success
+}
+
+void
+ModelInstanceState::ExecuteStreamed(
+    TRITONBACKEND_Request** requests, const uint32_t request_count)
+{
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Request* request = requests[r];
+    TRITONBACKEND_ResponseFactory* factory = nullptr;
+    TRITONSERVER_Error* err =
+        TRITONBACKEND_ResponseFactoryNew(&factory, request);
+    bool final_sent = false;
+    if (err == nullptr) {
+      err = StreamRequest(request, factory, &final_sent);
+    }
+    // A clip that failed part way ends with an error response, an empty
+    // one with the final flag alone.
+    if ((factory != nullptr) && !final_sent) {
+      TRITONBACKEND_Response* response = nullptr;
+      if (err == nullptr) {
+        LOG_IF_ERROR(
+            TRITONBACKEND_ResponseFactorySendFlags(
+                factory, TRITONSERVER_RESPONSE_COMPLETE_FINAL),
+            "failed to send the final flag");
+      } else {
+        LOG_IF_ERROR(
+            TRITONBACKEND_ResponseNewFromFactory(&response, factory),
+            "failed to create error response");
+        if (response != nullptr) {
+          LOG_IF_ERROR(
+              TRITONBACKEND_ResponseSend(
+                  response, TRITONSERVER_RESPONSE_COMPLETE_FINAL, err),
+              "failed to send error response");
+        }
+      }
+    }
+    if (err != nullptr) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_ERROR,
+          (std::string("instance ") + Name() + " failed to stream a clip: " +
+           TRITONSERVER_ErrorMessage(err))
+              .c_str());
+      LOG_IF_ERROR(
+          TRITONBACKEND_ModelInstanceReportStatistics(
+              TritonModelInstance(), request, false /* success */, 0, 0, 0,
+              0),
+          "failed reporting request statistics");
+      TRITONSERVER_ErrorDelete(err);
+    }
+    if (factory != nullptr) {
+      LOG_IF_ERROR(
+          TRITONBACKEND_ResponseFactoryDelete(factory),
+          "failed deleting response factory");
+    }
+    LOG_IF_ERROR(
+        TRITONBACKEND_RequestRelease(
+            request, TRITONSERVER_REQUEST_RELEASE_ALL),
+        "failed releasing request");
+  }
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::HasDmaBufInput(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    bool* dmabuf)
+{
+  *dmabuf = false;
+  const std::string& name = model_state_->DmaBufInputName();
+  if (name.empty()) {
+    return nullptr;  // success
+  }
+  uint32_t dmabuf_count = 0;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Input* input;
+    TRITONSERVER_Error* err =
+        TRITONBACKEND_RequestInput(requests[r], name.c_str(), &input);
+    if (err == nullptr) {
+      dmabuf_count++;
+    } else {
+      TRITONSERVER_ErrorDelete(err);
+    }
+  }
+  RETURN_ERROR_IF_TRUE(
+      (dmabuf_count > 0) && (request_count > 1),
+      TRITONSERVER_ERROR_UNSUPPORTED,
+      std::string("requests with '") + name +
+          "' cannot be batched, disable dynamic batching for model " +
+          model_state_->Name());
+  *dmabuf = (dmabuf_count > 0);
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::BindDmaBufInput(
+    TRITONBACKEND_Request* request, const rknn_tensor_attr& input_attr)
+{
+  const std::string& name = model_state_->DmaBufInputName();
+  TRITONBACKEND_Input* input;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestInput(request, name.c_str(), &input));
+  TRITONSERVER_DataType datatype;
+  uint64_t byte_size;
+  uint32_t buffer_count;
+  RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+      input, nullptr, &datatype, nullptr, nullptr, &byte_size,
+      &buffer_count));
+  RETURN_ERROR_IF_FALSE(
+      (datatype == TRITONSERVER_TYPE_INT64) &&
+          (byte_size == kDmaBufDescriptorElements * sizeof(int64_t)) &&
+          (buffer_count == 1),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'") + name + "' must hold 4 INT64: handle, offset, " +
+          "size, stride");
+  const void* buffer;
+  uint64_t buffer_byte_size;
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  RETURN_IF_ERROR(TRITONBACKEND_InputBuffer(
+      input, 0, &buffer, &buffer_byte_size, &memory_type, &memory_type_id));
+  int64_t values[kDmaBufDescriptorElements];
+  memcpy(values, buffer, sizeof(values));
+  DmaBufDescriptor desc;
+  desc.handle_ = values[0];
+  desc.offset_ = values[1];
+  desc.size_ = values[2];
+  desc.stride_ = values[3];
+
+  // The NPU reads the frame with the datatype declared for the input
+  // tensor, rows may be padded by the decoder.
+  rknn_tensor_attr attr = input_attr;
+  attr.type = RknnInputType(model_state_->TensorDataType());
+  // The frame is read in place, there is no CPU conversion of it.
+  attr.pass_through =
+      (input_pass_through_ && (input_converter_ == nullptr)) ? 1 : 0;
+  const int64_t element_size =
+      TRITONSERVER_DataTypeByteSize(model_state_->TensorDataType());
+  int64_t required_size = (int64_t)attr.n_elems * element_size;
+  if (desc.stride_ > 0) {
+    RETURN_ERROR_IF_FALSE(
+        (attr.fmt == RKNN_TENSOR_NHWC) && (attr.n_dims == 4),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("a dma-buf row stride needs an NHWC input"));
+    const int64_t pixel_size = (int64_t)attr.dims[3] * element_size;
+    RETURN_ERROR_IF_FALSE(
+        (desc.stride_ % pixel_size == 0) &&
+            (desc.stride_ >= (int64_t)attr.dims[2] * pixel_size),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("dma-buf row stride ") + std::to_string(desc.stride_) +
+            " is not a whole number of pixels of at least the width");
+    attr.w_stride = desc.stride_ / pixel_size;
+    required_size = (int64_t)attr.dims[0] * attr.dims[1] * desc.stride_;
+  }
+  RETURN_ERROR_IF_FALSE(
+      desc.size_ >= required_size, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("dma-buf frame of ") + std::to_string(desc.size_) +
+          " bytes, the input needs " + std::to_string(required_size));
+
+  if (dmabuf_importer_ == nullptr) {
+    dmabuf_importer_.reset(
+        new DmaBufImporter(
+            ctx, model_state_->DmaBufCacheSize(),
+            model_state_->StateForBackend()->Handoff()));
+  }
+  rknn_tensor_mem* mem;
+  RETURN_IF_ERROR(dmabuf_importer_->Import(desc, &mem));
+  const int ret = rknn_set_io_mem(ctx, mem, &attr);
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_set_io_mem the dma-buf frame, ret=") +
+          std::to_string(ret));
+  bound_input_mem_ = mem;
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::ConvertInput(
+    rknn_input* input, const size_t byte_size, const uint32_t frames)
+{
+  if (input_converter_ == nullptr) {
+    // A short batch is padded with zeros up to the NPU input.
+    const size_t padded_bytes =
+        (frames == 0) ? byte_size : byte_size / frames * npu_batch_;
+    if (padded_bytes > byte_size) {
+      converted_input_.resize(padded_bytes);
+      memcpy(converted_input_.data(), input->buf, byte_size);
+      memset(
+          converted_input_.data() + byte_size, 0, padded_bytes - byte_size);
+      input->buf = converted_input_.data();
+      input->size = padded_bytes;
+    }
+    return nullptr;  // success
+  }
+  const size_t frame_bytes = input_shape_.Elements() * input_element_size_;
+  RETURN_ERROR_IF_TRUE(
+      (byte_size == 0) || (byte_size % frame_bytes != 0),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("input '") + model_state_->InputTensorName() + "' has " +
+          std::to_string(byte_size) + " bytes, not frames of " +
+          std::to_string(frame_bytes));
+  ConvertShape shape = input_shape_;
+  shape.n_ = byte_size / frame_bytes;
+  const size_t converted_bytes =
+      shape.Elements() * RknnElementSize(input_type_);
+  // A short batch is padded with zeros up to the NPU input.
+  converted_input_.resize(std::max(converted_bytes, input_bytes_));
+  if (converted_bytes < converted_input_.size()) {
+    memset(
+        converted_input_.data() + converted_bytes, 0,
+        converted_input_.size() - converted_bytes);
+  }
+  input_converter_(input->buf, converted_input_.data(), shape);
+  input->buf = converted_input_.data();
+  input->size = converted_input_.size();
+  input->type = input_type_;
+  input->fmt = input_fmt_;
+  return nullptr;  // success
+}
 
-    // Now add the last element with no delimiter
-    oss << input_shape.back();
-    oss<< "][";
-    // Convert all but the last element to avoid a trailing ","
-    std::copy(output_shape.begin(), output_shape.end()-1,
-        std::ostream_iterator<int>(oss, ","));
+TRITONSERVER_Error*
+ModelInstanceState::BatchFrames(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    uint32_t* frames) const
+{
+  if (model_state_->MaxBatchSize() == 0) {
+    // The request holds the whole NPU batch.
+    *frames = npu_batch_;
+    return nullptr;  // success
+  }
+  *frames = 0;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Input* input;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestInput(
+        requests[r], model_state_->InputTensorName().c_str(), &input));
+    const int64_t* shape;
+    uint32_t dims_count;
+    RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+        input, nullptr, nullptr, &shape, &dims_count, nullptr, nullptr));
+    const int64_t request_frames = (dims_count > 0) ? shape[0] : 1;
+    RETURN_ERROR_IF_TRUE(
+        (request_count > 1) && (request_frames != 1),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("request ") + std::to_string(r) + " of a batch of " +
+            std::to_string(request_count) + " to model " +
+            model_state_->Name() + " holds " +
+            std::to_string(request_frames) +
+            " frames, a batched request must hold one");
+    *frames += request_frames;
+  }
+  RETURN_ERROR_IF_TRUE(
+      *frames > npu_batch_, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("a batch of ") + std::to_string(*frames) +
+          " frames does not fit the batch of " + std::to_string(npu_batch_) +
+          " model " + model_state_->Name() + " is compiled for");
+  return nullptr;  // success
+}
 
-    // Now add the last element with no delimiter
-    oss << output_shape.back();
+TRITONSERVER_Error*
+ModelInstanceState::SetInputs(
+    rknn_input* inputs, const uint32_t input_count,
+    const rknn_tensor_attr& input_attr)
+{
+  if (bound_input_mem_ == nullptr) {
+    const int ret = rknn_inputs_set(ctx, input_count, inputs);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_inputs_set, ret=") + std::to_string(ret));
+    return nullptr;  // success
+  }
+
+  // rknn_inputs_set does not undo a rknn_set_io_mem binding, keep the
+  // input bound to memory of the context and fill it instead.
+  if (staging_input_mem_ == nullptr) {
+    staging_input_mem_ = rknn_create_mem(ctx, inputs[0].size);
+    RETURN_ERROR_IF_TRUE(
+        staging_input_mem_ == nullptr, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_create_mem the staging input"));
+  }
+  memcpy(
+      staging_input_mem_->virt_addr, inputs[0].buf,
+      std::min(inputs[0].size, staging_input_mem_->size));
+  if (bound_input_mem_ != staging_input_mem_) {
+    rknn_tensor_attr attr = input_attr;
+    attr.type = inputs[0].type;
+    attr.fmt = inputs[0].fmt;
+    attr.pass_through = inputs[0].pass_through;
+    const int ret = rknn_set_io_mem(ctx, staging_input_mem_, &attr);
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_set_io_mem the staging input, ret=") +
+            std::to_string(ret));
+    bound_input_mem_ = staging_input_mem_;
   }
-  LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("validated model config for input and output shape is:[")+oss.str()+std::string("]")).c_str());
   return nullptr;  // success
 }
 
-//
-// ModelInstanceState
-//
-// State associated with a model instance. An object of this class is
-// created and associated with each
-// TRITONBACKEND_ModelInstance. ModelInstanceState is derived from
-// BackendModelInstance class provided in the backend utilities that
-// provides many common functions.
-//
-class ModelInstanceState : public BackendModelInstance {
- public:
-  static TRITONSERVER_Error* Create(
-      ModelState* model_state,
-      TRITONBACKEND_ModelInstance* triton_model_instance,
-      ModelInstanceState** state);
-  virtual ~ModelInstanceState() = default;
+TRITONSERVER_Error*
+ModelInstanceState::InitModelAttrs()
+{
+  RETURN_IF_ERROR(
+      QueryPlainModelAttrs(ctx, &io_num_, &input_attrs_, &output_attrs_));
+  RETURN_ERROR_IF_TRUE(
+      (io_num_.n_input == 0) || (io_num_.n_output == 0),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("model ") + model_state_->Name() + " has " +
+          std::to_string(io_num_.n_input) + " inputs and " +
+          std::to_string(io_num_.n_output) + " outputs");
+
+  // The requests of a batch are the first dimension of the NPU input,
+  // Triton must not gather more of them than the model is compiled for.
+  // Ragged batches and tiles are packed into that dimension on their
+  // own.
+  const rknn_tensor_attr& attr = input_attrs_[0];
+  npu_batch_ = ((attr.n_dims > 1) && (attr.dims[0] > 0)) ? attr.dims[0] : 1;
+  RETURN_ERROR_IF_TRUE(
+      !model_state_->RaggedBatching() && !model_state_->Tiling() &&
+          (model_state_->MaxBatchSize() > (int)npu_batch_),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("model ") + model_state_->Name() + " declares " +
+          "max_batch_size " + std::to_string(model_state_->MaxBatchSize()) +
+          " but is compiled for a batch of " + std::to_string(npu_batch_) +
+          ", set max_batch_size to at most " + std::to_string(npu_batch_));
+  return nullptr;  // success
+}
 
-  // Get the state of the model that corresponds to this instance.
-  ModelState* StateForModel() const { return model_state_; }
-  rknn_context* getRknnContext(){return &ctx;}
-  
-  // The maximum possible size of the TensorRT tensor and the
-  // corresponding allocated GPU buffer across all optimization
-  // profile.
-  using BatchInputData = std::pair<BatchInput, std::unique_ptr<BackendMemory>>;
-  std::vector<std::pair<std::string, std::int64_t>> outputs_bytes;
-  struct IOBindingInfo {
-    IOBindingInfo()
-        : byte_size_(0), buffer_(nullptr), device_buffer_(nullptr),
-          memory_type_(TRITONSERVER_MEMORY_GPU), memory_type_id_(0),
-          buffer_is_ragged_(false), is_linear_format_(true),
-          vectorized_dim_(-1), components_per_element_(1),
-          is_state_output_(false), is_requested_output_tensor_(false)
-    {
+void
+ModelInstanceState::InitDequantWorkers()
+{
+  if (!model_state_->HasFloatOutput()) {
+    return;
+  }
+  size_t quantized = 0;
+  for (const rknn_tensor_attr& attr : output_attrs_) {
+    if ((attr.type == RKNN_TENSOR_INT8) || (attr.type == RKNN_TENSOR_UINT8)) {
+      quantized++;
     }
-    uint64_t byte_size_;
-    void* buffer_;
-    void* device_buffer_;
-    TRITONSERVER_MemoryType memory_type_;
-    int64_t memory_type_id_;
-    bool buffer_is_ragged_;
-    bool is_linear_format_;
-    int vectorized_dim_;
-    int components_per_element_;
-    const BatchOutput* batch_output_;
-    // Instructions on constructing the batch input and the CPU buffer
-    // for storing mutable data
-    std::shared_ptr<BatchInputData> batch_input_;
-    // Store the pair of input name to look up and output shape
-    // for output scattering
-    std::pair<std::string, std::vector<int64_t>> io_shape_mapping_;
+  }
+  const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  const size_t threads = std::min(quantized, cores);
+  if (threads > 1) {
+    dequant_workers_.reset(new WorkerPool(threads - 1));
+  }
+}
 
-    // Indicates whether the output is a state output.
-    bool is_state_output_;
+TRITONSERVER_Error*
+ModelInstanceState::ChooseInputPath()
+{
+  const rknn_tensor_attr& attr = input_attrs_[0];
+  rknn_tensor_attr native;
+  memset(&native, 0, sizeof(native));
+  native.index = 0;
+  int ret =
+      rknn_query(ctx, RKNN_QUERY_NATIVE_INPUT_ATTR, &native, sizeof(native));
+  if (ret < 0) {
+    // Older runtimes only know the regular attr, which is what they
+    // consume without conversion.
+    native = attr;
+  }
 
-    // Indicates whether the output is a output tensor.
-    bool is_requested_output_tensor_;
-  };
-  TRITONSERVER_Error* InitIOBindingBuffers(); //assume input num always 1
-  // There are Context::num_expected_bindings_ number of IOBindingInfo
-  // elements for copy stream.
-  std::vector<IOBindingInfo> io_binding_infos_;
- private:
-  ModelInstanceState(
-      ModelState* model_state,
-      TRITONBACKEND_ModelInstance* triton_model_instance)
-      : BackendModelInstance(model_state, triton_model_instance),
-        model_state_(model_state)
-  {
-    deviceArch=std::move(std::string(getBuild()));
-    LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("rk backends running on device arch :")+deviceArch).c_str());
+  // Without a declared format the client data is in the layout of the
+  // model input, the backend already binds it with that fmt.
+  const std::string& format = model_state_->InputFormat();
+  rknn_tensor_format declared_fmt = attr.fmt;
+  if (format == "FORMAT_NHWC") {
+    declared_fmt = RKNN_TENSOR_NHWC;
+  } else if (format == "FORMAT_NCHW") {
+    declared_fmt = RKNN_TENSOR_NCHW;
   }
-  TRITONSERVER_Error* InitializeConfigShapeOutputBindings(
-      common::TritonJson::Value& config_output);
-  ModelState* model_state_;
-  rknn_context ctx;
-  std::string deviceArch{};
-  unsigned char *model=NULL; // useless
-};
+  const TRITONSERVER_DataType datatype = model_state_->TensorDataType();
+  ElementType element = ElementType::UINT8;
+  const bool typed = InputElementType(datatype, &element);
+  const rknn_tensor_type declared_type = RknnInputType(datatype);
+  const bool declared_float = (datatype == TRITONSERVER_TYPE_FP16) ||
+                              (datatype == TRITONSERVER_TYPE_FP32) ||
+                              (datatype == TRITONSERVER_TYPE_FP64) ||
+                              (datatype == TRITONSERVER_TYPE_BF16);
+
+  // A declared type or NCHW layout the native NHWC input does not share
+  // is converted into it on the CPU when there is a kernel for the
+  // pair, the NPU then still takes the data with pass_through.
+  InputLayout layout = InputLayout::SAME;
+  InputConvertFn native_converter = nullptr;
+  if (typed && (native.fmt == RKNN_TENSOR_NHWC) && (native.n_dims == 4)) {
+    layout = (declared_fmt == RKNN_TENSOR_NCHW) ? InputLayout::NCHW_TO_NHWC
+                                                : InputLayout::SAME;
+    if ((layout != InputLayout::SAME) || (declared_type != native.type) ||
+        NeedsHostConversion(element)) {
+      native_converter = FindInputConversion(element, native.type, layout);
+    }
+  }
+  const uint32_t declared_size =
+      (native_converter != nullptr)
+          ? attr.n_elems * RknnElementSize(native.type)
+          : attr.n_elems * TRITONSERVER_DataTypeByteSize(datatype);
+
+  std::string reason;
+  if (!model_state_->InputPassThroughAllowed()) {
+    reason = "input_pass_through is off";
+  } else if ((native_converter == nullptr) && (declared_type != native.type)) {
+    reason = std::string("declared type ") + get_type_string(declared_type) +
+             ", native " + get_type_string(native.type);
+  } else if ((native_converter == nullptr) && (declared_fmt != native.fmt)) {
+    reason = std::string("declared format ") +
+             get_format_string(declared_fmt) + ", native " +
+             get_format_string(native.fmt);
+  } else if (declared_float && (native.qnt_type != RKNN_TENSOR_QNT_NONE)) {
+    reason = std::string("native input is quantized ") +
+             get_qnt_type_string(native.qnt_type);
+  } else if (declared_size != native.size) {
+    // e.g. rows padded to the native w_stride.
+    reason = std::string("declared ") + std::to_string(declared_size) +
+             " bytes, native " + std::to_string(native.size);
+  }
+
+  input_pass_through_ = reason.empty();
+  input_converter_ = nullptr;
+  input_type_ = declared_type;
+  input_fmt_ = attr.fmt;
+  if (input_pass_through_ && (native_converter != nullptr)) {
+    input_converter_ = native_converter;
+    input_type_ = native.type;
+    input_fmt_ = native.fmt;
+  } else if (!input_pass_through_ && typed && NeedsHostConversion(element)) {
+    // The driver converts from FLOAT32 but not from this type.
+    layout = InputLayout::SAME;
+    input_converter_ =
+        FindInputConversion(element, RKNN_TENSOR_FLOAT32, layout);
+  }
+  if (input_converter_ != nullptr) {
+    const bool nchw = (attr.fmt == RKNN_TENSOR_NCHW);
+    input_shape_ = ConvertShape();
+    input_shape_.n_ = 1;
+    if (attr.n_dims == 4) {
+      input_shape_.c_ = attr.dims[nchw ? 1 : 3];
+      input_shape_.h_ = attr.dims[nchw ? 2 : 1];
+      input_shape_.w_ = attr.dims[nchw ? 3 : 2];
+    } else {
+      input_shape_.c_ = 1;
+      input_shape_.h_ = 1;
+      input_shape_.w_ = attr.n_elems / std::max(attr.dims[0], 1u);
+    }
+    input_element_size_ = ElementSize(element);
+    input_bytes_ = (size_t)attr.n_elems * RknnElementSize(input_type_);
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("instance ") + Name() + " converts '" +
+         model_state_->InputTensorName() + "' on the CPU: " +
+         ElementTypeName(element) +
+         ((layout == InputLayout::NCHW_TO_NHWC) ? " NCHW" : "") + " to " +
+         get_type_string(input_type_) +
+         ((layout == InputLayout::NCHW_TO_NHWC) ? " NHWC" : ""))
+            .c_str());
+  }
+  if (input_pass_through_) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("instance ") + Name() + " binds '" +
+         model_state_->InputTensorName() + "' with pass_through: " +
+         get_type_string(native.type) + " " + get_format_string(native.fmt) +
+         " " + get_qnt_type_string(native.qnt_type) +
+         " is the native input")
+            .c_str());
+  } else {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("instance ") + Name() + " converts '" +
+         model_state_->InputTensorName() + "' in the driver: " + reason)
+            .c_str());
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitSequenceStates()
+{
+  std::vector<SequenceStates::Tensor> tensors;
+  for (const auto& names : model_state_->StateTensors()) {
+    SequenceStates::Tensor tensor;
+    tensor.input_name_ = names.first;
+    tensor.output_name_ = names.second;
+    rknn_tensor_attr input_attr, output_attr;
+    bool found_input = false, found_output = false;
+    // The first input is the one of the model configuration.
+    for (uint32_t i = 1; (i < io_num_.n_input) && !found_input; ++i) {
+      input_attr = input_attrs_[i];
+      found_input = (names.first == input_attr.name);
+    }
+    for (uint32_t i = 0; (i < io_num_.n_output) && !found_output; ++i) {
+      output_attr = output_attrs_[i];
+      found_output = (names.second == output_attr.name);
+    }
+    RETURN_ERROR_IF_FALSE(
+        found_input && found_output, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("state '") + names.first + "' / '" + names.second +
+            "' is not an input / output pair of the model");
+
+    tensor.input_attr_ = input_attr;
+    tensor.output_attr_ = output_attr;
+    int ret = rknn_query(
+        ctx, RKNN_QUERY_NATIVE_INPUT_ATTR, &tensor.input_attr_,
+        sizeof(tensor.input_attr_));
+    if (ret >= 0) {
+      ret = rknn_query(
+          ctx, RKNN_QUERY_NATIVE_OUTPUT_ATTR, &tensor.output_attr_,
+          sizeof(tensor.output_attr_));
+    }
+    if ((ret >= 0) && (tensor.input_attr_.fmt == tensor.output_attr_.fmt) &&
+        (tensor.input_attr_.type == tensor.output_attr_.type)) {
+      tensor.input_attr_.pass_through = 1;
+    } else {
+      // e.g. an NHWC input fed by an NC1HWC2 output, the runtime
+      // converts both ends.
+      tensor.input_attr_ = input_attr;
+      tensor.output_attr_ = output_attr;
+      tensor.input_attr_.pass_through = 0;
+    }
+    tensors.push_back(tensor);
+  }
+  return SequenceStates::Create(
+      ctx, Name(), tensors, model_state_->SequenceSlots(), &sequence_states_);
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::AllocateBatchBinding(
+    const std::vector<rknn_tensor_attr>& attrs, const size_t position,
+    std::vector<bool>* bound, BatchBinding* binding)
+{
+  size_t index = 0;
+  while ((index < attrs.size()) && (binding->name_ != attrs[index].name)) {
+    index++;
+  }
+  if ((index == attrs.size()) && (position < attrs.size()) &&
+      !(*bound)[position]) {
+    // Models whose tensor names were not exported.
+    index = position;
+  }
+  RETURN_ERROR_IF_TRUE(
+      (index == attrs.size()) || (*bound)[index],
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'") + binding->name_ +
+          "' is not an unbound input of the model");
+  const size_t element_size =
+      TRITONSERVER_DataTypeByteSize(binding->datatype_);
+  RETURN_ERROR_IF_TRUE(
+      element_size == 0, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("'") + binding->name_ + "' of type " +
+          TRITONSERVER_DataTypeString(binding->datatype_) +
+          " cannot be batched into an NPU input");
+  binding->attr_ = attrs[index];
+  binding->byte_size_ = (size_t)attrs[index].n_elems * element_size;
+  BackendMemory* memory;
+  RETURN_IF_ERROR(BackendMemory::Create(
+      model_state_->TritonMemoryManager(),
+      {BackendMemory::AllocationType::CPU_PINNED_POOL,
+       BackendMemory::AllocationType::CPU},
+      0 /* memory_type_id */, binding->byte_size_, &memory));
+  binding->memory_.reset(memory);
+  (*bound)[index] = true;
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitializeBatchInputBindings(
+    common::TritonJson::Value& config)
+{
+  const std::vector<rknn_tensor_attr>& attrs = input_attrs_;
+  std::vector<bool> bound(io_num_.n_input, false);
+
+  common::TritonJson::Value inputs;
+  RETURN_IF_ERROR(config.MemberAsArray("input", &inputs));
+  for (size_t i = 0; i < inputs.ArraySize(); ++i) {
+    common::TritonJson::Value input;
+    RETURN_IF_ERROR(inputs.IndexAsObject(i, &input));
+    BatchBinding binding;
+    RETURN_IF_ERROR(input.MemberAsString("name", &binding.name_));
+    std::string data_type;
+    RETURN_IF_ERROR(input.MemberAsString("data_type", &data_type));
+    binding.datatype_ = ModelConfigDataTypeToTritonServerDataType(data_type);
+    ElementType element;
+    RETURN_ERROR_IF_TRUE(
+        InputElementType(binding.datatype_, &element) &&
+            NeedsHostConversion(element),
+        TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("input '") + binding.name_ + "' is " + data_type +
+            ", which the driver does not take and ragged batching gathers "
+            "as is");
+    binding.buffer_is_ragged_ = model_state_->RaggedInput(binding.name_);
+    RETURN_IF_ERROR(AllocateBatchBinding(attrs, i, &bound, &binding));
+    batch_bindings_.push_back(std::move(binding));
+  }
+  for (const auto& batch_input : model_state_->BatchInputs()) {
+    RETURN_ERROR_IF_TRUE(
+        batch_input.BatchInputKind() ==
+            BatchInput::Kind::BATCH_MAX_ELEMENT_COUNT_AS_SHAPE,
+        TRITONSERVER_ERROR_UNSUPPORTED,
+        std::string("batch input kind BATCH_MAX_ELEMENT_COUNT_AS_SHAPE only "
+                    "sets a shape, the NPU inputs have a static one"));
+    for (const auto& name : batch_input.TargetNames()) {
+      BatchBinding binding;
+      binding.name_ = name;
+      binding.datatype_ = batch_input.DataType();
+      binding.batch_input_ = &batch_input;
+      // Matched by name only.
+      RETURN_IF_ERROR(
+          AllocateBatchBinding(attrs, attrs.size(), &bound, &binding));
+      batch_bindings_.push_back(std::move(binding));
+    }
+  }
+  for (uint32_t i = 0; i < io_num_.n_input; ++i) {
+    RETURN_ERROR_IF_FALSE(
+        bound[i], TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("input '") + attrs[i].name +
+            "' of the model is neither an input nor a batch_input of the "
+            "model configuration");
+  }
+
+  std::string ragged;
+  for (const auto& binding : batch_bindings_) {
+    if (binding.buffer_is_ragged_) {
+      ragged += (ragged.empty() ? "" : ", ") + binding.name_;
+    }
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + Name() + " gathers its " +
+       std::to_string(batch_bindings_.size()) +
+       " NPU inputs from the whole batch, ragged: " +
+       (ragged.empty() ? std::string("none") : ragged))
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitializeBatchOutputBindings()
+{
+  batch_outputs_.assign(
+      io_num_.n_output,
+      std::make_pair(std::string(), (const BatchOutput*)nullptr));
+  for (const auto& batch_output : model_state_->BatchOutputs()) {
+    for (const auto& name : batch_output.TargetNames()) {
+      const uint32_t i =
+          ModelOutputIndex(name, output_attrs_.data(), io_num_.n_output);
+      RETURN_ERROR_IF_TRUE(
+          i == io_num_.n_output, TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("batch output '") + name +
+              "' is not an output of the model");
+      batch_outputs_[i] = std::make_pair(name, &batch_output);
+    }
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::CollectBatchInputs(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    BackendInputCollector* collector)
+{
+  for (auto& binding : batch_bindings_) {
+    size_t byte_size = 0;
+    if (binding.batch_input_ != nullptr) {
+      std::vector<int64_t> shape;
+      RETURN_IF_ERROR(
+          collector->BatchInputShape(*binding.batch_input_, &shape));
+      byte_size = GetByteSize(binding.datatype_, shape);
+    } else {
+      for (uint32_t r = 0; r < request_count; ++r) {
+        TRITONBACKEND_Input* input;
+        RETURN_IF_ERROR(TRITONBACKEND_RequestInput(
+            requests[r], binding.name_.c_str(), &input));
+        uint64_t input_byte_size;
+        RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+            input, nullptr, nullptr, nullptr, nullptr, &input_byte_size,
+            nullptr));
+        byte_size += input_byte_size;
+      }
+    }
+    RETURN_ERROR_IF_TRUE(
+        byte_size > binding.byte_size_, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("a batch of ") + std::to_string(request_count) +
+            " requests holds " + std::to_string(byte_size) + " bytes of '" +
+            binding.name_ + "', the NPU input holds " +
+            std::to_string(binding.byte_size_));
+
+    char* buffer = binding.memory_->MemoryPtr();
+    const std::vector<std::pair<TRITONSERVER_MemoryType, int64_t>>
+        allowed_input_types = {
+            {binding.memory_->MemoryType(), binding.memory_->MemoryTypeId()}};
+    const char* dst_buffer;
+    size_t dst_buffer_byte_size;
+    TRITONSERVER_MemoryType dst_memory_type;
+    int64_t dst_memory_type_id;
+    if (binding.batch_input_ != nullptr) {
+      RETURN_IF_ERROR(collector->ProcessBatchInput(
+          *binding.batch_input_, buffer, byte_size, allowed_input_types,
+          &dst_buffer, &dst_buffer_byte_size, &dst_memory_type,
+          &dst_memory_type_id));
+    } else {
+      RETURN_IF_ERROR(collector->ProcessTensor(
+          binding.name_.c_str(), buffer, byte_size, allowed_input_types,
+          &dst_buffer, &dst_buffer_byte_size, &dst_memory_type,
+          &dst_memory_type_id));
+    }
+    // The NPU input keeps its static shape, past the batch it is zero.
+    memset(buffer + byte_size, 0, binding.byte_size_ - byte_size);
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::SetBatchInputs()
+{
+  std::vector<rknn_input> inputs(batch_bindings_.size());
+  for (size_t b = 0; b < batch_bindings_.size(); ++b) {
+    const BatchBinding& binding = batch_bindings_[b];
+    memset(&inputs[b], 0, sizeof(inputs[b]));
+    inputs[b].index = binding.attr_.index;
+    inputs[b].buf = binding.memory_->MemoryPtr();
+    inputs[b].size = binding.byte_size_;
+    inputs[b].type = RknnInputType(binding.datatype_);
+    inputs[b].fmt = binding.attr_.fmt;
+    // The driver quantizes the gathered data like any declared input.
+    inputs[b].pass_through = 0;
+  }
+  const int ret = rknn_inputs_set(ctx, inputs.size(), inputs.data());
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_inputs_set the batch, ret=") +
+          std::to_string(ret));
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RespondBatchOutputs(
+    BackendOutputResponder* responder, const rknn_tensor_attr* output_attrs,
+    const rknn_output* outputs, const uint32_t output_count,
+    std::vector<std::unique_ptr<char[]>>* buffers, uint64_t* copy_bytes)
+{
+  std::vector<DequantJob> jobs;
+  std::vector<std::pair<uint32_t, const char*>> converted;
+  for (uint32_t i = 0; (i < output_count) && (i < batch_outputs_.size());
+       ++i) {
+    const BatchOutput* batch_output = batch_outputs_[i].second;
+    if ((batch_output == nullptr) || (outputs[i].buf == nullptr)) {
+      // Not a batch output, or one no request asks for.
+      continue;
+    }
+    const size_t byte_size =
+        (size_t)output_attrs[i].n_elems *
+        TRITONSERVER_DataTypeByteSize(batch_output->DataType());
+    buffers->emplace_back(new char[byte_size]);
+    RETURN_IF_ERROR(CopyOutput(
+        batch_outputs_[i].first, output_attrs[i], outputs[i].buf,
+        std::min((size_t)outputs[i].size, (size_t)output_attrs[i].size),
+        buffers->back().get(), byte_size, &jobs, copy_bytes));
+    converted.emplace_back(i, buffers->back().get());
+  }
+  DequantizeAll(jobs, dequant_workers_.get());
+  for (const auto& output : converted) {
+    responder->ProcessBatchOutput(
+        batch_outputs_[output.first].first,
+        *batch_outputs_[output.first].second, output.second,
+        TRITONSERVER_MEMORY_CPU, 0 /* memory_type_id */);
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitNativeOutputs()
+{
+  std::vector<NativeOutput> outputs(io_num_.n_output);
+  TRITONSERVER_Error* err = nullptr;
+  for (uint32_t i = 0; (i < io_num_.n_output) && (err == nullptr); ++i) {
+    NativeOutput& output = outputs[i];
+    output.mem_ = nullptr;
+    output.attr_ = output_attrs_[i];
+    output.native_attr_ = output.attr_;
+    int ret = rknn_query(
+        ctx, RKNN_QUERY_NATIVE_OUTPUT_ATTR, &output.native_attr_,
+        sizeof(output.native_attr_));
+    if (ret < 0) {
+      err = TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("fail to rknn_query the attrs of output ") +
+           std::to_string(i) + ", ret=" + std::to_string(ret))
+              .c_str());
+      break;
+    }
+    // Outputs without a native layout the CPU can undo, e.g. 2-D ones,
+    // are bound in their regular layout and copied as is.
+    output.convert_ = Nc1hwc2LayoutFromAttrs(
+        output.native_attr_, output.attr_, &output.layout_);
+    if (!output.convert_) {
+      output.native_attr_ = output.attr_;
+    }
+    const uint32_t size = std::max(
+        output.native_attr_.size, output.native_attr_.size_with_stride);
+    output.mem_ = rknn_create_mem(ctx, size);
+    if (output.mem_ == nullptr) {
+      err = TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("fail to rknn_create_mem output ") +
+           output.attr_.name)
+              .c_str());
+      break;
+    }
+    ret = rknn_set_io_mem(ctx, output.mem_, &output.native_attr_);
+    if (ret < 0) {
+      err = TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("fail to rknn_set_io_mem output ") +
+           output.attr_.name + ", ret=" + std::to_string(ret))
+              .c_str());
+      break;
+    }
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("instance ") + Name() + " binds output '" +
+         output.attr_.name + "' in " +
+         get_format_string(output.native_attr_.fmt) +
+         (output.convert_ ? ", converted on request" : ""))
+            .c_str());
+  }
+  if (err != nullptr) {
+    for (auto& output : outputs) {
+      rknn_destroy_mem(ctx, output.mem_);
+    }
+    return err;
+  }
+  native_outputs_.swap(outputs);
+  return nullptr;  // success
+}
+
+const ModelInstanceState::NativeOutput*
+ModelInstanceState::FindNativeOutput(const std::string& name) const
+{
+  const std::vector<std::string>& names = model_state_->OutputTensorName();
+  const size_t config_idx =
+      std::find(names.begin(), names.end(), name) - names.begin();
+  if (config_idx == names.size()) {
+    return nullptr;
+  }
+  // Config outputs are matched by name, by position for models whose
+  // tensor names were not exported.
+  for (const auto& candidate : native_outputs_) {
+    if (name == candidate.attr_.name) {
+      return &candidate;
+    }
+  }
+  if (config_idx < native_outputs_.size()) {
+    return &native_outputs_[config_idx];
+  }
+  return nullptr;
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RespondNativeOutputs(
+    TRITONBACKEND_Request* request, TRITONBACKEND_Response* response,
+    StagedResponse* staged, uint64_t* copy_bytes)
+{
+  bool native_layout = false;
+  uint32_t parameter_count = 0;
+  RETURN_IF_ERROR(
+      TRITONBACKEND_RequestParameterCount(request, &parameter_count));
+  for (uint32_t p = 0; p < parameter_count; ++p) {
+    const char* key;
+    TRITONSERVER_ParameterType type;
+    const void* vvalue;
+    RETURN_IF_ERROR(
+        TRITONBACKEND_RequestParameter(request, p, &key, &type, &vvalue));
+    if ((std::string(key) == "native_output_layout") &&
+        (type == TRITONSERVER_PARAMETER_BOOL)) {
+      native_layout = *reinterpret_cast<const bool*>(vvalue);
+    }
+  }
+
+  std::set<std::string> sparse;
+  RETURN_IF_ERROR(SparseHeads(request, &sparse));
+  std::set<std::string> requested;
+  std::vector<DequantJob> jobs;
+  std::vector<std::unique_ptr<uint8_t[]>> scratch;
+  uint32_t output_count;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestOutputCount(request, &output_count));
+  for (uint32_t r = 0; r < output_count; ++r) {
+    const char* name;
+    RETURN_IF_ERROR(TRITONBACKEND_RequestOutputName(request, r, &name));
+    requested.insert(name);
+    std::string head;
+    if ((sparse.count(name) != 0) ||
+        model_state_->SparseIndexOutput(name, &head)) {
+      continue;
+    }
+    const NativeOutput* output = FindNativeOutput(name);
+    RETURN_ERROR_IF_TRUE(
+        output == nullptr, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("unknown output '") + name + "'");
+
+    const TRITONSERVER_DataType dt = model_state_->OutputTensorDataType(name);
+    const bool raw = native_layout && output->convert_;
+    // A dequantized output keeps its declared type in either layout.
+    DequantJob probe;
+    const bool dequant = OutputDequantJob(name, output->attr_, &probe);
+    const size_t dt_size = TRITONSERVER_DataTypeByteSize(dt);
+    std::vector<int64_t> shape;
+    size_t byte_size;
+    size_t src_size;
+    if (raw) {
+      for (uint32_t d = 0; d < output->native_attr_.n_dims; ++d) {
+        shape.push_back(output->native_attr_.dims[d]);
+      }
+      src_size = output->layout_.NativeByteSize();
+      byte_size = dequant ? src_size * dt_size : src_size;
+    } else {
+      shape = model_state_->getOutputshapes(name);
+      byte_size = GetByteSize(dt, shape);
+      src_size = output->convert_ ? output->layout_.ByteSize()
+                                  : (size_t)output->mem_->size;
+      const size_t expected = dequant ? src_size * dt_size : src_size;
+      RETURN_ERROR_IF_TRUE(
+          output->convert_ && (byte_size != expected),
+          TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("output '") + name + "' holds " +
+              std::to_string(expected) +
+              " bytes, the model configuration declares " +
+              std::to_string(byte_size));
+      if (!dequant) {
+        byte_size = std::min(byte_size, src_size);
+      }
+    }
+
+    void* buffer;
+    RETURN_IF_ERROR(
+        NewOutput(response, staged, name, dt, shape, byte_size, &buffer));
+    // The layout is converted first, into 'buffer' or into scratch
+    // memory when the result is dequantized afterwards.
+    const void* src = output->mem_->virt_addr;
+    if (!raw && output->convert_) {
+      void* converted = buffer;
+      if (dequant) {
+        scratch.emplace_back(new uint8_t[src_size]);
+        converted = scratch.back().get();
+      }
+      if (output->attr_.fmt == RKNN_TENSOR_NHWC) {
+        Nc1hwc2ToNhwc(output->layout_, src, converted);
+      } else {
+        Nc1hwc2ToNchw(output->layout_, src, converted);
+      }
+      src = converted;
+      if (!dequant) {
+        *copy_bytes += byte_size;
+        continue;
+      }
+    }
+    RETURN_IF_ERROR(CopyOutput(
+        name, output->attr_, src, src_size, buffer, byte_size, &jobs,
+        copy_bytes));
+  }
+  // Sparse heads are scanned in the layout of the model configuration
+  // whatever "native_output_layout" says.
+  for (const auto& head : sparse) {
+    const NativeOutput* output = FindNativeOutput(head);
+    RETURN_ERROR_IF_TRUE(
+        output == nullptr, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("unknown output '") + head + "'");
+    const void* src = output->mem_->virt_addr;
+    if (output->convert_) {
+      scratch.emplace_back(new uint8_t[output->layout_.ByteSize()]);
+      if (output->attr_.fmt == RKNN_TENSOR_NHWC) {
+        Nc1hwc2ToNhwc(output->layout_, src, scratch.back().get());
+      } else {
+        Nc1hwc2ToNchw(output->layout_, src, scratch.back().get());
+      }
+      src = scratch.back().get();
+    }
+    RETURN_IF_ERROR(RespondSparseOutput(
+        response, staged, head, requested.count(head) != 0, output->attr_,
+        src, &jobs, &scratch, copy_bytes));
+  }
+  DequantizeAll(jobs, dequant_workers_.get());
+  if (native_layout) {
+    RETURN_IF_ERROR(TRITONBACKEND_ResponseSetStringParameter(
+        response, "output_layout", "NC1HWC2"));
+  }
+  return nullptr;  // success
+}
 
 TRITONSERVER_Error*
 ModelInstanceState::Create(
     ModelState* model_state, TRITONBACKEND_ModelInstance* triton_model_instance,
     ModelInstanceState** state){
   try {
-    *state = new ModelInstanceState(model_state, triton_model_instance);
-    auto* ctx =(*state)->getRknnContext();auto myself=*state;
-    TRITONBACKEND_ArtifactType artifatct_type; 
-    const char *path = ""; 
+    // Torn down by its destructor when any step below fails, with the
+    // context, threads and buffers set up so far.
+    std::unique_ptr<ModelInstanceState> local_state(
+        new ModelInstanceState(model_state, triton_model_instance));
+    auto* ctx =local_state->getRknnContext();auto myself=local_state.get();
     int ret = -1;
     rknn_mem_size memSize{};rknn_sdk_version rknnSdkVersion{};
-    RETURN_IF_ERROR(TRITONBACKEND_ModelRepository((*state)->model_state_->TritonModel(), &artifatct_type, &path)); 
-    
-    std::stringstream ss;
-    ss<<path<<'/'<<(*state)->model_state_->Version()<<"/model.rknn";
+    const std::string model_path = local_state->model_state_->ModelPath();
 
-    LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("rk backend will load model from :")+ss.str()).c_str());
+    LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("rk backend will load model from :")+model_path).c_str());
      // int model_len;
-     // (*state)->model = load_model(ss.str().c_str(),&model_len);
+     // local_state->model = load_model(ss.str().c_str(),&model_len);
      
-     //  ret = rknn_init(&((*state)->ctx), (*state)->model, 0, 0,0);
-     ret = rknn_init(ctx,(void*)ss.str().c_str(),0,0,0);
-     if(ret < 0)
-       LOG_MESSAGE(TRITONSERVER_LOG_ERROR,(std::string("rknn_init fail! ret= :")+std::to_string(ret)).c_str());
-     else
-       LOG_MESSAGE(TRITONSERVER_LOG_ERROR,(std::string("rknn_init succeed! ret= :")+std::to_string(ret)).c_str());
+     //  ret = rknn_init(&(local_state->ctx), local_state->model, 0, 0,0);
+     // Layer timings are only collected by contexts created with
+     // RKNN_FLAG_COLLECT_PERF_MASK.
+     local_state->init_flags_ =
+         (local_state->model_state_->Profiler() != nullptr)
+             ? RKNN_FLAG_COLLECT_PERF_MASK
+             : 0;
+     ret = local_state->model_state_->InitContext(
+         model_path, local_state->init_flags_, ctx);
+     // A version that fails to load leaves the one serving in place.
+     RETURN_ERROR_IF_TRUE(
+         ret < 0, TRITONSERVER_ERROR_INTERNAL,
+         std::string("fail to create the context of ") + model_path +
+             ", ret=" + std::to_string(ret));
      ret=rknn_query(*ctx,RKNN_QUERY_SDK_VERSION,(void*)&rknnSdkVersion,sizeof(rknnSdkVersion));
      LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("rknn sdk api version: ")+std::string(rknnSdkVersion.api_version)+
        std::string(", rknn driver version: ")+std::string(rknnSdkVersion.drv_version)).c_str());
@@ -416,7 +5379,86 @@ ModelInstanceState::Create(
             std::to_string(memSize.total_weight_size)+std::string("\n\t total_internal_size : ")+
             std::to_string(memSize.total_internal_size)).c_str());
      }
-     RETURN_IF_ERROR((*state)->InitIOBindingBuffers());
+     RETURN_IF_ERROR(local_state->InitModelAttrs());
+     local_state->InitDequantWorkers();
+     RETURN_IF_ERROR(local_state->ChooseInputPath());
+     if (local_state->model_state_->NativeOutput()) {
+       RETURN_IF_ERROR(local_state->InitNativeOutputs());
+     }
+     if (local_state->model_state_->ImplicitState()) {
+       RETURN_IF_ERROR(local_state->InitSequenceStates());
+     }
+     if (local_state->model_state_->RaggedBatching()) {
+       RETURN_IF_ERROR(local_state->InitializeBatchInputBindings(
+           local_state->model_state_->ModelConfig()));
+       RETURN_IF_ERROR(local_state->InitializeBatchOutputBindings());
+     }
+     RETURN_IF_ERROR(local_state->InitIOBindingBuffers());
+     if (local_state->model_state_->Cascade()) {
+       RETURN_IF_ERROR(local_state->InitCascade());
+     }
+     if (local_state->model_state_->Tiling()) {
+       RETURN_IF_ERROR(local_state->InitTiling());
+     }
+     if (local_state->model_state_->Decoupled()) {
+       RETURN_IF_ERROR(local_state->InitStreaming());
+     }
+     if (local_state->model_state_->ResponseCodec() != rk_codec::Codec::NONE) {
+       local_state->compressor_.reset(new ResponseCompressor(
+           local_state->Name(), local_state->model_state_->ResponseCodec(),
+           local_state->model_state_->ResponseCompressionLevel()));
+     }
+     if (local_state->model_state_->EagerBatching()) {
+       local_state->StartCompletionThread();
+     }
+     RETURN_IF_ERROR(local_state->Warmup());
+     ContextManager* contexts =
+         local_state->model_state_->StateForBackend()->Contexts();
+     if (contexts != nullptr) {
+       ret = rknn_query(*ctx, RKNN_QUERY_MEM_SIZE, &memSize, sizeof(memSize));
+       if (ret >= 0) {
+         local_state->context_bytes_ =
+             (uint64_t)memSize.total_weight_size +
+             memSize.total_internal_size;
+       } else {
+         LOG_MESSAGE(
+             TRITONSERVER_LOG_WARN,
+             (std::string("instance ") + local_state->Name() +
+              " cannot query RKNN_QUERY_MEM_SIZE, its context is not "
+              "counted in npu-memory-budget-mb")
+                 .c_str());
+       }
+       // The cascade context is not rebuilt with the detector one, it
+       // stays with it and counts against the budget.
+       if ((local_state->cascade_ctx_ != 0) &&
+           (rknn_query(
+                local_state->cascade_ctx_, RKNN_QUERY_MEM_SIZE, &memSize,
+                sizeof(memSize)) >= 0)) {
+         local_state->context_bytes_ +=
+             (uint64_t)memSize.total_weight_size +
+             memSize.total_internal_size;
+       }
+       // So do the tile contexts, which share the weights.
+       for (const TileWorker& worker : local_state->tile_workers_) {
+         if ((worker.ctx_ != 0) &&
+             (rknn_query(
+                  worker.ctx_, RKNN_QUERY_MEM_SIZE, &memSize,
+                  sizeof(memSize)) >= 0)) {
+           local_state->context_bytes_ += memSize.total_internal_size;
+         }
+       }
+       // The memory the NPU writes to between executions (sequence
+       // state, native outputs, imported frames, outputs answered on
+       // the completion thread) cannot be rebuilt, those contexts stay.
+       const ModelState* ms = local_state->model_state_;
+       const bool pinned = ms->NativeOutput() || ms->ImplicitState() ||
+                           !ms->DmaBufInputName().empty() ||
+                           ms->EagerBatching() || ms->Cascade() ||
+                           ms->Tiling();
+       contexts->Register(
+           local_state.get(), local_state->context_bytes_, pinned);
+     }
+     *state = local_state.release();
   }
   catch (const BackendModelInstanceException& ex) {
     RETURN_ERROR_IF_TRUE(
@@ -424,90 +5466,539 @@ ModelInstanceState::Create(
         std::string("unexpected nullptr in BackendModelInstanceException"));
     RETURN_IF_ERROR(ex.err_);
   }
-  
+  
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::Run()
+{
+  int core = -1;
+  RETURN_IF_ERROR(RunOn(ctx, &npu_core_, &core));
+
+  LayerProfiler* profiler = model_state_->Profiler();
+  if ((profiler != nullptr) && profiler->ShouldSample()) {
+    LOG_IF_ERROR(
+        profiler->Sample(ctx, Name(), (core >= 0) ? core : npu_core_),
+        "failed to sample per-layer NPU profile");
+  }
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RunOn(
+    rknn_context context, int* bound_core, int* core)
+{
+  BackendState* backend_state = model_state_->StateForBackend();
+  NpuArbiter* arbiter =
+      backend_state->ArbiterEnabled() ? backend_state->Arbiter() : nullptr;
+
+  *core = -1;
+  if (arbiter != nullptr) {
+    *core = arbiter->Acquire(
+        model_state_->Name(), model_state_->NpuCoreMask(), *bound_core);
+    // Only re-program the context when the arbiter moved it to another
+    // core, rknn_set_core_mask is not free.
+    if ((*core != *bound_core) && (arbiter->CoreCount() > 1)) {
+      int ret = rknn_set_core_mask(context, (rknn_core_mask)(1 << *core));
+      if (ret < 0) {
+        arbiter->Release(model_state_->Name(), *core, 0);
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INTERNAL,
+            (std::string("fail to rknn_set_core_mask to core ") +
+             std::to_string(*core) + ", ret=" + std::to_string(ret))
+                .c_str());
+      }
+      *bound_core = *core;
+    }
+  }
+
+  uint64_t run_start_ns = 0;
+  SET_TIMESTAMP(run_start_ns);
+  int ret = rknn_run(context, NULL);
+  uint64_t run_end_ns = 0;
+  SET_TIMESTAMP(run_end_ns);
+
+  if (arbiter != nullptr) {
+    arbiter->Release(model_state_->Name(), *core, run_end_ns - run_start_ns);
+  }
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics != nullptr) {
+    metrics->ObserveRun(run_end_ns - run_start_ns);
+    // Without the arbiter a context left on the automatic core mask
+    // cannot be attributed to a core.
+    backend_state->Metrics()->AddCoreBusy(
+        (*core >= 0) ? *core : *bound_core, run_end_ns - run_start_ns);
+  }
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_run, ret=") + std::to_string(ret));
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::Warmup()
+{
+  const uint32_t runs = model_state_->WarmupRuns();
+  if (runs == 0) {
+    return nullptr;  // success
+  }
+  std::vector<std::vector<uint8_t>> buffers;
+  RETURN_IF_ERROR(SetZeroInputs(ctx, &buffers));
+  uint64_t start_ns = 0;
+  SET_TIMESTAMP(start_ns);
+  for (uint32_t r = 0; r < runs; ++r) {
+    RETURN_IF_ERROR(Run());
+  }
+  uint64_t end_ns = 0;
+  SET_TIMESTAMP(end_ns);
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + Name() + " warmed up with " +
+       std::to_string(runs) + " runs in " +
+       std::to_string((end_ns - start_ns) / 1000) + " us")
+          .c_str());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::LeaseContext()
+{
+  ContextManager* contexts = model_state_->StateForBackend()->Contexts();
+  if ((contexts == nullptr) || contexts->Acquire(this)) {
+    return nullptr;  // success
+  }
+  uint64_t start_ns = 0;
+  SET_TIMESTAMP(start_ns);
+  const int ret =
+      model_state_->InitContext(model_state_->ModelPath(), init_flags_, &ctx);
+  if (ret < 0) {
+    ctx = 0;
+    contexts->Release(this, false /* resident */);
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_UNAVAILABLE,
+        (std::string("fail to materialize the context of instance ") +
+         Name() + ", ret=" + std::to_string(ret))
+            .c_str());
+  }
+  uint64_t end_ns = 0;
+  SET_TIMESTAMP(end_ns);
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics != nullptr) {
+    metrics->ObserveContextReload(end_ns - start_ns);
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_VERBOSE,
+      (std::string("instance ") + Name() + " materialized its context in " +
+       std::to_string((end_ns - start_ns) / 1000) + " us")
+          .c_str());
+  return nullptr;  // success
+}
+
+void
+ModelInstanceState::ReturnContext()
+{
+  ContextManager* contexts = model_state_->StateForBackend()->Contexts();
+  if (contexts != nullptr) {
+    contexts->Release(this, true /* resident */);
+  }
+}
+
+void
+ModelInstanceState::EvictContext()
+{
+  model_state_->ReleaseContext(ctx);
+  rknn_destroy(ctx);
+  ctx = 0;
+  // A new context starts on the automatic core mask.
+  npu_core_ = -1;
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics != nullptr) {
+    metrics->AddContextEviction();
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_VERBOSE,
+      (std::string("instance ") + Name() + " context evicted").c_str());
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::InitializeConfigShapeOutputBindings(
+    common::TritonJson::Value& config_output){
+          // todo sth.
+          return nullptr;
+    }
+
+
+TRITONSERVER_Error*
+ModelInstanceState::InitIOBindingBuffers()
+{
+  triton::common::TritonJson::Value config_outputs;
+  RETURN_IF_ERROR(
+  model_state_->ModelConfig().MemberAsArray("output", &config_outputs));
+  // std::vector<std::pair<std::string, std::int64_t>> outputs_bytes;
+  for (size_t i = 0; i < config_outputs.ArraySize(); i++) {
+      triton::common::TritonJson::Value io;
+      RETURN_IF_ERROR(config_outputs.IndexAsObject(i, &io));
+      std::string io_name;
+      io.MemberAsString("name", &io_name);
+      std::string io_data_type;
+      io.MemberAsString("data_type", &io_data_type);
+      common::TritonJson::Value model_config_dims;
+      common::TritonJson::Value reshape;
+      if (io.Find("reshape", &reshape)) {
+        reshape.MemberAsArray("shape", &model_config_dims);
+        //todo: deal with reshape operations.
+        //
+        //
+      } else {
+        io.MemberAsArray("dims", &model_config_dims);
+        std::vector<int64_t> dim_vec;
+        int64_t byte_size;
+        RETURN_IF_ERROR(DimsJsonToDimVec(model_config_dims, &dim_vec));
+        std::vector<int64_t> dim_vec_with_mbs;
+        // dim_vec_with_mbs.push_back(model_state_->MaxBatchSize());
+        dim_vec_with_mbs.insert(
+            dim_vec_with_mbs.end(), dim_vec.begin(), dim_vec.end());
+        byte_size = GetByteSize(ModelConfigDataTypeToTritonServerDataType(io_data_type), dim_vec_with_mbs);
+        outputs_bytes.push_back(std::make_pair(io_name,byte_size));
+        LOG_MESSAGE(TRITONSERVER_LOG_INFO,(
+        std::string("\n io_name : ")+
+        io_name+
+        std::string("\n byte_size : ")+
+
+        std::to_string(byte_size)).c_str());
+        // std::cout<< "1111111111111111111111111111111 "<<std::endl;
+        // std::cout<< "bytesize: "<< std::to_string(byte_size)<<std::endl<<std::flush;
+        // std::cout<< "dim_vec_with_mbs :"<<std::endl;
+        //     for(auto&dim :dim_vec_with_mbs){
+        //       std::cout<< std::to_string(dim) <<", ";
+        //     }
+        // std::cout<< std::endl<<std::flush;
+      }
+    }
+  int64_t max_byte_size = 0;
+  for(auto& i :outputs_bytes){
+    auto&j =i.second;
+    max_byte_size += std::max((int64_t)1, j);
+  }
+  // std::cout <<std::string("=================================")<<std::endl<< max_byte_size <<std::endl<<std::flush;//================================= 3265920
+  for(int i=0;i<model_state_->MaxBatchSize();i++){ // warning: maxbatchsize should be less then request_num in every request.
+    IOBindingInfo io_binding_info;
+    void* buffer = nullptr;
+    buffer = malloc(std::max((int64_t)1,max_byte_size));
+
+    // std::cout<< "1111111111111111111111111111111 "<<std::endl;
+    // std::cout<< "malloc: "<< std::to_string(max_byte_size)<<std::endl<<std::flush;
+
+    io_binding_info.byte_size_ = max_byte_size;
+    io_binding_info.buffer_ = buffer;
+    io_binding_info.device_buffer_ = buffer;
+    io_binding_infos_.push_back(io_binding_info);
+    pool_capacity_bytes_ += max_byte_size;
+  }
+  if (model_state_->Metrics() != nullptr) {
+    model_state_->Metrics()->AddBufferPool(0, pool_capacity_bytes_);
+  }
+  RETURN_IF_ERROR(InitializeConfigShapeOutputBindings(config_outputs));
+  return nullptr;
+}
+
+//////////////////////////////////////////////////////
+void
+ModelInstanceState::CompleteExecution(ExecutionPayload* payload)
+{
+  TRITONBACKEND_Request** requests = payload->requests_.data();
+  const uint32_t request_count = payload->requests_.size();
+  std::vector<TRITONBACKEND_Response*>& responses = payload->responses_;
+  std::vector<std::unique_ptr<StagedResponse>>& staged = payload->staged_;
+  ResponseCompressor* compressor = compressor_.get();
+  const bool direct_outputs = payload->direct_outputs_;
+  const bool native_outputs = payload->native_outputs_;
+  const int ret = payload->ret_;
+  const rknn_tensor_attr* output_attrs = output_attrs_.data();
+  const rknn_output* outputs = payload->outputs_.data();
+  const uint32_t output_count = payload->outputs_.size();
+
+  ModelMetrics* metrics = model_state_->Metrics();
+  if (metrics != nullptr) {
+    metrics->AddInputConversion(payload->input_conversion_ns_);
+    metrics->ObserveBatch(request_count);
+  }
+  ReportBufferPoolUsage(outputs, output_count);
+  uint64_t output_copy_bytes = 0;
+
+  if (native_outputs && (request_count == 1) && (responses[0] != nullptr)) {
+    RESPOND_AND_SET_NULL_IF_ERROR(
+        &responses[0],
+        RespondNativeOutputs(
+            requests[0], responses[0], staged[0].get(), &output_copy_bytes));
+  }
+
+  if (direct_outputs && (ret >= 0) && (responses[0] != nullptr)) {
+    std::vector<DequantJob> jobs;
+    for (const auto& copy : payload->output_copies_) {
+      const rknn_tensor_attr& attr = output_attrs[copy.index_];
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &responses[0],
+          CopyOutput(
+              copy.name_, attr, outputs[copy.index_].buf,
+              std::min((size_t)outputs[copy.index_].size, (size_t)attr.size),
+              copy.buffer_, copy.byte_size_, &jobs, &output_copy_bytes));
+      if (responses[0] == nullptr) {
+        break;
+      }
+    }
+    // The heads are scanned in the frame of the request only, not in
+    // the padding of the NPU batch.
+    std::vector<rknn_tensor_attr> frame_attrs;
+    std::vector<rknn_output> frame_outputs;
+    FrameOutputs(outputs, 0, &frame_attrs, &frame_outputs);
+    if (responses[0] != nullptr) {
+      DequantizeAll(jobs, dequant_workers_.get());
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &responses[0],
+          RespondSparseOutputs(
+              requests[0], responses[0], nullptr, frame_attrs.data(),
+              frame_outputs.data(), output_count, &output_copy_bytes));
+    }
+    if (responses[0] != nullptr) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &responses[0],
+          RespondCascadeOutputs(
+              requests[0], responses[0], nullptr, frame_attrs.data(),
+              frame_outputs.data(), output_count, &output_copy_bytes));
+    }
+  }
+
+  uint64_t compute_end_ns = 0;
+  SET_TIMESTAMP(compute_end_ns);
+  bool supports_first_dim_batching;
+  RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+      responses, request_count,
+      model_state_->SupportsFirstDimBatching(&supports_first_dim_batching));
+
+  BackendOutputResponder responder(
+      requests, request_count, &responses, model_state_->TritonMemoryManager(),
+      supports_first_dim_batching, false /* pinned_enabled */,
+      nullptr /* stream*/);
+
+  // Request 'idx' is answered from frame 'idx' of the NPU batch.
+  std::vector<rknn_tensor_attr> frame_attrs;
+  std::vector<rknn_output> frame_outputs;
+  for (size_t idx = 0; !direct_outputs && !native_outputs && (ret >= 0) &&
+                       (idx < request_count);
+       idx++) {
+    auto& response = responses[idx];
+    if (response != nullptr) {
+      FrameOutputs(outputs, idx, &frame_attrs, &frame_outputs);
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &response, ScatterOutputs(
+                         requests[idx], response, staged[idx].get(),
+                         frame_attrs.data(), frame_outputs.data(),
+                         output_count, &output_copy_bytes));
+    }
+  }
+
+  // The "batch_output" tensors are cut out of the whole NPU output by
+  // the responder, from buffers that must outlive it.
+  std::vector<std::unique_ptr<char[]>> batch_output_buffers;
+  if (!direct_outputs && !native_outputs && (ret >= 0) &&
+      !batch_outputs_.empty()) {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        RespondBatchOutputs(
+            &responder, output_attrs, outputs, output_count,
+            &batch_output_buffers, &output_copy_bytes));
+  }
+
+  // Finalize the responder. If 'true' is returned, the OUT0
+  // tensors' data will not be valid until the backend synchronizes
+  // the CUDA stream or event that was used when creating the
+  // responder. For this backend, GPU is not supported and so no
+  // CUDA sync should be needed; so if 'true' is returned simply log
+  // an error.
+
+  if (metrics != nullptr) {
+    metrics->AddOutputCopy(output_copy_bytes);
+  }
+
+  const bool need_cuda_output_sync = responder.Finalize();
+  if (need_cuda_output_sync) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_ERROR,
+        "'minimal' backend: unexpected CUDA sync required by responder");
+  }
+
+  
+
+  // Send all the responses that haven't already been sent because of
+  // an earlier error. Staged responses are sent by the compressor once
+  // their outputs are compressed.
+  
+  for (uint32_t r = 0; r < request_count; r++) {
+    auto& response = responses[r];
+    if ((response != nullptr) && (staged[r] != nullptr)) {
+      compressor->Enqueue(std::move(staged[r]));
+    } else if (response != nullptr) {
+      LOG_IF_ERROR(
+          TRITONBACKEND_ResponseSend(
+              response, TRITONSERVER_RESPONSE_COMPLETE_FINAL, nullptr),
+          "failed to send response");
+    }
+  }
+  uint64_t exec_end_ns = 0;
+  SET_TIMESTAMP(exec_end_ns);
+
+#ifdef TRITON_ENABLE_STATS
+  // For batch statistics need to know the total batch size of the
+  // requests. This is not necessarily just the number of requests,
+  // because if the model supports batching then any request can be a
+  // batched request itself.
+  size_t total_batch_size = 0;
+  if (!supports_first_dim_batching) {
+    total_batch_size = request_count;
+  } else {
+    for (uint32_t r = 0; r < request_count; ++r) {
+      auto& request = requests[r];
+      TRITONBACKEND_Input* input = nullptr;
+      LOG_IF_ERROR(
+          TRITONBACKEND_RequestInputByIndex(request, 0 /* index */, &input),
+          "failed getting request input");
+      if (input != nullptr) {
+        const int64_t* shape = nullptr;
+        LOG_IF_ERROR(
+            TRITONBACKEND_InputProperties(
+                input, nullptr, nullptr, &shape, nullptr, nullptr, nullptr),
+            "failed getting input properties");
+        if (shape != nullptr) {
+          total_batch_size += shape[0];
+        }
+      }
+    }
+  }
+#else
+  (void)payload->exec_start_ns_;
+  (void)exec_end_ns;
+  (void)payload->compute_start_ns_;
+  (void)compute_end_ns;
+#endif  // TRITON_ENABLE_STATS
+
+  // Done with the request objects so release them.
+  for (uint32_t r = 0; r < request_count; ++r) {
+    auto& request = requests[r];
+    // Before releasing, record failed requests as those where
+    // responses[r] is nullptr. The timestamps are ignored in this
+    // case.
+    if (responses[r] == nullptr) {
+      LOG_IF_ERROR(
+          TRITONBACKEND_ModelInstanceReportStatistics(
+              TritonModelInstance(), request,
+              false /* success */, 0, 0, 0, 0),
+          "failed reporting request statistics");
+    }
+
+    LOG_IF_ERROR(
+        TRITONBACKEND_RequestRelease(request, TRITONSERVER_REQUEST_RELEASE_ALL),
+        "failed releasing request");
+  }
 
-  return nullptr;  // success
 }
 
-TRITONSERVER_Error*
-ModelInstanceState::InitializeConfigShapeOutputBindings(
-    common::TritonJson::Value& config_output){
-          // todo sth.
-          return nullptr;
-    }
-
+void
+ModelInstanceState::AcquireOutputs()
+{
+  if (semaphore_ == nullptr) {
+    return;
+  }
+  semaphore_->Acquire();
+  // The previous batch is answered, its runtime outputs can go back.
+  if (!unreleased_outputs_.empty()) {
+    rknn_outputs_release(
+        ctx, unreleased_outputs_.size(), unreleased_outputs_.data());
+    unreleased_outputs_.clear();
+  }
+}
 
-TRITONSERVER_Error*
-ModelInstanceState::InitIOBindingBuffers()
+void
+ModelInstanceState::Complete(std::unique_ptr<ExecutionPayload> payload)
 {
-  triton::common::TritonJson::Value config_outputs;
-  RETURN_IF_ERROR(
-  model_state_->ModelConfig().MemberAsArray("output", &config_outputs));
-  // std::vector<std::pair<std::string, std::int64_t>> outputs_bytes;
-  for (size_t i = 0; i < config_outputs.ArraySize(); i++) {
-      triton::common::TritonJson::Value io;
-      RETURN_IF_ERROR(config_outputs.IndexAsObject(i, &io));
-      std::string io_name;
-      io.MemberAsString("name", &io_name);
-      std::string io_data_type;
-      io.MemberAsString("data_type", &io_data_type);
-      common::TritonJson::Value model_config_dims;
-      common::TritonJson::Value reshape;
-      if (io.Find("reshape", &reshape)) {
-        reshape.MemberAsArray("shape", &model_config_dims);
-        //todo: deal with reshape operations.
-        //
-        //
-      } else {
-        io.MemberAsArray("dims", &model_config_dims);
-        std::vector<int64_t> dim_vec;
-        int64_t byte_size;
-        RETURN_IF_ERROR(DimsJsonToDimVec(model_config_dims, &dim_vec));
-        std::vector<int64_t> dim_vec_with_mbs;
-        // dim_vec_with_mbs.push_back(model_state_->MaxBatchSize());
-        dim_vec_with_mbs.insert(
-            dim_vec_with_mbs.end(), dim_vec.begin(), dim_vec.end());
-        byte_size = GetByteSize(ModelConfigDataTypeToTritonServerDataType(io_data_type), dim_vec_with_mbs);
-        outputs_bytes.push_back(std::make_pair(io_name,byte_size));
-        LOG_MESSAGE(TRITONSERVER_LOG_INFO,(
-        std::string("\n io_name : ")+
-        io_name+
-        std::string("\n byte_size : ")+
+  if (semaphore_ == nullptr) {
+    CompleteExecution(payload.get());
+    if (!payload->fetched_outputs_.empty()) {
+      rknn_outputs_release(
+          ctx, payload->fetched_outputs_.size(),
+          payload->fetched_outputs_.data());
+    }
+    return;
+  }
+  // Only the execute thread calls into the context, the outputs are
+  // released once the completion thread is done reading them.
+  unreleased_outputs_ = std::move(payload->fetched_outputs_);
+  {
+    std::lock_guard<std::mutex> lk(completion_mu_);
+    completion_queue_.push_back(std::move(payload));
+  }
+  completion_cv_.notify_one();
+}
 
-        std::to_string(byte_size)).c_str());
-        // std::cout<< "1111111111111111111111111111111 "<<std::endl;
-        // std::cout<< "bytesize: "<< std::to_string(byte_size)<<std::endl<<std::flush;
-        // std::cout<< "dim_vec_with_mbs :"<<std::endl;
-        //     for(auto&dim :dim_vec_with_mbs){
-        //       std::cout<< std::to_string(dim) <<", ";
-        //     }
-        // std::cout<< std::endl<<std::flush;
+void
+ModelInstanceState::StartCompletionThread()
+{
+  // The semaphore goes in the context of the core the instance is
+  // pinned to by "npu_core_mask", else of the core with the fewest
+  // instances of the model.
+  BackendState* backend_state = model_state_->StateForBackend();
+  const int core_count = backend_state->ArbiterEnabled()
+                             ? backend_state->Arbiter()->CoreCount()
+                             : 1;
+  int core = 0;
+  const uint32_t mask = model_state_->NpuCoreMask();
+  if (mask != 0) {
+    while (((mask >> core) & 1) == 0) {
+      core++;
+    }
+  } else {
+    for (int c = 1; c < core_count; ++c) {
+      if (model_state_->SemaphoreCount(c) <
+          model_state_->SemaphoreCount(core)) {
+        core = c;
       }
     }
-  int64_t max_byte_size = 0;
-  for(auto& i :outputs_bytes){
-    auto&j =i.second;
-    max_byte_size += std::max((int64_t)1, j);
   }
-  // std::cout <<std::string("=================================")<<std::endl<< max_byte_size <<std::endl<<std::flush;//================================= 3265920
-  for(int i=0;i<model_state_->MaxBatchSize();i++){ // warning: maxbatchsize should be less then request_num in every request.
-    IOBindingInfo io_binding_info;
-    void* buffer = nullptr;
-    buffer = malloc(std::max((int64_t)1,max_byte_size));
-
-    // std::cout<< "1111111111111111111111111111111 "<<std::endl;
-    // std::cout<< "malloc: "<< std::to_string(max_byte_size)<<std::endl<<std::flush;
+  semaphore_ = model_state_->RegisterSemaphore(core, 1 /* count */);
+  completion_thread_ =
+      std::thread(&ModelInstanceState::CompletionLoop, this);
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + Name() + " eager batching, semaphore " +
+       std::to_string(model_state_->SemaphoreCount(core)) + " of core " +
+       std::to_string(core))
+          .c_str());
+}
 
-    io_binding_info.byte_size_ = max_byte_size;
-    io_binding_info.buffer_ = buffer;
-    io_binding_info.device_buffer_ = buffer;
-    io_binding_infos_.push_back(io_binding_info);
+void
+ModelInstanceState::CompletionLoop()
+{
+  std::unique_lock<std::mutex> lk(completion_mu_);
+  while (true) {
+    completion_cv_.wait(lk, [this] {
+      return completion_exiting_ || !completion_queue_.empty();
+    });
+    if (completion_queue_.empty()) {
+      return;
+    }
+    std::unique_ptr<ExecutionPayload> payload =
+        std::move(completion_queue_.front());
+    completion_queue_.pop_front();
+    lk.unlock();
+    CompleteExecution(payload.get());
+    semaphore_->Release();
+    lk.lock();
   }
-  RETURN_IF_ERROR(InitializeConfigShapeOutputBindings(config_outputs));
-  return nullptr;
 }
 
-//////////////////////////////////////////////////////
 extern "C" {
 // Triton calls TRITONBACKEND_Initialize when a backend is loaded into
 // Triton to allow the backend to create and initialize any state that
@@ -570,9 +6061,10 @@ TRITONBACKEND_Initialize(TRITONBACKEND_Backend* backend)
       TRITONSERVER_LOG_INFO,
       (std::string("backend configuration:\n") + buffer).c_str());
 
-  // This backend does not require any "global" state but as an
-  // example create a string to demonstrate.
-  std::string* state = new std::string("backend state");
+  // Create the state shared by all rockchip models, it owns the NPU
+  // arbiter.
+  BackendState* state;
+  RETURN_IF_ERROR(BackendState::Create(backend, &state));
   RETURN_IF_ERROR(
       TRITONBACKEND_BackendSetState(backend, reinterpret_cast<void*>(state)));
 
@@ -588,11 +6080,18 @@ TRITONBACKEND_Finalize(TRITONBACKEND_Backend* backend)
   // Delete the "global" state associated with the backend.
   void* vstate;
   RETURN_IF_ERROR(TRITONBACKEND_BackendState(backend, &vstate));
-  std::string* state = reinterpret_cast<std::string*>(vstate);
-
+  BackendState* state = reinterpret_cast<BackendState*>(vstate);
+
+  std::vector<uint64_t> run_count;
+  state->Arbiter()->CoreRunCount(&run_count);
+  std::string runs;
+  for (size_t core = 0; core < run_count.size(); ++core) {
+    runs += " core" + std::to_string(core) + "=" +
+            std::to_string(run_count[core]);
+  }
   LOG_MESSAGE(
       TRITONSERVER_LOG_INFO,
-      (std::string("TRITONBACKEND_Finalize: state is '") + *state + "'")
+      (std::string("TRITONBACKEND_Finalize: NPU runs per core:") + runs)
           .c_str());
 
   delete state;
@@ -743,14 +6242,16 @@ TRITONBACKEND_ModelInstanceExecute(
   // we should not return from this function until execution is
   // complete. Triton will automatically release 'instance' on return
   // from this function so that it is again available to be used for
-  // another call to TRITONBACKEND_ModelInstanceExecute.
+  // another call to TRITONBACKEND_ModelInstanceExecute. With
+  // "eager_batching" the responses of the batch are still being sent
+  // on return, see ModelInstanceState::Complete.
   
   //rk defaut set to support batching.
   // bool supports_batching = false;
   // RETURN_IF_ERROR(model_state->SupportsFirstDimBatching(&supports_batching));
   
   LOG_MESSAGE(
-      TRITONSERVER_LOG_INFO,
+      TRITONSERVER_LOG_VERBOSE,
       (std::string("model ") + model_state->Name() + ", instance " +
        instance_state->Name() + ", executing " + std::to_string(request_count) +
        " requests")
@@ -767,15 +6268,39 @@ TRITONBACKEND_ModelInstanceExecute(
   // useful macros for error handling that can be found in
   // backend_common.h.
 
+  // A context evicted by the ContextManager is materialized again
+  // before the backend takes the requests, Triton answers them if that
+  // fails.
+  RETURN_IF_ERROR(instance_state->LeaseContext());
+
+  // A decoupled model answers each request from its response factory,
+  // a response per frame of its clip.
+  if (model_state->Decoupled()) {
+    instance_state->ExecuteStreamed(requests, request_count);
+    instance_state->ReturnContext();
+    return nullptr;  // success
+  }
+
   std::vector<TRITONBACKEND_Response*> responses;
   responses.reserve(request_count);
   for (uint32_t r = 0; r < request_count; ++r) {
     TRITONBACKEND_Request* request = requests[r];
     TRITONBACKEND_Response* response;
-    RETURN_IF_ERROR(TRITONBACKEND_ResponseNew(&response, request));
+    TRITONSERVER_Error* err = TRITONBACKEND_ResponseNew(&response, request);
+    if (err != nullptr) {
+      instance_state->ReturnContext();
+      return err;
+    }
     responses.push_back(response);
   }
 
+  // Tiled frames take their own way through the NPU.
+  if (model_state->Tiling()) {
+    instance_state->ExecuteTiled(requests, request_count, &responses);
+    instance_state->ReturnContext();
+    return nullptr;  // success
+  }
+
   // At this point, the backend takes ownership of 'requests', which
   // means that it is responsible for sending a response for every
   // request. From here, even if something goes wrong in processing,
@@ -813,6 +6338,18 @@ TRITONBACKEND_ModelInstanceExecute(
   // created, so use ProcessTensor arguments that cause collector to
   // manage it.
 
+  // Gathering the batch and rknn_inputs_set below are accounted as
+  // input conversion time in the backend metrics.
+  uint64_t input_start_ns = 0;
+  SET_TIMESTAMP(input_start_ns);
+
+  // A request may hand over its frame as a dma-buf instead of tensor
+  // data, it is bound below once the input attributes are known.
+  bool dmabuf_input = false;
+  RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+      responses, request_count,
+      instance_state->HasDmaBufInput(requests, request_count, &dmabuf_input));
+
   BackendInputCollector collector(
       requests, request_count, &responses, model_state->TritonMemoryManager(),
       false /* pinned_enabled */, nullptr /* stream*/);
@@ -821,25 +6358,42 @@ TRITONBACKEND_ModelInstanceExecute(
   // input tensors into a single contiguous buffer in CPU memory, set
   // the "allowed input types" to be the CPU ones (see tritonserver.h
   // in the triton-inference-server/core repo for allowed memory
-  // types).
+  // types). The NPU runtime reads both, so a single request whose
+  // input already sits in one CPU or pinned buffer, such as a system
+  // shared-memory region registered by a co-located client, is handed
+  // to rknn_inputs_set without being copied.
   std::vector<std::pair<TRITONSERVER_MemoryType, int64_t>> allowed_input_types =
       {
-        // {TRITONSERVER_MEMORY_CPU_PINNED, 0}, 
+        {TRITONSERVER_MEMORY_CPU_PINNED, 0},
         {TRITONSERVER_MEMORY_CPU, 0}
       };
 
-  const char* input_buffer;
-  size_t input_buffer_byte_size;
-  TRITONSERVER_MemoryType input_buffer_memory_type;
-  int64_t input_buffer_memory_type_id;
-
-  RESPOND_ALL_AND_SET_NULL_IF_ERROR(
-      responses, request_count,
-      collector.ProcessTensor(
-          model_state->InputTensorName().c_str(), nullptr /* existing_buffer */,
-          0 /* existing_buffer_byte_size */, allowed_input_types, &input_buffer,
-          &input_buffer_byte_size, &input_buffer_memory_type,
-          &input_buffer_memory_type_id));
+  const char* input_buffer = nullptr;
+  size_t input_buffer_byte_size = 0;
+  TRITONSERVER_MemoryType input_buffer_memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t input_buffer_memory_type_id = 0;
+
+  // With ragged batching every NPU input is gathered from the whole
+  // batch instead, see InitializeBatchInputBindings.
+  const bool ragged_batching = model_state->RaggedBatching();
+  uint32_t frames = 1;
+  if (ragged_batching) {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        instance_state->CollectBatchInputs(
+            requests, request_count, &collector));
+  } else if (!dmabuf_input) {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        instance_state->BatchFrames(requests, request_count, &frames));
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        collector.ProcessTensor(
+            model_state->InputTensorName().c_str(),
+            nullptr /* existing_buffer */, 0 /* existing_buffer_byte_size */,
+            allowed_input_types, &input_buffer, &input_buffer_byte_size,
+            &input_buffer_memory_type, &input_buffer_memory_type_id));
+  }
 
   // Finalize the collector. If 'true' is returned, 'input_buffer'
   // will not be valid until the backend synchronizes the CUDA
@@ -852,6 +6406,9 @@ TRITONBACKEND_ModelInstanceExecute(
         TRITONSERVER_LOG_ERROR,
         "'rk' backend: does not suppory async required by collector");
   }
+  uint64_t input_end_ns = 0;
+  SET_TIMESTAMP(input_end_ns);
+  uint64_t input_conversion_ns = input_end_ns - input_start_ns;
 
   // 'input_buffer' contains the batched "IN0" tensor. The backend can
   // implement whatever logic is necesary to produce "OUT0". This
@@ -861,404 +6418,195 @@ TRITONBACKEND_ModelInstanceExecute(
   uint64_t compute_start_ns = 0;
   SET_TIMESTAMP(compute_start_ns);
 
-  LOG_MESSAGE(
-      TRITONSERVER_LOG_INFO,
-      (std::string("model ") + model_state->Name() + ": requests in batch " +
-       std::to_string(request_count))
-          .c_str());
-  std::string tstr;
-  IGNORE_ERROR(BufferAsTypedString(
-      tstr, input_buffer, input_buffer_byte_size, model_state->TensorDataType()));
-  LOG_MESSAGE(
-      TRITONSERVER_LOG_INFO,
-      (std::string("batched " + model_state->InputTensorName() + " value: ignored")).c_str());
-      //  tstr).c_str());
-
-  //step 1. query rknn and verify input and output num.
-  rknn_input_output_num io_num;
-  rknn_context* rkctx=instance_state->getRknnContext();
-  if(rkctx==NULL)RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG, "fail to rknn_query in out nums."));
-  int ret=-1;
-  ret=rknn_query(*rkctx, RKNN_QUERY_IN_OUT_NUM, &io_num, sizeof(io_num));
-  if(ret<0){
-    RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG, "fail to rknn_query in out nums."));
+  // The attrs were queried when the context was created.
+  const rknn_input_output_num& io_num = instance_state->IONum();
+  const rknn_tensor_attr* input_attrs = instance_state->InputAttrs();
+  const rknn_tensor_attr* output_attrs = instance_state->OutputAttrs();
+
+  // The requests of the batch are the frames of the single NPU input,
+  // gathered in their order into 'input_buffer'.
+  rknn_input input;
+  memset(&input, 0, sizeof(input));
+  input.index = 0;
+  input.type = instance_state->InputType();
+  input.size = input_buffer_byte_size;
+  input.fmt = input_attrs[0].fmt;
+  input.pass_through = instance_state->InputPassThrough() ? 1 : 0;
+  input.buf = (void*)input_buffer;
+  SET_TIMESTAMP(input_start_ns);
+  if (dmabuf_input) {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        instance_state->BindDmaBufInput(requests[0], input_attrs[0]));
+  } else if (ragged_batching) {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count, instance_state->SetBatchInputs());
+  } else {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        instance_state->ConvertInput(&input, input_buffer_byte_size, frames));
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        instance_state->SetInputs(&input, 1, input_attrs[0]));
   }
-  
-  LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("model input num: ")+std::to_string(io_num.n_input)+
-    std::string(", output num: ")+std::to_string(io_num.n_output)+std::string(" \n")).c_str());
-  
-  rknn_tensor_attr input_attrs[io_num.n_input];
-  memset(input_attrs, 0, sizeof(input_attrs));
-  for (uint i = 0; i < io_num.n_input; i++) {
-    input_attrs[i].index = i;
-    ret                  = rknn_query(*rkctx, RKNN_QUERY_INPUT_ATTR, &(input_attrs[i]), sizeof(rknn_tensor_attr));
-    if (ret < 0) {
-      RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG, "fail to rknn_query in out attrs."));
+  // The implicit state of the sequence is bound in place of the state
+  // inputs and outputs, a request at a time.
+  SequenceStates* states = instance_state->States();
+  SequenceFlags sequence_flags;
+  size_t state_slot = 0;
+  bool state_bound = false;
+  if ((states != nullptr) && (request_count == 1) &&
+      (responses[0] != nullptr)) {
+    RESPOND_AND_SET_NULL_IF_ERROR(
+        &responses[0],
+        ReadSequenceFlags(
+            requests[0], model_state->SequenceControlInputs(),
+            &sequence_flags));
+    if (responses[0] != nullptr) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &responses[0], states->Bind(sequence_flags, &state_slot));
+      state_bound = (responses[0] != nullptr);
     }
-    dump_tensor_attr(&(input_attrs[i]));
-    // index=0, name=images, n_dims=4, dims=[1, 384, 640, 3], n_elems=737280, size=737280, fmt=NHWC, type=INT8, qnt_type=AFFINE, zp=-128, scale=0.003922
-  }
-  rknn_tensor_attr output_attrs[io_num.n_output];
-  memset(output_attrs, 0, sizeof(output_attrs));
-  for (uint i = 0; i < io_num.n_output; i++) {
-    output_attrs[i].index = i;
-    ret                   = rknn_query(*rkctx, RKNN_QUERY_OUTPUT_ATTR, &(output_attrs[i]), sizeof(rknn_tensor_attr));
-    dump_tensor_attr(&(output_attrs[i]));
-    // index=0, name=output, n_dims=4, dims=[1, 81, 48, 80], n_elems=311040, size=311040, fmt=NCHW, type=INT8, qnt_type=AFFINE, zp=55, scale=0.141896
-    // index=1, name=376, n_dims=4, dims=[1, 81, 24, 40], n_elems=77760, size=77760, fmt=NCHW, type=INT8, qnt_type=AFFINE, zp=45, scale=0.142525
-    // index=2, name=377, n_dims=4, dims=[1, 81, 12, 20], n_elems=19440, size=19440, fmt=NCHW, type=INT8, qnt_type=AFFINE, zp=53, scale=0.104938
-  }
-
-  //step 2 verify model argument is or not compatible.
-  if(!verifyInputModelInput(input_attrs,input_buffer,request_count,input_buffer_byte_size)){
-    RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG, "fail to verify model config and input tensors."));
   }
-  
-
-  //step 3 do infer. notice that here we use NHWC.
-  //3.1 get rknn model arg.
-  int channel = 3;
-  int width   = 0;
-  int height  = 0;
-  if (input_attrs[0].fmt == RKNN_TENSOR_NCHW) {
-    LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("model is NCHW input fmt").c_str()); 
-
-    channel = input_attrs[0].dims[1];
-    width   = input_attrs[0].dims[2];
-    height  = input_attrs[0].dims[3];
-  } else {
-    LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("model is NHWC input fmt").c_str());
-    width   = input_attrs[0].dims[1];
-    height  = input_attrs[0].dims[2];
-    channel = input_attrs[0].dims[3];
-    // RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG, std::string("tensor shape mismatch.").c_str()));
-  }
-  //model input height=640, width=384, channel=3
-  LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("model input height="+std::to_string(height)+std::string(", width=")+
-      std::to_string(width)+std::string(", channel=")+std::to_string(channel)).c_str()));
-
-  //3.2 allocate input.
-  //assume 1 input per request, so there are 1*request_nums inputs.
-  rknn_input* inputs= new rknn_input[request_count];
-  // memset(inputs, 0, sizeof(inputs));
-  for(uint rc=0;rc<request_count;rc++){
-    inputs[rc].index        = rc;
-    // inputs[0].type       = RKNN_TENSOR_UINT8;
-    inputs[rc].type         = getRKType(model_state->TensorDataType());
-    inputs[rc].size         = width * height * channel;
-    // inputs[rc].fmt       = RKNN_TENSOR_NHWC;
-    inputs[rc].fmt          = input_attrs[0].fmt;
-    inputs[rc].pass_through = 0;
-    //3.2.1 assign input pointer
-    inputs[rc].buf = (void*)(input_buffer+(rc*input_buffer_byte_size/request_count));
-  }
-  rknn_inputs_set(*rkctx, io_num.n_input, inputs);
+  SET_TIMESTAMP(input_end_ns);
+  input_conversion_ns += input_end_ns - input_start_ns;
   
   //3.3 allocate output 
   rknn_output outputs[io_num.n_output];
   memset(outputs, 0, sizeof(outputs));
-  for (uint32_t i = 0; i < io_num.n_output && i<(uint32_t)model_state->MaxBatchSize() ; i++) {
-    outputs[i].want_float = 0;
-    outputs[i].is_prealloc = 1;
+  for (uint32_t i = 0; i < io_num.n_output; i++) {
     outputs[i].index = i;
-    outputs[i].buf = instance_state->io_binding_infos_[i].buffer_;
-    outputs[i].size = instance_state->io_binding_infos_[i].byte_size_;
-    memset(outputs[i].buf, 0, outputs[i].size);
-  }
-
-  //3.4 run  
-  ret = rknn_run(*rkctx, NULL);
-  if (ret < 0) {
-      RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL, "fail to rknn_run."));
   }
-  //3.5 get and copy output to response.
-  //3.5.1 get output
-  ret = rknn_outputs_get(*rkctx, io_num.n_output, outputs, NULL);
-  if (ret < 0) {
-      RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses,request_count,TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL, "fail to rknn_outputs_get."));
-  }
-  //3.5.2 delete inputs
-  delete[] inputs;
-
-  //3.5.3 copy to output_buffer
-  const char* output_buffer = (const char* )instance_state->io_binding_infos_[0].buffer_;
-
-
-  // const char*  output_buffer = nullptr;
-  TRITONSERVER_MemoryType output_buffer_memory_type = input_buffer_memory_type;
-  int64_t output_buffer_memory_type_id = input_buffer_memory_type_id;
-
-  // // Only need an response tensor for requested outputs.
-  // if ((response != nullptr) &&
-  //     (request_required_outputs[idx].find(name) !=
-  //       request_required_outputs[idx].end())) {
-  //   TRITONBACKEND_Output* response_output = nullptr;
-  //   RESPOND_AND_SET_NULL_IF_ERROR(
-  //       &response, TRITONBACKEND_ResponseOutput(
-  //                       response, &response_output, name.c_str(), dt,
-  //                       batchn_shape.data(), batchn_shape.size()));
-  //   cuda_copy |= SetOutputShapeTensorBuffer(
-  //       shape_value_ptr, &response, response_output, tensor_element_cnt,
-  //       batchn_shape[0], stream_);
-  // }
-
-
-  uint64_t compute_end_ns = 0;
-  SET_TIMESTAMP(compute_end_ns);
-  bool supports_first_dim_batching;
-  RESPOND_ALL_AND_SET_NULL_IF_ERROR(
-      responses, request_count,
-      model_state->SupportsFirstDimBatching(&supports_first_dim_batching));
-  std::vector<int64_t> tensor_shape;
-  RESPOND_ALL_AND_SET_NULL_IF_ERROR(
-      responses, request_count, model_state->TensorShape(tensor_shape));
-  {
-    std::ostringstream oss;
-    oss <<"[";
-    for (auto& i:tensor_shape){
-      oss<<std::to_string(i);
-      oss<<",";
-    }
-    oss.seekp(-1, std::ios_base::end);oss<<"]";
-    LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("now dump supports_first_dim_batching ")+std::to_string(supports_first_dim_batching)+
-      std::string(" ,input_tensor_shape")+  oss.str()+std::string(",responses.size :[")+std::to_string(responses.size())+std::string("]")).c_str());
-    
+  // A single request has its outputs written by rknn_outputs_get
+  // directly into the response buffers instead of the io binding
+  // buffers, saving the copy below.
+  // With native outputs the NPU writes into memory bound to the
+  // context, which holds the result of one request only.
+  const bool native_outputs = instance_state->NativeOutputs();
+  if (native_outputs && (request_count > 1)) {
+    RESPOND_ALL_AND_SET_NULL_IF_ERROR(
+        responses, request_count,
+        TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_UNSUPPORTED,
+            (std::string("requests to model ") + model_state->Name() +
+             " cannot be batched with 'native_output' on, disable dynamic "
+             "batching")
+                .c_str()));
   }
-
-  // for(auto& n:request_required_outputs){
-  //   for(auto& m:n)
-  //     LOG_MESSAGE(TRITONSERVER_LOG_ERROR,(std::string("'k': ")+std::string(m)).c_str());
-  // }
-
-  // Only need an response tensor for requested outputs.
-  // for (size_t idx = 0; idx < request_count; idx++){
-  //   const auto& request = requests[idx];
-  //   auto& response = responses[idx];
-  //   if ((response != nullptr) &&
-  //     (request_required_outputs[idx].find(name) !=
-  //       request_required_outputs[idx].end())) {
-  //   TRITONBACKEND_Output* response_output = nullptr;
-  //   RESPOND_AND_SET_NULL_IF_ERROR(
-  //       &response, TRITONBACKEND_ResponseOutput(
-  //                       response, &response_output, name.c_str(), dt,
-  //                       batchn_shape.data(), batchn_shape.size()));
-  //   cuda_copy |= SetOutputShapeTensorBuffer(
-  //       shape_value_ptr, &response, response_output, tensor_element_cnt,
-  //       batchn_shape[0], stream_);
-  // }
-  // }
-  
-  
-
-
-
-  // Because the output tensor values are concatenated into a single
-  // contiguous 'output_buffer', the backend must "scatter" them out
-  // to the individual response output tensors.  The backend utilities
-  // provide a "responder" to facilitate this scattering process.
-
-  // The 'responders's ProcessTensor function will copy the portion of
-  // 'output_buffer' corresonding to each request's output into the
-  // response for that request.
-
-  BackendOutputResponder responder(
-      requests, request_count, &responses, model_state->TritonMemoryManager(),
-      supports_first_dim_batching, false /* pinned_enabled */,
-      nullptr /* stream*/);
-
-  
-  
-  //3.5.4  make output response.
-  // Collect the names of requested outputs. Do not include outputs
-  // for requests that have already responded with an error.
-  // std::vector<std::set<std::string>> request_required_outputs(request_count);
-  for (size_t idx = 0; idx < request_count; idx++) {
-    
-    const auto& request = requests[idx];
-    auto& response = responses[idx];
-    auto& iobind_=instance_state->io_binding_infos_[idx];
-    // LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("responder.ProcessTensor 11111111111111111111111111111111111-")+std::to_string(response==nullptr)).c_str()); 
-    if (response != nullptr) {
-      // LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("responder.ProcessTensor 2222222222222222").c_str());
-      uint32_t output_count;
+  // Outputs that at least one request of the batch asks for, the
+  // others are neither fetched nor converted by rknn_outputs_get.
+  std::vector<bool> wanted_outputs(io_num.n_output, false);
+  for (uint32_t r = 0; r < request_count; r++) {
+    if (responses[r] != nullptr) {
       RESPOND_AND_SET_NULL_IF_ERROR(
-          &response, TRITONBACKEND_RequestOutputCount(request, &output_count));
-      if (response != nullptr) {
-        // LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("responder.ProcessTensor 3333333333333333333333333").c_str());
-        // for (uint32_t output_idx = 0; output_idx < output_count; output_idx++) {
-        for(auto&output_name:model_state->OutputTensorName()){
-          // const char* output_name;
-          // RESPOND_AND_SET_NULL_IF_ERROR(
-          //     &response, TRITONBACKEND_RequestOutputName(
-          //                    request, output_idx, &output_name));
-          // LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("output_shape_: [").c_str());
-          // {
-          //   std::stringstream ss;
-          //   for (auto it = model_state->getOutputshapes(output_name).begin(); it != model_state->getOutputshapes(output_name).end(); it++)    {
-          //       if (it != model_state->getOutputshapes(output_name).begin()) {
-          //           ss << " ";
-          //       }
-          //       ss << *it;
-          //   }
-        
-          //   std::cout << ss.str() << std::endl;
-          // }
-          // LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("]").c_str());
-          // LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("responder.ProcessTensor 4444444444444444444444444444444").c_str());
-          // if(model_state->OutputTensorName().find(output_name)!=model_state->OutputTensorName().end()){
-          if(std::find(model_state->OutputTensorName().begin(), model_state->OutputTensorName().end(), output_name) != model_state->OutputTensorName().end()){
-            // LOG_MESSAGE(TRITONSERVER_LOG_INFO,std::string("responder.ProcessTensor 555555555555555555555555555").c_str());
-            TRITONBACKEND_Output* response_output = nullptr;
-            TRITONSERVER_DataType dt = model_state->OutputTensorDataType(output_name);
-            // To demonstrate response parameters we attach some here. Most
-            // responses do not use parameters but they provide a way for
-            // backends to communicate arbitrary information along with the
-            // response.
-            LOG_IF_ERROR(
-                TRITONBACKEND_ResponseSetStringParameter(
-                    response, "param0", "an example string parameter"),
-                "failed setting string parameter");
-            LOG_IF_ERROR(
-                TRITONBACKEND_ResponseSetIntParameter(response, "param1", 42),
-                "failed setting integer parameter");
-            LOG_IF_ERROR(
-                TRITONBACKEND_ResponseSetBoolParameter(response, "param2", false),
-                "failed setting boolean parameter");
-            size_t tensor_offset = 0;
-            // const size_t tensor_byte_size = GetByteSize(dt, model_state->getOutputshapes(output_name));
-
-            // TRITONBACKEND_Output* response_output;
-            if (response != nullptr) {
-              uint32_t output_count;
-              RESPOND_AND_SET_NULL_IF_ERROR(
-                  &response, TRITONBACKEND_RequestOutputCount(request, &output_count));
-              for (uint32_t output_idx = 0; output_idx < output_count; output_idx++) {
-                // const char* name;
-                // RESPOND_AND_SET_NULL_IF_ERROR(
-                //     &response,
-                //     TRITONBACKEND_RequestOutputName(request, output_idx, &name));
-                // if ((response != nullptr) && (output_name == name)) {
-                  RESPOND_AND_SET_NULL_IF_ERROR(
-                      &response, TRITONBACKEND_ResponseOutput(
-                                    response, &response_output, output_name.c_str(), dt,
-                                    model_state->getOutputshapes(output_name).data(), model_state->getOutputshapes(output_name).size()));
-                  //创建output_buffer
-                  void* output_buffer;
-                  TRITONSERVER_MemoryType output_memory_type = TRITONSERVER_MEMORY_CPU;
-                  int64_t output_memory_type_id = 0;
-                  RESPOND_AND_SET_NULL_IF_ERROR(
-                      &response, TRITONBACKEND_OutputBuffer(
-                          response_output, &output_buffer, GetByteSize(dt, model_state->getOutputshapes(output_name)), &output_memory_type,
-                          &output_memory_type_id));
-                  memcpy(output_buffer, (void*)(((char*)iobind_.buffer_+tensor_offset)), GetByteSize(dt, model_state->getOutputshapes(output_name))); 
-                  // if (response != nullptr) {
-                  //   responder.SetFixedSizeBuffer(
-                  //       &response, response_output, output_name, tensor_byte_size,
-                  //       tensor_offset, buffer, memory_type, memory_type_id,
-                  //       use_pinned_memory_type, false /* state */);
-                  // }
-
-                  break;
-                // }
-                tensor_offset += GetByteSize(dt, model_state->getOutputshapes(output_name));
-              }
-            }
-
-            
-            
-          }
-        }
-      }
+          &responses[r], instance_state->MarkRequestedOutputs(
+                             requests[r], output_attrs, io_num.n_output,
+                             &wanted_outputs));
     }
   }
-  
-
-  // Finalize the responder. If 'true' is returned, the OUT0
-  // tensors' data will not be valid until the backend synchronizes
-  // the CUDA stream or event that was used when creating the
-  // responder. For this backend, GPU is not supported and so no
-  // CUDA sync should be needed; so if 'true' is returned simply log
-  // an error.
-
-  const bool need_cuda_output_sync = responder.Finalize();
-  if (need_cuda_output_sync) {
-    LOG_MESSAGE(
-        TRITONSERVER_LOG_ERROR,
-        "'minimal' backend: unexpected CUDA sync required by responder");
+  // With "response_compression" the outputs are staged in host memory
+  // and created by the compressor, never written in place.
+  ResponseCompressor* compressor = instance_state->Compressor();
+  std::vector<std::unique_ptr<StagedResponse>> staged(request_count);
+  for (uint32_t r = 0; (compressor != nullptr) && (r < request_count); r++) {
+    if (responses[r] != nullptr) {
+      staged[r].reset(new StagedResponse(responses[r]));
+    }
   }
-
-  
-
-  // Send all the responses that haven't already been sent because of
-  // an earlier error.
-  
-  for (auto& response : responses) {
-    if (response != nullptr) {
-      LOG_IF_ERROR(
-          TRITONBACKEND_ResponseSend(
-              response, TRITONSERVER_RESPONSE_COMPLETE_FINAL, nullptr),
-          "failed to send response");
+  // A batch output is sliced by the responder, out of the whole NPU
+  // output.
+  const bool direct_outputs = !native_outputs && (compressor == nullptr) &&
+                              model_state->BatchOutputs().empty() &&
+                              (request_count == 1) &&
+                              (responses[0] != nullptr);
+  std::vector<ModelInstanceState::OutputCopy> output_copies;
+  if (direct_outputs) {
+    std::set<std::string> sparse_heads;
+    RESPOND_AND_SET_NULL_IF_ERROR(
+        &responses[0],
+        instance_state->SparseHeads(requests[0], &sparse_heads));
+    if (responses[0] != nullptr) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &responses[0],
+          instance_state->CascadeOnlyHeads(requests[0], &sparse_heads));
+    }
+    if (responses[0] != nullptr) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          &responses[0], instance_state->BindResponseOutputs(
+                             responses[0], output_attrs, io_num.n_output,
+                             wanted_outputs, sparse_heads, outputs,
+                             &output_copies));
+    }
+    if (responses[0] == nullptr) {
+      // The response buffers went with the failed response.
+      wanted_outputs.assign(io_num.n_output, false);
     }
   }
-  uint64_t exec_end_ns = 0;
-  SET_TIMESTAMP(exec_end_ns);
-
-#ifdef TRITON_ENABLE_STATS
-  // For batch statistics need to know the total batch size of the
-  // requests. This is not necessarily just the number of requests,
-  // because if the model supports batching then any request can be a
-  // batched request itself.
-  size_t total_batch_size = 0;
-  if (!supports_first_dim_batching) {
-    total_batch_size = request_count;
-  } else {
-    for (uint32_t r = 0; r < request_count; ++r) {
-      auto& request = requests[r];
-      TRITONBACKEND_Input* input = nullptr;
-      LOG_IF_ERROR(
-          TRITONBACKEND_RequestInputByIndex(request, 0 /* index */, &input),
-          "failed getting request input");
-      if (input != nullptr) {
-        const int64_t* shape = nullptr;
-        LOG_IF_ERROR(
-            TRITONBACKEND_InputProperties(
-                input, nullptr, nullptr, &shape, nullptr, nullptr, nullptr),
-            "failed getting input properties");
-        if (shape != nullptr) {
-          total_batch_size += shape[0];
-        }
-      }
+  // The io binding buffers and the native outputs still hold the
+  // previous batch until its completion is done with them.
+  instance_state->AcquireOutputs();
+  // An output of the whole NPU batch that does not fit its buffer is
+  // left to the runtime.
+  for (uint32_t i = 0; !direct_outputs && !native_outputs &&
+                       (i < io_num.n_output) &&
+                       (i < instance_state->io_binding_infos_.size());
+       i++) {
+    if (!wanted_outputs[i] || instance_state->IsBatchOutput(i) ||
+        (instance_state->io_binding_infos_[i].byte_size_ <
+         output_attrs[i].size)) {
+      continue;
     }
+    outputs[i].want_float = 0;
+    outputs[i].is_prealloc = 1;
+    outputs[i].index = i;
+    outputs[i].buf = instance_state->io_binding_infos_[i].buffer_;
+    outputs[i].size = instance_state->io_binding_infos_[i].byte_size_;
+    memset(outputs[i].buf, 0, outputs[i].size);
   }
-#else
-  (void)exec_start_ns;
-  (void)exec_end_ns;
-  (void)compute_start_ns;
-  (void)compute_end_ns;
-#endif  // TRITON_ENABLE_STATS
 
-  // Done with the request objects so release them.
-  for (uint32_t r = 0; r < request_count; ++r) {
-    auto& request = requests[r];
-    // Before releasing, record failed requests as those where
-    // responses[r] is nullptr. The timestamps are ignored in this
-    // case.
-    if (responses[r] == nullptr) {
-      LOG_IF_ERROR(
-          TRITONBACKEND_ModelInstanceReportStatistics(
-              instance_state->TritonModelInstance(), request,
-              false /* success */, 0, 0, 0, 0),
-          "failed reporting request statistics");
+  //3.4 run on the core granted by the backend NPU arbiter.
+  TRITONSERVER_Error* run_err = instance_state->Run();
+  if (state_bound) {
+    // The state written by a failed run is dropped.
+    states->Commit(state_slot, run_err == nullptr, sequence_flags.end_);
+  }
+  RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses, request_count, run_err);
+  //3.5 get and copy output to response.
+  //3.5.1 get output
+  std::vector<rknn_output> fetched_outputs;
+  int ret = 0;
+  if (!native_outputs) {
+    TRITONSERVER_Error* err = instance_state->GetOutputs(
+        outputs, io_num.n_output, wanted_outputs, &fetched_outputs);
+    if (err != nullptr) {
+      ret = -1;
+      RESPOND_ALL_AND_SET_NULL_IF_ERROR(responses, request_count, err);
     }
-
-    LOG_IF_ERROR(
-        TRITONBACKEND_RequestRelease(request, TRITONSERVER_REQUEST_RELEASE_ALL),
-        "failed releasing request");
   }
 
+  // The outputs are copied into the responses here or, with eager
+  // batching, on the completion thread while Triton already hands this
+  // instance its next batch.
+  std::unique_ptr<ModelInstanceState::ExecutionPayload> payload(
+      new ModelInstanceState::ExecutionPayload());
+  payload->requests_.assign(requests, requests + request_count);
+  payload->responses_ = std::move(responses);
+  payload->staged_ = std::move(staged);
+  payload->outputs_.assign(outputs, outputs + io_num.n_output);
+  payload->fetched_outputs_ = std::move(fetched_outputs);
+  payload->output_copies_ = std::move(output_copies);
+  payload->direct_outputs_ = direct_outputs;
+  payload->native_outputs_ = native_outputs;
+  payload->ret_ = ret;
+  payload->exec_start_ns_ = exec_start_ns;
+  payload->compute_start_ns_ = compute_start_ns;
+  payload->input_conversion_ns_ = input_conversion_ns;
+  instance_state->Complete(std::move(payload));
+  instance_state->ReturnContext();
+
   return nullptr;  // success
 }
 
 }  // extern "C"
 
-}}}
\ No newline at end of file
+}}}
@@ -1,6 +1,9 @@
 #pragma once
 
-#if defined(__x86_64__) || defined(_M_X64) || defined(i386) || defined(__i386__) || defined(__i386) || defined(_M_IX86)
+#if defined(ROCKCHIP_RKNN_STUB)
+// Built against the rknn_stub stand-in runtime (TRITON_ROCKCHIP_RKNN_STUB),
+// any host architecture is fine.
+#elif defined(__x86_64__) || defined(_M_X64) || defined(i386) || defined(__i386__) || defined(__i386) || defined(_M_IX86)
 #error rock-chip triton backend support rv1126 and rk3588 for now!
 #elif defined(__aarch64__) || defined(_M_ARM64)
 #elif defined(__ARM_ARCH_7__) || defined(__ARM_ARCH_7A__) || defined(__ARM_ARCH_7R__) || defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7S__)
@@ -12,8 +15,16 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "rknn_api.h"
+#include "rock-chip_convert.h"
 
 const char *getBuild() { //Get current architecture, detectx nearly every architecture. Coded by Freak
 
@@ -61,80 +72,70 @@ const char *getBuild() { //Get current architecture, detectx nearly every archit
         return "UNKNOWN";
         #endif
     }
-static void dump_tensor_attr(rknn_tensor_attr* attr)
+// The element type the client sends for the Triton datatype 'dt',
+// false for BYTES, which has none. Mapped once when the context is
+// created, the conversion kernel of the input is chosen from it.
+inline bool
+InputElementType(
+    const TRITONSERVER_DataType dt,
+    triton::backend::rockchip::ElementType* type)
 {
-  printf("  index=%d, name=%s, n_dims=%d, dims=[%d, %d, %d, %d], n_elems=%d, size=%d, fmt=%s, type=%s, qnt_type=%s, "
-         "zp=%d, scale=%f\n",
-         attr->index, attr->name, attr->n_dims, attr->dims[0], attr->dims[1], attr->dims[2], attr->dims[3],
-         attr->n_elems, attr->size, get_format_string(attr->fmt), get_type_string(attr->type),
-         get_qnt_type_string(attr->qnt_type), attr->zp, attr->scale);
-  std::cout<<std::flush;
-}
-
-inline bool verifyInputModelInput(rknn_tensor_attr* modelinput,const char* input,int request_count,size_t input_buffer_byte_size){
-  /**
-   * @brief todo verify model configration and input tensor,
-   * etc. shape/nchw/bt.709
-   * notice that here we use NCHW.
-   */
-  uint i=0;
-  LOG_MESSAGE(TRITONSERVER_LOG_INFO,(std::string("========================\n")+std::to_string(input_buffer_byte_size)).c_str());
-
-  return true;
-}
-
-/*
-    the tensor data type.
-*/
-// typedef enum _rknn_tensor_type {
-//     RKNN_TENSOR_FLOAT32 = 0,                            /* data type is float32. */
-//     RKNN_TENSOR_FLOAT16,                                /* data type is float16. */
-//     RKNN_TENSOR_INT8,                                   /* data type is int8. */
-//     RKNN_TENSOR_UINT8,                                  /* data type is uint8. */
-//     RKNN_TENSOR_INT16,                                  /* data type is int16. */
-//     RKNN_TENSOR_UINT16,                                 /* data type is uint16. */
-//     RKNN_TENSOR_INT32,                                  /* data type is int32. */
-//     RKNN_TENSOR_UINT32,                                 /* data type is uint32. */
-//     RKNN_TENSOR_INT64,                                  /* data type is int64. */
-//     RKNN_TENSOR_BOOL,
-
-//     RKNN_TENSOR_TYPE_MAX
-// } rknn_tensor_type;
-rknn_tensor_type getRKType(TRITONSERVER_DataType tritonType){
-  switch (tritonType)
-  {
+  using triton::backend::rockchip::ElementType;
+  switch (dt) {
     case TRITONSERVER_TYPE_BOOL:
-      return RKNN_TENSOR_BOOL;
+      *type = ElementType::BOOL;
+      return true;
     case TRITONSERVER_TYPE_UINT8:
-      return RKNN_TENSOR_UINT8;
+      *type = ElementType::UINT8;
+      return true;
     case TRITONSERVER_TYPE_UINT16:
-      return RKNN_TENSOR_UINT16;
+      *type = ElementType::UINT16;
+      return true;
     case TRITONSERVER_TYPE_UINT32:
-      return RKNN_TENSOR_UINT32;
+      *type = ElementType::UINT32;
+      return true;
     case TRITONSERVER_TYPE_UINT64:
-      return RKNN_TENSOR_INT64;
+      *type = ElementType::UINT64;
+      return true;
     case TRITONSERVER_TYPE_INT8:
-      return RKNN_TENSOR_INT8;
+      *type = ElementType::INT8;
+      return true;
     case TRITONSERVER_TYPE_INT16:
-      return RKNN_TENSOR_INT16;
+      *type = ElementType::INT16;
+      return true;
     case TRITONSERVER_TYPE_INT32:
-      return RKNN_TENSOR_INT32;
+      *type = ElementType::INT32;
+      return true;
     case TRITONSERVER_TYPE_INT64:
-      return RKNN_TENSOR_INT64;
+      *type = ElementType::INT64;
+      return true;
     case TRITONSERVER_TYPE_FP16:
-      return RKNN_TENSOR_FLOAT16;
+      *type = ElementType::FP16;
+      return true;
+    case TRITONSERVER_TYPE_BF16:
+      *type = ElementType::BF16;
+      return true;
     case TRITONSERVER_TYPE_FP32:
-      return RKNN_TENSOR_FLOAT32;
+      *type = ElementType::FP32;
+      return true;
     case TRITONSERVER_TYPE_FP64:
-      return RKNN_TENSOR_TYPE_MAX;
-    case TRITONSERVER_TYPE_BYTES:
-      return RKNN_TENSOR_UINT8;
-    case TRITONSERVER_TYPE_BF16:
-      return RKNN_TENSOR_FLOAT16;
+      *type = ElementType::FP64;
+      return true;
     default:
-      break;
+      return false;
   }
-  return RKNN_TENSOR_UINT8;
+}
+
+// The RKNN type the data of 'dt' is handed to the driver as, BYTES as
+// UINT8. FP64 and BF16 are handed as FLOAT32, only once converted.
+inline rknn_tensor_type
+RknnInputType(const TRITONSERVER_DataType dt)
+{
+  triton::backend::rockchip::ElementType type;
+  if (!InputElementType(dt, &type)) {
+    return RKNN_TENSOR_UINT8;
+  }
+  return triton::backend::rockchip::RknnTensorType(type);
 }
 
 
@@ -150,48 +151,3 @@ DimsJsonToDimVec(
   }
   return nullptr;
 }
-
-  // TRITONSERVER_TYPE_INVALID,
-  // TRITONSERVER_TYPE_BOOL,
-  // TRITONSERVER_TYPE_UINT8,
-  // TRITONSERVER_TYPE_UINT16,
-  // TRITONSERVER_TYPE_UINT32,
-  // TRITONSERVER_TYPE_UINT64,
-  // TRITONSERVER_TYPE_INT8,
-  // TRITONSERVER_TYPE_INT16,
-  // TRITONSERVER_TYPE_INT32,
-  // TRITONSERVER_TYPE_INT64,
-  // TRITONSERVER_TYPE_FP16,
-  // TRITONSERVER_TYPE_FP32,
-  // TRITONSERVER_TYPE_FP64,
-  // TRITONSERVER_TYPE_BYTES,
-  // TRITONSERVER_TYPE_BF16
-TRITONSERVER_DataType getTritonDT(std::string xx){
-  if(!xx.compare("TYPE_UINT8"))
-    return TRITONSERVER_TYPE_UINT8;
-  else if (!xx.compare("TYPE_UINT16"))
-    return TRITONSERVER_TYPE_UINT16;
-  else if (!xx.compare("TYPE_UINT32"))
-    return TRITONSERVER_TYPE_UINT32;
-  else if (!xx.compare("TYPE_UINT64"))
-    return TRITONSERVER_TYPE_UINT64;
-  else if (!xx.compare("TYPE_INT8"))
-    return TRITONSERVER_TYPE_INT8;
-  else if (!xx.compare("TYPE_INT16"))
-    return TRITONSERVER_TYPE_INT16;
-  else if (!xx.compare("TYPE_INT3"))
-    return TRITONSERVER_TYPE_INT32;
-  else if (!xx.compare("TYPE_INT64"))
-    return TRITONSERVER_TYPE_INT64;
-  else if (!xx.compare("TYPE_FP16"))
-    return TRITONSERVER_TYPE_FP16;
-  else if (!xx.compare("TYPE_FP32"))
-    return TRITONSERVER_TYPE_FP32;
-  else if (!xx.compare("TYPE_FP64"))
-    return TRITONSERVER_TYPE_FP64;
-  else if (!xx.compare("TYPE_BYTES"))
-    return TRITONSERVER_TYPE_BYTES;
-
-  return TRITONSERVER_TYPE_UINT8;
-}
-
@@ -0,0 +1,251 @@
+#include "rock-chip_cascade.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define ROCKCHIP_CASCADE_NEON 1
+#endif
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+// Fixed point of the bilinear weights, a row interpolated with them
+// still fits in 16 bits.
+constexpr int kWeightBits = 7;
+constexpr uint32_t kWeightOne = 1 << kWeightBits;
+
+float
+Clamp(const float value, const float low, const float high)
+{
+  return std::min(std::max(value, low), high);
+}
+
+float
+IntersectionOverUnion(const Detection& a, const Detection& b)
+{
+  const float w = std::min(a.x2_, b.x2_) - std::max(a.x1_, b.x1_);
+  const float h = std::min(a.y2_, b.y2_) - std::max(a.y1_, b.y1_);
+  if ((w <= 0) || (h <= 0)) {
+    return 0;
+  }
+  const float intersection = w * h;
+  const float area_a = (a.x2_ - a.x1_) * (a.y2_ - a.y1_);
+  const float area_b = (b.x2_ - b.x1_) * (b.y2_ - b.y1_);
+  return intersection / (area_a + area_b - intersection);
+}
+
+// The two source pixels a destination coordinate is interpolated from
+// and the weight of the second one.
+struct Tap {
+  uint32_t i0_;
+  uint32_t i1_;
+  uint32_t w1_;
+};
+
+// Taps of the 'dst_size' destination pixels resized from the span
+// ['start', 'end') of a source dimension of 'size' pixels, sampled at
+// the pixel centers.
+void
+ComputeTaps(
+    const float start, const float end, const uint32_t size,
+    const uint32_t dst_size, std::vector<Tap>* taps)
+{
+  const float step = (end - start) / dst_size;
+  taps->resize(dst_size);
+  for (uint32_t d = 0; d < dst_size; ++d) {
+    const float s =
+        Clamp(start + (d + 0.5f) * step - 0.5f, 0, (float)(size - 1));
+    Tap& tap = (*taps)[d];
+    tap.i0_ = (uint32_t)s;
+    tap.i1_ = std::min(tap.i0_ + 1, size - 1);
+    tap.w1_ = (uint32_t)std::lround((s - tap.i0_) * kWeightOne);
+  }
+}
+
+// Interpolate the source row 'y' at the 'taps' into 'row', HWC. The
+// values are kept in offset binary, an INT8 image is turned into UINT8
+// by flipping the sign bit, and scaled by kWeightOne.
+void
+InterpolateRow(
+    const CropSource& src, const uint32_t y, const std::vector<Tap>& taps,
+    uint16_t* row)
+{
+  const uint8_t* data = static_cast<const uint8_t*>(src.data_);
+  const uint8_t flip = src.signed_ ? 0x80 : 0;
+  const size_t plane = (size_t)src.height_ * src.width_;
+  const size_t pixel_stride = src.planar_ ? 1 : src.channels_;
+  for (size_t x = 0; x < taps.size(); ++x) {
+    const Tap& tap = taps[x];
+    for (uint32_t c = 0; c < src.channels_; ++c) {
+      const size_t base = src.planar_
+                              ? c * plane + (size_t)y * src.width_
+                              : (size_t)y * src.width_ * src.channels_ + c;
+      const uint32_t p0 = data[base + tap.i0_ * pixel_stride] ^ flip;
+      const uint32_t p1 = data[base + tap.i1_ * pixel_stride] ^ flip;
+      row[x * src.channels_ + c] =
+          (uint16_t)(p0 * (kWeightOne - tap.w1_) + p1 * tap.w1_);
+    }
+  }
+}
+
+// Blend the interpolated rows 'r0' and 'r1' with the weight 'w1' of the
+// second into the 'count' values of 'dst', flipping the sign bit back
+// with 'flip'.
+void
+BlendRows(
+    const uint16_t* r0, const uint16_t* r1, const uint32_t w1,
+    const size_t count, const uint8_t flip, uint8_t* dst)
+{
+  size_t i = 0;
+#ifdef ROCKCHIP_CASCADE_NEON
+  const uint16x4_t w0_v = vdup_n_u16((uint16_t)(kWeightOne - w1));
+  const uint16x4_t w1_v = vdup_n_u16((uint16_t)w1);
+  const uint8x8_t flip_v = vdup_n_u8(flip);
+  for (; i + 8 <= count; i += 8) {
+    const uint16x8_t a = vld1q_u16(r0 + i);
+    const uint16x8_t b = vld1q_u16(r1 + i);
+    uint32x4_t lo = vmull_u16(vget_low_u16(a), w0_v);
+    lo = vmlal_u16(lo, vget_low_u16(b), w1_v);
+    uint32x4_t hi = vmull_u16(vget_high_u16(a), w0_v);
+    hi = vmlal_u16(hi, vget_high_u16(b), w1_v);
+    const uint16x8_t sum = vcombine_u16(
+        vrshrn_n_u32(lo, 2 * kWeightBits), vrshrn_n_u32(hi, 2 * kWeightBits));
+    vst1_u8(dst + i, veor_u8(vmovn_u16(sum), flip_v));
+  }
+#endif  // ROCKCHIP_CASCADE_NEON
+  for (; i < count; ++i) {
+    const uint32_t sum = r0[i] * (kWeightOne - w1) + r1[i] * w1;
+    dst[i] = (uint8_t)((sum + (1u << (2 * kWeightBits - 1))) >>
+                       (2 * kWeightBits)) ^
+             flip;
+  }
+}
+
+}  // namespace
+
+void
+DecodeDetections(
+    const DetectionHead& head, const void* data, const float threshold,
+    const float width, const float height,
+    std::vector<Detection>* detections)
+{
+  const SparseHead& sparse = head.head_;
+  const int32_t first_passing = FirstPassingValue(
+      threshold, head.zp_, head.scale_, OutputActivation::SIGMOID,
+      sparse.signed_);
+  std::vector<int32_t> cells;
+  const size_t count = FindSparseCells(sparse, data, first_passing, &cells);
+  if (count == 0) {
+    return;
+  }
+  std::vector<uint8_t> values(count * sparse.group_);
+  GatherSparseCells(sparse, data, cells, values.data());
+
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* q = values.data() + i * sparse.group_;
+    auto value = [&](const uint32_t c) {
+      const int32_t v = sparse.signed_ ? (int32_t)(int8_t)q[c] : q[c];
+      return DequantizeOne(v, head.zp_, head.scale_, OutputActivation::SIGMOID);
+    };
+    const float objectness = value(sparse.objectness_);
+    int32_t best_class = -1;
+    float best_score = 1.0f;
+    for (uint32_t c = sparse.objectness_ + 1; c < sparse.group_; ++c) {
+      const float score = value(c);
+      if ((best_class < 0) || (score > best_score)) {
+        best_class = c - sparse.objectness_ - 1;
+        best_score = score;
+      }
+    }
+    const float score = objectness * best_score;
+    if (score <= threshold) {
+      continue;
+    }
+
+    const uint32_t anchor = cells[i * 4 + 1];
+    const float cx = (value(0) * 2 - 0.5f + cells[i * 4 + 3]) * head.stride_x_;
+    const float cy = (value(1) * 2 - 0.5f + cells[i * 4 + 2]) * head.stride_y_;
+    const float w = std::pow(value(2) * 2, 2) * head.anchors_[anchor * 2];
+    const float h = std::pow(value(3) * 2, 2) * head.anchors_[anchor * 2 + 1];
+    Detection detection;
+    detection.n_ = cells[i * 4];
+    detection.x1_ = Clamp(cx - w / 2, 0, width);
+    detection.y1_ = Clamp(cy - h / 2, 0, height);
+    detection.x2_ = Clamp(cx + w / 2, 0, width);
+    detection.y2_ = Clamp(cy + h / 2, 0, height);
+    detection.score_ = score;
+    detection.class_ = best_class;
+    detections->push_back(detection);
+  }
+}
+
+void
+SuppressDetections(
+    const float iou_threshold, const size_t max_count, const bool per_class,
+    std::vector<Detection>* detections)
+{
+  std::stable_sort(
+      detections->begin(), detections->end(),
+      [](const Detection& a, const Detection& b) {
+        return a.score_ > b.score_;
+      });
+  std::vector<Detection> kept;
+  for (const Detection& detection : *detections) {
+    if (kept.size() == max_count) {
+      break;
+    }
+    bool keep = true;
+    for (const Detection& other : kept) {
+      if ((other.n_ == detection.n_) &&
+          (!per_class || (other.class_ == detection.class_)) &&
+          (IntersectionOverUnion(other, detection) > iou_threshold)) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) {
+      kept.push_back(detection);
+    }
+  }
+  detections->swap(kept);
+}
+
+void
+CropResize(
+    const CropSource& src, const Detection& detection,
+    const uint32_t dst_height, const uint32_t dst_width, void* dst)
+{
+  std::vector<Tap> xs, ys;
+  ComputeTaps(detection.x1_, detection.x2_, src.width_, dst_width, &xs);
+  ComputeTaps(detection.y1_, detection.y2_, src.height_, dst_height, &ys);
+  const uint8_t flip = src.signed_ ? 0x80 : 0;
+  const size_t row_size = (size_t)dst_width * src.channels_;
+  std::vector<uint16_t> rows(2 * row_size);
+  uint16_t* row0 = rows.data();
+  uint16_t* row1 = rows.data() + row_size;
+  // Source rows held by 'row0' and 'row1', reused by the next
+  // destination rows when the crop is enlarged.
+  int64_t y0 = -1, y1 = -1;
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  for (uint32_t dy = 0; dy < dst_height; ++dy) {
+    const Tap& tap = ys[dy];
+    if ((int64_t)tap.i0_ == y1) {
+      std::swap(row0, row1);
+      std::swap(y0, y1);
+    }
+    if ((int64_t)tap.i0_ != y0) {
+      InterpolateRow(src, tap.i0_, xs, row0);
+      y0 = tap.i0_;
+    }
+    if ((int64_t)tap.i1_ != y1) {
+      InterpolateRow(src, tap.i1_, xs, row1);
+      y1 = tap.i1_;
+    }
+    BlendRows(row0, row1, tap.w1_, row_size, flip, out + dy * row_size);
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
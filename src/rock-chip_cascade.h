@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rock-chip_sparse.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// Outputs of a model running a cascade: the detections kept, one row
+// of (n, x1, y1, x2, y2, score, class) each, and the output of the
+// second model on the crop of each detection.
+static const char kCascadeDetectionsOutput[] = "cascade_detections";
+static const char kCascadeClassesOutput[] = "cascade_classes";
+static const size_t kCascadeDetectionValues = 7;
+
+//
+// DetectionHead
+//
+// A YOLOv5-style detection head: each anchor of each cell holds the
+// box (x, y, w, h) in its first 4 channels, the objectness at
+// 'objectness_' and the class scores after it, all before a sigmoid.
+// The cells are found by the objectness scan of SparseHead, only those
+// are dequantized and decoded.
+//
+struct DetectionHead {
+  DetectionHead() : zp_(0), scale_(1.0f), stride_x_(0), stride_y_(0) {}
+
+  SparseHead head_;
+  int32_t zp_;
+  float scale_;
+  // Input pixels per cell.
+  float stride_x_;
+  float stride_y_;
+  // Width and height of each anchor, in input pixels.
+  std::vector<float> anchors_;
+};
+
+// A box on the image 'n_' of the batch, in input pixels.
+struct Detection {
+  uint32_t n_;
+  float x1_;
+  float y1_;
+  float x2_;
+  float y2_;
+  // Objectness times the best class score.
+  float score_;
+  int32_t class_;
+};
+
+// Append the boxes of 'data', the quantized 'head', whose objectness
+// and score are above 'threshold' to 'detections', clipped to the
+// 'width' x 'height' input.
+void DecodeDetections(
+    const DetectionHead& head, const void* data, const float threshold,
+    const float width, const float height,
+    std::vector<Detection>* detections);
+
+// Sort 'detections' by score and drop those overlapping a better box
+// of the same image, and of the same class if 'per_class', by more
+// than 'iou_threshold', keeping at most 'max_count'.
+void SuppressDetections(
+    const float iou_threshold, const size_t max_count, const bool per_class,
+    std::vector<Detection>* detections);
+
+//
+// CropSource
+//
+// An 8-bit image, HWC or planar CHW, the crops are cut out of.
+//
+struct CropSource {
+  CropSource()
+      : data_(nullptr), height_(0), width_(0), channels_(0), planar_(false),
+        signed_(true)
+  {
+  }
+
+  const void* data_;
+  uint32_t height_;
+  uint32_t width_;
+  uint32_t channels_;
+  bool planar_;
+  // INT8 elements if 'signed_', else UINT8.
+  bool signed_;
+};
+
+// Resize the box of 'detection' in 'src' bilinearly to a 'dst_height'
+// x 'dst_width' HWC image of the element type of 'src' at 'dst'. The
+// rows are interpolated in 7-bit fixed point, the vertical pass with
+// NEON on aarch64.
+void CropResize(
+    const CropSource& src, const Detection& detection,
+    const uint32_t dst_height, const uint32_t dst_width, void* dst);
+
+}}}  // namespace triton::backend::rockchip
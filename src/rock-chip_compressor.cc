@@ -0,0 +1,128 @@
+#include "rock-chip_compressor.h"
+
+#include <cstring>
+
+#include "triton/backend/backend_common.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+ResponseCompressor::ResponseCompressor(
+    const std::string& instance_name, const rk_codec::Codec codec,
+    const int level)
+    : instance_name_(instance_name), codec_(codec), level_(level),
+      exiting_(false)
+{
+  thread_ = std::thread(&ResponseCompressor::CompressLoop, this);
+}
+
+ResponseCompressor::~ResponseCompressor()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void
+ResponseCompressor::Enqueue(std::unique_ptr<StagedResponse> response)
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    queue_.push_back(std::move(response));
+  }
+  cv_.notify_one();
+}
+
+void
+ResponseCompressor::CompressLoop()
+{
+  std::unique_lock<std::mutex> lk(mu_);
+  while (true) {
+    cv_.wait(lk, [this] { return exiting_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      // Exiting with nothing left to send.
+      return;
+    }
+    std::unique_ptr<StagedResponse> staged = std::move(queue_.front());
+    queue_.pop_front();
+    lk.unlock();
+    Send(staged.get());
+    lk.lock();
+  }
+}
+
+void
+ResponseCompressor::Send(StagedResponse* staged)
+{
+  TRITONSERVER_Error* err = nullptr;
+  for (const auto& output : staged->outputs_) {
+    err = AddOutput(staged->response_, output);
+    if (err != nullptr) {
+      break;
+    }
+  }
+  if (err != nullptr) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_ERROR,
+        (std::string("instance ") + instance_name_ +
+         ": failed to compress the response: " +
+         TRITONSERVER_ErrorMessage(err))
+            .c_str());
+  }
+  LOG_IF_ERROR(
+      TRITONBACKEND_ResponseSend(
+          staged->response_, staged->flags_, err),
+      "failed to send response");
+  if (err != nullptr) {
+    TRITONSERVER_ErrorDelete(err);
+  }
+}
+
+TRITONSERVER_Error*
+ResponseCompressor::AddOutput(
+    TRITONBACKEND_Response* response, const StagedOutput& output)
+{
+  std::vector<uint8_t> frame;
+  std::string error;
+  RETURN_ERROR_IF_FALSE(
+      rk_codec::Encode(
+          codec_, level_, output.data_.data(), output.data_.size(), &frame,
+          &error),
+      TRITONSERVER_ERROR_INTERNAL,
+      std::string("output '") + output.name_ + "': " + error);
+
+  // One BYTES element: its 4-byte length, then the frame.
+  const std::vector<int64_t> shape{1};
+  TRITONBACKEND_Output* response_output;
+  RETURN_IF_ERROR(TRITONBACKEND_ResponseOutput(
+      response, &response_output, output.name_.c_str(),
+      TRITONSERVER_TYPE_BYTES, shape.data(), shape.size()));
+  void* buffer;
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  const uint32_t frame_size = frame.size();
+  RETURN_IF_ERROR(TRITONBACKEND_OutputBuffer(
+      response_output, &buffer, sizeof(frame_size) + frame.size(),
+      &memory_type, &memory_type_id));
+  memcpy(buffer, &frame_size, sizeof(frame_size));
+  memcpy((uint8_t*)buffer + sizeof(frame_size), frame.data(), frame.size());
+
+  std::string dims;
+  for (const int64_t dim : output.shape_) {
+    dims += (dims.empty() ? "" : ",") + std::to_string(dim);
+  }
+  RETURN_IF_ERROR(TRITONBACKEND_ResponseSetStringParameter(
+      response, (output.name_ + "_shape").c_str(), dims.c_str()));
+  RETURN_IF_ERROR(TRITONBACKEND_ResponseSetStringParameter(
+      response, (output.name_ + "_datatype").c_str(),
+      TRITONSERVER_DataTypeString(output.datatype_)));
+  return TRITONBACKEND_ResponseSetStringParameter(
+      response, (output.name_ + "_encoding").c_str(),
+      rk_codec::CodecName(codec_));
+}
+
+}}}  // namespace triton::backend::rockchip
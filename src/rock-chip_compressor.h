@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rk_codec.h"
+#include "triton/core/tritonbackend.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// An output tensor held back until it is compressed.
+struct StagedOutput {
+  std::string name_;
+  TRITONSERVER_DataType datatype_;
+  std::vector<int64_t> shape_;
+  std::vector<uint8_t> data_;
+};
+
+// A response whose outputs are created by a ResponseCompressor. The
+// outputs are in a deque so the buffers handed out stay put while
+// more are staged. A response streamed by a decoupled model is sent
+// with 'flags_' 0 until the last one.
+struct StagedResponse {
+  explicit StagedResponse(TRITONBACKEND_Response* response)
+      : response_(response), flags_(TRITONSERVER_RESPONSE_COMPLETE_FINAL)
+  {
+  }
+
+  TRITONBACKEND_Response* response_;
+  uint32_t flags_;
+  std::deque<StagedOutput> outputs_;
+};
+
+//
+// ResponseCompressor
+//
+// Compresses the staged outputs of the responses of a model instance
+// with "response_compression" set, creates them as BYTES tensors of a
+// single rk_codec frame and sends the responses, on a worker thread so
+// the instance can run the NPU for the next requests meanwhile. The
+// raw shape and datatype of an output are sent in the response
+// parameters "<output>_shape" (e.g. "1,81,48,80") and
+// "<output>_datatype" (e.g. "INT8"), the codec in "<output>_encoding".
+// One worker per instance keeps the responses in order.
+//
+class ResponseCompressor {
+ public:
+  ResponseCompressor(
+      const std::string& instance_name, const rk_codec::Codec codec,
+      const int level);
+  // Sends the responses still queued.
+  ~ResponseCompressor();
+
+  // Take over 'response', sent once compressed.
+  void Enqueue(std::unique_ptr<StagedResponse> response);
+
+ private:
+  void CompressLoop();
+  // Create the compressed outputs of 'staged' and send it.
+  void Send(StagedResponse* staged);
+  TRITONSERVER_Error* AddOutput(
+      TRITONBACKEND_Response* response, const StagedOutput& output);
+
+  const std::string instance_name_;
+  const rk_codec::Codec codec_;
+  const int level_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool exiting_;
+  std::deque<std::unique_ptr<StagedResponse>> queue_;
+  std::thread thread_;
+};
+
+}}}  // namespace triton::backend::rockchip
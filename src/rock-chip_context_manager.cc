@@ -0,0 +1,102 @@
+#include "rock-chip_context_manager.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+ContextManager::ContextManager(const uint64_t budget_bytes)
+    : budget_bytes_(budget_bytes), resident_bytes_(0)
+{
+}
+
+void
+ContextManager::Register(
+    Client* client, const uint64_t bytes, const bool pinned)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  MakeRoom(bytes);
+  Entry& entry = entries_[client];
+  entry.bytes_ = bytes;
+  entry.pinned_ = pinned;
+  entry.resident_ = true;
+  resident_bytes_ += bytes;
+  if (!pinned) {
+    entry.lru_it_ = lru_.insert(lru_.end(), client);
+  }
+}
+
+void
+ContextManager::Unregister(Client* client)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = entries_.find(client);
+  if (it == entries_.end()) {
+    return;
+  }
+  Entry& entry = it->second;
+  if (entry.resident_) {
+    resident_bytes_ -= entry.bytes_;
+    if (!entry.pinned_ && !entry.busy_) {
+      lru_.erase(entry.lru_it_);
+    }
+  }
+  entries_.erase(it);
+}
+
+bool
+ContextManager::Acquire(Client* client)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  Entry& entry = entries_[client];
+  entry.busy_ = true;
+  if (entry.pinned_) {
+    return true;
+  }
+  if (entry.resident_) {
+    lru_.erase(entry.lru_it_);
+    return true;
+  }
+  // The room is taken now so that the clients materializing at the
+  // same time do not all count on the same free bytes.
+  MakeRoom(entry.bytes_);
+  entry.resident_ = true;
+  resident_bytes_ += entry.bytes_;
+  return false;
+}
+
+void
+ContextManager::Release(Client* client, const bool resident)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  Entry& entry = entries_[client];
+  entry.busy_ = false;
+  if (!resident && entry.resident_) {
+    entry.resident_ = false;
+    resident_bytes_ -= entry.bytes_;
+  }
+  if (entry.resident_ && !entry.pinned_) {
+    entry.lru_it_ = lru_.insert(lru_.end(), client);
+  }
+}
+
+uint64_t
+ContextManager::ResidentBytes()
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  return resident_bytes_;
+}
+
+void
+ContextManager::MakeRoom(const uint64_t bytes)
+{
+  // Over the budget with nothing idle, e.g. every model busy at once,
+  // the context is materialized anyway rather than failing requests.
+  while ((resident_bytes_ + bytes > budget_bytes_) && !lru_.empty()) {
+    Client* victim = lru_.front();
+    lru_.pop_front();
+    Entry& entry = entries_[victim];
+    victim->EvictContext();
+    entry.resident_ = false;
+    resident_bytes_ -= entry.bytes_;
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// ContextManager
+//
+// Backend-wide budget of the NPU memory held by the rknn contexts of
+// every rockchip model, for boards hosting more models than fit in NPU
+// memory at once. An instance leases its context from the manager for
+// each execution. Contexts stay materialized while they fit in the
+// budget; when a context needs room, the least recently used idle
+// contexts are evicted, and their instances materialize them again on
+// their next execution. A context that cannot be rebuilt between
+// executions, e.g. one holding sequence state, is pinned and only
+// counts against the budget.
+//
+// The lock is never held across rknn_init, so a model materializing
+// its context does not stall the executions of the resident ones.
+//
+class ContextManager {
+ public:
+  // The context of an instance, as seen by the manager.
+  class Client {
+   public:
+    virtual ~Client() = default;
+    // Destroy the context. Called with the manager lock held, only
+    // while the client is idle.
+    virtual void EvictContext() = 0;
+  };
+
+  explicit ContextManager(const uint64_t budget_bytes);
+  ~ContextManager() = default;
+
+  uint64_t BudgetBytes() const { return budget_bytes_; }
+
+  // Add 'client', whose materialized context holds 'bytes' of NPU
+  // memory, as idle. Idle contexts of other clients are evicted to make
+  // room for it. A 'pinned' client is never evicted.
+  void Register(Client* client, const uint64_t bytes, const bool pinned);
+  void Unregister(Client* client);
+
+  // Mark 'client' busy before it uses its context. Returns false if the
+  // context was evicted: room has been made and is reserved for it, the
+  // client must materialize it again and report with Release.
+  bool Acquire(Client* client);
+  // Mark 'client' idle again, 'resident' is false when materializing
+  // its context failed.
+  void Release(Client* client, const bool resident);
+
+  // NPU memory held by the resident contexts.
+  uint64_t ResidentBytes();
+
+ private:
+  struct Entry {
+    Entry() : bytes_(0), pinned_(false), busy_(false), resident_(false) {}
+    uint64_t bytes_;
+    bool pinned_;
+    bool busy_;
+    bool resident_;
+    // Position in 'lru_' while resident and idle.
+    std::list<Client*>::iterator lru_it_;
+  };
+
+  // Evict idle contexts, least recently used first, until 'bytes' more
+  // fit in the budget or nothing is left to evict. Must be called with
+  // 'mu_' held.
+  void MakeRoom(const uint64_t bytes);
+
+  const uint64_t budget_bytes_;
+  std::mutex mu_;
+  std::map<Client*, Entry> entries_;
+  // Idle resident evictable contexts, least recently used first.
+  std::list<Client*> lru_;
+  uint64_t resident_bytes_;
+};
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,498 @@
+#include "rock-chip_convert.h"
+
+#include <cstring>
+#include <type_traits>
+
+#include "rock-chip_dequant.h"
+
+#if !defined(ROCKCHIP_NO_NEON) &&                                   \
+    ((defined(__aarch64__) &&                                       \
+      (defined(__ARM_NEON) || defined(__ARM_NEON__))) ||            \
+     defined(ROCKCHIP_NEON_EMULATION))
+#include <arm_neon.h>
+#define ROCKCHIP_CONVERT_NEON 1
+#endif
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+// The 16-bit float types, as their bits.
+struct Fp16 {
+  uint16_t bits_;
+};
+struct Bf16 {
+  uint16_t bits_;
+};
+
+// The client type of each C++ source type and the RKNN type of each
+// destination type, tying a kernel to its table entry.
+template <typename T>
+struct Source;
+template <>
+struct Source<uint8_t> {
+  static constexpr ElementType kType = ElementType::UINT8;
+};
+template <>
+struct Source<int8_t> {
+  static constexpr ElementType kType = ElementType::INT8;
+};
+template <>
+struct Source<Fp16> {
+  static constexpr ElementType kType = ElementType::FP16;
+};
+template <>
+struct Source<Bf16> {
+  static constexpr ElementType kType = ElementType::BF16;
+};
+template <>
+struct Source<float> {
+  static constexpr ElementType kType = ElementType::FP32;
+};
+template <>
+struct Source<double> {
+  static constexpr ElementType kType = ElementType::FP64;
+};
+
+template <typename T>
+struct Destination;
+template <>
+struct Destination<uint8_t> {
+  static constexpr rknn_tensor_type kType = RKNN_TENSOR_UINT8;
+};
+template <>
+struct Destination<int8_t> {
+  static constexpr rknn_tensor_type kType = RKNN_TENSOR_INT8;
+};
+template <>
+struct Destination<Fp16> {
+  static constexpr rknn_tensor_type kType = RKNN_TENSOR_FLOAT16;
+};
+template <>
+struct Destination<float> {
+  static constexpr rknn_tensor_type kType = RKNN_TENSOR_FLOAT32;
+};
+
+// Unsigned word an element is moved as.
+template <size_t Size>
+struct Word;
+template <>
+struct Word<1> {
+  typedef uint8_t Type;
+};
+template <>
+struct Word<2> {
+  typedef uint16_t Type;
+};
+template <>
+struct Word<4> {
+  typedef uint32_t Type;
+};
+
+// Conversion of one element.
+template <typename Src, typename Dst>
+struct Cast;
+template <typename T>
+struct Cast<T, T> {
+  static T Run(const T value) { return value; }
+};
+template <>
+struct Cast<double, float> {
+  static float Run(const double value) { return (float)value; }
+};
+template <>
+struct Cast<Bf16, float> {
+  static float Run(const Bf16 value)
+  {
+    const uint32_t bits = (uint32_t)value.bits_ << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+};
+template <>
+struct Cast<float, Fp16> {
+  static Fp16 Run(const float value)
+  {
+    Fp16 result;
+    result.bits_ = FloatToHalf(value);
+    return result;
+  }
+};
+
+// Conversion of 'count' contiguous elements, vectorized where NEON has
+// the conversion.
+template <typename Src, typename Dst>
+struct Row {
+  static void Convert(const Src* src, Dst* dst, const size_t count)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      dst[i] = Cast<Src, Dst>::Run(src[i]);
+    }
+  }
+};
+
+#ifdef ROCKCHIP_CONVERT_NEON
+template <>
+struct Row<double, float> {
+  static void Convert(const double* src, float* dst, const size_t count)
+  {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+      const float32x2_t lo = vcvt_f32_f64(vld1q_f64(src + i));
+      const float32x2_t hi = vcvt_f32_f64(vld1q_f64(src + i + 2));
+      vst1q_f32(dst + i, vcombine_f32(lo, hi));
+    }
+    for (; i < count; ++i) {
+      dst[i] = Cast<double, float>::Run(src[i]);
+    }
+  }
+};
+
+template <>
+struct Row<Bf16, float> {
+  static void Convert(const Bf16* src, float* dst, const size_t count)
+  {
+    const uint16_t* bits = (const uint16_t*)src;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      const uint16x8_t b = vld1q_u16(bits + i);
+      vst1q_f32(
+          dst + i, vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(b), 16)));
+      vst1q_f32(
+          dst + i + 4,
+          vreinterpretq_f32_u32(vshll_n_u16(vget_high_u16(b), 16)));
+    }
+    for (; i < count; ++i) {
+      dst[i] = Cast<Bf16, float>::Run(src[i]);
+    }
+  }
+};
+
+template <>
+struct Row<float, Fp16> {
+  static void Convert(const float* src, Fp16* dst, const size_t count)
+  {
+    uint16_t* bits = (uint16_t*)dst;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      vst1_u16(
+          bits + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+      vst1_u16(
+          bits + i + 4,
+          vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i + 4))));
+    }
+    for (; i < count; ++i) {
+      dst[i] = Cast<float, Fp16>::Run(src[i]);
+    }
+  }
+};
+
+// Interleaving of 3 or 4 channel rows with the structured stores.
+template <typename T>
+struct Interleaver;
+template <>
+struct Interleaver<uint8_t> {
+  static constexpr size_t kLanes = 16;
+  static void Store3(const uint8_t* const* rows, const size_t x, uint8_t* dst)
+  {
+    uint8x16x3_t v;
+    v.val[0] = vld1q_u8(rows[0] + x);
+    v.val[1] = vld1q_u8(rows[1] + x);
+    v.val[2] = vld1q_u8(rows[2] + x);
+    vst3q_u8(dst, v);
+  }
+  static void Store4(const uint8_t* const* rows, const size_t x, uint8_t* dst)
+  {
+    uint8x16x4_t v;
+    v.val[0] = vld1q_u8(rows[0] + x);
+    v.val[1] = vld1q_u8(rows[1] + x);
+    v.val[2] = vld1q_u8(rows[2] + x);
+    v.val[3] = vld1q_u8(rows[3] + x);
+    vst4q_u8(dst, v);
+  }
+};
+template <>
+struct Interleaver<uint16_t> {
+  static constexpr size_t kLanes = 8;
+  static void Store3(
+      const uint16_t* const* rows, const size_t x, uint16_t* dst)
+  {
+    uint16x8x3_t v;
+    v.val[0] = vld1q_u16(rows[0] + x);
+    v.val[1] = vld1q_u16(rows[1] + x);
+    v.val[2] = vld1q_u16(rows[2] + x);
+    vst3q_u16(dst, v);
+  }
+  static void Store4(
+      const uint16_t* const* rows, const size_t x, uint16_t* dst)
+  {
+    uint16x8x4_t v;
+    v.val[0] = vld1q_u16(rows[0] + x);
+    v.val[1] = vld1q_u16(rows[1] + x);
+    v.val[2] = vld1q_u16(rows[2] + x);
+    v.val[3] = vld1q_u16(rows[3] + x);
+    vst4q_u16(dst, v);
+  }
+};
+template <>
+struct Interleaver<uint32_t> {
+  static constexpr size_t kLanes = 4;
+  static void Store3(
+      const uint32_t* const* rows, const size_t x, uint32_t* dst)
+  {
+    uint32x4x3_t v;
+    v.val[0] = vld1q_u32(rows[0] + x);
+    v.val[1] = vld1q_u32(rows[1] + x);
+    v.val[2] = vld1q_u32(rows[2] + x);
+    vst3q_u32(dst, v);
+  }
+  static void Store4(
+      const uint32_t* const* rows, const size_t x, uint32_t* dst)
+  {
+    uint32x4x4_t v;
+    v.val[0] = vld1q_u32(rows[0] + x);
+    v.val[1] = vld1q_u32(rows[1] + x);
+    v.val[2] = vld1q_u32(rows[2] + x);
+    v.val[3] = vld1q_u32(rows[3] + x);
+    vst4q_u32(dst, v);
+  }
+};
+#endif  // ROCKCHIP_CONVERT_NEON
+
+// Interleave the 'width' pixels of the 'channels' rows into 'dst'.
+template <typename T>
+void
+InterleaveRow(
+    const T* const* rows, const size_t channels, const size_t width, T* dst)
+{
+  size_t x = 0;
+#ifdef ROCKCHIP_CONVERT_NEON
+  const size_t lanes = Interleaver<T>::kLanes;
+  if (channels == 3) {
+    for (; x + lanes <= width; x += lanes) {
+      Interleaver<T>::Store3(rows, x, dst + x * 3);
+    }
+  } else if (channels == 4) {
+    for (; x + lanes <= width; x += lanes) {
+      Interleaver<T>::Store4(rows, x, dst + x * 4);
+    }
+  }
+#endif  // ROCKCHIP_CONVERT_NEON
+  for (; x < width; ++x) {
+    for (size_t c = 0; c < channels; ++c) {
+      dst[x * channels + c] = rows[c][x];
+    }
+  }
+}
+
+template <typename Src, typename Dst, InputLayout Layout>
+struct Kernel;
+
+template <typename Src, typename Dst>
+struct Kernel<Src, Dst, InputLayout::SAME> {
+  static void Run(const Src* src, Dst* dst, const ConvertShape& shape)
+  {
+    Row<Src, Dst>::Convert(src, dst, shape.Elements());
+  }
+};
+
+// A row of each plane is converted into a scratch row, then the rows
+// are interleaved into the pixels; the same type is interleaved
+// straight from the planes.
+template <typename Src, typename Dst>
+struct Kernel<Src, Dst, InputLayout::NCHW_TO_NHWC> {
+  static void Run(const Src* src, Dst* dst, const ConvertShape& shape)
+  {
+    typedef typename Word<sizeof(Dst)>::Type W;
+    const bool same = std::is_same<Src, Dst>::value;
+    const size_t plane = shape.h_ * shape.w_;
+    std::vector<Dst> scratch(same ? 0 : shape.c_ * shape.w_);
+    std::vector<const W*> rows(shape.c_);
+    W* out = (W*)dst;
+    for (size_t n = 0; n < shape.n_; ++n) {
+      for (size_t y = 0; y < shape.h_; ++y) {
+        for (size_t c = 0; c < shape.c_; ++c) {
+          const Src* row = src + (n * shape.c_ + c) * plane + y * shape.w_;
+          if (same) {
+            rows[c] = (const W*)row;
+          } else {
+            Dst* converted = scratch.data() + c * shape.w_;
+            Row<Src, Dst>::Convert(row, converted, shape.w_);
+            rows[c] = (const W*)converted;
+          }
+        }
+        InterleaveRow<W>(
+            rows.data(), shape.c_, shape.w_,
+            out + (n * plane + y * shape.w_) * shape.c_);
+      }
+    }
+  }
+};
+
+template <typename Src, typename Dst, InputLayout Layout>
+void
+Convert(const void* src, void* dst, const ConvertShape& shape)
+{
+  Kernel<Src, Dst, Layout>::Run((const Src*)src, (Dst*)dst, shape);
+}
+
+template <typename Src, typename Dst, InputLayout Layout>
+InputConversion
+Entry()
+{
+  InputConversion conversion;
+  conversion.src_ = Source<Src>::kType;
+  conversion.dst_ = Destination<Dst>::kType;
+  conversion.layout_ = Layout;
+  conversion.convert_ = &Convert<Src, Dst, Layout>;
+  return conversion;
+}
+
+}  // namespace
+
+size_t
+ElementSize(const ElementType type)
+{
+  switch (type) {
+    case ElementType::UINT16:
+    case ElementType::INT16:
+    case ElementType::FP16:
+    case ElementType::BF16:
+      return 2;
+    case ElementType::UINT32:
+    case ElementType::INT32:
+    case ElementType::FP32:
+      return 4;
+    case ElementType::UINT64:
+    case ElementType::INT64:
+    case ElementType::FP64:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+const char*
+ElementTypeName(const ElementType type)
+{
+  switch (type) {
+    case ElementType::BOOL:
+      return "BOOL";
+    case ElementType::UINT8:
+      return "UINT8";
+    case ElementType::INT8:
+      return "INT8";
+    case ElementType::UINT16:
+      return "UINT16";
+    case ElementType::INT16:
+      return "INT16";
+    case ElementType::UINT32:
+      return "UINT32";
+    case ElementType::INT32:
+      return "INT32";
+    case ElementType::UINT64:
+      return "UINT64";
+    case ElementType::INT64:
+      return "INT64";
+    case ElementType::FP16:
+      return "FP16";
+    case ElementType::BF16:
+      return "BF16";
+    case ElementType::FP32:
+      return "FP32";
+    case ElementType::FP64:
+      return "FP64";
+  }
+  return "UNKNOWN";
+}
+
+size_t
+RknnElementSize(const rknn_tensor_type type)
+{
+  switch (type) {
+    case RKNN_TENSOR_FLOAT32:
+    case RKNN_TENSOR_INT32:
+    case RKNN_TENSOR_UINT32:
+      return 4;
+    case RKNN_TENSOR_FLOAT16:
+    case RKNN_TENSOR_INT16:
+    case RKNN_TENSOR_UINT16:
+      return 2;
+    case RKNN_TENSOR_INT64:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+rknn_tensor_type
+RknnTensorType(const ElementType type)
+{
+  switch (type) {
+    case ElementType::BOOL:
+      return RKNN_TENSOR_BOOL;
+    case ElementType::UINT8:
+      return RKNN_TENSOR_UINT8;
+    case ElementType::INT8:
+      return RKNN_TENSOR_INT8;
+    case ElementType::UINT16:
+      return RKNN_TENSOR_UINT16;
+    case ElementType::INT16:
+      return RKNN_TENSOR_INT16;
+    case ElementType::UINT32:
+      return RKNN_TENSOR_UINT32;
+    case ElementType::INT32:
+      return RKNN_TENSOR_INT32;
+    case ElementType::UINT64:
+    case ElementType::INT64:
+      return RKNN_TENSOR_INT64;
+    case ElementType::FP16:
+      return RKNN_TENSOR_FLOAT16;
+    case ElementType::BF16:
+    case ElementType::FP32:
+    case ElementType::FP64:
+      return RKNN_TENSOR_FLOAT32;
+  }
+  return RKNN_TENSOR_UINT8;
+}
+
+bool
+NeedsHostConversion(const ElementType type)
+{
+  return (type == ElementType::BF16) || (type == ElementType::FP64);
+}
+
+const std::vector<InputConversion>&
+InputConversions()
+{
+  static const std::vector<InputConversion> conversions{
+      Entry<double, float, InputLayout::SAME>(),
+      Entry<Bf16, float, InputLayout::SAME>(),
+      Entry<float, Fp16, InputLayout::SAME>(),
+      Entry<uint8_t, uint8_t, InputLayout::NCHW_TO_NHWC>(),
+      Entry<int8_t, int8_t, InputLayout::NCHW_TO_NHWC>(),
+      Entry<Fp16, Fp16, InputLayout::NCHW_TO_NHWC>(),
+      Entry<float, float, InputLayout::NCHW_TO_NHWC>(),
+      Entry<float, Fp16, InputLayout::NCHW_TO_NHWC>(),
+      Entry<double, float, InputLayout::NCHW_TO_NHWC>(),
+      Entry<Bf16, float, InputLayout::NCHW_TO_NHWC>(),
+  };
+  return conversions;
+}
+
+InputConvertFn
+FindInputConversion(
+    const ElementType src, const rknn_tensor_type dst,
+    const InputLayout layout)
+{
+  for (const InputConversion& conversion : InputConversions()) {
+    if ((conversion.src_ == src) && (conversion.dst_ == dst) &&
+        (conversion.layout_ == layout)) {
+      return conversion.convert_;
+    }
+  }
+  return nullptr;
+}
+
+}}}  // namespace triton::backend::rockchip
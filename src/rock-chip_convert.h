@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rknn_api.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// Element type of a tensor as the client sends it, the Triton datatypes
+// without BYTES.
+enum class ElementType {
+  BOOL,
+  UINT8,
+  INT8,
+  UINT16,
+  INT16,
+  UINT32,
+  INT32,
+  UINT64,
+  INT64,
+  FP16,
+  BF16,
+  FP32,
+  FP64
+};
+
+size_t ElementSize(const ElementType type);
+// The model configuration name of 'type', e.g. "FP32".
+const char* ElementTypeName(const ElementType type);
+
+// Bytes of an element of the RKNN tensor 'type'.
+size_t RknnElementSize(const rknn_tensor_type type);
+
+// RKNN type 'type' is handed to the driver as. FP64 and BF16, which the
+// driver does not take, are first converted to FLOAT32 on the CPU, see
+// NeedsHostConversion.
+rknn_tensor_type RknnTensorType(const ElementType type);
+bool NeedsHostConversion(const ElementType type);
+
+// How the elements are moved while they are converted.
+enum class InputLayout {
+  // In place, the kernel only converts the type.
+  SAME,
+  // From the planes of NCHW to the interleaved pixels of NHWC.
+  NCHW_TO_NHWC
+};
+
+// Frames converted by one call, 'n_' images of 'c_' x 'h_' x 'w_'
+// elements. A SAME kernel only uses the element count.
+struct ConvertShape {
+  ConvertShape() : n_(0), c_(0), h_(0), w_(0) {}
+
+  size_t Elements() const { return n_ * c_ * h_ * w_; }
+
+  size_t n_;
+  size_t c_;
+  size_t h_;
+  size_t w_;
+};
+
+typedef void (*InputConvertFn)(
+    const void* src, void* dst, const ConvertShape& shape);
+
+//
+// InputConversion
+//
+// A kernel converting a client input of type 'src_' into the RKNN type
+// 'dst_' while moving it as 'layout_'. Each is a specialization for its
+// triple, with NEON rows on aarch64, so nothing is dispatched per
+// element: the backend picks the kernel of the model input once when
+// the context is created and calls it through the pointer. Independent
+// of Triton so rk_stat can time every one of them.
+//
+struct InputConversion {
+  ElementType src_;
+  rknn_tensor_type dst_;
+  InputLayout layout_;
+  InputConvertFn convert_;
+};
+
+// Every kernel there is.
+const std::vector<InputConversion>& InputConversions();
+
+// The kernel of ('src', 'dst', 'layout'), nullptr if there is none.
+InputConvertFn FindInputConversion(
+    const ElementType src, const rknn_tensor_type dst,
+    const InputLayout layout);
+
+}}}  // namespace triton::backend::rockchip
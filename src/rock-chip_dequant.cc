@@ -0,0 +1,251 @@
+#include "rock-chip_dequant.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// ROCKCHIP_NO_NEON and ROCKCHIP_NEON_EMULATION: see rock-chip_layout.cc.
+#if !defined(ROCKCHIP_NO_NEON) &&                                   \
+    ((defined(__aarch64__) &&                                       \
+      (defined(__ARM_NEON) || defined(__ARM_NEON__))) ||            \
+     defined(ROCKCHIP_NEON_EMULATION))
+#include <arm_neon.h>
+#define ROCKCHIP_DEQUANT_NEON 1
+#endif
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+// Below this many elements a job is not worth a thread of its own.
+const size_t kParallelElements = 64 * 1024;
+
+// Every 8-bit input maps to one of 256 results, table them and gather.
+template <typename Q, typename D>
+void
+DequantizeTable(const DequantJob& job, const D* table)
+{
+  const Q* src = (const Q*)job.src_;
+  D* dst = (D*)job.dst_;
+  for (size_t i = 0; i < job.count_; ++i) {
+    dst[i] = table[(uint8_t)src[i]];
+  }
+}
+
+template <typename Q>
+void
+BuildTable(const DequantJob& job, float* table)
+{
+  for (int v = 0; v < 256; ++v) {
+    const Q q = (Q)(uint8_t)v;
+    table[v] = DequantizeOne(q, job.zp_, job.scale_, job.activation_);
+  }
+}
+
+#ifdef ROCKCHIP_DEQUANT_NEON
+// Widen 16 quantized values to 4 float32x4_t of (q - zp) * scale.
+inline void
+DequantizeQuad(
+    const int16x8_t lo, const int16x8_t hi, const int32x4_t zp,
+    const float scale, float32x4_t out[4])
+{
+  out[0] = vmulq_n_f32(
+      vcvtq_f32_s32(vsubq_s32(vmovl_s16(vget_low_s16(lo)), zp)), scale);
+  out[1] = vmulq_n_f32(
+      vcvtq_f32_s32(vsubq_s32(vmovl_s16(vget_high_s16(lo)), zp)), scale);
+  out[2] = vmulq_n_f32(
+      vcvtq_f32_s32(vsubq_s32(vmovl_s16(vget_low_s16(hi)), zp)), scale);
+  out[3] = vmulq_n_f32(
+      vcvtq_f32_s32(vsubq_s32(vmovl_s16(vget_high_s16(hi)), zp)), scale);
+}
+#endif  // ROCKCHIP_DEQUANT_NEON
+
+// (q - zp) * scale without activation.
+template <typename Q>
+void
+DequantizeLinear(const DequantJob& job)
+{
+  const Q* src = (const Q*)job.src_;
+  size_t i = 0;
+#ifdef ROCKCHIP_DEQUANT_NEON
+  const int32x4_t zp = vdupq_n_s32(job.zp_);
+  float32x4_t f[4];
+  for (; i + 16 <= job.count_; i += 16) {
+    int16x8_t lo, hi;
+    if (job.src_signed_) {
+      const int8x16_t q = vld1q_s8((const int8_t*)src + i);
+      lo = vmovl_s8(vget_low_s8(q));
+      hi = vmovl_s8(vget_high_s8(q));
+    } else {
+      const uint8x16_t q = vld1q_u8((const uint8_t*)src + i);
+      lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(q)));
+      hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(q)));
+    }
+    DequantizeQuad(lo, hi, zp, job.scale_, f);
+    if (job.fp16_) {
+      uint16_t* dst = (uint16_t*)job.dst_ + i;
+      for (int k = 0; k < 4; ++k) {
+        vst1_u16(dst + 4 * k, vreinterpret_u16_f16(vcvt_f16_f32(f[k])));
+      }
+    } else {
+      float* dst = (float*)job.dst_ + i;
+      for (int k = 0; k < 4; ++k) {
+        vst1q_f32(dst + 4 * k, f[k]);
+      }
+    }
+  }
+#endif  // ROCKCHIP_DEQUANT_NEON
+  for (; i < job.count_; ++i) {
+    const float value = (src[i] - job.zp_) * job.scale_;
+    if (job.fp16_) {
+      ((uint16_t*)job.dst_)[i] = FloatToHalf(value);
+    } else {
+      ((float*)job.dst_)[i] = value;
+    }
+  }
+}
+
+template <typename Q>
+void
+DequantizeTyped(const DequantJob& job)
+{
+  if (job.activation_ == OutputActivation::NONE) {
+    DequantizeLinear<Q>(job);
+    return;
+  }
+  float table[256];
+  BuildTable<Q>(job, table);
+  if (job.fp16_) {
+    uint16_t half_table[256];
+    for (int v = 0; v < 256; ++v) {
+      half_table[v] = FloatToHalf(table[v]);
+    }
+    DequantizeTable<Q, uint16_t>(job, half_table);
+  } else {
+    DequantizeTable<Q, float>(job, table);
+  }
+}
+
+}  // namespace
+
+bool
+ParseOutputActivation(const std::string& str, OutputActivation* act)
+{
+  if (str == "none") {
+    *act = OutputActivation::NONE;
+  } else if (str == "sigmoid") {
+    *act = OutputActivation::SIGMOID;
+  } else if (str == "exp") {
+    *act = OutputActivation::EXP;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+float
+DequantizeOne(
+    const int32_t q, const int32_t zp, const float scale,
+    const OutputActivation activation)
+{
+  const float x = (q - zp) * scale;
+  switch (activation) {
+    case OutputActivation::SIGMOID:
+      return 1.0f / (1.0f + std::exp(-x));
+    case OutputActivation::EXP:
+      return std::exp(x);
+    default:
+      return x;
+  }
+}
+
+uint16_t
+FloatToHalf(const float value)
+{
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t mantissa = x & 0x7fffff;
+  const int32_t exponent = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+  if (((x >> 23) & 0xff) == 0xff) {
+    // Inf or NaN, keep NaN quiet.
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 0x1f) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // Subnormal half, or zero.
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const uint32_t shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t midway = 1u << (shift - 1);
+    if ((rest > midway) || ((rest == midway) && (half & 1))) {
+      half++;
+    }
+    return sign | half;
+  }
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  // A carry out of the mantissa correctly bumps the exponent.
+  if ((rest > 0x1000) || ((rest == 0x1000) && (half & 1))) {
+    half++;
+  }
+  return half;
+}
+
+void
+Dequantize(const DequantJob& job)
+{
+  if (job.src_signed_) {
+    DequantizeTyped<int8_t>(job);
+  } else {
+    DequantizeTyped<uint8_t>(job);
+  }
+}
+
+void
+DequantizeAll(const std::vector<DequantJob>& jobs, WorkerPool* workers)
+{
+  if (jobs.empty()) {
+    return;
+  }
+  size_t largest = 0;
+  for (size_t j = 1; j < jobs.size(); ++j) {
+    if (jobs[j].count_ > jobs[largest].count_) {
+      largest = j;
+    }
+  }
+  // Task 0 is the largest job and the small ones, each other task a
+  // job worth a thread.
+  std::vector<size_t> parallel;
+  for (size_t j = 0; (workers != nullptr) && (j < jobs.size()); ++j) {
+    if ((j != largest) && (jobs[j].count_ >= kParallelElements)) {
+      parallel.push_back(j);
+    }
+  }
+  if (parallel.empty()) {
+    for (const DequantJob& job : jobs) {
+      Dequantize(job);
+    }
+    return;
+  }
+  workers->Run(parallel.size() + 1, [&jobs, &parallel, largest](size_t t) {
+    if (t > 0) {
+      Dequantize(jobs[parallel[t - 1]]);
+      return;
+    }
+    Dequantize(jobs[largest]);
+    for (size_t j = 0; j < jobs.size(); ++j) {
+      if ((j != largest) && (jobs[j].count_ < kParallelElements)) {
+        Dequantize(jobs[j]);
+      }
+    }
+  });
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "rock-chip_worker_pool.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// Activation applied to an output while it is dequantized.
+enum class OutputActivation { NONE, SIGMOID, EXP };
+
+// Parse "none", "sigmoid" or "exp".
+bool ParseOutputActivation(const std::string& str, OutputActivation* act);
+
+//
+// DequantJob
+//
+// Conversion of an 8-bit affine-quantized NPU output into the FP32 or
+// FP16 tensor declared in the model configuration, in one pass:
+// (q - zp) * scale, then the activation. rknn_outputs_get can
+// dequantize with want_float but does it element by element and
+// without the activation. Plain dequantization is vectorized with NEON
+// on aarch64; with an activation the 256 possible results are tabled
+// first, which is exact and cheaper than a vector exp. Independent of
+// Triton so rk_stat can time it.
+//
+struct DequantJob {
+  DequantJob()
+      : src_(nullptr), src_signed_(true), count_(0), zp_(0), scale_(1.0f),
+        activation_(OutputActivation::NONE), fp16_(false), dst_(nullptr)
+  {
+  }
+
+  // INT8 elements if 'src_signed_', else UINT8.
+  const void* src_;
+  bool src_signed_;
+  size_t count_;
+  int32_t zp_;
+  float scale_;
+  OutputActivation activation_;
+  // IEEE half elements if 'fp16_', else float.
+  bool fp16_;
+  void* dst_;
+};
+
+void Dequantize(const DequantJob& job);
+
+// Run 'jobs' in parallel on 'workers', each job above a size worth a
+// thread of its own as a task, the largest and the small ones on the
+// calling thread. Without 'workers' they all run on the calling thread.
+void DequantizeAll(const std::vector<DequantJob>& jobs, WorkerPool* workers);
+
+// Value of the single quantized 'q', as Dequantize computes it.
+float DequantizeOne(
+    const int32_t q, const int32_t zp, const float scale,
+    const OutputActivation activation);
+
+// IEEE half bits of 'value', rounded to nearest even.
+uint16_t FloatToHalf(const float value);
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,354 @@
+#include "rock-chip_dmabuf.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "triton/backend/backend_common.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+TRITONSERVER_Error*
+DmaBufHandoff::Create(
+    const std::string& path, std::unique_ptr<DmaBufHandoff>* handoff)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  RETURN_ERROR_IF_TRUE(
+      path.empty() || (path.size() >= sizeof(addr.sun_path)),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("invalid dma-buf socket path '") + path + "'");
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  // Only a socket is replaced, never a file someone else put there.
+  struct stat existing;
+  if (lstat(path.c_str(), &existing) == 0) {
+    RETURN_ERROR_IF_FALSE(
+        S_ISSOCK(existing.st_mode), TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("dma-buf socket path '") + path + "' is not a socket");
+    unlink(path.c_str());
+  }
+  const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  RETURN_ERROR_IF_TRUE(
+      fd < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("cannot create the dma-buf socket: ") + strerror(errno));
+  if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (chmod(path.c_str(), 0600) != 0) || (listen(fd, 16) != 0)) {
+    const int err = errno;
+    close(fd);
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("cannot listen on the dma-buf socket '") + path +
+         "': " + strerror(err))
+            .c_str());
+  }
+  std::unique_ptr<DmaBufHandoff> local_handoff(new DmaBufHandoff(path, fd));
+  RETURN_ERROR_IF_FALSE(
+      local_handoff->thread_.joinable(), TRITONSERVER_ERROR_INTERNAL,
+      std::string("cannot create the dma-buf socket wake pipe"));
+  *handoff = std::move(local_handoff);
+  return nullptr;  // success
+}
+
+DmaBufHandoff::DmaBufHandoff(const std::string& path, const int listen_fd)
+    : path_(path), listen_fd_(listen_fd)
+{
+  if (pipe2(wake_fds_, O_CLOEXEC) != 0) {
+    wake_fds_[0] = wake_fds_[1] = -1;
+    return;
+  }
+  thread_ = std::thread(&DmaBufHandoff::Serve, this);
+}
+
+DmaBufHandoff::~DmaBufHandoff()
+{
+  if (thread_.joinable()) {
+    const char stop = 0;
+    while ((write(wake_fds_[1], &stop, 1) < 0) && (errno == EINTR)) {
+    }
+    thread_.join();
+  }
+  for (const int fd : wake_fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  for (const auto& buffer : buffers_) {
+    close(buffer.second.fd_);
+  }
+  close(listen_fd_);
+  unlink(path_.c_str());
+}
+
+bool
+DmaBufHandoff::Registered(const int64_t handle)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  return buffers_.find(handle) != buffers_.end();
+}
+
+TRITONSERVER_Error*
+DmaBufHandoff::Duplicate(const int64_t handle, int* fd)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = buffers_.find(handle);
+  RETURN_ERROR_IF_TRUE(
+      it == buffers_.end(), TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("unknown dma-buf handle ") + std::to_string(handle));
+  *fd = fcntl(it->second.fd_, F_DUPFD_CLOEXEC, 0);
+  RETURN_ERROR_IF_TRUE(
+      *fd < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("cannot duplicate the fd of dma-buf handle ") +
+          std::to_string(handle) + ": " + strerror(errno));
+  return nullptr;  // success
+}
+
+void
+DmaBufHandoff::Serve()
+{
+  std::vector<int> clients;
+  while (true) {
+    std::vector<struct pollfd> fds(2 + clients.size());
+    fds[0].fd = wake_fds_[0];
+    fds[1].fd = listen_fd_;
+    for (size_t c = 0; c < clients.size(); ++c) {
+      fds[2 + c].fd = clients[c];
+    }
+    for (auto& fd : fds) {
+      fd.events = POLLIN;
+      fd.revents = 0;
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_ERROR,
+          (std::string("dma-buf socket poll failed: ") + strerror(errno))
+              .c_str());
+      break;
+    }
+    if (fds[0].revents != 0) {
+      break;
+    }
+
+    // Clients that are gone are dropped, last first so the indices of
+    // the others hold.
+    for (size_t c = clients.size(); c-- > 0;) {
+      if ((fds[2 + c].revents != 0) && !Receive(clients[c])) {
+        Disconnect(clients[c]);
+        clients.erase(clients.begin() + c);
+      }
+    }
+
+    if (fds[1].revents & POLLIN) {
+      const int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0) {
+        continue;
+      }
+      struct ucred cred;
+      socklen_t cred_size = sizeof(cred);
+      if ((getsockopt(
+               client, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size) != 0) ||
+          ((cred.uid != geteuid()) && (cred.uid != 0))) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("dma-buf socket refuses a client of uid ") +
+             std::to_string(cred.uid))
+                .c_str());
+        close(client);
+        continue;
+      }
+      clients.push_back(client);
+    }
+  }
+  for (const int client : clients) {
+    Disconnect(client);
+  }
+}
+
+bool
+DmaBufHandoff::Receive(const int client)
+{
+  int64_t value = 0;
+  struct iovec iov;
+  iov.iov_base = &value;
+  iov.iov_len = sizeof(value);
+  union {
+    struct cmsghdr align_;
+    char buf_[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf_;
+  msg.msg_controllen = sizeof(control.buf_);
+  const ssize_t received = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+  if (received <= 0) {
+    return (received < 0) && (errno == EINTR);
+  }
+  int fd = -1;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_SOCKET) &&
+        (cmsg->cmsg_type == SCM_RIGHTS) &&
+        (cmsg->cmsg_len == CMSG_LEN(sizeof(int)))) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  int64_t reply = -1;
+  if ((fd >= 0) && ((msg.msg_flags & MSG_CTRUNC) != 0)) {
+    close(fd);
+  } else if (fd >= 0) {
+    std::lock_guard<std::mutex> lk(mu_);
+    do {
+      reply = (int64_t)((((uint64_t)random_() << 32) | random_()) >> 1);
+    } while ((reply == 0) || (buffers_.find(reply) != buffers_.end()));
+    buffers_[reply] = Buffer{fd, client};
+  } else if (received == sizeof(value)) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = buffers_.find(value);
+    if ((it != buffers_.end()) && (it->second.client_ == client)) {
+      close(it->second.fd_);
+      buffers_.erase(it);
+      reply = 0;
+    }
+  }
+  return send(client, &reply, sizeof(reply), MSG_NOSIGNAL) ==
+         (ssize_t)sizeof(reply);
+}
+
+void
+DmaBufHandoff::Disconnect(const int client)
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+      if (it->second.client_ == client) {
+        close(it->second.fd_);
+        it = buffers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  close(client);
+}
+
+DmaBufImporter::DmaBufImporter(
+    rknn_context ctx, const size_t capacity, DmaBufHandoff* handoff)
+    : ctx_(ctx), capacity_(std::max<size_t>(capacity, 1)), handoff_(handoff),
+      hits_(0), misses_(0)
+{
+}
+
+DmaBufImporter::~DmaBufImporter()
+{
+  for (auto& entry : entries_) {
+    Release(&entry);
+  }
+}
+
+void
+DmaBufImporter::Release(Entry* entry)
+{
+  if (entry->mem_ != nullptr) {
+    rknn_destroy_mem(ctx_, entry->mem_);
+  }
+  if (entry->map_ != MAP_FAILED) {
+    munmap(entry->map_, entry->map_size_);
+  }
+  if (entry->local_fd_ >= 0) {
+    close(entry->local_fd_);
+  }
+}
+
+TRITONSERVER_Error*
+DmaBufImporter::Import(const DmaBufDescriptor& desc, rknn_tensor_mem** mem)
+{
+  RETURN_ERROR_IF_FALSE(
+      (desc.handle_ > 0) && (desc.offset_ >= 0) &&
+          (desc.size_ > 0) && (desc.size_ <= UINT32_MAX) &&
+          (desc.offset_ <= INT32_MAX),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("invalid dma-buf descriptor"));
+
+  // The client may have released the handle since it was imported,
+  // the buffer may then hold anything.
+  const bool registered = handoff_->Registered(desc.handle_);
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->handle_ != desc.handle_) {
+      continue;
+    }
+    if (registered && (it->offset_ == desc.offset_) &&
+        (it->size_ == desc.size_)) {
+      entries_.splice(entries_.begin(), entries_, it);
+      hits_++;
+      *mem = entries_.front().mem_;
+      return nullptr;  // success
+    }
+    Release(&*it);
+    entries_.erase(it);
+    break;
+  }
+
+  misses_++;
+  Entry entry;
+  entry.handle_ = desc.handle_;
+  entry.offset_ = desc.offset_;
+  entry.size_ = desc.size_;
+  entry.map_ = MAP_FAILED;
+  entry.map_size_ = desc.offset_ + desc.size_;
+  entry.mem_ = nullptr;
+  entry.local_fd_ = -1;
+  RETURN_IF_ERROR(handoff_->Duplicate(desc.handle_, &entry.local_fd_));
+
+  // The runtime wants the CPU mapping too, for the layers and
+  // conversions that do not run on the NPU.
+  entry.map_ = mmap(
+      nullptr, entry.map_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+      entry.local_fd_, 0);
+  if (entry.map_ == MAP_FAILED) {
+    const int err = errno;
+    Release(&entry);
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        (std::string("cannot map ") + std::to_string(entry.map_size_) +
+         " bytes of the imported buffer: " + strerror(err))
+            .c_str());
+  }
+
+  entry.mem_ = rknn_create_mem_from_fd(
+      ctx_, entry.local_fd_, entry.map_, (uint32_t)desc.size_,
+      (int32_t)desc.offset_);
+  if (entry.mem_ == nullptr) {
+    Release(&entry);
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL, "rknn_create_mem_from_fd failed");
+  }
+
+  if (entries_.size() >= capacity_) {
+    Release(&entries_.back());
+    entries_.pop_back();
+  }
+  entries_.push_front(entry);
+  *mem = entry.mem_;
+  return nullptr;  // success
+}
+
+}}}  // namespace triton::backend::rockchip
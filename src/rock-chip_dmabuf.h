@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "rknn_api.h"
+#include "triton/core/tritonserver.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// A frame in a dma-buf (or any mappable fd, e.g. a memfd) the client
+// handed over to the DmaBufHandoff. Sent as the TYPE_INT64 [ 4 ] request
+// input named by the "dmabuf_input" model parameter, in this order.
+struct DmaBufDescriptor {
+  DmaBufDescriptor() : handle_(0), offset_(0), size_(0), stride_(0) {}
+
+  // Handle DmaBufHandoff answered for the fd of the buffer.
+  int64_t handle_;
+  // Start of the frame in the buffer.
+  int64_t offset_;
+  // Bytes of the frame, from 'offset_'.
+  int64_t size_;
+  // Bytes per row, 0 when the rows are packed.
+  int64_t stride_;
+};
+
+static const size_t kDmaBufDescriptorElements = 4;
+
+//
+// DmaBufHandoff
+//
+// The Unix socket local clients pass the fds of their buffers through,
+// with SCM_RIGHTS, before they send descriptors of frames in them. The
+// socket is created with mode 0600 and connections of other users than
+// the server are refused, so a request only reaches a buffer its owner
+// handed over, and the handles are random so that a client cannot name
+// the buffers of another one. A message of a client is either
+//  - 8 bytes with an fd attached: the fd is kept and the reply is its
+//    handle, a positive int64, or -1 if it cannot be kept;
+//  - the 8 bytes of a handle without fd: the handle is released, the
+//    reply is 0, or -1 if the connection did not register it.
+// The handles of a client are released when it disconnects. A single
+// thread serves every connection, the lookups are thread-safe.
+//
+class DmaBufHandoff {
+ public:
+  // Listen on the socket 'path', replacing a socket left there.
+  static TRITONSERVER_Error* Create(
+      const std::string& path, std::unique_ptr<DmaBufHandoff>* handoff);
+  ~DmaBufHandoff();
+
+  // Whether 'handle' is registered.
+  bool Registered(const int64_t handle);
+  // Duplicate the fd registered as 'handle' into 'fd', which the caller
+  // closes.
+  TRITONSERVER_Error* Duplicate(const int64_t handle, int* fd);
+
+ private:
+  struct Buffer {
+    int fd_;
+    // Connection that registered it.
+    int client_;
+  };
+
+  DmaBufHandoff(const std::string& path, const int listen_fd);
+  void Serve();
+  // Answer a message of 'client', false once it is disconnected.
+  bool Receive(const int client);
+  // Release the buffers of 'client' and close it.
+  void Disconnect(const int client);
+
+  const std::string path_;
+  const int listen_fd_;
+  // Written to stop Serve.
+  int wake_fds_[2];
+
+  std::mutex mu_;
+  std::unordered_map<int64_t, Buffer> buffers_;
+  std::random_device random_;
+  std::thread thread_;
+};
+
+//
+// DmaBufImporter
+//
+// Turns client buffers into rknn_tensor_mem that the NPU reads
+// directly. The fd registered with the DmaBufHandoff is duplicated,
+// mapped and imported with rknn_create_mem_from_fd. Video decoders
+// cycle through a small pool of buffers so the imports are cached per
+// context, keyed by the handle, which is never reused for another
+// buffer; the import of a released handle is dropped. One importer
+// belongs to one model instance and is not thread-safe.
+//
+class DmaBufImporter {
+ public:
+  DmaBufImporter(
+      rknn_context ctx, const size_t capacity, DmaBufHandoff* handoff);
+  ~DmaBufImporter();
+
+  // Return the tensor memory of 'desc', importing it if needed. The
+  // memory stays owned by the importer.
+  TRITONSERVER_Error* Import(
+      const DmaBufDescriptor& desc, rknn_tensor_mem** mem);
+
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    int64_t handle_;
+    int64_t offset_;
+    int64_t size_;
+    int local_fd_;
+    void* map_;
+    size_t map_size_;
+    rknn_tensor_mem* mem_;
+  };
+
+  void Release(Entry* entry);
+
+  rknn_context ctx_;
+  const size_t capacity_;
+  DmaBufHandoff* handoff_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  uint64_t hits_;
+  uint64_t misses_;
+};
+
+}}}  // namespace triton::backend::rockchip
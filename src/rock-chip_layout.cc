@@ -0,0 +1,244 @@
+#include "rock-chip_layout.h"
+
+#include <algorithm>
+#include <cstring>
+
+// ROCKCHIP_NO_NEON and ROCKCHIP_NEON_EMULATION are only set by the
+// tests in test/, to build the scalar path on aarch64 and the NEON path
+// elsewhere.
+#if !defined(ROCKCHIP_NO_NEON) &&                    \
+    (defined(__ARM_NEON) || defined(__ARM_NEON__) || \
+     defined(ROCKCHIP_NEON_EMULATION))
+#include <arm_neon.h>
+#define ROCKCHIP_LAYOUT_NEON 1
+#endif
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+uint32_t
+TypeSize(const rknn_tensor_type type)
+{
+  switch (type) {
+    case RKNN_TENSOR_FLOAT32:
+    case RKNN_TENSOR_INT32:
+    case RKNN_TENSOR_UINT32:
+      return 4;
+    case RKNN_TENSOR_FLOAT16:
+    case RKNN_TENSOR_INT16:
+    case RKNN_TENSOR_UINT16:
+      return 2;
+    case RKNN_TENSOR_INT64:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+// Scatter 'width' pixels of 'channels' channels, 'c2' apart in 'src',
+// to the rows of the channel planes of 'dst', 'plane' elements apart.
+template <typename T>
+void
+RowToPlanes(
+    const T* src, const uint32_t c2, const uint32_t channels,
+    const uint32_t width, T* dst, const size_t plane)
+{
+  for (uint32_t c = 0; c < channels; ++c) {
+    T* dst_row = dst + c * plane;
+    const T* src_c = src + c;
+    for (uint32_t w = 0; w < width; ++w) {
+      dst_row[w] = src_c[(size_t)w * c2];
+    }
+  }
+}
+
+#ifdef ROCKCHIP_LAYOUT_NEON
+// Transpose the 16x16 bytes of 'r' in place: three vtrn passes swap the
+// low three bits of the row and column indices, the 64-bit halves are
+// exchanged last.
+inline void
+Transpose16x16(uint8x16_t r[16])
+{
+  uint8x16_t s1[16];
+  for (int m = 0; m < 8; ++m) {
+    const uint8x16x2_t t = vtrnq_u8(r[2 * m], r[2 * m + 1]);
+    s1[2 * m] = t.val[0];
+    s1[2 * m + 1] = t.val[1];
+  }
+  uint8x16_t s2[16];
+  for (int m = 0; m < 4; ++m) {
+    for (int p = 0; p < 2; ++p) {
+      const uint16x8x2_t t = vtrnq_u16(
+          vreinterpretq_u16_u8(s1[4 * m + p]),
+          vreinterpretq_u16_u8(s1[4 * m + 2 + p]));
+      s2[4 * m + p] = vreinterpretq_u8_u16(t.val[0]);
+      s2[4 * m + 2 + p] = vreinterpretq_u8_u16(t.val[1]);
+    }
+  }
+  uint8x16_t s3[16];
+  for (int m = 0; m < 2; ++m) {
+    for (int k = 0; k < 4; ++k) {
+      const uint32x4x2_t t = vtrnq_u32(
+          vreinterpretq_u32_u8(s2[8 * m + k]),
+          vreinterpretq_u32_u8(s2[8 * m + 4 + k]));
+      s3[8 * m + k] = vreinterpretq_u8_u32(t.val[0]);
+      s3[8 * m + 4 + k] = vreinterpretq_u8_u32(t.val[1]);
+    }
+  }
+  for (int k = 0; k < 8; ++k) {
+    r[k] = vcombine_u8(vget_low_u8(s3[k]), vget_low_u8(s3[k + 8]));
+    r[k + 8] = vcombine_u8(vget_high_u8(s3[k]), vget_high_u8(s3[k + 8]));
+  }
+}
+
+// RowToPlanes of 8-bit elements in groups of 16 channels, 16 pixels at
+// a time.
+void
+RowToPlanesC16(
+    const uint8_t* src, const uint32_t channels, const uint32_t width,
+    uint8_t* dst, const size_t plane)
+{
+  uint32_t w = 0;
+  uint8x16_t r[16];
+  for (; w + 16 <= width; w += 16) {
+    for (int i = 0; i < 16; ++i) {
+      r[i] = vld1q_u8(src + (w + i) * 16);
+    }
+    Transpose16x16(r);
+    for (uint32_t c = 0; c < channels; ++c) {
+      vst1q_u8(dst + c * plane + w, r[c]);
+    }
+  }
+  if (w < width) {
+    RowToPlanes<uint8_t>(
+        src + w * 16, 16, channels, width - w, dst + w, plane);
+  }
+}
+#endif  // ROCKCHIP_LAYOUT_NEON
+
+template <typename T>
+void
+ToNchw(const Nc1hwc2Layout& layout, const T* src, T* dst)
+{
+  const size_t plane = (size_t)layout.height_ * layout.width_;
+  const size_t src_row = (size_t)layout.w_stride_ * layout.c2_;
+  for (uint32_t n = 0; n < layout.batch_; ++n) {
+    for (uint32_t c1 = 0; c1 < layout.c1_; ++c1) {
+      const uint32_t c_begin = c1 * layout.c2_;
+      if (c_begin >= layout.channels_) {
+        break;
+      }
+      const uint32_t channels =
+          std::min(layout.c2_, layout.channels_ - c_begin);
+      const T* src_group =
+          src + ((size_t)n * layout.c1_ + c1) * layout.height_ * src_row;
+      T* dst_group = dst + ((size_t)n * layout.channels_ + c_begin) * plane;
+      for (uint32_t h = 0; h < layout.height_; ++h) {
+#ifdef ROCKCHIP_LAYOUT_NEON
+        if ((sizeof(T) == 1) && (layout.c2_ == 16)) {
+          RowToPlanesC16(
+              (const uint8_t*)(src_group + h * src_row), channels,
+              layout.width_, (uint8_t*)(dst_group + h * layout.width_),
+              plane);
+          continue;
+        }
+#endif  // ROCKCHIP_LAYOUT_NEON
+        RowToPlanes<T>(
+            src_group + h * src_row, layout.c2_, channels, layout.width_,
+            dst_group + h * layout.width_, plane);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+bool
+Nc1hwc2LayoutFromAttrs(
+    const rknn_tensor_attr& native, const rknn_tensor_attr& attr,
+    Nc1hwc2Layout* layout)
+{
+  if ((native.fmt != RKNN_TENSOR_NC1HWC2) || (native.n_dims != 5) ||
+      (attr.n_dims != 4) || (native.type != attr.type)) {
+    return false;
+  }
+  Nc1hwc2Layout l;
+  l.batch_ = attr.dims[0];
+  if (attr.fmt == RKNN_TENSOR_NHWC) {
+    l.height_ = attr.dims[1];
+    l.width_ = attr.dims[2];
+    l.channels_ = attr.dims[3];
+  } else {
+    l.channels_ = attr.dims[1];
+    l.height_ = attr.dims[2];
+    l.width_ = attr.dims[3];
+  }
+  l.c1_ = native.dims[1];
+  l.c2_ = native.dims[4];
+  l.w_stride_ = std::max(native.dims[3], native.w_stride);
+  l.element_size_ = TypeSize(native.type);
+  if ((native.dims[0] != l.batch_) || (native.dims[2] != l.height_) ||
+      (l.w_stride_ < l.width_) || (l.c2_ == 0) ||
+      ((size_t)l.c1_ * l.c2_ < l.channels_) ||
+      (l.NativeByteSize() > std::max(native.size, native.size_with_stride))) {
+    return false;
+  }
+  *layout = l;
+  return true;
+}
+
+void
+Nc1hwc2ToNchw(const Nc1hwc2Layout& layout, const void* src, void* dst)
+{
+  switch (layout.element_size_) {
+    case 1:
+      ToNchw<uint8_t>(layout, (const uint8_t*)src, (uint8_t*)dst);
+      break;
+    case 2:
+      ToNchw<uint16_t>(layout, (const uint16_t*)src, (uint16_t*)dst);
+      break;
+    case 4:
+      ToNchw<uint32_t>(layout, (const uint32_t*)src, (uint32_t*)dst);
+      break;
+    default:
+      ToNchw<uint64_t>(layout, (const uint64_t*)src, (uint64_t*)dst);
+      break;
+  }
+}
+
+void
+Nc1hwc2ToNhwc(const Nc1hwc2Layout& layout, const void* src, void* dst)
+{
+  // Each group is a run of C2 channels in both layouts.
+  const size_t es = layout.element_size_;
+  const size_t src_row = (size_t)layout.w_stride_ * layout.c2_ * es;
+  const size_t dst_pixel = (size_t)layout.channels_ * es;
+  const uint8_t* s = (const uint8_t*)src;
+  uint8_t* d = (uint8_t*)dst;
+  for (uint32_t n = 0; n < layout.batch_; ++n) {
+    for (uint32_t c1 = 0; c1 < layout.c1_; ++c1) {
+      const uint32_t c_begin = c1 * layout.c2_;
+      if (c_begin >= layout.channels_) {
+        break;
+      }
+      const size_t group_bytes =
+          std::min(layout.c2_, layout.channels_ - c_begin) * es;
+      for (uint32_t h = 0; h < layout.height_; ++h) {
+        const uint8_t* src_pixel =
+            s + (((size_t)n * layout.c1_ + c1) * layout.height_ + h) *
+                    src_row;
+        uint8_t* dst_pixel_ptr =
+            d + ((size_t)n * layout.height_ + h) * layout.width_ * dst_pixel +
+            c_begin * es;
+        for (uint32_t w = 0; w < layout.width_; ++w) {
+          memcpy(dst_pixel_ptr, src_pixel, group_bytes);
+          src_pixel += layout.c2_ * es;
+          dst_pixel_ptr += dst_pixel;
+        }
+      }
+    }
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rknn_api.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// Nc1hwc2Layout
+//
+// The NPU produces its outputs in NC1HWC2: the channels are split in
+// C1 groups of C2 channels (16 for 8-bit types on rk3588) that are
+// stored interleaved per pixel, the last group padded with zeros.
+// rknn_outputs_get converts every output to NCHW on every call; binding
+// the outputs in this layout with rknn_set_io_mem and converting on
+// the CPU lets the backend skip the outputs nobody asked for. The
+// conversions are independent of Triton so rk_stat can time them.
+//
+struct Nc1hwc2Layout {
+  Nc1hwc2Layout()
+      : batch_(0), channels_(0), c1_(0), c2_(0), height_(0), width_(0),
+        w_stride_(0), element_size_(0)
+  {
+  }
+
+  uint32_t batch_;
+  // Channels of the tensor, without the padding of the last group.
+  uint32_t channels_;
+  uint32_t c1_;
+  uint32_t c2_;
+  uint32_t height_;
+  uint32_t width_;
+  // Pixels per row in the native buffer, at least 'width_'.
+  uint32_t w_stride_;
+  uint32_t element_size_;
+
+  // Bytes of the native buffer.
+  size_t NativeByteSize() const
+  {
+    return (size_t)batch_ * c1_ * height_ * w_stride_ * c2_ * element_size_;
+  }
+  // Bytes of the tensor in NCHW or NHWC.
+  size_t ByteSize() const
+  {
+    return (size_t)batch_ * channels_ * height_ * width_ * element_size_;
+  }
+};
+
+// Describe the native output 'native' (RKNN_QUERY_NATIVE_OUTPUT_ATTR)
+// of the 4-D output 'attr' (RKNN_QUERY_OUTPUT_ATTR). Returns false if
+// 'native' is not in NC1HWC2 or does not match 'attr'.
+bool Nc1hwc2LayoutFromAttrs(
+    const rknn_tensor_attr& native, const rknn_tensor_attr& attr,
+    Nc1hwc2Layout* layout);
+
+// Convert the native buffer 'src' into 'dst' in NCHW or NHWC,
+// 'dst' holds layout.ByteSize() bytes.
+void Nc1hwc2ToNchw(const Nc1hwc2Layout& layout, const void* src, void* dst);
+void Nc1hwc2ToNhwc(const Nc1hwc2Layout& layout, const void* src, void* dst);
+
+}}}  // namespace triton::backend::rockchip
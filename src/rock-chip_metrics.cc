@@ -0,0 +1,477 @@
+#include "rock-chip_metrics.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "triton/backend/backend_common.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+// Upper bounds of the rknn_run duration buckets, in us.
+const std::vector<uint64_t> kRunDurationBoundsUs = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000};
+// Upper bounds of the batch size buckets.
+const std::vector<uint64_t> kBatchSizeBounds = {1, 2, 4, 8, 16, 32, 64};
+// Upper bounds of the context reload duration buckets, in us.
+const std::vector<uint64_t> kReloadDurationBoundsUs = {
+    1000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000};
+
+uint64_t
+NowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void
+DeleteMetric(TRITONSERVER_Metric* metric)
+{
+  if (metric != nullptr) {
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricDelete(metric), "failed to delete metric");
+  }
+}
+
+void
+DeleteFamily(TRITONSERVER_MetricFamily* family)
+{
+  if (family != nullptr) {
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricFamilyDelete(family),
+        "failed to delete metric family");
+  }
+}
+
+void
+Increment(TRITONSERVER_Metric* metric, const uint64_t value)
+{
+  if (value != 0) {
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricIncrement(metric, (double)value),
+        "failed to increment metric");
+  }
+}
+
+}  // namespace
+
+AtomicHistogram::AtomicHistogram(const std::vector<uint64_t>& bounds)
+    : bounds_(bounds), buckets_(new std::atomic<uint64_t>[bounds.size() + 1]),
+      sum_(0)
+{
+  for (size_t i = 0; i <= bounds_.size(); ++i) {
+    buckets_[i].store(0);
+  }
+}
+
+ModelMetrics::ModelMetrics()
+    : run_duration_us_(kRunDurationBoundsUs), batch_size_(kBatchSizeBounds),
+      context_reload_us_(kReloadDurationBoundsUs), input_conversion_ns_(0),
+      output_copy_bytes_(0), buffer_pool_used_bytes_(0),
+      buffer_pool_capacity_bytes_(0), context_evictions_(0)
+{
+}
+
+BackendMetrics::BackendMetrics(const int core_count, const uint64_t interval_ms)
+    : core_count_(core_count), interval_ms_(interval_ms),
+      core_busy_ns_(new std::atomic<uint64_t>[core_count]),
+      core_busy_flushed_(core_count, 0), last_flush_ns_(NowNs()),
+      run_bucket_family_(nullptr), run_sum_family_(nullptr),
+      run_count_family_(nullptr), batch_bucket_family_(nullptr),
+      batch_sum_family_(nullptr), batch_count_family_(nullptr),
+      input_conversion_family_(nullptr), output_copy_family_(nullptr),
+      pool_used_family_(nullptr), pool_capacity_family_(nullptr),
+      reload_bucket_family_(nullptr), reload_sum_family_(nullptr),
+      reload_count_family_(nullptr), evictions_family_(nullptr),
+      core_busy_family_(nullptr), exiting_(false)
+{
+  for (int i = 0; i < core_count_; ++i) {
+    core_busy_ns_[i].store(0);
+  }
+}
+
+TRITONSERVER_Error*
+BackendMetrics::Create(
+    const int core_count, const uint64_t interval_ms,
+    std::unique_ptr<BackendMetrics>* metrics)
+{
+  std::unique_ptr<BackendMetrics> local_metrics(
+      new BackendMetrics(core_count, interval_ms));
+  RETURN_IF_ERROR(local_metrics->CreateFamilies());
+  for (int core = 0; core < core_count; ++core) {
+    TRITONSERVER_Metric* metric;
+    RETURN_IF_ERROR(local_metrics->NewMetric(
+        local_metrics->core_busy_family_, {{"core", std::to_string(core)}},
+        &metric));
+    local_metrics->core_busy_.push_back(metric);
+  }
+  local_metrics->flush_thread_ =
+      std::thread(&BackendMetrics::FlushLoop, local_metrics.get());
+  *metrics = std::move(local_metrics);
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+BackendMetrics::CreateFamilies()
+{
+  // Histograms are exported the Prometheus way: cumulative "_bucket"
+  // counters labelled with "le", plus "_sum" and "_count".
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &run_bucket_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_run_duration_us_bucket",
+      "Number of rknn_run calls that took at most 'le' microseconds"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &run_sum_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_run_duration_us_sum",
+      "Cumulative rknn_run duration in microseconds"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &run_count_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_run_duration_us_count", "Number of rknn_run calls"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &batch_bucket_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_batch_size_bucket",
+      "Number of executions with at most 'le' requests"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &batch_sum_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_batch_size_sum", "Cumulative number of requests executed"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &batch_count_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_batch_size_count", "Number of executions"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &input_conversion_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_input_conversion_duration_us",
+      "Cumulative time spent gathering and converting inputs for the NPU "
+      "in microseconds"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &output_copy_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_output_copy_bytes",
+      "Cumulative bytes copied from NPU outputs into responses"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &pool_used_family_, TRITONSERVER_METRIC_KIND_GAUGE,
+      "rknpu_buffer_pool_used_bytes",
+      "Output buffer pool bytes used by the last execution of each "
+      "instance"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &pool_capacity_family_, TRITONSERVER_METRIC_KIND_GAUGE,
+      "rknpu_buffer_pool_capacity_bytes",
+      "Output buffer pool bytes allocated by the instances"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &reload_bucket_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_context_reload_duration_us_bucket",
+      "Number of evicted contexts materialized again in at most 'le' "
+      "microseconds"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &reload_sum_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_context_reload_duration_us_sum",
+      "Cumulative time spent materializing evicted contexts in "
+      "microseconds"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &reload_count_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_context_reload_duration_us_count",
+      "Number of evicted contexts materialized again"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &evictions_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+      "rknpu_context_evictions",
+      "Number of idle contexts evicted to stay in the NPU memory budget"));
+  RETURN_IF_ERROR(TRITONSERVER_MetricFamilyNew(
+      &core_busy_family_, TRITONSERVER_METRIC_KIND_GAUGE,
+      "rknpu_core_busy_ratio",
+      "Fraction of the last metrics interval the NPU core spent in "
+      "rknn_run"));
+  return nullptr;  // success
+}
+
+BackendMetrics::~BackendMetrics()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+  if (flush_thread_.joinable()) {
+    flush_thread_.join();
+  }
+
+  for (auto& model : models_) {
+    DeleteModelEntry(&model.second);
+  }
+  for (auto metric : core_busy_) {
+    DeleteMetric(metric);
+  }
+  DeleteFamily(run_bucket_family_);
+  DeleteFamily(run_sum_family_);
+  DeleteFamily(run_count_family_);
+  DeleteFamily(batch_bucket_family_);
+  DeleteFamily(batch_sum_family_);
+  DeleteFamily(batch_count_family_);
+  DeleteFamily(input_conversion_family_);
+  DeleteFamily(output_copy_family_);
+  DeleteFamily(pool_used_family_);
+  DeleteFamily(pool_capacity_family_);
+  DeleteFamily(reload_bucket_family_);
+  DeleteFamily(reload_sum_family_);
+  DeleteFamily(reload_count_family_);
+  DeleteFamily(evictions_family_);
+  DeleteFamily(core_busy_family_);
+}
+
+TRITONSERVER_Error*
+BackendMetrics::NewMetric(
+    TRITONSERVER_MetricFamily* family,
+    const std::vector<std::pair<std::string, std::string>>& labels,
+    TRITONSERVER_Metric** metric)
+{
+  std::vector<const TRITONSERVER_Parameter*> params;
+  for (const auto& label : labels) {
+    params.push_back(TRITONSERVER_ParameterNew(
+        label.first.c_str(), TRITONSERVER_PARAMETER_STRING,
+        label.second.c_str()));
+  }
+  TRITONSERVER_Error* err =
+      TRITONSERVER_MetricNew(metric, family, params.data(), params.size());
+  for (auto param : params) {
+    TRITONSERVER_ParameterDelete(const_cast<TRITONSERVER_Parameter*>(param));
+  }
+  return err;
+}
+
+void
+BackendMetrics::DeleteModelEntry(ModelEntry* entry)
+{
+  for (auto metric : entry->run_buckets_) {
+    DeleteMetric(metric);
+  }
+  for (auto metric : entry->batch_buckets_) {
+    DeleteMetric(metric);
+  }
+  for (auto metric : entry->reload_buckets_) {
+    DeleteMetric(metric);
+  }
+  DeleteMetric(entry->run_sum_);
+  DeleteMetric(entry->run_count_);
+  DeleteMetric(entry->batch_sum_);
+  DeleteMetric(entry->batch_count_);
+  DeleteMetric(entry->input_conversion_);
+  DeleteMetric(entry->output_copy_);
+  DeleteMetric(entry->pool_used_);
+  DeleteMetric(entry->pool_capacity_);
+  DeleteMetric(entry->reload_sum_);
+  DeleteMetric(entry->reload_count_);
+  DeleteMetric(entry->evictions_);
+}
+
+TRITONSERVER_Error*
+BackendMetrics::RegisterModel(
+    const std::string& model_name, const int64_t model_version,
+    std::shared_ptr<ModelMetrics>* model_metrics)
+{
+  const auto key = std::make_pair(model_name, model_version);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = models_.find(key);
+    if (it != models_.end()) {
+      it->second.registrations_++;
+      *model_metrics = it->second.metrics_;
+      return nullptr;  // success
+    }
+  }
+
+  ModelEntry entry;
+  entry.metrics_.reset(new ModelMetrics());
+  entry.registrations_ = 1;
+  entry.run_sum_ = entry.run_count_ = nullptr;
+  entry.batch_sum_ = entry.batch_count_ = nullptr;
+  entry.input_conversion_ = entry.output_copy_ = nullptr;
+  entry.pool_used_ = entry.pool_capacity_ = nullptr;
+  entry.reload_sum_ = entry.reload_count_ = entry.evictions_ = nullptr;
+  entry.run_sum_flushed_ = entry.batch_sum_flushed_ = 0;
+  entry.input_conversion_flushed_ = entry.output_copy_flushed_ = 0;
+  entry.reload_sum_flushed_ = entry.evictions_flushed_ = 0;
+
+  const std::vector<std::pair<std::string, std::string>> labels = {
+      {"model", model_name}, {"version", std::to_string(model_version)}};
+  TRITONSERVER_Error* err = nullptr;
+  auto new_metric = [&](TRITONSERVER_MetricFamily* family,
+                        const std::vector<std::pair<std::string, std::string>>&
+                            metric_labels,
+                        TRITONSERVER_Metric** metric) {
+    *metric = nullptr;
+    if (err == nullptr) {
+      err = NewMetric(family, metric_labels, metric);
+    }
+  };
+  auto new_histogram = [&](TRITONSERVER_MetricFamily* family,
+                           const std::vector<uint64_t>& bounds,
+                           std::vector<TRITONSERVER_Metric*>* buckets) {
+    for (size_t i = 0; i <= bounds.size(); ++i) {
+      auto bucket_labels = labels;
+      bucket_labels.emplace_back(
+          "le", (i < bounds.size()) ? std::to_string(bounds[i]) : "+Inf");
+      TRITONSERVER_Metric* metric;
+      new_metric(family, bucket_labels, &metric);
+      buckets->push_back(metric);
+    }
+  };
+
+  new_histogram(run_bucket_family_, kRunDurationBoundsUs, &entry.run_buckets_);
+  new_metric(run_sum_family_, labels, &entry.run_sum_);
+  new_metric(run_count_family_, labels, &entry.run_count_);
+  new_histogram(batch_bucket_family_, kBatchSizeBounds, &entry.batch_buckets_);
+  new_metric(batch_sum_family_, labels, &entry.batch_sum_);
+  new_metric(batch_count_family_, labels, &entry.batch_count_);
+  new_metric(input_conversion_family_, labels, &entry.input_conversion_);
+  new_metric(output_copy_family_, labels, &entry.output_copy_);
+  new_metric(pool_used_family_, labels, &entry.pool_used_);
+  new_metric(pool_capacity_family_, labels, &entry.pool_capacity_);
+  new_histogram(
+      reload_bucket_family_, kReloadDurationBoundsUs, &entry.reload_buckets_);
+  new_metric(reload_sum_family_, labels, &entry.reload_sum_);
+  new_metric(reload_count_family_, labels, &entry.reload_count_);
+  new_metric(evictions_family_, labels, &entry.evictions_);
+  if (err != nullptr) {
+    DeleteModelEntry(&entry);
+    return err;
+  }
+  entry.run_flushed_.assign(entry.run_buckets_.size(), 0);
+  entry.batch_flushed_.assign(entry.batch_buckets_.size(), 0);
+  entry.reload_flushed_.assign(entry.reload_buckets_.size(), 0);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = models_.find(key);
+  if (it != models_.end()) {
+    // Registered concurrently while the metrics were created, share the
+    // entry that made it first.
+    DeleteModelEntry(&entry);
+    it->second.registrations_++;
+    *model_metrics = it->second.metrics_;
+    return nullptr;  // success
+  }
+  *model_metrics = entry.metrics_;
+  models_.emplace(key, std::move(entry));
+  return nullptr;  // success
+}
+
+void
+BackendMetrics::UnregisterModel(
+    const std::string& model_name, const int64_t model_version)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = models_.find(std::make_pair(model_name, model_version));
+  if (it == models_.end()) {
+    return;
+  }
+  if (it->second.registrations_ > 0) {
+    it->second.registrations_--;
+  }
+  if (it->second.registrations_ == 0) {
+    DeleteModelEntry(&it->second);
+    models_.erase(it);
+  }
+}
+
+void
+BackendMetrics::FlushLoop()
+{
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!exiting_) {
+    cv_.wait_for(lk, std::chrono::milliseconds(interval_ms_));
+    if (!exiting_) {
+      Flush();
+    }
+  }
+}
+
+void
+BackendMetrics::FlushHistogram(
+    const AtomicHistogram& histogram,
+    const std::vector<TRITONSERVER_Metric*>& buckets,
+    TRITONSERVER_Metric* sum, TRITONSERVER_Metric* count,
+    std::vector<uint64_t>* flushed, uint64_t* sum_flushed)
+{
+  // Read every bucket once, the "_count" is the +Inf bucket so all the
+  // exported values stay consistent with each other even while the
+  // instances keep observing.
+  const uint64_t count_flushed = flushed->back();
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    cumulative += histogram.BucketCount(i);
+    Increment(buckets[i], cumulative - (*flushed)[i]);
+    (*flushed)[i] = cumulative;
+  }
+  Increment(count, cumulative - count_flushed);
+  const uint64_t histogram_sum = histogram.Sum();
+  Increment(sum, histogram_sum - *sum_flushed);
+  *sum_flushed = histogram_sum;
+}
+
+void
+BackendMetrics::Flush()
+{
+  for (auto& model : models_) {
+    ModelEntry& entry = model.second;
+    ModelMetrics& metrics = *entry.metrics_;
+
+    FlushHistogram(
+        metrics.run_duration_us_, entry.run_buckets_, entry.run_sum_,
+        entry.run_count_, &entry.run_flushed_, &entry.run_sum_flushed_);
+    FlushHistogram(
+        metrics.batch_size_, entry.batch_buckets_, entry.batch_sum_,
+        entry.batch_count_, &entry.batch_flushed_, &entry.batch_sum_flushed_);
+    FlushHistogram(
+        metrics.context_reload_us_, entry.reload_buckets_, entry.reload_sum_,
+        entry.reload_count_, &entry.reload_flushed_,
+        &entry.reload_sum_flushed_);
+
+    const uint64_t conversion_us =
+        metrics.input_conversion_ns_.load(std::memory_order_relaxed) / 1000;
+    Increment(
+        entry.input_conversion_,
+        conversion_us - entry.input_conversion_flushed_);
+    entry.input_conversion_flushed_ = conversion_us;
+
+    const uint64_t copy_bytes =
+        metrics.output_copy_bytes_.load(std::memory_order_relaxed);
+    Increment(entry.output_copy_, copy_bytes - entry.output_copy_flushed_);
+    entry.output_copy_flushed_ = copy_bytes;
+
+    const uint64_t evictions =
+        metrics.context_evictions_.load(std::memory_order_relaxed);
+    Increment(entry.evictions_, evictions - entry.evictions_flushed_);
+    entry.evictions_flushed_ = evictions;
+
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricSet(
+            entry.pool_used_,
+            (double)metrics.buffer_pool_used_bytes_.load(
+                std::memory_order_relaxed)),
+        "failed to set metric");
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricSet(
+            entry.pool_capacity_,
+            (double)metrics.buffer_pool_capacity_bytes_.load(
+                std::memory_order_relaxed)),
+        "failed to set metric");
+  }
+
+  const uint64_t now_ns = NowNs();
+  const uint64_t elapsed_ns = now_ns - last_flush_ns_;
+  last_flush_ns_ = now_ns;
+  for (int core = 0; core < core_count_; ++core) {
+    const uint64_t busy_ns =
+        core_busy_ns_[core].load(std::memory_order_relaxed);
+    const double ratio =
+        (elapsed_ns > 0)
+            ? std::min(
+                  1.0, (double)(busy_ns - core_busy_flushed_[core]) /
+                           elapsed_ns)
+            : 0.0;
+    core_busy_flushed_[core] = busy_ns;
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricSet(core_busy_[core], ratio),
+        "failed to set metric");
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
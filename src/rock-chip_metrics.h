@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "triton/core/tritonserver.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// AtomicHistogram
+//
+// Fixed-bucket histogram updated with relaxed atomic increments, so
+// recording a value from ModelInstanceExecute is a handful of
+// nanoseconds and never takes a lock. Buckets are not cumulative here,
+// the flusher accumulates them into Prometheus "le" buckets.
+//
+class AtomicHistogram {
+ public:
+  // 'bounds' are the inclusive upper bounds of the buckets in
+  // increasing order, a last +Inf bucket is implicit.
+  explicit AtomicHistogram(const std::vector<uint64_t>& bounds);
+
+  void Observe(const uint64_t value)
+  {
+    size_t idx = 0;
+    while ((idx < bounds_.size()) && (value > bounds_[idx])) {
+      idx++;
+    }
+    buckets_[idx].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  const std::vector<uint64_t>& Bounds() const { return bounds_; }
+  // Count of bucket 'idx', 'idx' == Bounds().size() is the +Inf bucket.
+  uint64_t BucketCount(const size_t idx) const
+  {
+    return buckets_[idx].load(std::memory_order_relaxed);
+  }
+  uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+  const std::vector<uint64_t> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> sum_;
+};
+
+//
+// ModelMetrics
+//
+// Counters of one model (all its instances), shared between the model
+// state that updates them and the BackendMetrics flusher that reads
+// them.
+//
+class ModelMetrics {
+ public:
+  ModelMetrics();
+
+  // rknn_run duration.
+  void ObserveRun(const uint64_t duration_ns)
+  {
+    run_duration_us_.Observe(duration_ns / 1000);
+  }
+  // Number of requests executed together.
+  void ObserveBatch(const uint64_t batch_size)
+  {
+    batch_size_.Observe(batch_size);
+  }
+  // Time spent gathering the request inputs and converting them with
+  // rknn_inputs_set.
+  void AddInputConversion(const uint64_t duration_ns)
+  {
+    input_conversion_ns_.fetch_add(duration_ns, std::memory_order_relaxed);
+  }
+  // Bytes copied from the NPU output buffers into the responses.
+  void AddOutputCopy(const uint64_t bytes)
+  {
+    output_copy_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  // Output buffer pool of the instances: bytes in use by the last
+  // execution and bytes allocated. Instances add their own deltas.
+  void AddBufferPool(const int64_t used_delta, const int64_t capacity_delta)
+  {
+    buffer_pool_used_bytes_.fetch_add(used_delta, std::memory_order_relaxed);
+    buffer_pool_capacity_bytes_.fetch_add(
+        capacity_delta, std::memory_order_relaxed);
+  }
+  // An idle context of the model evicted by the ContextManager.
+  void AddContextEviction()
+  {
+    context_evictions_.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Time to materialize an evicted context again.
+  void ObserveContextReload(const uint64_t duration_ns)
+  {
+    context_reload_us_.Observe(duration_ns / 1000);
+  }
+
+ private:
+  friend class BackendMetrics;
+
+  AtomicHistogram run_duration_us_;
+  AtomicHistogram batch_size_;
+  AtomicHistogram context_reload_us_;
+  std::atomic<uint64_t> input_conversion_ns_;
+  std::atomic<uint64_t> output_copy_bytes_;
+  std::atomic<int64_t> buffer_pool_used_bytes_;
+  std::atomic<int64_t> buffer_pool_capacity_bytes_;
+  std::atomic<uint64_t> context_evictions_;
+};
+
+//
+// BackendMetrics
+//
+// Metric families of the rockchip backend, registered with Triton
+// through the TRITONSERVER_Metric API when the backend is initialized
+// and exposed on the regular Triton metrics endpoint next to the
+// nv_inference_* metrics.
+//
+// The hot path only touches the atomics of ModelMetrics and of the
+// per-core busy time. A flusher thread wakes up every 'interval_ms',
+// reads the atomics and pushes the deltas to the Triton metrics, so
+// the Triton metric objects (and their locks) are never used from
+// ModelInstanceExecute.
+//
+class BackendMetrics {
+ public:
+  // Returns an error if the metric families cannot be created, e.g.
+  // when Triton runs with --allow-metrics=false.
+  static TRITONSERVER_Error* Create(
+      const int core_count, const uint64_t interval_ms,
+      std::unique_ptr<BackendMetrics>* metrics);
+  ~BackendMetrics();
+
+  // Create the per-model metrics labelled with 'model' and 'version'.
+  // Registrations are counted like those of the NpuArbiter: the
+  // ModelState of a reloaded version registers before the old one is
+  // destroyed, both share the metrics and they are only deleted with
+  // the last UnregisterModel.
+  TRITONSERVER_Error* RegisterModel(
+      const std::string& model_name, const int64_t model_version,
+      std::shared_ptr<ModelMetrics>* model_metrics);
+  void UnregisterModel(
+      const std::string& model_name, const int64_t model_version);
+
+  // NPU time spent by a run on 'core'.
+  void AddCoreBusy(const int core, const uint64_t busy_ns)
+  {
+    if ((core >= 0) && (core < core_count_)) {
+      core_busy_ns_[core].fetch_add(busy_ns, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  // Triton metrics of one model and the values already pushed to them.
+  struct ModelEntry {
+    std::shared_ptr<ModelMetrics> metrics_;
+    uint32_t registrations_;
+    std::vector<TRITONSERVER_Metric*> run_buckets_;
+    TRITONSERVER_Metric* run_sum_;
+    TRITONSERVER_Metric* run_count_;
+    std::vector<TRITONSERVER_Metric*> batch_buckets_;
+    TRITONSERVER_Metric* batch_sum_;
+    TRITONSERVER_Metric* batch_count_;
+    TRITONSERVER_Metric* input_conversion_;
+    TRITONSERVER_Metric* output_copy_;
+    TRITONSERVER_Metric* pool_used_;
+    TRITONSERVER_Metric* pool_capacity_;
+    std::vector<TRITONSERVER_Metric*> reload_buckets_;
+    TRITONSERVER_Metric* reload_sum_;
+    TRITONSERVER_Metric* reload_count_;
+    TRITONSERVER_Metric* evictions_;
+    std::vector<uint64_t> run_flushed_;
+    uint64_t run_sum_flushed_;
+    std::vector<uint64_t> batch_flushed_;
+    uint64_t batch_sum_flushed_;
+    uint64_t input_conversion_flushed_;
+    uint64_t output_copy_flushed_;
+    std::vector<uint64_t> reload_flushed_;
+    uint64_t reload_sum_flushed_;
+    uint64_t evictions_flushed_;
+  };
+
+  BackendMetrics(const int core_count, const uint64_t interval_ms);
+  TRITONSERVER_Error* CreateFamilies();
+  TRITONSERVER_Error* NewMetric(
+      TRITONSERVER_MetricFamily* family,
+      const std::vector<std::pair<std::string, std::string>>& labels,
+      TRITONSERVER_Metric** metric);
+  static void DeleteModelEntry(ModelEntry* entry);
+
+  void FlushLoop();
+  // Must be called with 'mu_' held.
+  void Flush();
+  void FlushHistogram(
+      const AtomicHistogram& histogram,
+      const std::vector<TRITONSERVER_Metric*>& buckets,
+      TRITONSERVER_Metric* sum, TRITONSERVER_Metric* count,
+      std::vector<uint64_t>* flushed, uint64_t* sum_flushed);
+
+  const int core_count_;
+  const uint64_t interval_ms_;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> core_busy_ns_;
+  std::vector<uint64_t> core_busy_flushed_;
+  uint64_t last_flush_ns_;
+
+  TRITONSERVER_MetricFamily* run_bucket_family_;
+  TRITONSERVER_MetricFamily* run_sum_family_;
+  TRITONSERVER_MetricFamily* run_count_family_;
+  TRITONSERVER_MetricFamily* batch_bucket_family_;
+  TRITONSERVER_MetricFamily* batch_sum_family_;
+  TRITONSERVER_MetricFamily* batch_count_family_;
+  TRITONSERVER_MetricFamily* input_conversion_family_;
+  TRITONSERVER_MetricFamily* output_copy_family_;
+  TRITONSERVER_MetricFamily* pool_used_family_;
+  TRITONSERVER_MetricFamily* pool_capacity_family_;
+  TRITONSERVER_MetricFamily* reload_bucket_family_;
+  TRITONSERVER_MetricFamily* reload_sum_family_;
+  TRITONSERVER_MetricFamily* reload_count_family_;
+  TRITONSERVER_MetricFamily* evictions_family_;
+  TRITONSERVER_MetricFamily* core_busy_family_;
+  std::vector<TRITONSERVER_Metric*> core_busy_;
+
+  // Protects 'models_' and the flushed values, never taken by the
+  // execution path.
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool exiting_;
+  std::map<std::pair<std::string, int64_t>, ModelEntry> models_;
+  std::thread flush_thread_;
+};
+
+}}}  // namespace triton::backend::rockchip
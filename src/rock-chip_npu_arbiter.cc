@@ -0,0 +1,208 @@
+#include "rock-chip_npu_arbiter.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+uint64_t
+NowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+NpuArbiter::NpuArbiter(const int core_count)
+    : core_count_(std::max(1, core_count)), next_seq_(0), vclock_(0),
+      window_start_ns_(NowNs())
+{
+  cores_.resize(core_count_);
+}
+
+void
+NpuArbiter::RegisterModel(
+    const std::string& model_name, const uint32_t weight,
+    const int32_t priority)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  ModelEntry* model = FindOrAddModel(model_name);
+  model->weight_ = std::max((uint32_t)1, weight);
+  model->priority_ = priority;
+  model->registrations_++;
+}
+
+void
+NpuArbiter::UnregisterModel(const std::string& model_name)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = models_.find(model_name);
+  if (it == models_.end()) {
+    return;
+  }
+  if (it->second.registrations_ > 0) {
+    it->second.registrations_--;
+  }
+  // Tickets hold raw pointers to the entry, keep it while in use.
+  if ((it->second.registrations_ == 0) && (it->second.active_ == 0)) {
+    models_.erase(it);
+  }
+}
+
+int
+NpuArbiter::Acquire(
+    const std::string& model_name, const uint32_t core_mask,
+    const int preferred_core)
+{
+  std::unique_lock<std::mutex> lk(mu_);
+  ModelEntry* model = FindOrAddModel(model_name);
+  if (model->active_ == 0) {
+    model->vtime_ = std::max(model->vtime_, vclock_);
+  }
+  model->active_++;
+
+  // Fast path, nobody is queued and a core is free.
+  if (waiting_.empty()) {
+    const int core = FreeCore(core_mask, preferred_core);
+    if (core >= 0) {
+      Grant(model, core);
+      return core;
+    }
+  }
+
+  Ticket ticket;
+  ticket.model_ = model;
+  ticket.core_mask_ = core_mask;
+  ticket.preferred_core_ = preferred_core;
+  ticket.seq_ = next_seq_++;
+  waiting_.push_back(&ticket);
+  Dispatch();
+  ticket.cv_.wait(lk, [&ticket] { return ticket.core_ >= 0; });
+  return ticket.core_;
+}
+
+void
+NpuArbiter::Release(
+    const std::string& model_name, const int core, const uint64_t busy_ns)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  if ((core >= 0) && (core < core_count_)) {
+    CoreEntry& entry = cores_[core];
+    entry.busy_ = false;
+    entry.busy_ns_ += busy_ns;
+    entry.window_busy_ns_ += busy_ns;
+  }
+
+  ModelEntry* model = FindOrAddModel(model_name);
+  model->vtime_ += busy_ns / model->weight_;
+  if (model->active_ > 0) {
+    model->active_--;
+  }
+
+  Dispatch();
+}
+
+void
+NpuArbiter::CoreUtilization(std::vector<double>* utilization)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  const uint64_t now_ns = NowNs();
+  const uint64_t window_ns = std::max((uint64_t)1, now_ns - window_start_ns_);
+  utilization->clear();
+  for (auto& core : cores_) {
+    utilization->push_back(
+        std::min(1.0, (double)core.window_busy_ns_ / (double)window_ns));
+    core.window_busy_ns_ = 0;
+  }
+  window_start_ns_ = now_ns;
+}
+
+void
+NpuArbiter::CoreRunCount(std::vector<uint64_t>* run_count)
+{
+  std::lock_guard<std::mutex> lk(mu_);
+  run_count->clear();
+  for (const auto& core : cores_) {
+    run_count->push_back(core.runs_);
+  }
+}
+
+NpuArbiter::ModelEntry*
+NpuArbiter::FindOrAddModel(const std::string& model_name)
+{
+  return &models_[model_name];
+}
+
+int
+NpuArbiter::FreeCore(const uint32_t core_mask, const int preferred_core) const
+{
+  const uint32_t mask = (core_mask == 0) ? ~0u : core_mask;
+  if ((preferred_core >= 0) && (preferred_core < core_count_) &&
+      ((mask >> preferred_core) & 1) && !cores_[preferred_core].busy_) {
+    return preferred_core;
+  }
+  for (int core = 0; core < core_count_; ++core) {
+    if (((mask >> core) & 1) && !cores_[core].busy_) {
+      return core;
+    }
+  }
+  return -1;
+}
+
+void
+NpuArbiter::Grant(ModelEntry* model, const int core)
+{
+  CoreEntry& entry = cores_[core];
+  entry.busy_ = true;
+  entry.runs_++;
+  vclock_ = std::max(vclock_, model->vtime_);
+}
+
+void
+NpuArbiter::Dispatch()
+{
+  while (!waiting_.empty()) {
+    // Pick the best ticket that can run on a currently free core.
+    auto best = waiting_.end();
+    int best_core = -1;
+    for (auto it = waiting_.begin(); it != waiting_.end(); ++it) {
+      const int core = FreeCore((*it)->core_mask_, (*it)->preferred_core_);
+      if (core < 0) {
+        continue;
+      }
+      if (best != waiting_.end()) {
+        const ModelEntry* a = (*it)->model_;
+        const ModelEntry* b = (*best)->model_;
+        if (a->priority_ != b->priority_) {
+          if (a->priority_ < b->priority_) {
+            continue;
+          }
+        } else if (a->vtime_ != b->vtime_) {
+          if (a->vtime_ > b->vtime_) {
+            continue;
+          }
+        } else if ((*it)->seq_ > (*best)->seq_) {
+          continue;
+        }
+      }
+      best = it;
+      best_core = core;
+    }
+
+    if (best == waiting_.end()) {
+      return;
+    }
+
+    Ticket* ticket = *best;
+    waiting_.erase(best);
+    Grant(ticket->model_, best_core);
+    ticket->core_ = best_core;
+    ticket->cv_.notify_one();
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// NpuArbiter
+//
+// Backend-wide scheduler for the NPU cores. One arbiter is owned by
+// the backend state and shared by every rockchip model (and every
+// instance of those models) loaded in the process. An instance asks
+// for a core right before rknn_run and gives it back as soon as the
+// run returns, so the arbiter always knows which cores are busy and
+// who is waiting for them.
+//
+// When more instances are waiting than there are free cores the
+// arbiter picks the next one by:
+//   1. highest model priority ("npu_priority" parameter),
+//   2. lowest weighted virtual time, i.e. NPU time already consumed
+//      divided by the model weight ("npu_weight" parameter),
+//   3. arrival order.
+// This is start-time fair queuing: a detector with weight 1 cannot
+// starve a classifier with weight 1 on the same board, and a model
+// with weight 2 gets roughly twice the NPU time of a weight 1 model
+// while both are backlogged.
+//
+class NpuArbiter {
+ public:
+  explicit NpuArbiter(const int core_count);
+  ~NpuArbiter() = default;
+
+  int CoreCount() const { return core_count_; }
+
+  // Register a model with the arbiter. A model that is not registered
+  // is scheduled with weight 1 and priority 0. The versions of a model
+  // loaded at once, e.g. while a new version is swapped in, share its
+  // entry: each registers and unregisters it, the latest registration
+  // sets the weight and priority, and the entry goes away with the
+  // last version.
+  void RegisterModel(
+      const std::string& model_name, const uint32_t weight,
+      const int32_t priority);
+  void UnregisterModel(const std::string& model_name);
+
+  // Block until a core in 'core_mask' (bit i set means core i is
+  // allowed, 0 means any core) is free and this model is the next one
+  // to be served. Returns the index of the granted core. 'preferred_core'
+  // is used when it is free, which avoids re-programming the core mask
+  // of the caller's rknn context.
+  int Acquire(
+      const std::string& model_name, const uint32_t core_mask,
+      const int preferred_core);
+
+  // Return a core granted by Acquire. 'busy_ns' is the NPU time used by
+  // the run, it is charged to the model and to the core.
+  void Release(
+      const std::string& model_name, const int core, const uint64_t busy_ns);
+
+  // Fraction of wall time each core has been busy since the previous
+  // call to this function (or since the arbiter was created).
+  void CoreUtilization(std::vector<double>* utilization);
+
+  // Total number of runs granted on each core.
+  void CoreRunCount(std::vector<uint64_t>* run_count);
+
+ private:
+  struct ModelEntry {
+    ModelEntry()
+        : weight_(1), priority_(0), vtime_(0), active_(0), registrations_(0)
+    {
+    }
+    uint32_t weight_;
+    int32_t priority_;
+    // Weighted NPU time consumed, in ns / weight.
+    uint64_t vtime_;
+    // Number of runs of this model waiting for or holding a core.
+    uint32_t active_;
+    // Number of loaded versions of this model.
+    uint32_t registrations_;
+  };
+
+  struct Ticket {
+    Ticket()
+        : model_(nullptr), core_mask_(0), preferred_core_(-1), seq_(0),
+          core_(-1)
+    {
+    }
+    ModelEntry* model_;
+    uint32_t core_mask_;
+    int preferred_core_;
+    uint64_t seq_;
+    // Granted core, -1 while waiting.
+    int core_;
+    std::condition_variable cv_;
+  };
+
+  struct CoreEntry {
+    CoreEntry() : busy_(false), busy_ns_(0), window_busy_ns_(0), runs_(0) {}
+    bool busy_;
+    uint64_t busy_ns_;
+    uint64_t window_busy_ns_;
+    uint64_t runs_;
+  };
+
+  // Must be called with 'mu_' held.
+  ModelEntry* FindOrAddModel(const std::string& model_name);
+  int FreeCore(const uint32_t core_mask, const int preferred_core) const;
+  void Grant(ModelEntry* model, const int core);
+  void Dispatch();
+
+  const int core_count_;
+  std::mutex mu_;
+  std::map<std::string, ModelEntry> models_;
+  std::vector<CoreEntry> cores_;
+  std::deque<Ticket*> waiting_;
+  uint64_t next_seq_;
+  // Virtual time of the most recently granted run. A model that was
+  // idle starts from here so it cannot cash in its idle period.
+  uint64_t vclock_;
+  uint64_t window_start_ns_;
+};
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,244 @@
+#include "rock-chip_profiler.h"
+
+#include <cstdlib>
+#include <sstream>
+
+#include "triton/backend/backend_common.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+bool
+IsInteger(const std::string& token)
+{
+  if (token.empty()) {
+    return false;
+  }
+  for (const char c : token) {
+    if ((c < '0') || (c > '9')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+SplitWhitespace(const std::string& line, std::vector<std::string>* tokens)
+{
+  tokens->clear();
+  std::istringstream iss(line);
+  std::string token;
+  while (iss >> token) {
+    tokens->push_back(token);
+  }
+}
+
+int
+ColumnIndex(const std::vector<std::string>& header, const std::string& prefix)
+{
+  for (size_t i = 0; i < header.size(); ++i) {
+    if (header[i].compare(0, prefix.size(), prefix) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+std::string
+CsvEscape(const std::string& value)
+{
+  if (value.find_first_of(",\"\n") == std::string::npos) {
+    return value;
+  }
+  std::string escaped("\"");
+  for (const char c : value) {
+    if (c == '"') {
+      escaped += '"';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+}  // namespace
+
+void
+ParsePerfDetail(const char* perf_data, std::vector<LayerPerf>* layers)
+{
+  layers->clear();
+  if (perf_data == nullptr) {
+    return;
+  }
+
+  std::istringstream iss(perf_data);
+  std::string line;
+  std::vector<std::string> header;
+  std::vector<std::string> tokens;
+  int op_type_idx = -1, data_type_idx = -1, target_idx = -1, time_idx = -1,
+      workload_idx = -1;
+  while (std::getline(iss, line)) {
+    SplitWhitespace(line, &tokens);
+    if (tokens.empty()) {
+      continue;
+    }
+    if (tokens[0] == "ID") {
+      header = tokens;
+      op_type_idx = ColumnIndex(header, "OpType");
+      data_type_idx = ColumnIndex(header, "DataType");
+      target_idx = ColumnIndex(header, "Target");
+      time_idx = ColumnIndex(header, "Time(us)");
+      workload_idx = ColumnIndex(header, "WorkLoad");
+      continue;
+    }
+    if (header.empty() || !IsInteger(tokens[0])) {
+      continue;
+    }
+
+    // Rows may be missing trailing columns, only trust a column if the
+    // row is long enough to contain it.
+    auto column = [&tokens](const int idx) -> std::string {
+      return ((idx >= 0) && ((size_t)idx < tokens.size())) ? tokens[idx] : "";
+    };
+    LayerPerf layer;
+    layer.id_ = std::strtoll(tokens[0].c_str(), nullptr, 10);
+    layer.op_type_ = column(op_type_idx);
+    layer.data_type_ = column(data_type_idx);
+    layer.target_ = column(target_idx);
+    layer.time_us_ = std::strtoull(column(time_idx).c_str(), nullptr, 10);
+    layer.workload_ = column(workload_idx);
+    if (tokens.size() >= header.size()) {
+      layer.full_name_ = tokens.back();
+    }
+    layers->push_back(layer);
+  }
+}
+
+LayerProfiler::LayerProfiler(
+    const std::string& model_name, const std::string& path,
+    const Format format, const uint64_t interval)
+    : model_name_(model_name), path_(path), format_(format),
+      interval_(std::max((uint64_t)1, interval)), inference_count_(0),
+      sample_count_(0)
+{
+}
+
+TRITONSERVER_Error*
+LayerProfiler::Create(
+    const std::string& model_name, const std::string& path,
+    const Format format, const uint64_t interval,
+    std::unique_ptr<LayerProfiler>* profiler)
+{
+  std::unique_ptr<LayerProfiler> local(
+      new LayerProfiler(model_name, path, format, interval));
+  local->file_.open(path, std::ios::out | std::ios::app);
+  RETURN_ERROR_IF_FALSE(
+      local->file_.is_open(), TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("unable to open perf profile file '") + path + "'");
+  if ((format == Format::CSV) && (local->file_.tellp() == 0)) {
+    local->file_ << "model,instance,sample,inference,core,run_duration_us,"
+                    "layer_id,op_type,data_type,target,time_us,workload,"
+                    "full_name\n";
+  }
+  *profiler = std::move(local);
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+LayerProfiler::Sample(
+    rknn_context ctx, const std::string& instance_name, const int core)
+{
+  const uint64_t inference = inference_count_.load();
+
+  rknn_perf_run perf_run;
+  memset(&perf_run, 0, sizeof(perf_run));
+  int ret = rknn_query(ctx, RKNN_QUERY_PERF_RUN, &perf_run, sizeof(perf_run));
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_query RKNN_QUERY_PERF_RUN, ret=") +
+          std::to_string(ret));
+
+  rknn_perf_detail perf_detail;
+  memset(&perf_detail, 0, sizeof(perf_detail));
+  ret = rknn_query(
+      ctx, RKNN_QUERY_PERF_DETAIL, &perf_detail, sizeof(perf_detail));
+  RETURN_ERROR_IF_TRUE(
+      ret < 0, TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to rknn_query RKNN_QUERY_PERF_DETAIL, ret=") +
+          std::to_string(ret));
+
+  std::vector<LayerPerf> layers;
+  ParsePerfDetail(perf_detail.perf_data, &layers);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  if (format_ == Format::JSON) {
+    RETURN_IF_ERROR(WriteJson(
+        instance_name, core, inference, perf_run.run_duration, layers));
+  } else {
+    WriteCsv(instance_name, core, inference, perf_run.run_duration, layers);
+  }
+  file_.flush();
+  sample_count_++;
+  RETURN_ERROR_IF_FALSE(
+      file_.good(), TRITONSERVER_ERROR_INTERNAL,
+      std::string("fail to write perf profile file '") + path_ + "'");
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+LayerProfiler::WriteJson(
+    const std::string& instance_name, const int core, const uint64_t inference,
+    const int64_t run_duration_us, const std::vector<LayerPerf>& layers)
+{
+  common::TritonJson::Value sample(common::TritonJson::ValueType::OBJECT);
+  RETURN_IF_ERROR(sample.AddString("model", model_name_));
+  RETURN_IF_ERROR(sample.AddString("instance", instance_name));
+  RETURN_IF_ERROR(sample.AddUInt("sample", sample_count_));
+  RETURN_IF_ERROR(sample.AddUInt("inference", inference));
+  RETURN_IF_ERROR(sample.AddInt("core", core));
+  RETURN_IF_ERROR(sample.AddInt("run_duration_us", run_duration_us));
+
+  common::TritonJson::Value json_layers(
+      sample, common::TritonJson::ValueType::ARRAY);
+  for (const auto& layer : layers) {
+    common::TritonJson::Value json_layer(
+        sample, common::TritonJson::ValueType::OBJECT);
+    RETURN_IF_ERROR(json_layer.AddInt("id", layer.id_));
+    RETURN_IF_ERROR(json_layer.AddString("op_type", layer.op_type_));
+    RETURN_IF_ERROR(json_layer.AddString("data_type", layer.data_type_));
+    RETURN_IF_ERROR(json_layer.AddString("target", layer.target_));
+    RETURN_IF_ERROR(json_layer.AddUInt("time_us", layer.time_us_));
+    RETURN_IF_ERROR(json_layer.AddString("workload", layer.workload_));
+    RETURN_IF_ERROR(json_layer.AddString("full_name", layer.full_name_));
+    RETURN_IF_ERROR(json_layers.Append(std::move(json_layer)));
+  }
+  RETURN_IF_ERROR(sample.Add("layers", std::move(json_layers)));
+
+  common::TritonJson::WriteBuffer buffer;
+  RETURN_IF_ERROR(sample.Write(&buffer));
+  file_ << buffer.Contents() << "\n";
+
+  return nullptr;  // success
+}
+
+void
+LayerProfiler::WriteCsv(
+    const std::string& instance_name, const int core, const uint64_t inference,
+    const int64_t run_duration_us, const std::vector<LayerPerf>& layers)
+{
+  const std::string prefix = CsvEscape(model_name_) + "," +
+                             CsvEscape(instance_name) + "," +
+                             std::to_string(sample_count_) + "," +
+                             std::to_string(inference) + "," +
+                             std::to_string(core) + "," +
+                             std::to_string(run_duration_us) + ",";
+  for (const auto& layer : layers) {
+    file_ << prefix << layer.id_ << "," << CsvEscape(layer.op_type_) << ","
+          << CsvEscape(layer.data_type_) << "," << CsvEscape(layer.target_)
+          << "," << layer.time_us_ << "," << CsvEscape(layer.workload_) << ","
+          << CsvEscape(layer.full_name_) << "\n";
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rknn_api.h"
+#include "triton/core/tritonserver.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// One row of the RKNN_QUERY_PERF_DETAIL layer table.
+struct LayerPerf {
+  LayerPerf() : id_(0), time_us_(0) {}
+  int64_t id_;
+  std::string op_type_;
+  std::string data_type_;
+  std::string target_;
+  uint64_t time_us_;
+  // Per core share of the layer, e.g. "100.0%/0.0%/0.0%", when the
+  // runtime reports it.
+  std::string workload_;
+  std::string full_name_;
+};
+
+// Parse the text table returned by RKNN_QUERY_PERF_DETAIL. The column
+// layout differs between runtime versions so the columns are located
+// by their header names.
+void ParsePerfDetail(const char* perf_data, std::vector<LayerPerf>* layers);
+
+//
+// LayerProfiler
+//
+// Per-layer NPU profiling enabled by the "perf_profile_path" model
+// parameter. The rknn contexts of the model are initialized with
+// RKNN_FLAG_COLLECT_PERF_MASK and every 'interval' inferences one
+// instance queries RKNN_QUERY_PERF_DETAIL and RKNN_QUERY_PERF_RUN and
+// appends the layer table to the profile file, either as one JSON
+// object per line or as CSV rows. The profiler is shared by all the
+// instances of a model.
+//
+class LayerProfiler {
+ public:
+  enum class Format { JSON, CSV };
+
+  static TRITONSERVER_Error* Create(
+      const std::string& model_name, const std::string& path,
+      const Format format, const uint64_t interval,
+      std::unique_ptr<LayerProfiler>* profiler);
+
+  // Count one inference, returns true if this one must be sampled.
+  bool ShouldSample()
+  {
+    return (inference_count_.fetch_add(1) % interval_) == 0;
+  }
+
+  // Query the perf data of the last rknn_run on 'ctx' and append it to
+  // the profile file.
+  TRITONSERVER_Error* Sample(
+      rknn_context ctx, const std::string& instance_name, const int core);
+
+  const std::string& Path() const { return path_; }
+
+ private:
+  LayerProfiler(
+      const std::string& model_name, const std::string& path,
+      const Format format, const uint64_t interval);
+
+  TRITONSERVER_Error* WriteJson(
+      const std::string& instance_name, const int core,
+      const uint64_t inference, const int64_t run_duration_us,
+      const std::vector<LayerPerf>& layers);
+  void WriteCsv(
+      const std::string& instance_name, const int core,
+      const uint64_t inference, const int64_t run_duration_us,
+      const std::vector<LayerPerf>& layers);
+
+  const std::string model_name_;
+  const std::string path_;
+  const Format format_;
+  const uint64_t interval_;
+  std::atomic<uint64_t> inference_count_;
+
+  std::mutex mu_;
+  std::ofstream file_;
+  uint64_t sample_count_;
+};
+
+}}}  // namespace triton::backend::rockchip
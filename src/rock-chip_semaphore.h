@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// Semaphore
+//
+// Counting semaphore, as in the TensorRT backend. With eager batching
+// an instance takes its semaphore right before rknn_run and the
+// completion thread gives it back once the outputs of the batch are
+// in the responses, so the next batch is gathered and set as the NPU
+// input while the previous one is still being answered.
+//
+class Semaphore {
+ public:
+  explicit Semaphore(const int count) : count_(count) {}
+
+  void Release()
+  {
+    std::unique_lock<std::mutex> lck(mtx_);
+    count_++;
+    cv_.notify_one();
+  }
+
+  void Acquire()
+  {
+    std::unique_lock<std::mutex> lck(mtx_);
+    cv_.wait(lck, [this] { return count_ > 0; });
+    count_--;
+  }
+
+ private:
+  int count_;
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
+
+}}}  // namespace triton::backend::rockchip
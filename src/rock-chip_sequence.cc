@@ -0,0 +1,310 @@
+#include "rock-chip_sequence.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "triton/backend/backend_common.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+// First element of the input 'name' of 'request', as a double.
+TRITONSERVER_Error*
+ReadControlValue(
+    TRITONBACKEND_Request* request, const std::string& name, double* value)
+{
+  TRITONBACKEND_Input* input;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestInput(request, name.c_str(), &input));
+  TRITONSERVER_DataType datatype;
+  RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+      input, nullptr, &datatype, nullptr, nullptr, nullptr, nullptr));
+  const void* buffer;
+  uint64_t byte_size;
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  RETURN_IF_ERROR(TRITONBACKEND_InputBuffer(
+      input, 0, &buffer, &byte_size, &memory_type, &memory_type_id));
+  RETURN_ERROR_IF_TRUE(
+      byte_size < TRITONSERVER_DataTypeByteSize(datatype),
+      TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("sequence control input '") + name + "' is empty");
+  switch (datatype) {
+    case TRITONSERVER_TYPE_BOOL:
+    case TRITONSERVER_TYPE_UINT8:
+      *value = *(const uint8_t*)buffer;
+      break;
+    case TRITONSERVER_TYPE_INT8:
+      *value = *(const int8_t*)buffer;
+      break;
+    case TRITONSERVER_TYPE_INT32:
+      *value = *(const int32_t*)buffer;
+      break;
+    case TRITONSERVER_TYPE_UINT32:
+      *value = *(const uint32_t*)buffer;
+      break;
+    case TRITONSERVER_TYPE_INT64:
+      *value = *(const int64_t*)buffer;
+      break;
+    case TRITONSERVER_TYPE_UINT64:
+      *value = *(const uint64_t*)buffer;
+      break;
+    case TRITONSERVER_TYPE_FP32:
+      *value = *(const float*)buffer;
+      break;
+    default:
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_UNSUPPORTED,
+          (std::string("sequence control input '") + name + "' of type " +
+           TRITONSERVER_DataTypeString(datatype) + " is not supported")
+              .c_str());
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ReadControlFlag(
+    TRITONBACKEND_Request* request, const SequenceControlInput& control,
+    bool* flag)
+{
+  double value;
+  RETURN_IF_ERROR(ReadControlValue(request, control.name_, &value));
+  *flag = (value == control.true_value_);
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ReadCorrelationId(
+    TRITONBACKEND_Request* request, const std::string& name,
+    uint64_t* corrid)
+{
+  TRITONBACKEND_Input* input;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestInput(request, name.c_str(), &input));
+  TRITONSERVER_DataType datatype;
+  RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+      input, nullptr, &datatype, nullptr, nullptr, nullptr, nullptr));
+  const void* buffer;
+  uint64_t byte_size;
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  RETURN_IF_ERROR(TRITONBACKEND_InputBuffer(
+      input, 0, &buffer, &byte_size, &memory_type, &memory_type_id));
+  switch (datatype) {
+    case TRITONSERVER_TYPE_UINT64:
+    case TRITONSERVER_TYPE_INT64:
+      if (byte_size >= sizeof(uint64_t)) {
+        memcpy(corrid, buffer, sizeof(uint64_t));
+        return nullptr;  // success
+      }
+      break;
+    case TRITONSERVER_TYPE_UINT32:
+    case TRITONSERVER_TYPE_INT32:
+      if (byte_size >= sizeof(uint32_t)) {
+        uint32_t value;
+        memcpy(&value, buffer, sizeof(value));
+        *corrid = value;
+        return nullptr;  // success
+      }
+      break;
+    case TRITONSERVER_TYPE_BYTES: {
+      // A string ID, one BYTES element: its 4-byte length, then the
+      // bytes.
+      uint32_t length = 0;
+      if (byte_size >= sizeof(length)) {
+        memcpy(&length, buffer, sizeof(length));
+      }
+      if (byte_size >= sizeof(length) + length) {
+        *corrid = std::hash<std::string>()(
+            std::string((const char*)buffer + sizeof(length), length));
+        return nullptr;  // success
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return TRITONSERVER_ErrorNew(
+      TRITONSERVER_ERROR_INVALID_ARG,
+      (std::string("malformed correlation ID of type ") +
+       TRITONSERVER_DataTypeString(datatype) + " in '" + name + "'")
+          .c_str());
+}
+
+}  // namespace
+
+TRITONSERVER_Error*
+ReadSequenceFlags(
+    TRITONBACKEND_Request* request, const SequenceControls& controls,
+    SequenceFlags* flags)
+{
+  uint32_t request_flags = 0;
+  if (controls.start_.name_.empty() || controls.end_.name_.empty()) {
+    RETURN_IF_ERROR(TRITONBACKEND_RequestFlags(request, &request_flags));
+  }
+  if (controls.start_.name_.empty()) {
+    flags->start_ =
+        (request_flags & TRITONSERVER_REQUEST_FLAG_SEQUENCE_START) != 0;
+  } else {
+    RETURN_IF_ERROR(ReadControlFlag(request, controls.start_, &flags->start_));
+  }
+  if (controls.end_.name_.empty()) {
+    flags->end_ = (request_flags & TRITONSERVER_REQUEST_FLAG_SEQUENCE_END) != 0;
+  } else {
+    RETURN_IF_ERROR(ReadControlFlag(request, controls.end_, &flags->end_));
+  }
+  flags->ready_ = true;
+  if (!controls.ready_.name_.empty()) {
+    RETURN_IF_ERROR(ReadControlFlag(request, controls.ready_, &flags->ready_));
+  }
+  if (controls.corrid_.empty()) {
+    RETURN_IF_ERROR(
+        TRITONBACKEND_RequestCorrelationId(request, &flags->corrid_));
+  } else {
+    RETURN_IF_ERROR(
+        ReadCorrelationId(request, controls.corrid_, &flags->corrid_));
+  }
+  return nullptr;  // success
+}
+
+SequenceStates::SequenceStates(
+    rknn_context ctx, const std::string& instance_name,
+    const std::vector<Tensor>& tensors)
+    : ctx_(ctx), instance_name_(instance_name), tensors_(tensors)
+{
+}
+
+TRITONSERVER_Error*
+SequenceStates::Create(
+    rknn_context ctx, const std::string& instance_name,
+    const std::vector<Tensor>& tensors, const size_t slot_count,
+    std::unique_ptr<SequenceStates>* states)
+{
+  for (const auto& tensor : tensors) {
+    // The output buffer of a run is the input buffer of the next one.
+    RETURN_ERROR_IF_FALSE(
+        (tensor.input_attr_.type == tensor.output_attr_.type) &&
+            (tensor.input_attr_.fmt == tensor.output_attr_.fmt) &&
+            (tensor.input_attr_.n_elems == tensor.output_attr_.n_elems),
+        TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("state '") + tensor.input_name_ + "' and '" +
+            tensor.output_name_ +
+            "' have different native layouts on the NPU");
+  }
+  std::unique_ptr<SequenceStates> lstates(
+      new SequenceStates(ctx, instance_name, tensors));
+  lstates->slots_.resize(std::max<size_t>(slot_count, 1));
+  for (auto& slot : lstates->slots_) {
+    for (int b = 0; b < 2; ++b) {
+      for (const auto& tensor : tensors) {
+        const uint32_t size = std::max(
+            std::max(
+                tensor.input_attr_.size, tensor.input_attr_.size_with_stride),
+            std::max(
+                tensor.output_attr_.size,
+                tensor.output_attr_.size_with_stride));
+        rknn_tensor_mem* mem = rknn_create_mem(ctx, size);
+        RETURN_ERROR_IF_TRUE(
+            mem == nullptr, TRITONSERVER_ERROR_INTERNAL,
+            std::string("fail to rknn_create_mem state '") +
+                tensor.input_name_ + "'");
+        slot.mem_[b].push_back(mem);
+      }
+    }
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance ") + instance_name + " keeps " +
+       std::to_string(tensors.size()) + " state tensors of " +
+       std::to_string(lstates->slots_.size()) + " sequences on the NPU")
+          .c_str());
+  *states = std::move(lstates);
+  return nullptr;  // success
+}
+
+SequenceStates::~SequenceStates()
+{
+  for (auto& slot : slots_) {
+    for (int b = 0; b < 2; ++b) {
+      for (rknn_tensor_mem* mem : slot.mem_[b]) {
+        rknn_destroy_mem(ctx_, mem);
+      }
+    }
+  }
+}
+
+void
+SequenceStates::ZeroState(rknn_tensor_mem* mem, const rknn_tensor_attr& attr)
+{
+  // The zero of an 8-bit quantized state is its zero point.
+  int value = 0;
+  if ((attr.qnt_type == RKNN_TENSOR_QNT_AFFINE_ASYMMETRIC) &&
+      ((attr.type == RKNN_TENSOR_INT8) || (attr.type == RKNN_TENSOR_UINT8))) {
+    value = attr.zp;
+  }
+  memset(mem->virt_addr, value, mem->size);
+}
+
+TRITONSERVER_Error*
+SequenceStates::Bind(const SequenceFlags& flags, size_t* slot)
+{
+  RETURN_ERROR_IF_FALSE(
+      flags.ready_, TRITONSERVER_ERROR_INVALID_ARG,
+      std::string("request of sequence ") + std::to_string(flags.corrid_) +
+          " is not ready");
+  auto it = by_corrid_.find(flags.corrid_);
+  if (it == by_corrid_.end()) {
+    RETURN_ERROR_IF_FALSE(
+        flags.start_, TRITONSERVER_ERROR_INVALID_ARG,
+        std::string("sequence ") + std::to_string(flags.corrid_) +
+            " has no state on instance " + instance_name_ +
+            ", its first request must have the START flag");
+    size_t free_slot = 0;
+    while ((free_slot < slots_.size()) && slots_[free_slot].used_) {
+      free_slot++;
+    }
+    RETURN_ERROR_IF_TRUE(
+        free_slot == slots_.size(), TRITONSERVER_ERROR_UNAVAILABLE,
+        std::string("instance ") + instance_name_ + " holds the state of " +
+            std::to_string(slots_.size()) + " sequences already");
+    slots_[free_slot].used_ = true;
+    slots_[free_slot].corrid_ = flags.corrid_;
+    it = by_corrid_.emplace(flags.corrid_, free_slot).first;
+  }
+  Slot& s = slots_[it->second];
+  if (flags.start_) {
+    // A sequence restarting with the same ID starts over as well.
+    for (size_t t = 0; t < tensors_.size(); ++t) {
+      ZeroState(s.mem_[s.current_][t], tensors_[t].input_attr_);
+    }
+  }
+  for (size_t t = 0; t < tensors_.size(); ++t) {
+    rknn_tensor_attr input_attr = tensors_[t].input_attr_;
+    rknn_tensor_attr output_attr = tensors_[t].output_attr_;
+    int ret = rknn_set_io_mem(ctx_, s.mem_[s.current_][t], &input_attr);
+    if (ret >= 0) {
+      ret = rknn_set_io_mem(ctx_, s.mem_[1 - s.current_][t], &output_attr);
+    }
+    RETURN_ERROR_IF_TRUE(
+        ret < 0, TRITONSERVER_ERROR_INTERNAL,
+        std::string("fail to rknn_set_io_mem state '") +
+            tensors_[t].input_name_ + "', ret=" + std::to_string(ret));
+  }
+  *slot = it->second;
+  return nullptr;  // success
+}
+
+void
+SequenceStates::Commit(const size_t slot, const bool ran, const bool end)
+{
+  Slot& s = slots_[slot];
+  if (ran) {
+    s.current_ = 1 - s.current_;
+  }
+  if (end) {
+    by_corrid_.erase(s.corrid_);
+    s.used_ = false;
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
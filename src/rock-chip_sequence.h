@@ -0,0 +1,117 @@
+#pragma once
+
+#include <rknn_api.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "triton/core/tritonbackend.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+// A sequence control input of "sequence_batching", empty 'name_' if
+// the model configuration does not declare it.
+struct SequenceControlInput {
+  SequenceControlInput() : true_value_(1) {}
+
+  std::string name_;
+  // The value of the *_false_true pair that means true.
+  double true_value_;
+};
+
+// The control inputs Triton adds to the requests of a sequence. The
+// request flags and correlation ID stand in for the ones the model
+// configuration does not declare.
+struct SequenceControls {
+  SequenceControlInput start_;
+  SequenceControlInput end_;
+  SequenceControlInput ready_;
+  std::string corrid_;
+};
+
+// Where a request is in its sequence.
+struct SequenceFlags {
+  SequenceFlags() : start_(false), end_(false), ready_(true), corrid_(0) {}
+
+  bool start_;
+  bool end_;
+  bool ready_;
+  uint64_t corrid_;
+};
+
+// Read the sequence control inputs 'controls' of 'request'. A string
+// correlation ID is hashed.
+TRITONSERVER_Error* ReadSequenceFlags(
+    TRITONBACKEND_Request* request, const SequenceControls& controls,
+    SequenceFlags* flags);
+
+//
+// SequenceStates
+//
+// Implicit state of the sequences running on an instance, for
+// recurrent models whose hidden state is an extra NPU input and output
+// pair. The state never leaves the NPU memory of the context: each
+// state is kept in two buffers of a slot per sequence, one bound as
+// the input of the run and the other as its output with
+// rknn_set_io_mem, and the two swap roles once the run succeeds.
+// A failed run leaves the state of the sequence as it was. Both
+// tensors are bound in their native layout so the NPU reads back
+// exactly what it wrote.
+//
+class SequenceStates {
+ public:
+  // An input/output pair of the "state" of "sequence_batching".
+  struct Tensor {
+    std::string input_name_;
+    std::string output_name_;
+    // Native attrs the buffers are bound with.
+    rknn_tensor_attr input_attr_;
+    rknn_tensor_attr output_attr_;
+  };
+
+  // Preallocate 'slot_count' slots of 'tensors' for the context 'ctx'.
+  static TRITONSERVER_Error* Create(
+      rknn_context ctx, const std::string& instance_name,
+      const std::vector<Tensor>& tensors, const size_t slot_count,
+      std::unique_ptr<SequenceStates>* states);
+  ~SequenceStates();
+
+  // Bind the state of the sequence of 'flags' for the next run, a new
+  // sequence takes a free slot and starts from a zero state. Set
+  // 'slot' for Commit.
+  TRITONSERVER_Error* Bind(const SequenceFlags& flags, size_t* slot);
+  // Keep the state written by the run if 'ran', and free the slot at
+  // the end of the sequence.
+  void Commit(const size_t slot, const bool ran, const bool end);
+
+  // Number of sequences holding a slot.
+  size_t ActiveCount() const { return by_corrid_.size(); }
+
+ private:
+  struct Slot {
+    Slot() : used_(false), corrid_(0), current_(0) {}
+    bool used_;
+    uint64_t corrid_;
+    // Index in 'mem_' of the buffers holding the state.
+    int current_;
+    // Per tensor, the two buffers of its state.
+    std::vector<rknn_tensor_mem*> mem_[2];
+  };
+
+  SequenceStates(
+      rknn_context ctx, const std::string& instance_name,
+      const std::vector<Tensor>& tensors);
+  // Set 'mem' to the zero of the state of 'attr'.
+  static void ZeroState(rknn_tensor_mem* mem, const rknn_tensor_attr& attr);
+
+  rknn_context ctx_;
+  const std::string instance_name_;
+  const std::vector<Tensor> tensors_;
+  std::vector<Slot> slots_;
+  std::map<uint64_t, size_t> by_corrid_;
+};
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,155 @@
+#include "rock-chip_sparse.h"
+
+#include <cstring>
+
+#if !defined(ROCKCHIP_NO_NEON) &&                                   \
+    ((defined(__aarch64__) &&                                       \
+      (defined(__ARM_NEON) || defined(__ARM_NEON__))) ||            \
+     defined(ROCKCHIP_NEON_EMULATION))
+#include <arm_neon.h>
+#define ROCKCHIP_SPARSE_NEON 1
+#endif
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+#ifdef ROCKCHIP_SPARSE_NEON
+// Mask of the 16 values at 'p' that are at least 'first'.
+inline uint8x16_t
+AtLeast(const int8_t* p, const int8_t first)
+{
+  return vcgeq_s8(vld1q_s8(p), vdupq_n_s8(first));
+}
+
+inline uint8x16_t
+AtLeast(const uint8_t* p, const uint8_t first)
+{
+  return vcgeq_u8(vld1q_u8(p), vdupq_n_u8(first));
+}
+#endif  // ROCKCHIP_SPARSE_NEON
+
+// Append the positions of the 'count' values of 'p', 'stride' apart,
+// that are at least 'first'. Background runs are skipped 16 values at
+// a time when the values are contiguous.
+template <typename Q>
+void
+ScanObjectness(
+    const Q* p, const size_t count, const size_t stride, const Q first,
+    std::vector<uint32_t>* hits)
+{
+  size_t i = 0;
+#ifdef ROCKCHIP_SPARSE_NEON
+  if (stride == 1) {
+    for (; i + 16 <= count; i += 16) {
+      if (vmaxvq_u8(AtLeast(p + i, first)) == 0) {
+        continue;
+      }
+      for (size_t k = i; k < i + 16; ++k) {
+        if (p[k] >= first) {
+          hits->push_back(k);
+        }
+      }
+    }
+  }
+#endif  // ROCKCHIP_SPARSE_NEON
+  for (; i < count; ++i) {
+    if (p[i * stride] >= first) {
+      hits->push_back(i);
+    }
+  }
+}
+
+template <typename Q>
+size_t
+FindCells(
+    const SparseHead& head, const Q* data, const Q first,
+    std::vector<int32_t>* cells)
+{
+  const size_t plane = (size_t)head.height_ * head.width_;
+  const size_t start = cells->size();
+  std::vector<uint32_t> hits;
+  for (uint32_t n = 0; n < head.batch_; ++n) {
+    const Q* batch = data + (size_t)n * head.channels_ * plane;
+    for (uint32_t a = 0; a < head.Anchors(); ++a) {
+      const uint32_t c = a * head.group_ + head.objectness_;
+      hits.clear();
+      if (head.nhwc_) {
+        ScanObjectness<Q>(batch + c, plane, head.channels_, first, &hits);
+      } else {
+        ScanObjectness<Q>(batch + c * plane, plane, 1, first, &hits);
+      }
+      for (const uint32_t hit : hits) {
+        cells->push_back(n);
+        cells->push_back(a);
+        cells->push_back(hit / head.width_);
+        cells->push_back(hit % head.width_);
+      }
+    }
+  }
+  return (cells->size() - start) / 4;
+}
+
+}  // namespace
+
+int32_t
+FirstPassingValue(
+    const float threshold, const int32_t zp, const float scale,
+    const OutputActivation activation, const bool is_signed)
+{
+  // The values grow with q for a positive scale, 256 candidates are
+  // cheaper than inverting the activation and exact.
+  const int32_t lowest = is_signed ? -128 : 0;
+  const int32_t highest = is_signed ? 127 : 255;
+  for (int32_t q = lowest; q <= highest; ++q) {
+    if (DequantizeOne(q, zp, scale, activation) > threshold) {
+      return q;
+    }
+  }
+  return highest + 1;
+}
+
+size_t
+FindSparseCells(
+    const SparseHead& head, const void* data, const int32_t first_passing,
+    std::vector<int32_t>* cells)
+{
+  if (head.signed_) {
+    if (first_passing > 127) {
+      return 0;
+    }
+    return FindCells<int8_t>(
+        head, (const int8_t*)data, (int8_t)first_passing, cells);
+  }
+  if (first_passing > 255) {
+    return 0;
+  }
+  return FindCells<uint8_t>(
+      head, (const uint8_t*)data, (uint8_t)first_passing, cells);
+}
+
+void
+GatherSparseCells(
+    const SparseHead& head, const void* data,
+    const std::vector<int32_t>& cells, void* dst)
+{
+  const size_t plane = (size_t)head.height_ * head.width_;
+  const uint8_t* src = (const uint8_t*)data;
+  uint8_t* d = (uint8_t*)dst;
+  for (size_t i = 0; i + 4 <= cells.size(); i += 4) {
+    const size_t n = cells[i];
+    const size_t first_channel = (size_t)cells[i + 1] * head.group_;
+    const size_t pixel = (size_t)cells[i + 2] * head.width_ + cells[i + 3];
+    const uint8_t* batch = src + n * head.channels_ * plane;
+    if (head.nhwc_) {
+      memcpy(d, batch + pixel * head.channels_ + first_channel, head.group_);
+    } else {
+      for (uint32_t g = 0; g < head.group_; ++g) {
+        d[g] = batch[(first_channel + g) * plane + pixel];
+      }
+    }
+    d += head.group_;
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
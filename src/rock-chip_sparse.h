@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rock-chip_dequant.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// SparseHead
+//
+// A detection head of 8-bit quantized cells, [N, C, H, W] or
+// [N, H, W, C], whose C channels are 'group_' channels per anchor with
+// the objectness at 'objectness_' in each group. Almost every cell is
+// background, so instead of the dense tensor the backend can return
+// the cells whose objectness passes a threshold: their coordinates
+// (n, anchor, y, x) and the 'group_' values of each. The head is
+// scanned in the quantized domain, 16 cells at a time with NEON on
+// aarch64.
+//
+struct SparseHead {
+  SparseHead()
+      : batch_(0), channels_(0), height_(0), width_(0), nhwc_(false),
+        signed_(true), group_(0), objectness_(0)
+  {
+  }
+
+  uint32_t batch_;
+  uint32_t channels_;
+  uint32_t height_;
+  uint32_t width_;
+  bool nhwc_;
+  // INT8 elements if 'signed_', else UINT8.
+  bool signed_;
+  uint32_t group_;
+  uint32_t objectness_;
+
+  uint32_t Anchors() const { return (group_ == 0) ? 0 : channels_ / group_; }
+};
+
+// Smallest quantized value whose value as DequantizeOne computes it is
+// above 'threshold', 128 (INT8) or 256 (UINT8) if there is none.
+int32_t FirstPassingValue(
+    const float threshold, const int32_t zp, const float scale,
+    const OutputActivation activation, const bool is_signed);
+
+// Append the coordinates (n, anchor, y, x) of the cells of 'data' whose
+// objectness is at least 'first_passing' to 'cells'. Returns the number
+// of cells found.
+size_t FindSparseCells(
+    const SparseHead& head, const void* data, const int32_t first_passing,
+    std::vector<int32_t>* cells);
+
+// Copy the 'group_' values of each cell of 'cells' into 'dst', one row
+// per cell.
+void GatherSparseCells(
+    const SparseHead& head, const void* data,
+    const std::vector<int32_t>& cells, void* dst);
+
+}}}  // namespace triton::backend::rockchip
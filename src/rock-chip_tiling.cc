@@ -0,0 +1,70 @@
+#include "rock-chip_tiling.h"
+
+#include <algorithm>
+#include <string>
+
+namespace triton { namespace backend { namespace rockchip {
+
+namespace {
+
+// Start of each tile of 'tile' pixels along a dimension of 'size'.
+void
+TileAxis(
+    const uint32_t size, const uint32_t tile, const uint32_t overlap,
+    std::vector<uint32_t>* starts)
+{
+  starts->clear();
+  if (size <= tile) {
+    starts->push_back(0);
+    return;
+  }
+  // Fewest tiles whose overlap is at least 'overlap', the spare room is
+  // shared by all the overlaps.
+  const uint32_t step = tile - overlap;
+  const uint32_t count = (size - overlap + step - 1) / step;
+  for (uint32_t i = 0; i < count; ++i) {
+    starts->push_back(
+        (uint32_t)(((uint64_t)(size - tile) * i) / (count - 1)));
+  }
+}
+
+}  // namespace
+
+bool
+ParseTileMerge(const std::string& str, TileMerge* merge)
+{
+  if (str == "nms") {
+    *merge = TileMerge::NMS;
+  } else if (str == "class_nms") {
+    *merge = TileMerge::CLASS_NMS;
+  } else if (str == "none") {
+    *merge = TileMerge::NONE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void
+TileFrame(
+    const uint32_t height, const uint32_t width, const uint32_t tile_height,
+    const uint32_t tile_width, const uint32_t overlap,
+    std::vector<Tile>* tiles)
+{
+  std::vector<uint32_t> ys, xs;
+  TileAxis(height, tile_height, overlap, &ys);
+  TileAxis(width, tile_width, overlap, &xs);
+  tiles->clear();
+  for (const uint32_t y : ys) {
+    for (const uint32_t x : xs) {
+      Tile tile;
+      tile.x_ = x;
+      tile.y_ = y;
+      tile.width_ = std::min(tile_width, width);
+      tile.height_ = std::min(tile_height, height);
+      tiles->push_back(tile);
+    }
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace triton { namespace backend { namespace rockchip {
+
+// Output of a tiled model: the merged detections of each frame, one row
+// of (n, x1, y1, x2, y2, score, class) each in frame pixels.
+static const char kTiledDetectionsOutput[] = "tiled_detections";
+
+// How the detections of overlapping tiles are merged.
+enum class TileMerge {
+  // Class-agnostic NMS across the tiles of a frame.
+  NMS,
+  // NMS across the tiles among the boxes of the same class.
+  CLASS_NMS,
+  // Each tile keeps its own boxes.
+  NONE
+};
+
+// Parse "nms", "class_nms" or "none".
+bool ParseTileMerge(const std::string& str, TileMerge* merge);
+
+// A region of a frame run through the model as one tile.
+struct Tile {
+  uint32_t x_;
+  uint32_t y_;
+  uint32_t width_;
+  uint32_t height_;
+};
+
+// Cover a 'height' x 'width' frame with tiles of 'tile_height' x
+// 'tile_width' that overlap by at least 'overlap' pixels. The tiles of
+// a row, or a column, are spread evenly from one border of the frame to
+// the other; a frame dimension smaller than the tile is a single tile
+// of that dimension.
+void TileFrame(
+    const uint32_t height, const uint32_t width, const uint32_t tile_height,
+    const uint32_t tile_width, const uint32_t overlap,
+    std::vector<Tile>* tiles);
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,84 @@
+#include "rock-chip_worker_pool.h"
+
+namespace triton { namespace backend { namespace rockchip {
+
+WorkerPool::WorkerPool(const size_t thread_count)
+    : exiting_(false), generation_(0), busy_(0), task_(nullptr), count_(0),
+      next_(0)
+{
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads_.emplace_back(&WorkerPool::WorkLoop, this);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void
+WorkerPool::Run(const size_t count, const std::function<void(size_t)>& task)
+{
+  std::lock_guard<std::mutex> run_lk(run_mu_);
+  if (threads_.empty() || (count <= 1)) {
+    for (size_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    task_ = &task;
+    count_ = count;
+    next_.store(1);
+    busy_ = threads_.size();
+    generation_++;
+  }
+  work_cv_.notify_all();
+  task(0);
+  RunPending();
+
+  std::unique_lock<std::mutex> lk(mu_);
+  done_cv_.wait(lk, [this] { return busy_ == 0; });
+  task_ = nullptr;
+  count_ = 0;
+}
+
+void
+WorkerPool::RunPending()
+{
+  for (size_t i = next_.fetch_add(1); i < count_; i = next_.fetch_add(1)) {
+    (*task_)(i);
+  }
+}
+
+void
+WorkerPool::WorkLoop()
+{
+  uint64_t joined = 0;
+  std::unique_lock<std::mutex> lk(mu_);
+  while (true) {
+    work_cv_.wait(
+        lk, [this, joined] { return exiting_ || (generation_ != joined); });
+    if (exiting_) {
+      return;
+    }
+    joined = generation_;
+    lk.unlock();
+    RunPending();
+    lk.lock();
+    if (--busy_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+}}}  // namespace triton::backend::rockchip
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace triton { namespace backend { namespace rockchip {
+
+//
+// WorkerPool
+//
+// Threads a model instance keeps for the work it splits on every
+// execution, such as the dequantization of large outputs, so that no
+// thread is created on the hot path. Run deals the tasks to the
+// workers and to the calling thread and returns once all are done.
+// Runs are serialized, the execute thread and the completion thread of
+// eager batching may share a pool. Independent of Triton so rk_stat
+// can time the work it runs.
+//
+class WorkerPool {
+ public:
+  explicit WorkerPool(const size_t thread_count);
+  ~WorkerPool();
+
+  size_t ThreadCount() const { return threads_.size(); }
+
+  // Call 'task' with every index of [0, 'count'): 0 on the calling
+  // thread, the others on whichever thread is free first, the calling
+  // one included once it is done with 0.
+  void Run(const size_t count, const std::function<void(size_t)>& task);
+
+ private:
+  void WorkLoop();
+  // Run the indices of the current task nobody has taken yet.
+  void RunPending();
+
+  std::vector<std::thread> threads_;
+
+  // Held for a whole Run.
+  std::mutex run_mu_;
+
+  // Protects the fields below, 'task_' and 'count_' are only written
+  // while the workers are idle.
+  std::mutex mu_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  bool exiting_;
+  // Bumped by every Run, a worker joins each generation once.
+  uint64_t generation_;
+  // Workers that have not finished the current generation.
+  size_t busy_;
+  const std::function<void(size_t)>* task_;
+  size_t count_;
+  std::atomic<size_t> next_;
+};
+
+}}}  // namespace triton::backend::rockchip
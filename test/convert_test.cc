@@ -0,0 +1,141 @@
+// Every input conversion kernel against the conversion of each element
+// moved to its place one at a time, for channel counts with and without
+// an interleaved store and widths that leave a partial vector.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "rock-chip_convert.h"
+#include "rock-chip_dequant.h"
+
+namespace rk = triton::backend::rockchip;
+
+namespace {
+
+// Random source elements of 'type', finite for the float types so the
+// conversions are defined.
+std::vector<uint8_t>
+RandomSource(
+    const rk::ElementType type, const size_t count, std::mt19937* rng)
+{
+  std::vector<uint8_t> data(count * rk::ElementSize(type));
+  std::uniform_real_distribution<double> real(-70000.0, 70000.0);
+  for (size_t i = 0; i < count; ++i) {
+    uint8_t* element = &data[i * rk::ElementSize(type)];
+    if (type == rk::ElementType::FP32) {
+      const float value = (float)real(*rng);
+      std::memcpy(element, &value, sizeof(value));
+    } else if (type == rk::ElementType::FP64) {
+      const double value = real(*rng);
+      std::memcpy(element, &value, sizeof(value));
+    } else {
+      for (size_t b = 0; b < rk::ElementSize(type); ++b) {
+        element[b] = (uint8_t)(*rng)();
+      }
+    }
+  }
+  return data;
+}
+
+// Element 'src' of 'from' as the RKNN type 'to'.
+void
+ConvertElement(
+    const rk::ElementType from, const rknn_tensor_type to, const void* src,
+    void* dst)
+{
+  if ((from == rk::ElementType::FP64) && (to == RKNN_TENSOR_FLOAT32)) {
+    double value;
+    std::memcpy(&value, src, sizeof(value));
+    const float result = (float)value;
+    std::memcpy(dst, &result, sizeof(result));
+  } else if ((from == rk::ElementType::BF16) && (to == RKNN_TENSOR_FLOAT32)) {
+    uint16_t bits;
+    std::memcpy(&bits, src, sizeof(bits));
+    const uint32_t result = (uint32_t)bits << 16;
+    std::memcpy(dst, &result, sizeof(result));
+  } else if (
+      (from == rk::ElementType::FP32) && (to == RKNN_TENSOR_FLOAT16)) {
+    float value;
+    std::memcpy(&value, src, sizeof(value));
+    const uint16_t result = rk::FloatToHalf(value);
+    std::memcpy(dst, &result, sizeof(result));
+  } else {
+    std::memcpy(dst, src, rk::ElementSize(from));
+  }
+}
+
+}  // namespace
+
+int
+main()
+{
+  std::mt19937 rng(5);
+  int failures = 0;
+  for (const rk::InputConversion& conversion : rk::InputConversions()) {
+    const size_t src_size = rk::ElementSize(conversion.src_);
+    const size_t dst_size = rk::RknnElementSize(conversion.dst_);
+    const bool to_nhwc = (conversion.layout_ == rk::InputLayout::NCHW_TO_NHWC);
+    for (const size_t channels : {1, 3, 4, 5}) {
+      for (const size_t width : {1, 7, 16, 33}) {
+        rk::ConvertShape shape;
+        shape.n_ = 2;
+        shape.c_ = channels;
+        shape.h_ = 3;
+        shape.w_ = width;
+        const std::vector<uint8_t> src =
+            RandomSource(conversion.src_, shape.Elements(), &rng);
+
+        std::vector<uint8_t> expected(shape.Elements() * dst_size);
+        for (size_t n = 0; n < shape.n_; ++n) {
+          for (size_t c = 0; c < shape.c_; ++c) {
+            for (size_t y = 0; y < shape.h_; ++y) {
+              for (size_t x = 0; x < shape.w_; ++x) {
+                const size_t s =
+                    ((n * shape.c_ + c) * shape.h_ + y) * shape.w_ + x;
+                const size_t d =
+                    to_nhwc ? ((n * shape.h_ + y) * shape.w_ + x) * shape.c_ +
+                                  c
+                            : s;
+                ConvertElement(
+                    conversion.src_, conversion.dst_, &src[s * src_size],
+                    &expected[d * dst_size]);
+              }
+            }
+          }
+        }
+
+        std::vector<uint8_t> dst(expected.size());
+        conversion.convert_(src.data(), dst.data(), shape);
+        if (dst != expected) {
+          std::fprintf(
+              stderr,
+              "mismatch: %s to RKNN type %d, %s, channels %zu, width %zu\n",
+              rk::ElementTypeName(conversion.src_), (int)conversion.dst_,
+              to_nhwc ? "NCHW to NHWC" : "same layout", channels, width);
+          failures++;
+        }
+      }
+    }
+
+    if (rk::FindInputConversion(
+            conversion.src_, conversion.dst_, conversion.layout_) !=
+        conversion.convert_) {
+      std::fprintf(
+          stderr, "FindInputConversion misses %s to RKNN type %d\n",
+          rk::ElementTypeName(conversion.src_), (int)conversion.dst_);
+      failures++;
+    }
+  }
+
+  if (rk::FindInputConversion(
+          rk::ElementType::INT64, RKNN_TENSOR_FLOAT32,
+          rk::InputLayout::SAME) != nullptr) {
+    std::fprintf(stderr, "FindInputConversion found INT64 to FLOAT32\n");
+    failures++;
+  }
+
+  std::printf("convert_test: %d failures\n", failures);
+  return (failures == 0) ? 0 : 1;
+}
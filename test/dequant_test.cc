@@ -0,0 +1,225 @@
+// FloatToHalf against the nearest half of random floats, and Dequantize
+// and DequantizeAll against (q - zp) * scale and the activation computed
+// per element, for both input signs, FP32 and FP16 outputs and counts
+// around the 16-element NEON blocks, on pools of every size.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "rock-chip_dequant.h"
+#include "rock-chip_worker_pool.h"
+
+namespace rk = triton::backend::rockchip;
+
+namespace {
+
+float
+HalfToFloat(const uint16_t half)
+{
+  const int exponent = (half >> 10) & 0x1f;
+  const int mantissa = half & 0x3ff;
+  float value;
+  if (exponent == 0) {
+    value = std::ldexp((float)mantissa, -24);
+  } else if (exponent == 31) {
+    value = (mantissa == 0) ? INFINITY : NAN;
+  } else {
+    value = std::ldexp((float)(mantissa | 0x400), exponent - 25);
+  }
+  return (half & 0x8000) ? -value : value;
+}
+
+// Whether 'half' is the half nearest to the finite 'value', ties to the
+// even one.
+bool
+IsNearestHalf(const float value, const uint16_t half)
+{
+  if (std::isinf(HalfToFloat(half))) {
+    // Rounds to infinity from 65520, half way to the next binade.
+    return std::fabs(value) >= 65520.0f;
+  }
+  if ((half & 0x7fff) == 0x7bff) {
+    if (std::fabs(value) >= 65520.0f) {
+      return false;
+    }
+  }
+  const double exact = value;
+  const double got = HalfToFloat(half);
+  const double error = std::fabs(got - exact);
+  for (const int step : {-1, 1}) {
+    const uint16_t magnitude = half & 0x7fff;
+    if ((step < 0) && (magnitude == 0)) {
+      continue;
+    }
+    const uint16_t other = (half & 0x8000) | (uint16_t)(magnitude + step);
+    if ((other & 0x7c00) == 0x7c00) {
+      continue;
+    }
+    const double other_error = std::fabs(HalfToFloat(other) - exact);
+    if ((other_error < error) ||
+        ((other_error == error) && ((half & 1) != 0))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int
+CheckFloatToHalf(std::mt19937* rng)
+{
+  int failures = 0;
+  std::vector<float> values = {
+      0.0f,   -0.0f,    1.0f,     65504.0f, 65519.0f, 65520.0f,
+      1e-8f,  5.96e-8f, 2.98e-8f, 2.99e-8f, 6.1e-5f,  6.104e-5f};
+  for (int i = 0; i < 1000000; ++i) {
+    // Spread the exponents over the half range and a bit beyond.
+    const float mantissa = std::uniform_real_distribution<float>(1, 2)(*rng);
+    const int exponent = std::uniform_int_distribution<int>(-27, 16)(*rng);
+    const float value = std::ldexp(mantissa, exponent);
+    values.push_back(((*rng)() & 1) ? value : -value);
+  }
+  for (const float value : values) {
+    const uint16_t half = rk::FloatToHalf(value);
+    if (!IsNearestHalf(value, half)) {
+      if (failures < 10) {
+        std::fprintf(
+            stderr, "FloatToHalf(%g) = 0x%04x is not the nearest half\n",
+            value, half);
+      }
+      failures++;
+    }
+  }
+  return failures;
+}
+
+float
+Reference(const int32_t q, const rk::DequantJob& job)
+{
+  float value = (q - job.zp_) * job.scale_;
+  if (job.activation_ == rk::OutputActivation::SIGMOID) {
+    value = 1.0f / (1.0f + std::exp(-value));
+  } else if (job.activation_ == rk::OutputActivation::EXP) {
+    value = std::exp(value);
+  }
+  return value;
+}
+
+struct Case {
+  rk::DequantJob job_;
+  std::vector<uint8_t> src_;
+  std::vector<uint8_t> dst_;
+};
+
+void
+MakeCase(
+    const bool src_signed, const rk::OutputActivation activation,
+    const bool fp16, const size_t count, std::mt19937* rng, Case* c)
+{
+  c->src_.resize(count);
+  for (auto& q : c->src_) {
+    q = (uint8_t)(*rng)();
+  }
+  c->dst_.assign(count * (fp16 ? 2 : 4), 0);
+  c->job_.src_ = c->src_.data();
+  c->job_.src_signed_ = src_signed;
+  c->job_.count_ = count;
+  c->job_.zp_ = src_signed ? -5 : 128;
+  c->job_.scale_ = 0.0371f;
+  c->job_.activation_ = activation;
+  c->job_.fp16_ = fp16;
+  c->job_.dst_ = c->dst_.data();
+}
+
+int
+CheckCase(const Case& c)
+{
+  const rk::DequantJob& job = c.job_;
+  for (size_t i = 0; i < job.count_; ++i) {
+    const int32_t q =
+        job.src_signed_ ? (int32_t)(int8_t)c.src_[i] : (int32_t)c.src_[i];
+    const float expected = Reference(q, job);
+    bool match;
+    if (job.fp16_) {
+      uint16_t got;
+      std::memcpy(&got, &c.dst_[i * 2], sizeof(got));
+      match = (got == rk::FloatToHalf(expected));
+    } else {
+      float got;
+      std::memcpy(&got, &c.dst_[i * 4], sizeof(got));
+      match = (got == expected);
+    }
+    if (!match) {
+      std::fprintf(
+          stderr,
+          "mismatch: signed %d, activation %d, fp16 %d, count %zu at %zu\n",
+          job.src_signed_, (int)job.activation_, job.fp16_, job.count_, i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void
+WorkerPoolCases(
+    std::mt19937* rng, const rk::OutputActivation* activations, int* failures)
+{
+  std::unique_ptr<rk::WorkerPool> pools[] = {
+      std::unique_ptr<rk::WorkerPool>(new rk::WorkerPool(5)),
+      std::unique_ptr<rk::WorkerPool>(new rk::WorkerPool(2)),
+      std::unique_ptr<rk::WorkerPool>(new rk::WorkerPool(0)),
+      std::unique_ptr<rk::WorkerPool>()};
+  for (auto& pool : pools) {
+    for (int round = 0; round < 3; ++round) {
+      std::vector<Case> cases(6);
+      std::vector<rk::DequantJob> jobs;
+      for (size_t i = 0; i < cases.size(); ++i) {
+        // A small job among the large ones runs on the calling thread.
+        const size_t count = (i == 4) ? 100 : 100000 + i * 1000;
+        MakeCase(
+            (i % 2) == 0, activations[i % 3], i >= 3, count, rng, &cases[i]);
+        jobs.push_back(cases[i].job_);
+      }
+      rk::DequantizeAll(jobs, pool.get());
+      for (const auto& c : cases) {
+        *failures += CheckCase(c);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int
+main()
+{
+  std::mt19937 rng(1);
+  int failures = CheckFloatToHalf(&rng);
+
+  const rk::OutputActivation activations[] = {
+      rk::OutputActivation::NONE, rk::OutputActivation::SIGMOID,
+      rk::OutputActivation::EXP};
+  for (const bool src_signed : {true, false}) {
+    for (const auto activation : activations) {
+      for (const bool fp16 : {false, true}) {
+        for (const size_t count : {1, 15, 16, 17, 100, 70000}) {
+          Case c;
+          MakeCase(src_signed, activation, fp16, count, &rng, &c);
+          rk::Dequantize(c.job_);
+          failures += CheckCase(c);
+        }
+      }
+    }
+  }
+
+  // Jobs above the size worth a thread, run in parallel on as many
+  // workers as jobs, on fewer, on none and without a pool, several
+  // times on the same workers.
+  WorkerPoolCases(&rng, activations, &failures);
+
+  std::printf("dequant_test: %d failures\n", failures);
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+// Nc1hwc2ToNchw and Nc1hwc2ToNhwc against a per-element reference, for
+// every element size, channel counts below, at and above a C2 group and
+// widths that leave a partial 16-pixel block and a padded row stride.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "rock-chip_layout.h"
+
+namespace rk = triton::backend::rockchip;
+
+namespace {
+
+// The NCHW and NHWC of 'src', moved one element at a time.
+void
+Reference(
+    const rk::Nc1hwc2Layout& l, const std::vector<uint8_t>& src,
+    std::vector<uint8_t>* nchw, std::vector<uint8_t>* nhwc)
+{
+  const size_t es = l.element_size_;
+  for (size_t n = 0; n < l.batch_; ++n) {
+    for (size_t c = 0; c < l.channels_; ++c) {
+      for (size_t h = 0; h < l.height_; ++h) {
+        for (size_t w = 0; w < l.width_; ++w) {
+          const size_t s =
+              (((n * l.c1_ + c / l.c2_) * l.height_ + h) * l.w_stride_ + w) *
+                  l.c2_ +
+              c % l.c2_;
+          const size_t d_nchw = ((n * l.channels_ + c) * l.height_ + h) *
+                                    l.width_ +
+                                w;
+          const size_t d_nhwc = ((n * l.height_ + h) * l.width_ + w) *
+                                    l.channels_ +
+                                c;
+          std::memcpy(&(*nchw)[d_nchw * es], &src[s * es], es);
+          std::memcpy(&(*nhwc)[d_nhwc * es], &src[s * es], es);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int
+main()
+{
+  std::mt19937 rng(1);
+  int failures = 0;
+  for (const uint32_t es : {1u, 2u, 4u}) {
+    for (const uint32_t channels : {1u, 3u, 16u, 81u}) {
+      for (const uint32_t width : {7u, 20u, 33u, 80u}) {
+        rk::Nc1hwc2Layout l;
+        l.batch_ = 2;
+        l.channels_ = channels;
+        l.c2_ = 16 / es;
+        l.c1_ = (channels + l.c2_ - 1) / l.c2_;
+        l.height_ = 5;
+        l.width_ = width;
+        l.w_stride_ = width + (width % 3);
+        l.element_size_ = es;
+
+        std::vector<uint8_t> src(l.NativeByteSize());
+        for (auto& b : src) {
+          b = (uint8_t)rng();
+        }
+        std::vector<uint8_t> ref_nchw(l.ByteSize()), ref_nhwc(l.ByteSize());
+        Reference(l, src, &ref_nchw, &ref_nhwc);
+
+        std::vector<uint8_t> nchw(l.ByteSize()), nhwc(l.ByteSize());
+        rk::Nc1hwc2ToNchw(l, src.data(), nchw.data());
+        rk::Nc1hwc2ToNhwc(l, src.data(), nhwc.data());
+        if (nchw != ref_nchw) {
+          std::fprintf(
+              stderr, "NCHW mismatch: element %u, channels %u, width %u\n",
+              es, channels, width);
+          failures++;
+        }
+        if (nhwc != ref_nhwc) {
+          std::fprintf(
+              stderr, "NHWC mismatch: element %u, channels %u, width %u\n",
+              es, channels, width);
+          failures++;
+        }
+      }
+    }
+  }
+
+  std::printf("layout_test: %d failures\n", failures);
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,548 @@
+#pragma once
+
+//
+// Portable emulation of the NEON intrinsics used by the backend, put in
+// front of the include path of the '_neon' tests on hosts without NEON
+// (ROCKCHIP_NEON_EMULATION) so the NEON paths can be compared with the
+// scalar ones anywhere. Each intrinsic follows the lane semantics of
+// the Arm reference, not its speed; only those the backend uses are
+// here.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace rk_neon_emulation {
+
+template <typename T, int N>
+struct Vector {
+  T v[N];
+};
+
+template <typename D, typename S>
+inline D
+Reinterpret(const S& s)
+{
+  static_assert(sizeof(D) == sizeof(S), "reinterpret between sizes");
+  D d;
+  std::memcpy(&d, &s, sizeof(d));
+  return d;
+}
+
+template <typename V>
+inline V
+Load(const void* p)
+{
+  V r;
+  std::memcpy(r.v, p, sizeof(r.v));
+  return r;
+}
+
+template <typename V>
+inline void
+Store(void* p, const V& a)
+{
+  std::memcpy(p, a.v, sizeof(a.v));
+}
+
+template <typename H, typename V>
+inline H
+Half(const V& a, const int half)
+{
+  H r;
+  std::memcpy(r.v, a.v + half * (sizeof(r.v) / sizeof(r.v[0])), sizeof(r.v));
+  return r;
+}
+
+template <typename V, typename H>
+inline V
+Combine(const H& low, const H& high)
+{
+  V r;
+  std::memcpy(r.v, low.v, sizeof(low.v));
+  std::memcpy(r.v + sizeof(low.v) / sizeof(low.v[0]), high.v, sizeof(high.v));
+  return r;
+}
+
+// vtrnq: the even lanes of 'a' and 'b' interleaved in the first result,
+// the odd lanes in the second.
+template <typename P, typename V>
+inline P
+Transpose(const V& a, const V& b)
+{
+  P r;
+  const int lanes = sizeof(a.v) / sizeof(a.v[0]);
+  for (int i = 0; i < lanes; i += 2) {
+    r.val[0].v[i] = a.v[i];
+    r.val[0].v[i + 1] = b.v[i];
+    r.val[1].v[i] = a.v[i + 1];
+    r.val[1].v[i + 1] = b.v[i + 1];
+  }
+  return r;
+}
+
+// Widen every lane of 'a' to the lane type of R.
+template <typename R, typename V>
+inline R
+Widen(const V& a)
+{
+  R r;
+  for (size_t i = 0; i < sizeof(a.v) / sizeof(a.v[0]); ++i) {
+    r.v[i] = a.v[i];
+  }
+  return r;
+}
+
+// Widen every lane of 'a' to the lane type of R, shifted left by N.
+template <typename R, int N, typename V>
+inline R
+ShiftLeftLong(const V& a)
+{
+  R r = Widen<R>(a);
+  for (auto& lane : r.v) {
+    lane <<= N;
+  }
+  return r;
+}
+
+template <typename V, typename T>
+inline V
+Duplicate(const T x)
+{
+  V r;
+  for (auto& lane : r.v) {
+    lane = x;
+  }
+  return r;
+}
+
+// vst3q and vst4q: lane i of every vector of 'a', then lane i + 1.
+template <typename T, typename V, int N>
+inline void
+StoreInterleaved(T* p, const V (&a)[N])
+{
+  const size_t lanes = sizeof(a[0].v) / sizeof(a[0].v[0]);
+  for (size_t i = 0; i < lanes; ++i) {
+    for (int k = 0; k < N; ++k) {
+      p[i * N + k] = a[k].v[i];
+    }
+  }
+}
+
+// All ones in the lanes where 'a' is at least 'b'.
+template <typename M, typename V>
+inline M
+AtLeast(const V& a, const V& b)
+{
+  M r;
+  for (size_t i = 0; i < sizeof(a.v) / sizeof(a.v[0]); ++i) {
+    r.v[i] = (a.v[i] >= b.v[i]) ? 0xff : 0;
+  }
+  return r;
+}
+
+// IEEE half bits of 'value' rounded to nearest even, as FCVTN does with
+// the default rounding mode.
+inline uint16_t
+FloatToHalf(const float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs = bits & 0x7fffffff;
+  if (abs > 0x7f800000) {
+    return sign | 0x7e00 | ((abs >> 13) & 0x3ff);
+  }
+  if (abs >= 0x47800000) {
+    return sign | 0x7c00;
+  }
+
+  uint32_t half;
+  uint32_t rest;
+  uint32_t tie;
+  if (abs >= 0x38800000) {
+    half = (abs >> 13) - (112 << 10);
+    rest = abs & 0x1fff;
+    tie = 0x1000;
+  } else {
+    const int exponent = abs >> 23;
+    if (exponent < 102) {
+      return sign;
+    }
+    const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    const int shift = 126 - exponent;
+    half = mantissa >> shift;
+    rest = mantissa & ((1u << shift) - 1);
+    tie = 1u << (shift - 1);
+  }
+  if ((rest > tie) || ((rest == tie) && ((half & 1) != 0))) {
+    half++;
+  }
+  return sign | (uint16_t)half;
+}
+
+}  // namespace rk_neon_emulation
+
+typedef rk_neon_emulation::Vector<uint8_t, 8> uint8x8_t;
+typedef rk_neon_emulation::Vector<uint8_t, 16> uint8x16_t;
+typedef rk_neon_emulation::Vector<uint16_t, 8> uint16x8_t;
+typedef rk_neon_emulation::Vector<uint16_t, 4> uint16x4_t;
+typedef rk_neon_emulation::Vector<uint32_t, 4> uint32x4_t;
+typedef rk_neon_emulation::Vector<int8_t, 8> int8x8_t;
+typedef rk_neon_emulation::Vector<int8_t, 16> int8x16_t;
+typedef rk_neon_emulation::Vector<int16_t, 4> int16x4_t;
+typedef rk_neon_emulation::Vector<int16_t, 8> int16x8_t;
+typedef rk_neon_emulation::Vector<int32_t, 4> int32x4_t;
+typedef rk_neon_emulation::Vector<float, 2> float32x2_t;
+typedef rk_neon_emulation::Vector<float, 4> float32x4_t;
+typedef rk_neon_emulation::Vector<double, 2> float64x2_t;
+// The lanes hold the half bits, there is no portable half type.
+struct float16x4_t {
+  uint16_t v[4];
+};
+
+struct uint8x16x2_t {
+  uint8x16_t val[2];
+};
+struct uint16x8x2_t {
+  uint16x8_t val[2];
+};
+struct uint32x4x2_t {
+  uint32x4_t val[2];
+};
+struct uint8x16x3_t {
+  uint8x16_t val[3];
+};
+struct uint16x8x3_t {
+  uint16x8_t val[3];
+};
+struct uint32x4x3_t {
+  uint32x4_t val[3];
+};
+struct uint8x16x4_t {
+  uint8x16_t val[4];
+};
+struct uint16x8x4_t {
+  uint16x8_t val[4];
+};
+struct uint32x4x4_t {
+  uint32x4_t val[4];
+};
+
+inline uint8x16_t
+vld1q_u8(const uint8_t* p)
+{
+  return rk_neon_emulation::Load<uint8x16_t>(p);
+}
+
+inline void
+vst1q_u8(uint8_t* p, const uint8x16_t a)
+{
+  rk_neon_emulation::Store(p, a);
+}
+
+inline uint8x8_t
+vget_low_u8(const uint8x16_t a)
+{
+  return rk_neon_emulation::Half<uint8x8_t>(a, 0);
+}
+
+inline uint8x8_t
+vget_high_u8(const uint8x16_t a)
+{
+  return rk_neon_emulation::Half<uint8x8_t>(a, 1);
+}
+
+inline uint8x16_t
+vcombine_u8(const uint8x8_t low, const uint8x8_t high)
+{
+  return rk_neon_emulation::Combine<uint8x16_t>(low, high);
+}
+
+inline uint16x8_t
+vreinterpretq_u16_u8(const uint8x16_t a)
+{
+  return rk_neon_emulation::Reinterpret<uint16x8_t>(a);
+}
+
+inline uint8x16_t
+vreinterpretq_u8_u16(const uint16x8_t a)
+{
+  return rk_neon_emulation::Reinterpret<uint8x16_t>(a);
+}
+
+inline uint32x4_t
+vreinterpretq_u32_u8(const uint8x16_t a)
+{
+  return rk_neon_emulation::Reinterpret<uint32x4_t>(a);
+}
+
+inline uint8x16_t
+vreinterpretq_u8_u32(const uint32x4_t a)
+{
+  return rk_neon_emulation::Reinterpret<uint8x16_t>(a);
+}
+
+inline uint8x16x2_t
+vtrnq_u8(const uint8x16_t a, const uint8x16_t b)
+{
+  return rk_neon_emulation::Transpose<uint8x16x2_t>(a, b);
+}
+
+inline uint16x8x2_t
+vtrnq_u16(const uint16x8_t a, const uint16x8_t b)
+{
+  return rk_neon_emulation::Transpose<uint16x8x2_t>(a, b);
+}
+
+inline uint32x4x2_t
+vtrnq_u32(const uint32x4_t a, const uint32x4_t b)
+{
+  return rk_neon_emulation::Transpose<uint32x4x2_t>(a, b);
+}
+
+inline int8x16_t
+vld1q_s8(const int8_t* p)
+{
+  return rk_neon_emulation::Load<int8x16_t>(p);
+}
+
+inline int8x8_t
+vget_low_s8(const int8x16_t a)
+{
+  return rk_neon_emulation::Half<int8x8_t>(a, 0);
+}
+
+inline int8x8_t
+vget_high_s8(const int8x16_t a)
+{
+  return rk_neon_emulation::Half<int8x8_t>(a, 1);
+}
+
+inline int16x4_t
+vget_low_s16(const int16x8_t a)
+{
+  return rk_neon_emulation::Half<int16x4_t>(a, 0);
+}
+
+inline int16x4_t
+vget_high_s16(const int16x8_t a)
+{
+  return rk_neon_emulation::Half<int16x4_t>(a, 1);
+}
+
+inline int16x8_t
+vmovl_s8(const int8x8_t a)
+{
+  return rk_neon_emulation::Widen<int16x8_t>(a);
+}
+
+inline uint16x8_t
+vmovl_u8(const uint8x8_t a)
+{
+  return rk_neon_emulation::Widen<uint16x8_t>(a);
+}
+
+inline int32x4_t
+vmovl_s16(const int16x4_t a)
+{
+  return rk_neon_emulation::Widen<int32x4_t>(a);
+}
+
+inline int16x8_t
+vreinterpretq_s16_u16(const uint16x8_t a)
+{
+  return rk_neon_emulation::Reinterpret<int16x8_t>(a);
+}
+
+inline int32x4_t
+vdupq_n_s32(const int32_t x)
+{
+  return rk_neon_emulation::Duplicate<int32x4_t>(x);
+}
+
+inline int32x4_t
+vsubq_s32(const int32x4_t a, const int32x4_t b)
+{
+  int32x4_t r;
+  for (int i = 0; i < 4; ++i) {
+    r.v[i] = a.v[i] - b.v[i];
+  }
+  return r;
+}
+
+inline float32x4_t
+vcvtq_f32_s32(const int32x4_t a)
+{
+  return rk_neon_emulation::Widen<float32x4_t>(a);
+}
+
+inline float32x4_t
+vmulq_n_f32(const float32x4_t a, const float b)
+{
+  float32x4_t r;
+  for (int i = 0; i < 4; ++i) {
+    r.v[i] = a.v[i] * b;
+  }
+  return r;
+}
+
+inline void
+vst1q_f32(float* p, const float32x4_t a)
+{
+  rk_neon_emulation::Store(p, a);
+}
+
+inline float16x4_t
+vcvt_f16_f32(const float32x4_t a)
+{
+  float16x4_t r;
+  for (int i = 0; i < 4; ++i) {
+    r.v[i] = rk_neon_emulation::FloatToHalf(a.v[i]);
+  }
+  return r;
+}
+
+inline uint16x4_t
+vreinterpret_u16_f16(const float16x4_t a)
+{
+  return rk_neon_emulation::Reinterpret<uint16x4_t>(a);
+}
+
+inline void
+vst1_u16(uint16_t* p, const uint16x4_t a)
+{
+  rk_neon_emulation::Store(p, a);
+}
+
+inline int8x16_t
+vdupq_n_s8(const int8_t x)
+{
+  return rk_neon_emulation::Duplicate<int8x16_t>(x);
+}
+
+inline uint8x16_t
+vdupq_n_u8(const uint8_t x)
+{
+  return rk_neon_emulation::Duplicate<uint8x16_t>(x);
+}
+
+inline uint8x16_t
+vcgeq_s8(const int8x16_t a, const int8x16_t b)
+{
+  return rk_neon_emulation::AtLeast<uint8x16_t>(a, b);
+}
+
+inline uint8x16_t
+vcgeq_u8(const uint8x16_t a, const uint8x16_t b)
+{
+  return rk_neon_emulation::AtLeast<uint8x16_t>(a, b);
+}
+
+inline uint8_t
+vmaxvq_u8(const uint8x16_t a)
+{
+  uint8_t r = 0;
+  for (const uint8_t lane : a.v) {
+    r = (lane > r) ? lane : r;
+  }
+  return r;
+}
+
+inline float64x2_t
+vld1q_f64(const double* p)
+{
+  return rk_neon_emulation::Load<float64x2_t>(p);
+}
+
+inline float32x2_t
+vcvt_f32_f64(const float64x2_t a)
+{
+  float32x2_t r;
+  for (int i = 0; i < 2; ++i) {
+    r.v[i] = (float)a.v[i];
+  }
+  return r;
+}
+
+inline float32x4_t
+vcombine_f32(const float32x2_t low, const float32x2_t high)
+{
+  return rk_neon_emulation::Combine<float32x4_t>(low, high);
+}
+
+inline float32x4_t
+vld1q_f32(const float* p)
+{
+  return rk_neon_emulation::Load<float32x4_t>(p);
+}
+
+inline uint16x8_t
+vld1q_u16(const uint16_t* p)
+{
+  return rk_neon_emulation::Load<uint16x8_t>(p);
+}
+
+inline uint32x4_t
+vld1q_u32(const uint32_t* p)
+{
+  return rk_neon_emulation::Load<uint32x4_t>(p);
+}
+
+inline uint16x4_t
+vget_low_u16(const uint16x8_t a)
+{
+  return rk_neon_emulation::Half<uint16x4_t>(a, 0);
+}
+
+inline uint16x4_t
+vget_high_u16(const uint16x8_t a)
+{
+  return rk_neon_emulation::Half<uint16x4_t>(a, 1);
+}
+
+// A macro like the real one, the shift must be a constant.
+#define vshll_n_u16(a, n) rk_neon_emulation::ShiftLeftLong<uint32x4_t, n>(a)
+
+inline float32x4_t
+vreinterpretq_f32_u32(const uint32x4_t a)
+{
+  return rk_neon_emulation::Reinterpret<float32x4_t>(a);
+}
+
+inline void
+vst3q_u8(uint8_t* p, const uint8x16x3_t a)
+{
+  rk_neon_emulation::StoreInterleaved(p, a.val);
+}
+
+inline void
+vst4q_u8(uint8_t* p, const uint8x16x4_t a)
+{
+  rk_neon_emulation::StoreInterleaved(p, a.val);
+}
+
+inline void
+vst3q_u16(uint16_t* p, const uint16x8x3_t a)
+{
+  rk_neon_emulation::StoreInterleaved(p, a.val);
+}
+
+inline void
+vst4q_u16(uint16_t* p, const uint16x8x4_t a)
+{
+  rk_neon_emulation::StoreInterleaved(p, a.val);
+}
+
+inline void
+vst3q_u32(uint32_t* p, const uint32x4x3_t a)
+{
+  rk_neon_emulation::StoreInterleaved(p, a.val);
+}
+
+inline void
+vst4q_u32(uint32_t* p, const uint32x4x4_t a)
+{
+  rk_neon_emulation::StoreInterleaved(p, a.val);
+}
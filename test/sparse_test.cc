@@ -0,0 +1,119 @@
+// FindSparseCells and GatherSparseCells against a scan of every cell
+// with DequantizeOne, for NCHW and NHWC heads of both signs and widths
+// that leave a partial 16-cell block, and the bounds of
+// FirstPassingValue.
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "rock-chip_sparse.h"
+
+namespace rk = triton::backend::rockchip;
+
+namespace {
+
+// Value of channel 'c' of cell (n, y, x) of 'data'.
+uint8_t
+At(const rk::SparseHead& head, const std::vector<uint8_t>& data,
+   const size_t n, const size_t c, const size_t y, const size_t x)
+{
+  if (head.nhwc_) {
+    return data
+        [((n * head.height_ + y) * head.width_ + x) * head.channels_ + c];
+  }
+  return data[((n * head.channels_ + c) * head.height_ + y) * head.width_ + x];
+}
+
+}  // namespace
+
+int
+main()
+{
+  std::mt19937 rng(3);
+  int failures = 0;
+  const float threshold = 0.9f;
+  const float scale = 0.05f;
+  for (const bool nhwc : {false, true}) {
+    for (const bool is_signed : {true, false}) {
+      for (const uint32_t width : {7u, 33u, 80u}) {
+        rk::SparseHead head;
+        head.batch_ = 2;
+        head.channels_ = 81;
+        head.height_ = 5;
+        head.width_ = width;
+        head.nhwc_ = nhwc;
+        head.signed_ = is_signed;
+        head.group_ = 27;
+        head.objectness_ = 4;
+        const int32_t zp = is_signed ? -10 : 120;
+
+        std::vector<uint8_t> data(
+            (size_t)head.batch_ * head.channels_ * head.height_ * width);
+        for (auto& q : data) {
+          q = (uint8_t)rng();
+        }
+
+        std::vector<int32_t> ref_cells;
+        std::vector<uint8_t> ref_values;
+        for (size_t n = 0; n < head.batch_; ++n) {
+          for (size_t a = 0; a < head.Anchors(); ++a) {
+            for (size_t y = 0; y < head.height_; ++y) {
+              for (size_t x = 0; x < width; ++x) {
+                const uint8_t raw =
+                    At(head, data, n, a * head.group_ + head.objectness_, y,
+                       x);
+                const int32_t q = is_signed ? (int8_t)raw : raw;
+                if (rk::DequantizeOne(
+                        q, zp, scale, rk::OutputActivation::SIGMOID) <=
+                    threshold) {
+                  continue;
+                }
+                ref_cells.insert(
+                    ref_cells.end(),
+                    {(int32_t)n, (int32_t)a, (int32_t)y, (int32_t)x});
+                for (size_t g = 0; g < head.group_; ++g) {
+                  ref_values.push_back(
+                      At(head, data, n, a * head.group_ + g, y, x));
+                }
+              }
+            }
+          }
+        }
+
+        const int32_t first = rk::FirstPassingValue(
+            threshold, zp, scale, rk::OutputActivation::SIGMOID, is_signed);
+        std::vector<int32_t> cells;
+        const size_t count =
+            rk::FindSparseCells(head, data.data(), first, &cells);
+        std::vector<uint8_t> values(count * head.group_);
+        rk::GatherSparseCells(head, data.data(), cells, values.data());
+        if ((count * 4 != cells.size()) || (cells != ref_cells) ||
+            (values != ref_values)) {
+          std::fprintf(
+              stderr,
+              "mismatch: nhwc %d, signed %d, width %u: %zu cells, "
+              "expected %zu\n",
+              nhwc, is_signed, width, count, ref_cells.size() / 4);
+          failures++;
+        }
+      }
+    }
+  }
+
+  // Nothing passes a threshold above the activation range, everything
+  // passes one below it.
+  if (rk::FirstPassingValue(
+          2.0f, 0, 1.0f, rk::OutputActivation::SIGMOID, true) != 128) {
+    std::fprintf(stderr, "FirstPassingValue above the range\n");
+    failures++;
+  }
+  if (rk::FirstPassingValue(
+          -1.0f, 0, 1.0f, rk::OutputActivation::SIGMOID, false) != 0) {
+    std::fprintf(stderr, "FirstPassingValue below the range\n");
+    failures++;
+  }
+
+  std::printf("sparse_test: %d failures\n", failures);
+  return (failures == 0) ? 0 : 1;
+}